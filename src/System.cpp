@@ -2,13 +2,14 @@
 #include <memory/Bus.h>
 #include <arm/arm11.h>
 #include <arm/arm9.h>
+#include <pxi/pxi_trace.h>
 
 ARM11Core cores[4];
 ARM9Core arm9;
 
-void System::LoadBios(const char *bios9, const char *bios11)
+void System::LoadBios(const char *bios9, const char *bios11, bool is_new3ds)
 {
-    Bus::Initialize(bios9, bios11);
+    Bus::Initialize(bios9, bios11, is_new3ds);
 }
 
 void System::Reset()
@@ -21,17 +22,33 @@ void System::Reset()
 
 int System::Run()
 {
+    // When replaying a PXI trace, the CPU on the other end of the log isn't
+    // emulated at all
+    bool run_arm11 = PxiTrace::GetMode() != PxiTrace::MODE_REPLAY9;
+    bool run_arm9 = PxiTrace::GetMode() != PxiTrace::MODE_REPLAY11;
+
     while (1)
     {
-        for (int i = 0; i < 2; i++)
+        if (run_arm11)
         {
-            cores[0].Run();
-            cores[1].Run();
+            for (int i = 0; i < 2; i++)
+            {
+                cores[0].Run();
+                cores[1].Run();
+            }
         }
 
-        arm9.Run();
+        if (run_arm9)
+            arm9.Run();
 
         Bus::Run();
+
+        // With every CPU asleep in WFI or a polling loop, nothing happens
+        // until the next event
+        bool arm11_idle = !run_arm11 || (cores[0].IsIdle() && cores[1].IsIdle());
+        bool arm9_idle = !run_arm9 || arm9.IsIdle();
+        if (arm11_idle && arm9_idle)
+            Bus::FastForward();
     }
 
     return 0;
@@ -3,7 +3,7 @@
 namespace System
 {
 
-void LoadBios(const char* bios9, const char* bios11);
+void LoadBios(const char* bios9, const char* bios11, bool is_new3ds);
 void Reset();
 
 int Run();
@@ -4,6 +4,14 @@
 #include "Application.h"
 #include <signal.h>
 #include <System.h>
+#include <string>
+#include <crypto/ctr_cache.h>
+#include <pxi/pxi_trace.h>
+#include <memory/mmio.h>
+#include <memory/fastmem.h>
+#include <gpu/rasterizer.h>
+#include "capture.h"
+#include "presenter.h"
 
 bool Application::isRunning = false;
 int Application::exit_code = 0;
@@ -17,17 +25,101 @@ bool Application::Init(int argc, char** argv)
 {
 	if (argc < 3)
     {
-        printf("Usage: %s [bios9] [bios11]\n", argv[0]);
+        printf("Usage: %s [bios9] [bios11] [options]\n", argv[0]);
+        printf("Options:\n");
+        printf("  --ctr-cache [file]\tCache AES-CTR keystream in a persistent file\n");
+        printf("  --pxi-record [file]\tLog all PXI traffic to a trace\n");
+        printf("  --pxi-replay9 [file]\tRun only the ARM9, replaying the ARM11's PXI traffic\n");
+        printf("  --pxi-replay11 [file]\tRun only the ARM11, replaying the ARM9's PXI traffic\n");
+        printf("  --mmio-profile [csv]\tProfile MMIO accesses, report at exit\n");
+        printf("  --new3ds\t\tEmulate a New 3DS\n");
+        printf("  --fastmem\t\tAccess guest RAM directly, catching MMIO through page faults\n");
+        printf("  --gpu-threads [n]\tRasterizer worker threads (default: one per spare core)\n");
+        printf("  --no-display\t\tDon't open a window for the screens\n");
+        printf("  --capture [n]\t\tHash the screens every nth frame and report the frame rate\n");
+        printf("  --capture-dir [dir]\tWith --capture, write hashes and PNG dumps to dir\n");
+        printf("  --capture-raw\t\tWith --capture-dir, also dump raw RGBA\n");
         return false;
     }
 
+    bool is_new3ds = false;
+    bool display = true;
+    std::string capture_dir;
+    bool capture_raw = false;
+
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--ctr-cache" && i + 1 < argc)
+        {
+            if (!CtrCache::Open(argv[++i]))
+                return false;
+        }
+        else if (arg == "--pxi-record" && i + 1 < argc)
+        {
+            if (!PxiTrace::OpenRecord(argv[++i]))
+                return false;
+        }
+        else if (arg == "--pxi-replay9" && i + 1 < argc)
+        {
+            if (!PxiTrace::OpenReplay(argv[++i], PxiTrace::MODE_REPLAY9))
+                return false;
+        }
+        else if (arg == "--pxi-replay11" && i + 1 < argc)
+        {
+            if (!PxiTrace::OpenReplay(argv[++i], PxiTrace::MODE_REPLAY11))
+                return false;
+        }
+        else if (arg == "--mmio-profile" && i + 1 < argc)
+            MMIO::EnableProfiling(argv[++i]);
+        else if (arg == "--new3ds")
+            is_new3ds = true;
+        else if (arg == "--fastmem")
+        {
+            if (!Fastmem::Enable())
+                printf("Fastmem unavailable, using the regular memory path\n");
+        }
+        else if (arg == "--gpu-threads" && i + 1 < argc)
+            PicaRasterizer::SetWorkerCount(atoi(argv[++i]));
+        else if (arg == "--no-display")
+            display = false;
+        else if (arg == "--capture" && i + 1 < argc)
+            Capture::Enable(atoi(argv[++i]));
+        else if (arg == "--capture-dir" && i + 1 < argc)
+            capture_dir = argv[++i];
+        else if (arg == "--capture-raw")
+            capture_raw = true;
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return false;
+        }
+    }
+
+    if (!capture_dir.empty() && !Capture::IsEnabled())
+    {
+        printf("--capture-dir needs --capture\n");
+        return false;
+    }
+    if (capture_raw && capture_dir.empty())
+    {
+        printf("--capture-raw needs --capture-dir\n");
+        return false;
+    }
+    if (!capture_dir.empty() && !Capture::SetOutputDir(capture_dir, capture_raw))
+        return false;
+
     bool success = false;
 
     printf("Initializing System\n");
 
-	System::LoadBios(argv[1], argv[2]);
+	System::LoadBios(argv[1], argv[2], is_new3ds);
 	System::Reset();
 
+    if (display)
+        Presenter::Start();
+
     std::atexit(Application::Exit);
     // signal(SIGSEGV, Sig);
     signal(SIGINT, Application::Exit);
@@ -53,4 +145,6 @@ void Application::Exit(int code)
 void Application::Exit()
 {
 	System::Dump();
+    Presenter::Dump();
+    Capture::Dump();
 }
\ No newline at end of file
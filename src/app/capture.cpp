@@ -0,0 +1,356 @@
+#include "capture.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t FRAME_PIXELS = LCD::FRAME_WIDTH * LCD::FRAME_HEIGHT;
+
+// Frames allowed to wait for the writer before emulation stalls on it
+constexpr int MAX_PENDING = 4;
+
+// How often the frame rate gets logged while running
+constexpr auto REPORT_INTERVAL = std::chrono::seconds(5);
+
+struct CaptureJob
+{
+    uint64_t frame;
+    uint32_t* pixels;
+};
+
+static uint32_t capture_interval = 0;
+static std::string capture_dir;
+static bool capture_raw = false;
+static FILE* hash_file = nullptr;
+
+// Shared with the writer thread. Never destroyed, exit runs static
+// destructors and destroying a condition variable the writer is waiting on
+// blocks forever.
+struct CaptureQueue
+{
+    std::mutex lock;
+    std::condition_variable ready, done;
+    std::deque<CaptureJob> jobs;
+    std::vector<uint32_t*> free_buffers;
+};
+
+static CaptureQueue* capture_queue = nullptr;
+static uint32_t* current_buffer = nullptr;
+static std::atomic<int> capture_pending = 0;
+
+static uint64_t frames_captured = 0;
+static uint64_t last_frame = 0;
+static Clock::time_point capture_start, last_report;
+static uint64_t last_report_frame = 0;
+
+// XXH64, as in the reference implementation
+constexpr uint64_t XXH_PRIME1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t XXH_PRIME2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t XXH_PRIME3 = 0x165667B19E3779F9ull;
+constexpr uint64_t XXH_PRIME4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t XXH_PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    return rotl64(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t value)
+{
+    return (acc ^ xxh_round(0, value)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static uint64_t xxh64(const void* data, size_t len, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+    auto read64 = [](const uint8_t* ptr) { uint64_t v; memcpy(&v, ptr, 8); return v; };
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v[4] = {seed + XXH_PRIME1 + XXH_PRIME2, seed + XXH_PRIME2, seed, seed - XXH_PRIME1};
+        for (; p + 32 <= end; p += 32)
+        {
+            for (int i = 0; i < 4; i++)
+                v[i] = xxh_round(v[i], read64(p + i * 8));
+        }
+        h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = xxh_merge(h, v[i]);
+    }
+    else
+        h = seed + XXH_PRIME5;
+
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ xxh_round(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (p + 4 <= end)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        h = rotl64(h ^ (v * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len)
+{
+    static uint32_t table[256];
+    if (!table[1])
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_be32(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(value >> shift);
+}
+
+static void write_chunk(FILE* file, const char* type, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> chunk;
+    put_be32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    put_be32(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// Uncompressed PNG: the image data goes in stored deflate blocks, these are
+// for machines to diff, not for keeping around
+static bool write_png(const std::string& path, const uint32_t* pixels, uint32_t width, uint32_t height)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<uint8_t> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    // 8 bits per channel RGBA, no interlacing
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+    write_chunk(file, "IHDR", header);
+
+    // Every row starts with filter type 0
+    std::vector<uint8_t> rows;
+    rows.reserve(height * (width * 4 + 1));
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t* row = (const uint8_t*)(pixels + y * width);
+        rows.push_back(0);
+        rows.insert(rows.end(), row, row + width * 4);
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    uint32_t adler_a = 1, adler_b = 0;
+    for (size_t pos = 0; pos < rows.size();)
+    {
+        uint32_t len = std::min<size_t>(0xFFFF, rows.size() - pos);
+        zlib.push_back(pos + len == rows.size());
+        zlib.insert(zlib.end(), {(uint8_t)len, (uint8_t)(len >> 8), (uint8_t)~len, (uint8_t)(~len >> 8)});
+        zlib.insert(zlib.end(), rows.begin() + pos, rows.begin() + pos + len);
+        for (uint32_t i = 0; i < len; i++)
+        {
+            adler_a = (adler_a + rows[pos + i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        pos += len;
+    }
+    put_be32(zlib, (adler_b << 16) | adler_a);
+    write_chunk(file, "IDAT", zlib);
+    write_chunk(file, "IEND", {});
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static void write_frame(const CaptureJob& job)
+{
+    // The bottom screen only covers part of its rows
+    static uint32_t bottom[LCD::BOTTOM_WIDTH * LCD::SCREEN_HEIGHT];
+    const uint32_t* bottom_src = job.pixels + LCD::SCREEN_HEIGHT * LCD::FRAME_WIDTH + LCD::BOTTOM_X;
+    for (uint32_t y = 0; y < LCD::SCREEN_HEIGHT; y++)
+        memcpy(&bottom[y * LCD::BOTTOM_WIDTH], bottom_src + y * LCD::FRAME_WIDTH, LCD::BOTTOM_WIDTH * 4);
+
+    uint64_t top_hash = xxh64(job.pixels, LCD::SCREEN_HEIGHT * LCD::FRAME_WIDTH * 4, 0);
+    uint64_t bottom_hash = xxh64(bottom, sizeof(bottom), 0);
+    if (hash_file)
+    {
+        fprintf(hash_file, "%lu %016lx %016lx\n", job.frame, top_hash, bottom_hash);
+        fflush(hash_file);
+    }
+    else
+        printf("[CAPTURE]: Frame %lu, top %016lx, bottom %016lx\n", job.frame, top_hash, bottom_hash);
+
+    if (capture_dir.empty())
+        return;
+
+    char name[32];
+    snprintf(name, sizeof(name), "/frame%06lu", job.frame);
+    if (!write_png(capture_dir + name + ".png", job.pixels, LCD::FRAME_WIDTH, LCD::FRAME_HEIGHT))
+        printf("[CAPTURE]: Couldn't write %s%s.png\n", capture_dir.c_str(), name);
+    if (capture_raw)
+    {
+        FILE* file = fopen((capture_dir + name + ".rgba").c_str(), "wb");
+        if (file)
+        {
+            fwrite(job.pixels, 4, FRAME_PIXELS, file);
+            fclose(file);
+        }
+    }
+}
+
+static void capture_worker()
+{
+    // Ctrl+C has to land on another thread, exiting waits for this one
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    while (1)
+    {
+        CaptureJob job;
+        {
+            std::unique_lock<std::mutex> guard(capture_queue->lock);
+            capture_queue->ready.wait(guard, [] { return !capture_queue->jobs.empty(); });
+            job = capture_queue->jobs.front();
+            capture_queue->jobs.pop_front();
+        }
+
+        write_frame(job);
+        capture_pending--;
+
+        std::lock_guard<std::mutex> guard(capture_queue->lock);
+        capture_queue->free_buffers.push_back(job.pixels);
+        capture_queue->done.notify_all();
+    }
+}
+
+void Capture::Enable(uint32_t interval)
+{
+    capture_interval = std::max(interval, 1u);
+    capture_queue = new CaptureQueue;
+    for (int i = 0; i < MAX_PENDING; i++)
+        capture_queue->free_buffers.push_back(new uint32_t[FRAME_PIXELS]);
+
+    capture_start = last_report = Clock::now();
+    std::thread(capture_worker).detach();
+}
+
+bool Capture::SetOutputDir(const std::string& dir, bool raw)
+{
+    mkdir(dir.c_str(), 0755);
+    hash_file = fopen((dir + "/hashes.txt").c_str(), "w");
+    if (!hash_file)
+    {
+        printf("[CAPTURE]: Couldn't create %s/hashes.txt\n", dir.c_str());
+        return false;
+    }
+    capture_dir = dir;
+    capture_raw = raw;
+    return true;
+}
+
+bool Capture::IsEnabled()
+{
+    return capture_interval != 0;
+}
+
+bool Capture::WantsFrame(uint64_t frame)
+{
+    if (!capture_interval)
+        return false;
+
+    last_frame = frame;
+    Clock::time_point now = Clock::now();
+    if (now - last_report >= REPORT_INTERVAL)
+    {
+        double seconds = std::chrono::duration<double>(now - last_report).count();
+        printf("[CAPTURE]: %.1f fps\n", (frame - last_report_frame) / seconds);
+        last_report = now;
+        last_report_frame = frame;
+    }
+    return frame % capture_interval == 0;
+}
+
+uint32_t* Capture::BeginFrame()
+{
+    std::unique_lock<std::mutex> guard(capture_queue->lock);
+    capture_queue->done.wait(guard, [] { return !capture_queue->free_buffers.empty(); });
+    current_buffer = capture_queue->free_buffers.back();
+    capture_queue->free_buffers.pop_back();
+    return current_buffer;
+}
+
+void Capture::EndFrame(uint64_t frame)
+{
+    std::lock_guard<std::mutex> guard(capture_queue->lock);
+    capture_queue->jobs.push_back({frame, current_buffer});
+    capture_pending++;
+    frames_captured++;
+    capture_queue->ready.notify_one();
+}
+
+void Capture::Dump()
+{
+    if (!capture_interval)
+        return;
+
+    // This runs from the Ctrl+C handler, which may have interrupted the
+    // emulation thread anywhere, so it polls instead of taking the queue lock.
+    // Gives up if the writer stops making progress.
+    int pending = capture_pending;
+    for (int idle = 0; pending && idle < 100; idle++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (capture_pending != pending)
+        {
+            pending = capture_pending;
+            idle = 0;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - capture_start).count();
+    printf("[CAPTURE]: %lu frames in %.2fs (%.1f fps), %lu captured\n", last_frame, seconds,
+        seconds > 0 ? last_frame / seconds : 0.0, frames_captured);
+}
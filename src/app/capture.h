@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <gpu/lcd.h>
+
+// Frame capture for regression runs. Every nth frame gets both screens
+// hashed (XXH64 of the top and bottom images), and optionally dumped as PNG
+// or raw RGBA. Hashing and file writes happen on a background thread, in
+// frame order. Comparing the hash sequences of two builds shows where their
+// output starts to differ.
+namespace Capture
+{
+
+// Captures every interval-th frame. Hashes go to stdout, or to
+// dir/hashes.txt with the dumps next to it once SetOutputDir is called.
+void Enable(uint32_t interval);
+bool SetOutputDir(const std::string& dir, bool raw);
+bool IsEnabled();
+
+// Called on every frame, also tracks the frame rate
+bool WantsFrame(uint64_t frame);
+
+// The emulation thread fills a frame (see LCD::ComposeFrame) from
+// BeginFrame, then EndFrame queues it. BeginFrame blocks while too many
+// frames are waiting to be written.
+uint32_t* BeginFrame();
+void EndFrame(uint64_t frame);
+
+// Finishes the queued frames, then reports the frame rate
+void Dump();
+
+}
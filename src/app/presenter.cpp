@@ -0,0 +1,117 @@
+#include "presenter.h"
+
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <SDL.h>
+
+// Triple buffer slots. The emulation thread owns the back one and the
+// presenter the front one, the middle one is swapped atomically by both.
+// FRESH is set while it holds a frame the presenter hasn't picked up yet.
+constexpr int FRESH = 4;
+
+static uint32_t* frame_buffers[3];
+static int back_slot = 0;
+static int front_slot = 2;
+static std::atomic<int> middle_slot = 1;
+
+static std::atomic<bool> presenter_running = false;
+static std::mutex presenter_lock;
+static std::condition_variable frame_ready;
+
+static uint64_t frames_submitted = 0;
+static std::atomic<uint64_t> frames_presented = 0;
+
+static void present_loop()
+{
+    using namespace LCD;
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        printf("[PRESENT]: Couldn't start SDL: %s\n", SDL_GetError());
+        presenter_running = false;
+        return;
+    }
+
+    SDL_Window* window = SDL_CreateWindow("3ds", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        FRAME_WIDTH * 2, FRAME_HEIGHT * 2, SDL_WINDOW_RESIZABLE);
+    SDL_Renderer* renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC) : nullptr;
+    SDL_Texture* texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888,
+        SDL_TEXTUREACCESS_STREAMING, FRAME_WIDTH, FRAME_HEIGHT) : nullptr;
+    if (!texture)
+    {
+        printf("[PRESENT]: Couldn't open a window: %s\n", SDL_GetError());
+        presenter_running = false;
+        SDL_Quit();
+        return;
+    }
+    SDL_RenderSetLogicalSize(renderer, FRAME_WIDTH, FRAME_HEIGHT);
+    printf("[PRESENT]: Presenting through SDL's %s driver\n", SDL_GetCurrentVideoDriver());
+
+    while (1)
+    {
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            // Closing the window stops the emulator the same way Ctrl+C does
+            if (event.type == SDL_QUIT)
+                kill(getpid(), SIGINT);
+        }
+
+        {
+            // Wakes up now and then regardless, to keep the window responsive
+            std::unique_lock<std::mutex> guard(presenter_lock);
+            if (!frame_ready.wait_for(guard, std::chrono::milliseconds(16), [] { return (middle_slot & FRESH) != 0; }))
+                continue;
+        }
+        front_slot = middle_slot.exchange(front_slot) & 3;
+
+        SDL_UpdateTexture(texture, nullptr, frame_buffers[front_slot], FRAME_WIDTH * 4);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+        frames_presented++;
+    }
+}
+
+void Presenter::Start()
+{
+    for (uint32_t*& buffer : frame_buffers)
+        buffer = new uint32_t[LCD::FRAME_WIDTH * LCD::FRAME_HEIGHT]();
+
+    presenter_running = true;
+    std::thread(present_loop).detach();
+}
+
+bool Presenter::IsRunning()
+{
+    return presenter_running;
+}
+
+uint32_t* Presenter::BeginFrame()
+{
+    return frame_buffers[back_slot];
+}
+
+void Presenter::EndFrame()
+{
+    back_slot = middle_slot.exchange(back_slot | FRESH) & 3;
+    frames_submitted++;
+
+    // Taking the lock orders this against the presenter checking for a frame
+    {
+        std::lock_guard<std::mutex> guard(presenter_lock);
+    }
+    frame_ready.notify_one();
+}
+
+void Presenter::Dump()
+{
+    if (frames_submitted)
+        printf("[PRESENT]: %lu frames submitted, %lu presented\n", frames_submitted, frames_presented.load());
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <gpu/lcd.h>
+
+// Shows the screens in an SDL window. Frames are handed over through a
+// triple buffer to a thread of their own, which owns everything SDL, so
+// waiting on vsync never holds up emulation. When the presenter falls
+// behind, older frames are skipped rather than queued.
+//
+// Works with SDL's dummy and offscreen video drivers
+// (SDL_VIDEODRIVER=dummy), for running without a display.
+namespace Presenter
+{
+
+// Starts the presenter thread. If SDL can't open a window, the thread logs
+// why and stops, and IsRunning turns false.
+void Start();
+bool IsRunning();
+
+// The emulation thread fills a frame (see LCD::ComposeFrame) from
+// BeginFrame, then EndFrame hands it over
+uint32_t* BeginFrame();
+void EndFrame();
+
+void Dump();
+
+}
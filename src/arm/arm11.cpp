@@ -1,5 +1,6 @@
 #include "arm11.h"
 #include <memory/Bus.h>
+#include <memory/fastmem.h>
 
 #include <string.h>
 
@@ -54,9 +55,11 @@ void ARM11Core::Run()
         }
     }
 
-    if (halted)
+    if (halted || SkipPollingLoop())
         return;
 
+    uint32_t pc = *(registers[15]) - (cpsr.t ? 4 : 8);
+
     if (cpsr.t)
     {   
         didBranch = false;
@@ -65,6 +68,7 @@ void ARM11Core::Run()
             printf("Core %d (t): 0x%08x: ", coreId+1, *(registers[15]) - 4);
 
         uint16_t instr = Read16(*(registers[15]) - 4);
+        access_flags = 0;
         ARMGeneric::DoTHUMBInstruction(this, instr);
     }
     else
@@ -75,9 +79,12 @@ void ARM11Core::Run()
             printf("Core %d: 0x%08x: ", coreId+1, *(registers[15]) - 8);
 
         uint32_t instr = Read32(*(registers[15]) - 8);
+        access_flags = 0;
         ARMGeneric::DoARMInstruction(this, instr);
     }
 
+    TrackPollingLoop(pc);
+
     if (cpsr.t)
     {
         if (didBranch)
@@ -94,6 +101,13 @@ void ARM11Core::Run()
     }
 }
 
+bool ARM11Core::IsIdle()
+{
+    if (pmr->InterruptPending())
+        return false;
+    return halted || SpinningOnIo();
+}
+
 void ARM11Core::Dump()
 {
     printf("Core %d: [ARM11]:\n", coreId+1);
@@ -102,39 +116,65 @@ void ARM11Core::Dump()
 
 uint8_t ARM11Core::Read8(uint32_t addr)
 {
-    return Bus::ARM11::Read8(addr);
+    uint64_t reads = MMIO::GetReadCount();
+    uint8_t data = Fastmem::enabled ? Fastmem::Read8(MMIO::CPU_ARM11, addr) : Bus::ARM11::Read8(addr);
+    NoteRead(reads);
+    return data;
 }
 
 uint16_t ARM11Core::Read16(uint32_t addr)
 {
-    return Bus::ARM11::Read16(addr);
+    uint64_t reads = MMIO::GetReadCount();
+    uint16_t data = Fastmem::enabled ? Fastmem::Read16(MMIO::CPU_ARM11, addr) : Bus::ARM11::Read16(addr);
+    NoteRead(reads);
+    return data;
 }
 
 uint32_t ARM11Core::Read32(uint32_t addr)
 {
+    // The private region isn't in the MMIO registry, so this counts as an
+    // ordinary read and never looks like a polling loop
     if ((addr & 0xFFF00000) == 0x17E00000)
+    {
+        NoteRead(MMIO::GetReadCount());
         return pmr->Read32(addr);
-    
-    return Bus::ARM11::Read32(addr);
+    }
+
+    uint64_t reads = MMIO::GetReadCount();
+    uint32_t data = Fastmem::enabled ? Fastmem::Read32(MMIO::CPU_ARM11, addr) : Bus::ARM11::Read32(addr);
+    NoteRead(reads);
+    return data;
 }
 
 void ARM11Core::Write8(uint32_t addr, uint8_t data)
 {
+    NoteWrite();
     if ((addr & 0xFFF00000) == 0x17E00000)
         return pmr->Write8(addr, data);
 
-    Bus::ARM11::Write8(addr, data);
+    if (Fastmem::enabled)
+        Fastmem::Write8(MMIO::CPU_ARM11, addr, data);
+    else
+        Bus::ARM11::Write8(addr, data);
 }
 
 void ARM11Core::Write16(uint32_t addr, uint16_t data)
 {
-    Bus::ARM11::Write16(addr, data);
+    NoteWrite();
+    if (Fastmem::enabled)
+        Fastmem::Write16(MMIO::CPU_ARM11, addr, data);
+    else
+        Bus::ARM11::Write16(addr, data);
 }
 
 void ARM11Core::Write32(uint32_t addr, uint32_t data)
 {
+    NoteWrite();
     if ((addr & 0xFFF00000) == 0x17E00000)
         return pmr->Write32(addr, data);
 
-    Bus::ARM11::Write32(addr, data);
+    if (Fastmem::enabled)
+        Fastmem::Write32(MMIO::CPU_ARM11, addr, data);
+    else
+        Bus::ARM11::Write32(addr, data);
 }
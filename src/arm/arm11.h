@@ -14,6 +14,7 @@ public:
 
     void Reset();
     void Run();
+    bool IsIdle();
     void Dump();
 
     virtual uint8_t Read8(uint32_t addr);
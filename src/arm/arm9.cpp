@@ -1,6 +1,7 @@
 #include "arm9.h"
 
 #include <memory/Bus.h>
+#include <memory/fastmem.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -42,9 +43,11 @@ void ARM9Core::Run()
         halted = false;
     }
 
-    if (halted)
+    if (halted || SkipPollingLoop())
         return;
 
+    uint32_t pc = *(registers[15]) - (cpsr.t ? 4 : 8);
+
     if (cpsr.t)
     {   
         didBranch = false;
@@ -54,6 +57,7 @@ void ARM9Core::Run()
         if (CanDisassemble)
             printf("0x%04x (0x%08x) (t): ", *(registers[15]) - 4, instr);
         
+        access_flags = 0;
         ARMGeneric::DoTHUMBInstruction(this, instr);
     }
     else
@@ -65,9 +69,12 @@ void ARM9Core::Run()
         if (CanDisassemble)
             printf("0x%08x (0x%08x)", instr,  *(registers[15]) - 8);
         
+        access_flags = 0;
         ARMGeneric::DoARMInstruction(this, instr);
     }
 
+    TrackPollingLoop(pc);
+
     if (cpsr.t)
     {
         if (didBranch)
@@ -84,6 +91,13 @@ void ARM9Core::Run()
     }
 }
 
+bool ARM9Core::IsIdle()
+{
+    if (Bus::GetInterruptPending9() && !cpsr.i)
+        return false;
+    return halted || SpinningOnIo();
+}
+
 void ARM9Core::Dump()
 {
     printf("[ARM9]:\n");
@@ -92,30 +106,51 @@ void ARM9Core::Dump()
 
 uint8_t ARM9Core::Read8(uint32_t addr)
 {
-    return Bus::ARM9::Read8(addr);
+    uint64_t reads = MMIO::GetReadCount();
+    uint8_t data = Fastmem::enabled ? Fastmem::Read8(MMIO::CPU_ARM9, addr) : Bus::ARM9::Read8(addr);
+    NoteRead(reads);
+    return data;
 }
 
 uint16_t ARM9Core::Read16(uint32_t addr)
 {
-    return Bus::ARM9::Read16(addr);
+    uint64_t reads = MMIO::GetReadCount();
+    uint16_t data = Fastmem::enabled ? Fastmem::Read16(MMIO::CPU_ARM9, addr) : Bus::ARM9::Read16(addr);
+    NoteRead(reads);
+    return data;
 }
 
 uint32_t ARM9Core::Read32(uint32_t addr)
 {
-    return Bus::ARM9::Read32(addr);
+    uint64_t reads = MMIO::GetReadCount();
+    uint32_t data = Fastmem::enabled ? Fastmem::Read32(MMIO::CPU_ARM9, addr) : Bus::ARM9::Read32(addr);
+    NoteRead(reads);
+    return data;
 }
 
 void ARM9Core::Write8(uint32_t addr, uint8_t data)
 {
-    Bus::ARM9::Write8(addr, data);
+    NoteWrite();
+    if (Fastmem::enabled)
+        Fastmem::Write8(MMIO::CPU_ARM9, addr, data);
+    else
+        Bus::ARM9::Write8(addr, data);
 }
 
 void ARM9Core::Write16(uint32_t addr, uint16_t data)
 {
-    Bus::ARM9::Write16(addr, data);
+    NoteWrite();
+    if (Fastmem::enabled)
+        Fastmem::Write16(MMIO::CPU_ARM9, addr, data);
+    else
+        Bus::ARM9::Write16(addr, data);
 }
 
 void ARM9Core::Write32(uint32_t addr, uint32_t data)
 {
-    Bus::ARM9::Write32(addr, data);
+    NoteWrite();
+    if (Fastmem::enabled)
+        Fastmem::Write32(MMIO::CPU_ARM9, addr, data);
+    else
+        Bus::ARM9::Write32(addr, data);
 }
\ No newline at end of file
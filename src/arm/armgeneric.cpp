@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cassert>
 #include <bitset>
+#include <string.h>
 
 std::string HexToString(uint32_t num)
 {
@@ -48,6 +49,60 @@ void ARMCore::SwitchMode(uint8_t mode)
     }
 }
 
+bool ARMCore::SkipPollingLoop()
+{
+    if (!spinning)
+        return false;
+
+    if (MMIO::GetGeneration() != spin_generation)
+    {
+        spinning = false;
+        return false;
+    }
+
+    poll_instrs_skipped++;
+    return true;
+}
+
+void ARMCore::TrackPollingLoop(uint32_t pc)
+{
+    loop_instrs++;
+    loop_access |= access_flags;
+
+    if (!didBranch)
+        return;
+
+    // Forward branches (and calls) inside the loop body just keep going
+    uint32_t target = *(registers[15]);
+    if (target > pc || pc - target > MAX_POLL_LOOP_BYTES)
+        return;
+
+    uint32_t state[16];
+    for (int i = 0; i < 15; i++)
+        state[i] = *(registers[i]);
+    state[15] = cpsr.value;
+
+    uint64_t generation = MMIO::GetGeneration();
+
+    if (target == loop_start && pc == loop_end
+        && loop_access == LOOP_MMIO_READ
+        && loop_instrs <= MAX_POLL_LOOP_INSTRS
+        && generation == loop_generation
+        && !memcmp(state, loop_state, sizeof(state)))
+    {
+        spinning = true;
+        spin_generation = generation;
+        poll_loops_detected++;
+    }
+
+    loop_start = target;
+    loop_end = pc;
+    memcpy(loop_state, state, sizeof(state));
+    loop_generation = generation;
+    loop_instrs = 0;
+    loop_access = 0;
+}
+
 bool CondPassed(CPSR& cpsr, uint8_t cond)
 {
     switch (cond)
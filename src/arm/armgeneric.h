@@ -6,6 +6,7 @@
 #include <bit>
 
 #include "cp15.h"
+#include <memory/mmio.h>
 
 #define ADD_OVERFLOW(a, b, result) ((!(((a) ^ (b)) & 0x80000000)) && (((a) ^ (result)) & 0x80000000))
 #define SUB_OVERFLOW(a, b, result) (((a) ^ (b)) & 0x80000000) && (((a) ^ (result)) & 0x80000000)
@@ -91,6 +92,58 @@ protected:
     uint32_t pipeline[2];
     uint16_t t_pipeline[2];
 
+    // Polling-loop detection. A loop is a short backward branch, and the
+    // accesses made by each of its iterations are collected in loop_access.
+    // Once an iteration only read registers and ended in exactly the state
+    // the previous one did, with no device state changing in between, every
+    // further iteration would do the same thing, so the core sleeps until
+    // the MMIO generation moves.
+    enum LoopAccess
+    {
+        LOOP_MMIO_READ = 1 << 0,
+        LOOP_OTHER_READ = 1 << 1,
+        LOOP_WRITE = 1 << 2
+    };
+
+    static constexpr int MAX_POLL_LOOP_INSTRS = 16;
+    static constexpr uint32_t MAX_POLL_LOOP_BYTES = 64;
+
+    uint8_t access_flags = 0;
+    uint8_t loop_access = 0;
+    int loop_instrs = 0;
+    uint32_t loop_start = 0, loop_end = 0;
+    uint32_t loop_state[16];
+    uint64_t loop_generation = 0;
+
+    bool spinning = false;
+    uint64_t spin_generation = 0;
+
+    uint64_t poll_loops_detected = 0;
+    uint64_t poll_instrs_skipped = 0;
+
+    // Called by the memory accessors, reads_before is MMIO::GetReadCount()
+    // from before the access
+    void NoteRead(uint64_t reads_before)
+    {
+        access_flags |= MMIO::GetReadCount() != reads_before ? LOOP_MMIO_READ : LOOP_OTHER_READ;
+    }
+
+    void NoteWrite()
+    {
+        access_flags |= LOOP_WRITE;
+    }
+
+    bool SpinningOnIo()
+    {
+        return spinning && MMIO::GetGeneration() == spin_generation;
+    }
+
+    // Returns true if this step is spent asleep in a polling loop
+    bool SkipPollingLoop();
+
+    // Called after each instruction with the address it was fetched from
+    void TrackPollingLoop(uint32_t pc);
+
     void SetCPSR(uint32_t value)
     {
         cpsr.n = (value >> 31) & 1;
@@ -129,8 +182,13 @@ public:
         *(registers[15]) = (id == 9) ? 0xFFFF0018+8 : 0x18+8;
     }
 
+    // Whether the core can't do anything until some device state changes
+    virtual bool IsIdle() = 0;
+
     virtual void Dump()
     {
+        if (poll_loops_detected)
+            printf("%lu polling loops detected, %lu instructions skipped\n", poll_loops_detected, poll_instrs_skipped);
         for (int i = 0; i < 16; i++)
             printf("r%d\t->\t0x%08x\n", i, *(registers[i]));
         printf("[%s%s%s%s%s%s]\n", 
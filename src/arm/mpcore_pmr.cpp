@@ -1,5 +1,6 @@
 #include "mpcore_pmr.h"
 #include "arm11.h"
+#include <memory/mmio.h>
 
 #include <cassert>
 #include <string.h>
@@ -58,6 +59,7 @@ void MPCore_PMR::SetPendingIrq(int id, int id_of_requestor)
     int index = id / 32;
     int bit = id % 32;
     local_int_pending[index] |= 1 << bit;
+    MMIO::NotifyChange();
 
     if (id < 16)
         private_int_requestor[id] = id_of_requestor;
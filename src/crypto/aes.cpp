@@ -5,6 +5,11 @@
 #include <string.h>
 #include <fstream>
 #include <memory/Bus.h>
+#include <scheduler/scheduler.h>
+#include <dma/ndma.h>
+#include <memory/mmio.h>
+#include "crypto_pool.h"
+#include "ctr_cache.h"
 
 const static uint8_t key_const[] = {0x1F, 0xF9, 0xE9, 0xAA, 0xC5, 0xFE, 0x04, 0x08, 0x02, 0x45,
                                      0x91, 0xDC, 0x5D, 0x52, 0x76, 0x8A};
@@ -39,6 +44,7 @@ uint8_t normal_fifo[16], x_fifo[16], y_fifo[16];
 uint8_t normal_ctr = 0, x_ctr, y_ctr;
 
 AES_ctx lib_aes_ctx;
+uint64_t active_key_hash;
 
 uint8_t keycnt = 0, keysel = 0;
 uint16_t block_count = 0, mac_count = 0;
@@ -48,8 +54,41 @@ int temp_input_ctr;
 
 std::queue<uint32_t> output_fifo, input_fifo;
 
+// Blocks are ciphered on the AES crypto lane, which owns lib_aes_ctx and
+// pushes results into output_fifo. output_words tracks the FIFO occupancy the
+// guest sees, since the lane may not have filled the FIFO in yet.
+int output_words = 0;
+
+struct AesJob
+{
+    uint32_t block[4];
+    uint8_t mode;
+    bool out_word_order;
+    bool out_big_endian;
+};
+
+// Bumped whenever an operation starts so a stale completion event can't
+// end a newer one. finish_pending is set while the last block's completion
+// event is in flight: the engine is done, but busy still reads as set.
+uint32_t aes_generation = 0;
+bool finish_pending = false;
+constexpr uint64_t AES_FINISH_CYCLES = 0x10;
+
+void finish_crypt(uint32_t generation);
+
 void WriteAesCnt(uint32_t value)
 {
+    // Only a start with blocks to process is a new operation. Anything else,
+    // like a read-modify-write that keeps the busy bit or a mode change,
+    // leaves a pending completion alone.
+    bool idle = !aes_cnt.busy || finish_pending;
+    if ((value & (1 << 31)) && idle && block_count)
+    {
+        if (finish_pending)
+            finish_crypt(aes_generation);
+        aes_generation++;
+    }
+
     if ((aes_cnt.in_word_order << 25) ^ (value & (1 << 25)))
     {
         normal_ctr = 0;
@@ -71,8 +110,10 @@ void WriteAesCnt(uint32_t value)
 
     if (value & (1 << 26))
     {
+        CryptoPool::Wait(CryptoPool::ENGINE_AES);
         key_current = &aes_keys[keysel & 0x3F];
         AES_init_ctx(&lib_aes_ctx, (uint8_t*)key_current->normal);
+        active_key_hash = CtrCache::HashKey(key_current->normal);
     }
 
     printf("[AES]: Wrote 0x%08x to aes_cnt\n", value);
@@ -82,7 +123,7 @@ uint32_t ReadAesCnt()
 {
     uint32_t reg = 0;
     reg |= input_fifo.size();
-    reg |= output_fifo.size() << 5;
+    reg |= output_words << 5;
     reg |= aes_cnt.dma_write_size << 12;
     reg |= aes_cnt.dma_read_size << 14;
     reg |= aes_cnt.mac_size << 16;
@@ -108,7 +149,9 @@ void AES::Reset()
     key_current = nullptr;
     normal_ctr = 0;
 
+    CryptoPool::Wait(CryptoPool::ENGINE_AES);
     AES_init_ctx(&lib_aes_ctx, (uint8_t*)aes_keys[0x3F].normal);
+    active_key_hash = CtrCache::HashKey(aes_keys[0x3F].normal);
 }
 
 uint32_t bswp32(uint32_t value)
@@ -136,11 +179,6 @@ void input_vector(uint8_t* vector, int index, uint32_t value, int max_words, boo
 void decrypt_cbc()
 {
     printf("[AES]: Decrypt CBC\n");
-    for (int i = 0; i < 4; i++)
-    {
-        *(uint32_t*)&crypt_results[i*4] = input_fifo.front();
-        input_fifo.pop();
-    }
 
     AES_CBC_decrypt_buffer(&lib_aes_ctx, (uint8_t*)crypt_results, 16);
 }
@@ -148,86 +186,160 @@ void decrypt_cbc()
 void encrypt_cbc()
 {
     printf("[AES] Encrypt CBC\n");
-    for (int i = 0; i < 4; i++)
-    {
-        *(uint32_t*)&crypt_results[i * 4] = input_fifo.front();
-        input_fifo.pop();
-    }
 
     AES_CBC_encrypt_buffer(&lib_aes_ctx, (uint8_t*)crypt_results, 16);
 }
 
+void increment_ctr(uint8_t* ctr)
+{
+    for (int i = 15; i >= 0; i--)
+    {
+        if (++ctr[i])
+            break;
+    }
+}
+
 void crypt_ctr()
 {
-    for (int i = 0; i < 4; i++)
+    if (!CtrCache::IsOpen())
+    {
+        AES_CTR_xcrypt_buffer(&lib_aes_ctx, (uint8_t*)crypt_results, 16);
+        return;
+    }
+
+    uint8_t keystream[16];
+    if (CtrCache::Lookup(active_key_hash, lib_aes_ctx.Iv, keystream))
+        increment_ctr(lib_aes_ctx.Iv);
+    else
     {
-        *(uint32_t*)&crypt_results[i * 4] = input_fifo.front();
-        input_fifo.pop();
+        // Running the cipher over zeros yields the bare keystream block
+        uint8_t ctr[16];
+        memcpy(ctr, lib_aes_ctx.Iv, 16);
+        memset(keystream, 0, 16);
+        AES_CTR_xcrypt_buffer(&lib_aes_ctx, keystream, 16);
+        CtrCache::Insert(active_key_hash, ctr, keystream);
     }
 
-    AES_CTR_xcrypt_buffer(&lib_aes_ctx, (uint8_t*)crypt_results, 16);
+    for (int i = 0; i < 16; i++)
+        crypt_results[i] ^= keystream[i];
 }
 
 void decrypt_ecb()
 {
     printf("[AES] Decrypt ECB\n");
 
+
+    AES_ECB_decrypt(&lib_aes_ctx, (uint8_t*)crypt_results);
+}
+
+void crypt_block(const AesJob& job)
+{
+    memcpy(crypt_results, job.block, sizeof(crypt_results));
+
+    switch (job.mode)
+    {
+    case 0x2:
+    case 0x3:
+        crypt_ctr();
+        break;
+    case 0x4:
+        decrypt_cbc();
+        break;
+    case 0x5:
+        encrypt_cbc();
+        break;
+    case 0x6:
+        decrypt_ecb();
+        break;
+    }
+
     for (int i = 0; i < 4; i++)
     {
-        *(uint32_t*)&crypt_results[i * 4] = input_fifo.front();
-        input_fifo.pop();
+        int index = i << 2;
+        if (!job.out_word_order)
+        {
+            index = 12 - index;
+        }
+
+        uint32_t value = *(uint32_t*)&crypt_results[index];
+        if (!job.out_big_endian)
+            value = bswp32(value);
+        output_fifo.push(value);
     }
+}
 
-    AES_ECB_decrypt(&lib_aes_ctx, (uint8_t*)crypt_results);
+void finish_crypt(uint32_t generation)
+{
+    if (generation != aes_generation || !finish_pending)
+        return;
+
+    finish_pending = false;
+    aes_cnt.busy = false;
+    if (aes_cnt.irq_enable)
+        Bus::SetInterruptPending9(15);
+}
+
+// Ask NDMA for more input while the current operation still needs blocks,
+// and to drain the output FIFO once a whole block is waiting
+bool AES::InputRequested()
+{
+    return aes_cnt.busy && input_fifo.size() <= 12 && block_count * 4u > input_fifo.size();
+}
+
+bool AES::OutputRequested()
+{
+    return output_words >= 4;
+}
+
+void request_dma()
+{
+    if (AES::InputRequested())
+        NDMA::TriggerStartup(NDMA::STARTUP_AES_IN);
+    if (AES::OutputRequested())
+        NDMA::TriggerStartup(NDMA::STARTUP_AES_OUT);
 }
 
 void crypt_check()
 {
-    if (input_fifo.size() >= 4 && output_fifo.size() <= 12 && aes_cnt.busy)
+    if (input_fifo.size() >= 4 && output_words <= 12 && aes_cnt.busy && block_count)
     {
         switch (aes_cnt.mode)
         {
         case 0x2:
         case 0x3:
-            crypt_ctr();
-            break;
         case 0x4:
-            decrypt_cbc();
-            break;
         case 0x5:
-            encrypt_cbc();
-            break;
         case 0x6:
-            decrypt_ecb();
             break;
         default:
             printf("[AES]: Unhandled mode %d\n", aes_cnt.mode);
             exit(1);
         }
 
+        AesJob job;
         for (int i = 0; i < 4; i++)
         {
-            int index = i << 2;
-            if (!aes_cnt.out_word_order)
-            {
-                index = 12 - index;
-            }
-
-            uint32_t value = *(uint32_t*)&crypt_results[index];
-            if (!aes_cnt.out_big_endian)
-                value = bswp32(value);
-            output_fifo.push(value);
+            job.block[i] = input_fifo.front();
+            input_fifo.pop();
         }
+        job.mode = aes_cnt.mode;
+        job.out_word_order = aes_cnt.out_word_order;
+        job.out_big_endian = aes_cnt.out_big_endian;
+
+        output_words += 4;
+        CryptoPool::Submit(CryptoPool::ENGINE_AES, [job] { crypt_block(job); });
 
         block_count--;
 
         if (!block_count)
         {
-            aes_cnt.busy = false;
-            if (aes_cnt.irq_enable)
-                Bus::SetInterruptPending9(15);
+            uint32_t generation = aes_generation;
+            finish_pending = true;
+            Scheduler::ScheduleEvent(AES_FINISH_CYCLES, [generation] { finish_crypt(generation); });
         }
     }
+
+    request_dma();
 }
 
 void write_input_fifo(uint32_t value)
@@ -379,6 +491,7 @@ void AES::Write32(uint32_t addr, uint32_t data)
     {
         printf("[AES]: Write 0x%08x to ctr: 0x%08x\n", data, addr);
 
+        CryptoPool::Wait(CryptoPool::ENGINE_AES);
         input_vector((uint8_t*)AES_CTR, 3 - ((addr / 4) & 0x3), data, 4, true);
         AES_ctx_set_iv(&lib_aes_ctx, (uint8_t*)AES_CTR);
         return;
@@ -418,6 +531,7 @@ void AES::Write32(uint32_t addr, uint32_t data)
     {
     case 0x10009000:
         WriteAesCnt(data);
+        crypt_check();
         break;
     case 0x10009004:
         mac_count = data & 0xffff;
@@ -469,10 +583,13 @@ uint32_t AES::Read32(uint32_t addr)
         reg = ReadAesCnt();
         break;
     case 0x1000900C:
-        if (output_fifo.size())
+        if (output_words)
         {
+            CryptoPool::Wait(CryptoPool::ENGINE_AES);
             most_recent_output = output_fifo.front();
             output_fifo.pop();
+            output_words--;
+            MMIO::NotifyChange();
         }
         reg = most_recent_output;
         crypt_check();
@@ -20,4 +20,8 @@ void WriteKEYSEL(uint8_t data);
 
 void WriteBlockCount(uint16_t data);
 
+// Current level of the NDMA request lines
+bool InputRequested();
+bool OutputRequested();
+
 }
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "bignum.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Numbers are stored as 32 little-endian 64-bit limbs. Multiplication uses
+// Montgomery form (CIOS), and exponentiation walks the exponent in fixed
+// windows with a table lookup that touches every entry, so the sequence of
+// operations only depends on the bit length of the exponent, never on its
+// value or on the base.
+
+constexpr int LIMBS = 32;
+
+typedef uint64_t Num[LIMBS];
+typedef unsigned __int128 u128;
+
+static void from_bytes(Num dest, const uint8_t* src)
+{
+    for (int i = 0; i < LIMBS; i++)
+    {
+        uint64_t limb = 0;
+        for (int j = 0; j < 8; j++)
+            limb |= (uint64_t)src[0xFF - (i * 8 + j)] << (j * 8);
+        dest[i] = limb;
+    }
+}
+
+static void to_bytes(uint8_t* dest, const Num src)
+{
+    for (int i = 0; i < LIMBS; i++)
+    {
+        for (int j = 0; j < 8; j++)
+            dest[0xFF - (i * 8 + j)] = (src[i] >> (j * 8)) & 0xFF;
+    }
+}
+
+static bool is_zero(const Num a)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < LIMBS; i++)
+        acc |= a[i];
+    return acc == 0;
+}
+
+static int bit_length(const Num a)
+{
+    for (int i = LIMBS - 1; i >= 0; i--)
+    {
+        if (a[i])
+            return i * 64 + (64 - __builtin_clzll(a[i]));
+    }
+    return 0;
+}
+
+// dest = a - b, returns the borrow
+static uint64_t sub(Num dest, const Num a, const Num b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < LIMBS; i++)
+    {
+        u128 diff = (u128)a[i] - b[i] - borrow;
+        dest[i] = (uint64_t)diff;
+        borrow = (diff >> 64) & 1;
+    }
+    return borrow;
+}
+
+// dest = mask ? a : dest
+static void select(Num dest, const Num a, uint64_t mask)
+{
+    for (int i = 0; i < LIMBS; i++)
+        dest[i] = (a[i] & mask) | (dest[i] & ~mask);
+}
+
+// Subtracts mod from a if a (with an extra top word 'hi') is >= mod
+static void reduce_once(Num a, uint64_t hi, const Num mod)
+{
+    Num tmp;
+    uint64_t borrow = sub(tmp, a, mod);
+    // Keep the difference when it didn't underflow, or when the value
+    // overflowed into the extra word
+    uint64_t mask = -(uint64_t)((borrow ^ 1) | hi);
+    select(a, tmp, mask);
+}
+
+struct MontCtx
+{
+    Num mod;
+    Num r2;
+    uint64_t n0inv;
+};
+
+// dest = a * b * R^-1 mod n. The multiply and reduce passes of CIOS are fused
+// into one inner loop with two carry chains.
+static void mont_mul(Num dest, const Num a, const Num b, const MontCtx& ctx)
+{
+    uint64_t t[LIMBS + 1] = {0};
+
+    for (int i = 0; i < LIMBS; i++)
+    {
+        uint64_t bi = b[i];
+        uint64_t m = (t[0] + a[0] * bi) * ctx.n0inv;
+
+        u128 prod = (u128)a[0] * bi + t[0];
+        uint64_t carry_mul = prod >> 64;
+        u128 red = (u128)m * ctx.mod[0] + (uint64_t)prod;
+        uint64_t carry_red = red >> 64;
+
+        for (int j = 1; j < LIMBS; j++)
+        {
+            prod = (u128)a[j] * bi + t[j] + carry_mul;
+            carry_mul = prod >> 64;
+            red = (u128)m * ctx.mod[j] + (uint64_t)prod + carry_red;
+            carry_red = red >> 64;
+            t[j - 1] = (uint64_t)red;
+        }
+
+        u128 sum = (u128)t[LIMBS] + carry_mul + carry_red;
+        t[LIMBS - 1] = (uint64_t)sum;
+        t[LIMBS] = sum >> 64;
+    }
+
+    memcpy(dest, t, sizeof(Num));
+    reduce_once(dest, t[LIMBS], ctx.mod);
+}
+
+static void mont_init(MontCtx& ctx, const Num mod)
+{
+    memcpy(ctx.mod, mod, sizeof(Num));
+
+    // Newton iteration for mod^-1 mod 2^64, each step doubles the correct bits
+    uint64_t inv = 1;
+    for (int i = 0; i < 6; i++)
+        inv *= 2 - mod[0] * inv;
+    ctx.n0inv = -inv;
+
+    // R mod n by doubling the largest power of two below n up to 2^2048,
+    // then 64 more doublings give 2^64 in Montgomery form. Five Montgomery
+    // squarings of that land on 2^2048 in Montgomery form, which is R^2 mod n.
+    Num x = {0};
+    int bits = bit_length(mod);
+    x[(bits - 1) / 64] = 1ull << ((bits - 1) % 64);
+    for (int i = bits - 1; i < LIMBS * 64 + 64; i++)
+    {
+        uint64_t hi = x[LIMBS - 1] >> 63;
+        for (int j = LIMBS - 1; j > 0; j--)
+            x[j] = (x[j] << 1) | (x[j - 1] >> 63);
+        x[0] <<= 1;
+        reduce_once(x, hi, ctx.mod);
+    }
+
+    for (int i = 0; i < 5; i++)
+        mont_mul(x, x, x, ctx);
+    memcpy(ctx.r2, x, sizeof(Num));
+}
+
+static int get_window(const Num exp, int bit, int width)
+{
+    int value = 0;
+    for (int i = width - 1; i >= 0; i--)
+    {
+        int pos = bit + i;
+        value = (value << 1) | ((exp[pos / 64] >> (pos % 64)) & 1);
+    }
+    return value;
+}
+
+static void pow_mod_odd(Num result, const Num base, const Num exp, const Num mod)
+{
+    MontCtx ctx;
+    mont_init(ctx, mod);
+
+    Num one = {1};
+
+    // Short (public) exponents don't amortise a 16 entry table
+    int bits = bit_length(exp);
+    int width = bits > 64 ? 4 : 1;
+    int entries = 1 << width;
+
+    Num table[16];
+    mont_mul(table[0], one, ctx.r2, ctx);
+    mont_mul(table[1], base, ctx.r2, ctx);
+    for (int i = 2; i < entries; i++)
+        mont_mul(table[i], table[i - 1], table[1], ctx);
+
+    Num acc;
+    memcpy(acc, table[0], sizeof(Num));
+
+    int windows = (bits + width - 1) / width;
+    for (int w = windows - 1; w >= 0; w--)
+    {
+        for (int i = 0; i < width; i++)
+            mont_mul(acc, acc, acc, ctx);
+
+        int index = get_window(exp, w * width, width);
+
+        Num entry = {0};
+        for (int i = 0; i < entries; i++)
+            select(entry, table[i], -(uint64_t)(i == index));
+
+        mont_mul(acc, acc, entry, ctx);
+    }
+
+    mont_mul(result, acc, one, ctx);
+}
+
+// Montgomery reduction needs an odd modulus. Real RSA moduli always are, but
+// the guest can load anything, so fall back to plain shift-and-add arithmetic.
+static void mul_mod_slow(Num dest, const Num a, const Num b, const Num mod)
+{
+    Num acc = {0};
+    for (int bit = LIMBS * 64 - 1; bit >= 0; bit--)
+    {
+        uint64_t hi = acc[LIMBS - 1] >> 63;
+        for (int j = LIMBS - 1; j > 0; j--)
+            acc[j] = (acc[j] << 1) | (acc[j - 1] >> 63);
+        acc[0] <<= 1;
+        reduce_once(acc, hi, mod);
+
+        if ((b[bit / 64] >> (bit % 64)) & 1)
+        {
+            uint64_t carry = 0;
+            for (int j = 0; j < LIMBS; j++)
+            {
+                u128 sum = (u128)acc[j] + a[j] + carry;
+                acc[j] = (uint64_t)sum;
+                carry = sum >> 64;
+            }
+            reduce_once(acc, carry, mod);
+        }
+    }
+    memcpy(dest, acc, sizeof(Num));
+}
+
+static void pow_mod_even(Num result, const Num base, const Num exp, const Num mod)
+{
+    Num b, acc;
+
+    // Multiplying the base into 1 (rather than the other way around) reduces
+    // it below the modulus, which the shift-and-add relies on
+    Num one = {1};
+    mul_mod_slow(b, one, base, mod);
+    mul_mod_slow(acc, one, one, mod);
+
+    for (int bit = bit_length(exp) - 1; bit >= 0; bit--)
+    {
+        mul_mod_slow(acc, acc, acc, mod);
+        if ((exp[bit / 64] >> (bit % 64)) & 1)
+            mul_mod_slow(acc, acc, b, mod);
+    }
+
+    memcpy(result, acc, sizeof(Num));
+}
+
+void Bignum::PowMod(const uint8_t* base, const uint8_t* exp, const uint8_t* mod, uint8_t* out)
+{
+    Num b, e, m, result = {0};
+
+    from_bytes(b, base);
+    from_bytes(e, exp);
+    from_bytes(m, mod);
+
+    if (is_zero(m))
+    {
+        printf("[RSA]: Modular exponentiation with a zero modulus\n");
+    }
+    else if (m[0] & 1)
+        pow_mod_odd(result, b, e, m);
+    else
+        pow_mod_even(result, b, e, m);
+
+    to_bytes(out, result);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Self-contained 2048-bit modular exponentiation, used by the RSA engine when
+// the emulator is built without GMP. All operands are 0x100 byte big-endian
+// strings, matching the layout of the RSA peripheral's key and text buffers.
+namespace Bignum
+{
+
+void PowMod(const uint8_t* base, const uint8_t* exp, const uint8_t* mod, uint8_t* out);
+
+}
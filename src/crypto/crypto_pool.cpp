@@ -0,0 +1,79 @@
+#include "crypto_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct Lane
+{
+    std::mutex lock;
+    std::condition_variable job_ready, jobs_done;
+    std::deque<std::function<void()>> jobs;
+    std::atomic<int> pending = 0;
+    bool started = false;
+};
+
+// Never destroyed: the workers are detached and may still be blocked on the
+// condition variables while static destructors run at exit
+Lane* lanes = new Lane[CryptoPool::ENGINE_COUNT];
+
+// AES and SHA jobs are a single block each, so a sleeping thread's wakeup
+// latency would dwarf the work. Both sides poll for a short while first.
+constexpr int SPIN_COUNT = 256;
+
+void LaneWorker(Lane* lane)
+{
+    while (1)
+    {
+        for (int i = 0; i < SPIN_COUNT && lane->pending == 0; i++)
+            std::this_thread::yield();
+
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lane->lock);
+            lane->job_ready.wait(guard, [lane] { return !lane->jobs.empty(); });
+            job = std::move(lane->jobs.front());
+            lane->jobs.pop_front();
+        }
+
+        job();
+
+        std::lock_guard<std::mutex> guard(lane->lock);
+        if (--lane->pending == 0)
+            lane->jobs_done.notify_all();
+    }
+}
+
+void CryptoPool::Submit(Engine engine, std::function<void()> job)
+{
+    Lane* lane = &lanes[engine];
+
+    std::lock_guard<std::mutex> guard(lane->lock);
+    if (!lane->started)
+    {
+        std::thread(LaneWorker, lane).detach();
+        lane->started = true;
+    }
+
+    lane->pending++;
+    lane->jobs.push_back(std::move(job));
+    lane->job_ready.notify_one();
+}
+
+void CryptoPool::Wait(Engine engine)
+{
+    Lane* lane = &lanes[engine];
+
+    // Cheap check first, MMIO handlers call this on every access
+    for (int i = 0; i < SPIN_COUNT; i++)
+    {
+        if (lane->pending == 0)
+            return;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> guard(lane->lock);
+    lane->jobs_done.wait(guard, [lane] { return lane->pending == 0; });
+}
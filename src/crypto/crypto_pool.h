@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+
+// Host worker threads for the crypto engines. Each engine gets its own
+// in-order lane, so jobs for one engine never overlap or reorder, while
+// AES, SHA and RSA work can proceed in parallel with each other and with
+// the emulated CPUs. Anything on the emulation thread that observes an
+// engine's results has to Wait() on that engine first.
+namespace CryptoPool
+{
+
+enum Engine
+{
+    ENGINE_AES,
+    ENGINE_SHA,
+    ENGINE_RSA,
+    ENGINE_COUNT
+};
+
+void Submit(Engine engine, std::function<void()> job);
+void Wait(Engine engine);
+
+}
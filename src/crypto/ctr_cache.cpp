@@ -0,0 +1,167 @@
+#include "ctr_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint8_t pad[48];
+};
+
+struct CacheEntry
+{
+    uint64_t key_hash;
+    uint64_t valid;
+    uint8_t ctr[16];
+    uint8_t keystream[16];
+};
+
+static_assert(sizeof(CacheHeader) == 64);
+static_assert(sizeof(CacheEntry) == 48);
+
+// 2^20 entries (48MB) covers 16MB of keystream, and the file stays sparse
+// for the parts that are never touched
+constexpr uint32_t CACHE_ENTRIES = 1 << 20;
+constexpr uint32_t CACHE_WAYS = 4;
+constexpr uint32_t CACHE_VERSION = 1;
+const char cache_magic[8] = {'3', 'D', 'S', 'C', 'T', 'R', 'C', '\0'};
+
+CacheHeader* cache_header = nullptr;
+CacheEntry* cache_entries = nullptr;
+uint64_t cache_hits = 0, cache_misses = 0;
+
+bool CtrCache::Open(const char* path)
+{
+    size_t size = sizeof(CacheHeader) + sizeof(CacheEntry) * CACHE_ENTRIES;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        printf("[AES]: Couldn't open CTR cache %s\n", path);
+        return false;
+    }
+
+    // Anything that isn't a cache of the current layout gets discarded. The
+    // file is emptied and regrown, which leaves it sparse and zeroed.
+    CacheHeader header = {};
+    bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && !memcmp(header.magic, cache_magic, sizeof(cache_magic))
+        && header.version == CACHE_VERSION
+        && header.entry_count == CACHE_ENTRIES;
+
+    if (!valid)
+    {
+        printf("[AES]: Initializing new CTR cache %s\n", path);
+        memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = CACHE_VERSION;
+        header.entry_count = CACHE_ENTRIES;
+
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0
+            || pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            printf("[AES]: Couldn't resize CTR cache %s\n", path);
+            close(fd);
+            return false;
+        }
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("[AES]: Couldn't map CTR cache %s\n", path);
+        return false;
+    }
+
+    cache_header = (CacheHeader*)map;
+    cache_entries = (CacheEntry*)(cache_header + 1);
+
+    return true;
+}
+
+bool CtrCache::IsOpen()
+{
+    return cache_entries != nullptr;
+}
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t CtrCache::HashKey(const uint8_t* key)
+{
+    uint64_t lo, hi;
+    memcpy(&lo, key, 8);
+    memcpy(&hi, key + 8, 8);
+    return mix(lo ^ mix(hi));
+}
+
+static uint32_t get_set(uint64_t key_hash, const uint8_t* ctr)
+{
+    uint64_t lo, hi;
+    memcpy(&lo, ctr, 8);
+    memcpy(&hi, ctr + 8, 8);
+
+    // Consecutive counters land in consecutive sets
+    uint64_t hash = mix(key_hash ^ lo) + __builtin_bswap64(hi);
+    return (hash % (CACHE_ENTRIES / CACHE_WAYS)) * CACHE_WAYS;
+}
+
+bool CtrCache::Lookup(uint64_t key_hash, const uint8_t* ctr, uint8_t* keystream)
+{
+    CacheEntry* set = &cache_entries[get_set(key_hash, ctr)];
+
+    for (uint32_t i = 0; i < CACHE_WAYS; i++)
+    {
+        if (set[i].valid && set[i].key_hash == key_hash && !memcmp(set[i].ctr, ctr, 16))
+        {
+            memcpy(keystream, set[i].keystream, 16);
+            cache_hits++;
+            return true;
+        }
+    }
+
+    cache_misses++;
+    return false;
+}
+
+void CtrCache::Insert(uint64_t key_hash, const uint8_t* ctr, const uint8_t* keystream)
+{
+    CacheEntry* set = &cache_entries[get_set(key_hash, ctr)];
+
+    // Take a free way if there is one, otherwise evict based on the counter
+    CacheEntry* entry = &set[ctr[15] % CACHE_WAYS];
+    for (uint32_t i = 0; i < CACHE_WAYS; i++)
+    {
+        if (!set[i].valid)
+        {
+            entry = &set[i];
+            break;
+        }
+    }
+
+    entry->key_hash = key_hash;
+    memcpy(entry->ctr, ctr, 16);
+    memcpy(entry->keystream, keystream, 16);
+    entry->valid = 1;
+}
+
+void CtrCache::Dump()
+{
+    if (!IsOpen())
+        return;
+
+    printf("[AES]: CTR cache: %lu hits, %lu misses\n", cache_hits, cache_misses);
+}
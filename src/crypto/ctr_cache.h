@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// Optional persistent cache of AES-CTR keystream blocks, stored in a
+// memory-mapped file so repeated boots can skip ciphering the same NAND
+// sectors. An entry maps (hash of the normal key, counter) to E(key, counter),
+// so a hit produces exactly the bytes the cipher would have.
+namespace CtrCache
+{
+
+bool Open(const char* path);
+bool IsOpen();
+
+uint64_t HashKey(const uint8_t* key);
+
+bool Lookup(uint64_t key_hash, const uint8_t* ctr, uint8_t* keystream);
+void Insert(uint64_t key_hash, const uint8_t* ctr, const uint8_t* keystream);
+
+void Dump();
+
+}
@@ -2,12 +2,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <gmp.h>
 #include <string>
 #include <memory/Bus.h>
+#include <scheduler/scheduler.h>
+#include "crypto_pool.h"
+
+#ifdef USE_GMP
+#include <gmp.h>
+#else
+#include "bignum.h"
+#endif
 
 struct RsaCnt
 {
+    bool busy;
     bool irqen;
     uint8_t keyslot;
     bool byte_order;
@@ -26,6 +34,7 @@ struct RsaKey
 uint8_t msg[0x100];
 int msg_ctr;
 
+#ifdef USE_GMP
 void convert_to_bignum(uint8_t *src, mpz_t dest)
 {
     mpz_t base, temp;
@@ -70,11 +79,11 @@ void convert_from_bignum(mpz_t src, uint8_t* dest)
     }
 }
 
-void do_rsa_op()
+void do_rsa_op(int keyslot)
 {
     mpz_t gmp_msg, gmp_b, gmp_e, gmp_m;
 
-    RsaKey* key = &keys[rsa_cnt.keyslot];
+    RsaKey* key = &keys[keyslot];
     mpz_inits(gmp_msg, NULL);
     convert_to_bignum((uint8_t*)msg, gmp_b);
     convert_to_bignum((uint8_t*)key->exp, gmp_e);
@@ -88,11 +97,40 @@ void do_rsa_op()
     printf("Result: %s\n", mpz_get_str(NULL, 16, gmp_msg));
 
     convert_from_bignum(gmp_msg, msg);
+}
+#else
+void do_rsa_op(int keyslot)
+{
+    RsaKey* key = &keys[keyslot];
+
+    Bignum::PowMod(msg, key->exp, key->mod, msg);
+}
+#endif
+
+// The exponentiation itself runs on the RSA crypto lane. The guest sees the
+// engine busy until this completion event, which also syncs with the lane.
+constexpr uint64_t RSA_OP_CYCLES = 0x1000;
+
+void finish_rsa_op()
+{
+    CryptoPool::Wait(CryptoPool::ENGINE_RSA);
+    rsa_cnt.busy = false;
     Bus::SetInterruptPending9(22);
 }
 
+void start_rsa_op()
+{
+    int keyslot = rsa_cnt.keyslot;
+
+    rsa_cnt.busy = true;
+    CryptoPool::Submit(CryptoPool::ENGINE_RSA, [keyslot] { do_rsa_op(keyslot); });
+    Scheduler::ScheduleEvent(RSA_OP_CYCLES, finish_rsa_op);
+}
+
 uint8_t RSA::Read8(uint32_t addr)
 {
+    CryptoPool::Wait(CryptoPool::ENGINE_RSA);
+
     if (addr >= 0x1000B800 && addr < 0x1000B900)
     {
         int index = addr & 0xFF;
@@ -126,7 +164,8 @@ uint32_t RSA::Read32(uint32_t addr)
     {
     case 0x1000b000:
     {
-        uint32_t reg = (rsa_cnt.irqen << 1);
+        uint32_t reg = rsa_cnt.busy;
+        reg |= (rsa_cnt.irqen << 1);
         reg |= (rsa_cnt.keyslot << 4);
         reg |= (rsa_cnt.byte_order << 8);
         reg |= (rsa_cnt.word_order << 9);
@@ -143,6 +182,8 @@ uint32_t RSA::Read32(uint32_t addr)
 
 void RSA::Write8(uint32_t addr, uint8_t data)
 {
+    CryptoPool::Wait(CryptoPool::ENGINE_RSA);
+
     if (addr >= 0x1000B200 && addr < 0x1000B300)
     {
         printf("[RSA] Write8 key%d exp: $%02X\n", rsa_cnt.keyslot, data);
@@ -195,6 +236,8 @@ void RSA::Write8(uint32_t addr, uint8_t data)
 
 void RSA::Write32(uint32_t addr, uint32_t data)
 {
+    CryptoPool::Wait(CryptoPool::ENGINE_RSA);
+
     if (addr >= 0x1000B200 && addr < 0x1000B300)
     {
         printf("[RSA]: Writing 0x%08x to key%d exp\n", data, rsa_cnt.keyslot);
@@ -235,8 +278,8 @@ void RSA::Write32(uint32_t addr, uint32_t data)
         rsa_cnt.byte_order = (data >> 8) & 1;
         rsa_cnt.word_order = (data >> 9) & 1;
 
-        if (data & 1)
-            do_rsa_op();
+        if ((data & 1) && !rsa_cnt.busy)
+            start_rsa_op();
 
         printf("[RSA]: Write 0x%08x to RSA_CNT\n", data);
         break;
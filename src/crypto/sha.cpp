@@ -5,6 +5,10 @@
 #include <cassert>
 #include <queue>
 #include <bit>
+#include <scheduler/scheduler.h>
+#include <dma/ndma.h>
+#include <memory/mmio.h>
+#include "crypto_pool.h"
 
 const static uint32_t k_1[4] =
 {
@@ -23,6 +27,8 @@ const static uint32_t k_256[64] =
    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+// The hash state and message schedule belong to the SHA crypto lane: only
+// jobs touch them, and the emulation thread waits on the lane before reading
 uint32_t hash[8];
 
 struct ShaCnt
@@ -38,9 +44,22 @@ struct ShaCnt
 uint32_t messages[80];
 uint64_t message_len;
 
-void ResetHash()
+// Final rounds submitted but whose completion event hasn't fired yet
+int final_rounds_pending = 0;
+// A finished hash nobody has started a new message over yet
+bool hash_ready = false;
+constexpr uint64_t SHA_FINAL_CYCLES = 0x40;
+
+struct ShaBlock
 {
-    switch (sha_cnt.mode)
+    uint32_t words[16];
+    int count;
+    uint32_t len_lo;
+};
+
+void init_hash(int mode)
+{
+    switch (mode)
     {
         case 0:
             //SHA-256
@@ -67,8 +86,15 @@ void ResetHash()
             hash[7] = 0;
             break;
     }
+}
+
+void ResetHash()
+{
+    int mode = sha_cnt.mode;
+    CryptoPool::Submit(CryptoPool::ENGINE_SHA, [mode] { init_hash(mode); });
 
     message_len = 0;
+    hash_ready = false;
 }
 
 std::queue<uint32_t> in_fifo, out_fifo;
@@ -125,16 +151,13 @@ void _sha256()
     hash[7] += h;
 }
 
-void do_sha256(bool final_round)
+void do_sha256(const ShaBlock& block, bool final_round)
 {
     if (final_round)
     {
-        int round_size = in_fifo.size();
+        int round_size = block.count;
         for (int i = 0; i < round_size; i++)
-        {
-            messages[i] = __bswap_32(in_fifo.front());
-            in_fifo.pop();
-        }
+            messages[i] = block.words[i];
 
         //Clear to zero
         for (int i = round_size; i < 16; i++)
@@ -143,10 +166,6 @@ void do_sha256(bool final_round)
         //Append '1' to the end of the user message
         messages[round_size] = __bswap_32(0x80);
 
-        //Convert to bits
-        message_len *= 4 * 8;
-        uint32_t len_lo = message_len & 0xFFFFFFFF;
-
         if (round_size >= 14)
         {
             //EmuException::die("[SHA] 14 or above\n");
@@ -156,13 +175,13 @@ void do_sha256(bool final_round)
             for (int i = 0; i < 16; i++)
                 messages[i] = 0;
 
-            messages[15] = len_lo;
+            messages[15] = block.len_lo;
 
             _sha256();
         }
         else
         {
-            messages[15] = len_lo;
+            messages[15] = block.len_lo;
             _sha256();
         }
 
@@ -175,25 +194,54 @@ void do_sha256(bool final_round)
     else
     {
         for (int i = 0; i < 16; i++)
-        {
-            messages[i] = __bswap_32(in_fifo.front());
-            in_fifo.pop();
-        }
+            messages[i] = block.words[i];
         _sha256();
     }
 }
 
+void finish_final_round()
+{
+    CryptoPool::Wait(CryptoPool::ENGINE_SHA);
+    final_rounds_pending--;
+    sha_cnt.busy = final_rounds_pending != 0;
+    hash_ready = !sha_cnt.busy;
+
+    if (SHA::OutputRequested())
+        NDMA::TriggerStartup(NDMA::STARTUP_SHA_OUT);
+}
+
 void do_hash(bool final_round)
 {
     switch (sha_cnt.mode)
     {
     case 0:
-        do_sha256(final_round);
         break;
     default:
         printf("[SHA]: Unhandled mode %d\n", sha_cnt.mode);
         exit(1);
     }
+
+    // Drain the FIFO here, the lane only ever sees complete blocks
+    ShaBlock block = {};
+    block.count = final_round ? in_fifo.size() : 16;
+    for (int i = 0; i < block.count; i++)
+    {
+        block.words[i] = __bswap_32(in_fifo.front());
+        in_fifo.pop();
+    }
+
+    if (final_round)
+    {
+        //Convert to bits
+        message_len *= 4 * 8;
+        block.len_lo = message_len & 0xFFFFFFFF;
+
+        final_rounds_pending++;
+        sha_cnt.busy = true;
+        Scheduler::ScheduleEvent(SHA_FINAL_CYCLES, finish_final_round);
+    }
+
+    CryptoPool::Submit(CryptoPool::ENGINE_SHA, [block, final_round] { do_sha256(block, final_round); });
 }
 
 void write_fifo(uint32_t value)
@@ -206,11 +254,15 @@ void write_fifo(uint32_t value)
 
     in_fifo.push(value);
     out_fifo.push(value);
+    hash_ready = false;
     message_len++;
     if (in_fifo.size() == 16)
     {
         do_hash(false);
         sha_cnt.fifo_enable = true;
+
+        if (SHA::InputRequested())
+            NDMA::TriggerStartup(NDMA::STARTUP_SHA_IN);
     }
     else
         sha_cnt.fifo_enable = false;
@@ -227,7 +279,6 @@ void SHA::Write32(uint32_t addr, uint32_t data)
     switch (addr)
     {
     case 0x1000A000:
-        sha_cnt.busy = data & 1;
         sha_cnt.in_dma_enable = data & (1 << 2);
         sha_cnt.in_dma_enable = data & (1 << 2);
         sha_cnt.out_big_endian = data & (1 << 3);
@@ -238,6 +289,8 @@ void SHA::Write32(uint32_t addr, uint32_t data)
             ResetHash();
         if (data & 2)
             do_hash(true);
+        else if (SHA::InputRequested() && in_fifo.empty())
+            NDMA::TriggerStartup(NDMA::STARTUP_SHA_IN);
         printf("[SHA]: Wrote 0x%08x to SHACNT\n", data);
         break;
     default:
@@ -250,6 +303,8 @@ uint32_t SHA::Read32(uint32_t addr)
 {
     if (addr >= 0x1000A040 && addr < 0x1000A080)
     {
+        CryptoPool::Wait(CryptoPool::ENGINE_SHA);
+
         int index = (addr / 4) & 0x7;
         uint32_t value = *(uint32_t*)&hash[index];
         if (sha_cnt.out_big_endian)
@@ -261,6 +316,7 @@ uint32_t SHA::Read32(uint32_t addr)
     {
         uint32_t value = out_fifo.front();
         out_fifo.pop();
+        MMIO::NotifyChange();
         if (!out_fifo.size())
         {
             sha_cnt.fifo_enable = false;
@@ -272,7 +328,7 @@ uint32_t SHA::Read32(uint32_t addr)
     {
     case 0x1000A000:
     {
-        uint32_t reg;
+        uint32_t reg = sha_cnt.busy << 1;
         reg |= sha_cnt.in_dma_enable << 2;
         reg |= sha_cnt.out_big_endian << 3;
         reg |= sha_cnt.mode << 4;
@@ -289,8 +345,21 @@ uint32_t SHA::Read32(uint32_t addr)
     }
 }
 
+// The FIFO hashes itself as soon as it fills, so there is always room
+bool SHA::InputRequested()
+{
+    return sha_cnt.in_dma_enable;
+}
+
+bool SHA::OutputRequested()
+{
+    return sha_cnt.out_dma_enable && hash_ready;
+}
+
 uint8_t SHA::ReadHash(uint32_t addr)
 {
+    CryptoPool::Wait(CryptoPool::ENGINE_SHA);
+
     int index = (addr / 4) & 0x7;
     int offset = addr & 0x3;
     if (sha_cnt.out_big_endian)
@@ -10,4 +10,8 @@ uint32_t Read32(uint32_t addr);
 
 uint8_t ReadHash(uint32_t addr);
 
+// Current level of the NDMA request lines
+bool InputRequested();
+bool OutputRequested();
+
 }
\ No newline at end of file
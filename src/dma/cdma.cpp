@@ -2,110 +2,768 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <memory/Bus.h>
 
-void CDMA::ExecChannel(Channel &chan)
+// Channel programs are decoded once per DMAGO address and then run out of
+// the cache. Peripherals are modelled as always ready, so DMAWFP never
+// stalls and always reports the last request, which ends DMALPFE loops
+// after one pass.
+
+// Instructions a channel runs per Tick before yielding, so a channel stuck
+// in a DMALPFE loop can't hang the emulator
+constexpr int CDMA_INSTR_BUDGET = 256;
+
+// Longest program decoded before giving up on finding a DMAEND
+constexpr uint32_t CDMA_MAX_PROGRAM = 0x1000;
+
+// Fault types, as bit numbers of the channel fault type register
+enum FaultType
+{
+    FAULT_UNDEF_INSTR = 0,
+    FAULT_OPERAND_INVALID = 1,
+    FAULT_MFIFO_ERR = 12,
+    FAULT_ST_DATA_UNAVAILABLE = 13
+};
+
+static uint32_t src_inc(uint32_t ccr) { return ccr & 1; }
+static uint32_t src_size(uint32_t ccr) { return 1 << ((ccr >> 1) & 7); }
+static uint32_t src_len(uint32_t ccr) { return ((ccr >> 4) & 0xF) + 1; }
+static uint32_t dst_inc(uint32_t ccr) { return (ccr >> 14) & 1; }
+static uint32_t dst_size(uint32_t ccr) { return 1 << ((ccr >> 15) & 7); }
+static uint32_t dst_len(uint32_t ccr) { return ((ccr >> 18) & 0xF) + 1; }
+static uint32_t endian_swap(uint32_t ccr) { return (ccr >> 28) & 7; }
+
+static int instr_length(uint8_t opcode)
 {
-    while (chan.chan_status.status == EXECUTING)
+    switch (opcode)
     {
-        printf("0x%08x: ", chan.pc);
-        uint8_t opcode = read8_func(chan.pc++);
+    case 0x00: case 0x01:
+    case 0x04: case 0x05: case 0x07:
+    case 0x08: case 0x09: case 0x0B:
+    case 0x0C: case 0x12: case 0x13: case 0x18:
+        return 1;
+    case 0x20: case 0x22:
+    case 0x25: case 0x27:
+    case 0x29: case 0x2B:
+    case 0x28: case 0x2C: case 0x2D: case 0x2F:
+    case 0x38: case 0x39: case 0x3B:
+    case 0x3C: case 0x3D: case 0x3F:
+    case 0x30: case 0x31: case 0x32:
+    case 0x34: case 0x35: case 0x36:
+        return 2;
+    case 0x54: case 0x56: case 0x5C: case 0x5E:
+        return 3;
+    case 0xBC:
+        return 6;
+    default:
+        return 0;
+    }
+}
 
-        switch (opcode)
-        {
-        case 0x00:
+// Condition encoded in the bs/x bits of LD/ST/LPEND
+static uint8_t decode_cond(uint8_t opcode)
+{
+    switch (opcode & 3)
+    {
+    case 1: return 1;
+    case 3: return 2;
+    default: return 0;
+    }
+}
+
+template <typename BusAccess>
+int CDMA<BusAccess>::DecodeInstr(uint32_t addr, uint8_t* bytes, Instr& instr)
+{
+    bytes[0] = BusAccess::Read8(addr);
+    int length = instr_length(bytes[0]);
+
+    instr = {};
+    instr.op = OP_UNDEFINED;
+    if (!length)
+        return 0;
+
+    for (int i = 1; i < length; i++)
+        bytes[i] = BusAccess::Read8(addr + i);
+
+    uint8_t opcode = bytes[0];
+    switch (opcode)
+    {
+    case 0x00:
+        instr.op = OP_END;
+        break;
+    case 0x01:
+        instr.op = OP_KILL;
+        break;
+    case 0x12:
+    case 0x13:
+    case 0x18:
+        instr.op = OP_NOP;
+        break;
+    case 0x04: case 0x05: case 0x07:
+        instr.op = OP_LD;
+        instr.cond = (Cond)decode_cond(opcode);
+        break;
+    case 0x25: case 0x27:
+        instr.op = OP_LD;
+        instr.cond = (opcode & 2) ? COND_BURST : COND_SINGLE;
+        break;
+    case 0x08: case 0x09: case 0x0B:
+        instr.op = OP_ST;
+        instr.cond = (Cond)decode_cond(opcode);
+        break;
+    case 0x29: case 0x2B:
+        instr.op = OP_ST;
+        instr.cond = (opcode & 2) ? COND_BURST : COND_SINGLE;
+        break;
+    case 0x0C:
+        instr.op = OP_STZ;
+        break;
+    case 0x20: case 0x22:
+        instr.op = OP_LP;
+        instr.arg = (opcode >> 1) & 1;
+        instr.imm = bytes[1];
+        break;
+    case 0x28: case 0x2C: case 0x2D: case 0x2F:
+    case 0x38: case 0x39: case 0x3B:
+    case 0x3C: case 0x3D: case 0x3F:
+        instr.op = OP_LPEND;
+        instr.cond = (Cond)decode_cond(opcode);
+        instr.arg = (opcode >> 2) & 1;
+        // Loop forever (DMALPFE) unless nf is set
+        instr.imm = (opcode >> 4) & 1;
+        break;
+    case 0x30: case 0x31: case 0x32:
+        instr.op = OP_WFP;
+        // 0 = single, 1 = peripheral decides, 2 = burst
+        instr.arg = opcode & 3;
+        break;
+    case 0x34:
+        instr.op = OP_SEV;
+        instr.arg = bytes[1] >> 3;
+        break;
+    case 0x35:
+        instr.op = OP_FLUSHP;
+        instr.arg = bytes[1] >> 3;
+        break;
+    case 0x36:
+        instr.op = OP_WFE;
+        instr.arg = bytes[1] >> 3;
+        break;
+    case 0x54: case 0x56: case 0x5C: case 0x5E:
+        instr.op = OP_ADDH;
+        instr.arg = (opcode & 2) ? REG_DAR : REG_SAR;
+        instr.imm = bytes[1] | (bytes[2] << 8);
+        // DMAADNH adds a negative offset
+        if (opcode & 8)
+            instr.imm |= 0xFFFF0000;
+        break;
+    case 0xBC:
+        instr.op = OP_MOV;
+        instr.arg = bytes[1] & 7;
+        instr.imm = bytes[2] | (bytes[3] << 8) | (bytes[4] << 16) | (bytes[5] << 24);
+        if (instr.arg > REG_DAR)
+            instr.op = OP_UNDEFINED;
+        break;
+    }
+
+    return length;
+}
+
+template <typename BusAccess>
+std::shared_ptr<const typename CDMA<BusAccess>::Program> CDMA<BusAccess>::DecodeProgram(uint32_t pc)
+{
+    auto program = std::make_shared<Program>();
+    program->base = pc;
+
+    std::vector<int> lpend_jumps;
+    uint32_t offset = 0;
+    while (offset < CDMA_MAX_PROGRAM)
+    {
+        uint8_t bytes[6];
+        Instr instr;
+        int length = DecodeInstr(pc + offset, bytes, instr);
+        instr.offset = offset;
+
+        program->instrs.push_back(instr);
+        lpend_jumps.push_back(instr.op == OP_LPEND ? bytes[1] : 0);
+
+        if (!length)
         {
-            printf("DMAEND\n");
-            chan.chan_status.status = STOPPED;
+            // Keep the opcode so revalidation still sees the same bytes
+            program->raw.push_back(bytes[0]);
             break;
         }
-        case 0x35:
-        {
-            uint8_t peripheral = read8_func(chan.pc++);
-            printf("DMAFLUSHP %d\n", peripheral);
+
+        program->raw.insert(program->raw.end(), bytes, bytes + length);
+        offset += length;
+
+        if (instr.op == OP_END || instr.op == OP_KILL)
             break;
+    }
+
+    if (offset >= CDMA_MAX_PROGRAM)
+    {
+        printf("[CDMA]: Program at 0x%08x has no DMAEND\n", pc);
+        Instr instr = {};
+        instr.op = OP_UNDEFINED;
+        instr.offset = offset;
+        program->instrs.push_back(instr);
+        lpend_jumps.push_back(0);
+    }
+
+    // Resolve the backwards jumps of DMALPEND into instruction indices
+    auto& instrs = program->instrs;
+    for (size_t i = 0; i < instrs.size(); i++)
+    {
+        if (instrs[i].op != OP_LPEND)
+            continue;
+
+        int target_offset = instrs[i].offset - lpend_jumps[i];
+        size_t target = 0;
+        while (target < i && instrs[target].offset < target_offset)
+            target++;
+
+        if (target_offset < 0 || target == i || instrs[target].offset != target_offset)
+        {
+            instrs[i].op = OP_UNDEFINED;
+            continue;
+        }
+        instrs[i].target = target;
+
+        // DMALD; DMAST; DMALPEND back to the DMALD is the usual memcpy loop
+        if (target + 2 == i && instrs[i].imm && instrs[i].cond == COND_ALWAYS
+            && instrs[target].op == OP_LD && instrs[target].cond == COND_ALWAYS
+            && instrs[target + 1].op == OP_ST && instrs[target + 1].cond == COND_ALWAYS)
+            instrs[target].bulk_loop = true;
+    }
+
+    return program;
+}
+
+template <typename BusAccess>
+std::shared_ptr<const typename CDMA<BusAccess>::Program> CDMA<BusAccess>::GetProgram(uint32_t pc)
+{
+    auto it = program_cache.find(pc);
+    if (it != program_cache.end())
+    {
+        // The guest may have written a new program to the same address, so
+        // compare the raw bytes before trusting the decoded copy
+        const auto& raw = it->second->raw;
+        const uint8_t* code = BusAccess::GetPtr(pc, raw.size(), false);
+
+        bool valid = true;
+        if (code)
+            valid = !memcmp(code, raw.data(), raw.size());
+        else
+        {
+            for (size_t i = 0; i < raw.size() && valid; i++)
+                valid = BusAccess::Read8(pc + i) == raw[i];
+        }
+
+        if (valid)
+            return it->second;
+    }
+
+    auto program = DecodeProgram(pc);
+    program_cache[pc] = program;
+    return program;
+}
+
+template <typename BusAccess>
+void CDMA<BusAccess>::Fault(Channel& chan, uint32_t type)
+{
+    printf("[CDMA]: Channel %d faulted (type %d) at 0x%08x\n", (int)(&chan - chans), type, chan.pc);
+
+    chan.fault_type |= 1 << type;
+    chan.chan_status.status = FAULTING;
+    BusAccess::RaiseIrq(CDMA_ABORT_EVENT);
+}
+
+template <typename BusAccess>
+void CDMA<BusAccess>::SignalEvent(int event)
+{
+    if (inten & (1 << event))
+    {
+        int_event_ris |= 1 << event;
+        BusAccess::RaiseIrq(event);
+        return;
+    }
+
+    bool woke = false;
+    for (int i = 0; i < 8; i++)
+    {
+        auto& chan = chans[i];
+        if (chan.chan_status.status == WAITING_FOR_EVENT && chan.chan_status.wakeup_number == event)
+        {
+            chan.chan_status.status = EXECUTING;
+            woke = true;
+        }
+    }
+
+    if (!woke)
+        pending_events |= 1 << event;
+}
+
+template <typename BusAccess>
+bool CDMA<BusAccess>::CondPasses(const Channel& chan, Cond cond)
+{
+    switch (cond)
+    {
+    case COND_SINGLE:
+        return !chan.burst_request;
+    case COND_BURST:
+        return chan.burst_request;
+    default:
+        return true;
+    }
+}
+
+template <typename BusAccess>
+static void read_beat(uint32_t addr, uint32_t size, uint8_t* out)
+{
+    if (size >= 4)
+    {
+        for (uint32_t i = 0; i < size; i += 4)
+        {
+            uint32_t value = BusAccess::Read32(addr + i);
+            memcpy(out + i, &value, 4);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < size; i++)
+            out[i] = BusAccess::Read8(addr + i);
+    }
+}
+
+template <typename BusAccess>
+static void write_beat(uint32_t addr, uint32_t size, const uint8_t* in)
+{
+    if (size >= 4)
+    {
+        for (uint32_t i = 0; i < size; i += 4)
+        {
+            uint32_t value;
+            memcpy(&value, in + i, 4);
+            BusAccess::Write32(addr + i, value);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < size; i++)
+            BusAccess::Write8(addr + i, in[i]);
+    }
+}
+
+template <typename BusAccess>
+void CDMA<BusAccess>::Load(Channel& chan, uint32_t beats)
+{
+    uint32_t size = src_size(chan.ccr);
+    uint32_t bytes = beats * size;
+
+    if (chan.mfifo_size + bytes > MFIFO_SIZE)
+    {
+        Fault(chan, FAULT_MFIFO_ERR);
+        return;
+    }
+
+    if (chan.mfifo_head + chan.mfifo_size + bytes > MFIFO_SIZE)
+    {
+        memmove(chan.mfifo, chan.mfifo + chan.mfifo_head, chan.mfifo_size);
+        chan.mfifo_head = 0;
+    }
+
+    uint8_t* dest = chan.mfifo + chan.mfifo_head + chan.mfifo_size;
+
+    if (src_inc(chan.ccr))
+    {
+        if (uint8_t* src = BusAccess::GetPtr(chan.sar, bytes, false))
+            memcpy(dest, src, bytes);
+        else
+        {
+            for (uint32_t i = 0; i < beats; i++)
+                read_beat<BusAccess>(chan.sar + i * size, size, dest + i * size);
         }
-        default:
-            printf("Unknown CDMA opcode 0x%02x\n", opcode);
-            exit(1);
+        chan.sar += bytes;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < beats; i++)
+            read_beat<BusAccess>(chan.sar, size, dest + i * size);
+    }
+
+    chan.mfifo_size += bytes;
+}
+
+template <typename BusAccess>
+void CDMA<BusAccess>::Store(Channel& chan, uint32_t beats, bool zero)
+{
+    static const uint8_t zeroes[16 * 128] = {};
+
+    uint32_t size = dst_size(chan.ccr);
+    uint32_t bytes = beats * size;
+    const uint8_t* src = zeroes;
+
+    if (!zero)
+    {
+        if (chan.mfifo_size < bytes)
+        {
+            Fault(chan, FAULT_ST_DATA_UNAVAILABLE);
+            return;
+        }
+
+        uint8_t* data = chan.mfifo + chan.mfifo_head;
+        uint32_t swap = 1 << endian_swap(chan.ccr);
+        if (swap > 1)
+        {
+            for (uint32_t i = 0; i + swap <= bytes; i += swap)
+                std::reverse(data + i, data + i + swap);
+        }
+        src = data;
+    }
+
+    bytes_moved += bytes;
+
+    if (dst_inc(chan.ccr))
+    {
+        if (uint8_t* dest = BusAccess::GetPtr(chan.dar, bytes, true))
+        {
+            memcpy(dest, src, bytes);
+            bytes_direct += bytes;
+        }
+        else
+        {
+            for (uint32_t i = 0; i < beats; i++)
+                write_beat<BusAccess>(chan.dar + i * size, size, src + i * size);
+        }
+        chan.dar += bytes;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < beats; i++)
+            write_beat<BusAccess>(chan.dar, size, src + i * size);
+    }
+
+    if (!zero)
+    {
+        chan.mfifo_head += bytes;
+        chan.mfifo_size -= bytes;
+        if (!chan.mfifo_size)
+            chan.mfifo_head = 0;
+    }
+}
+
+// Runs every remaining iteration of a DMALD/DMAST/DMALPEND loop as a single
+// host copy. Only taken when nothing is buffered and both sides are plain,
+// incrementing memory with matching burst sizes, so the result is the same
+// as running the loop.
+template <typename BusAccess>
+bool CDMA<BusAccess>::BulkLoop(Channel& chan, const Instr& ld)
+{
+    if (!ld.bulk_loop || chan.mfifo_size || endian_swap(chan.ccr))
+        return false;
+    if (!src_inc(chan.ccr) || !dst_inc(chan.ccr))
+        return false;
+
+    uint32_t bytes = src_len(chan.ccr) * src_size(chan.ccr);
+    if (bytes != dst_len(chan.ccr) * dst_size(chan.ccr))
+        return false;
+
+    const Instr& lpend = chan.program->instrs[chan.index + 2];
+    uint64_t total = (uint64_t)(chan.lc[lpend.arg] + 1) * bytes;
+    if (total > 0xFFFFFFFF)
+        return false;
+
+    uint8_t* src = BusAccess::GetPtr(chan.sar, total, false);
+    uint8_t* dest = BusAccess::GetPtr(chan.dar, total, true);
+    if (!src || !dest)
+        return false;
+
+    // Burst by burst, a destination just above the source would pick up
+    // data stored by earlier iterations, which memmove doesn't reproduce
+    if (dest > src && dest < src + total)
+        return false;
+
+    memmove(dest, src, total);
+    bytes_moved += total;
+    bytes_direct += total;
+    chan.sar += total;
+    chan.dar += total;
+    chan.lc[lpend.arg] = 0;
+
+    // Continue at the DMALPEND, which falls through with the counter at 0
+    chan.index += 2;
+    return true;
+}
+
+template <typename BusAccess>
+void CDMA<BusAccess>::ExecChannel(Channel &chan)
+{
+    for (int budget = CDMA_INSTR_BUDGET; budget && chan.chan_status.status == EXECUTING; budget--)
+    {
+        const Instr& instr = chan.program->instrs[chan.index];
+        instrs_run++;
+        chan.pc = chan.program->base + instr.offset;
+
+        switch (instr.op)
+        {
+        case OP_END:
+        case OP_KILL:
+            chan.chan_status.status = STOPPED;
+            break;
+        case OP_NOP:
+        case OP_FLUSHP:
+            break;
+        case OP_MOV:
+            if (instr.arg == REG_SAR)
+                chan.sar = instr.imm;
+            else if (instr.arg == REG_CCR)
+                chan.ccr = instr.imm;
+            else
+                chan.dar = instr.imm;
+            break;
+        case OP_ADDH:
+            if (instr.arg == REG_SAR)
+                chan.sar += instr.imm;
+            else
+                chan.dar += instr.imm;
+            break;
+        case OP_LD:
+            if (!CondPasses(chan, instr.cond))
+                break;
+            if (BulkLoop(chan, instr))
+                continue;
+            Load(chan, instr.cond == COND_SINGLE ? 1 : src_len(chan.ccr));
+            break;
+        case OP_ST:
+            if (CondPasses(chan, instr.cond))
+                Store(chan, instr.cond == COND_SINGLE ? 1 : dst_len(chan.ccr), false);
+            break;
+        case OP_STZ:
+            Store(chan, dst_len(chan.ccr), true);
+            break;
+        case OP_LP:
+            chan.lc[instr.arg] = instr.imm;
+            break;
+        case OP_LPEND:
+            if (!CondPasses(chan, instr.cond))
+                break;
+            if (instr.imm)
+            {
+                if (chan.lc[instr.arg])
+                {
+                    chan.lc[instr.arg]--;
+                    chan.index = instr.target;
+                    continue;
+                }
+            }
+            else if (!chan.last_request)
+            {
+                chan.index = instr.target;
+                continue;
+            }
+            break;
+        case OP_WFP:
+            chan.burst_request = instr.arg != 0;
+            chan.last_request = true;
+            break;
+        case OP_SEV:
+            SignalEvent(instr.arg);
+            break;
+        case OP_WFE:
+            if (pending_events & (1 << instr.arg))
+            {
+                pending_events &= ~(1 << instr.arg);
+                break;
+            }
+            chan.chan_status.wakeup_number = instr.arg;
+            chan.chan_status.status = WAITING_FOR_EVENT;
+            // Resume after the DMAWFE once the event comes in
+            chan.index++;
+            continue;
+        case OP_UNDEFINED:
+            Fault(chan, FAULT_UNDEF_INSTR);
+            continue;
         }
+
+        if (chan.chan_status.status == EXECUTING || chan.chan_status.status == STOPPED)
+            chan.index++;
     }
 }
 
-CDMA::CDMA(write_func_t write, read_func_t read, read8_func_t read8)
+template <typename BusAccess>
+CDMA<BusAccess>::CDMA()
 {
-    write32_func = write;
-    read32_func = read;
-    read8_func = read8;
-    
-    memset(chans, 0, sizeof(chans));
+    for (int i = 0; i < 8; i++)
+    {
+        chans[i].chan_status.value = 0;
+        chans[i].pc = 0;
+        chans[i].sar = chans[i].dar = chans[i].ccr = 0;
+        chans[i].lc[0] = chans[i].lc[1] = 0;
+        chans[i].fault_type = 0;
+        chans[i].index = 0;
+        chans[i].burst_request = false;
+        chans[i].last_request = false;
+        chans[i].mfifo_head = chans[i].mfifo_size = 0;
+    }
+
+    inten = 0;
+    int_event_ris = 0;
+    pending_events = 0;
 }
 
 enum Opcodes
 {
     DMAKILL = 1,
-    DMAGO = 0xA2,
+    DMASEV = 0x34,
+    DMAGO = 0xA0,
+    DMAGO_NS = 0xA2,
 };
 
-void CDMA::run()
+template <typename BusAccess>
+void CDMA<BusAccess>::run()
 {
+    bool channel_thread = instr0 & 1;
     uint8_t chan = (instr0 >> 8) & 0x7;
     uint8_t instr = (instr0 >> 16) & 0xFF;
+    uint8_t operand = (instr0 >> 24) & 0xFF;
 
     switch (instr)
     {
     case DMAKILL:
+        if (!channel_thread)
+            break;
         chans[chan].chan_status.status = STOPPED;
+        chans[chan].fault_type = 0;
         printf("[DBG_CDMA]: Killing channel %d\n", chan);
         break;
+    case DMASEV:
+        SignalEvent(operand >> 3);
+        break;
     case DMAGO:
-        chans[chan].pc = instr1;
-        chans[chan].chan_status.status = EXECUTING;
+    case DMAGO_NS:
+    {
+        auto& target = chans[operand & 0x7];
+        if (target.chan_status.status != STOPPED)
+        {
+            printf("[DBG_CDMA]: DMAGO on busy channel %d\n", operand & 0x7);
+            break;
+        }
+
+        if (first_go == std::chrono::steady_clock::time_point())
+            first_go = std::chrono::steady_clock::now();
+
+        target.pc = instr1;
+        target.program = GetProgram(instr1);
+        target.index = 0;
+        target.mfifo_head = target.mfifo_size = 0;
+        target.burst_request = true;
+        target.last_request = false;
+        target.chan_status.non_secure = instr == DMAGO_NS;
+        target.chan_status.status = EXECUTING;
         printf("[DBG_CDMA]: DMAGO at address 0x%08x\n", instr1);
         break;
+    }
     default:
         printf("[DBG_CDMA]: Unknown instr 0x%02x\n", instr);
         exit(1);
     }
 }
 
-void CDMA::Tick()
+template <typename BusAccess>
+bool CDMA<BusAccess>::Tick()
 {
+    bool active = false;
     for (int i = 0; i < 8; i++)
     {
         if (chans[i].chan_status.status == EXECUTING)
         {
             ExecChannel(chans[i]);
+            active = true;
         }
     }
+
+    active_ticks += active;
+    return active;
 }
 
-uint32_t CDMA::Read32(uint32_t addr)
+template <typename BusAccess>
+uint32_t CDMA<BusAccess>::Read32(uint32_t addr)
 {
-    int chan = (addr >> 4) & 0x7;
+    addr &= 0xFFF;
 
-    switch (addr & 0xFFF)
+    if (addr >= 0x400 && addr < 0x500)
+    {
+        auto& chan = chans[(addr >> 5) & 0x7];
+        switch (addr & 0x1F)
+        {
+        case 0x00:
+            return chan.sar;
+        case 0x04:
+            return chan.dar;
+        case 0x08:
+            return chan.ccr;
+        case 0x0C:
+            return chan.lc[0];
+        case 0x10:
+            return chan.lc[1];
+        }
+    }
+
+    switch (addr)
     {
+    case 0x000:
+    case 0x004:
+    case 0x030:
+    case 0x038:
+        return 0;
     case 0x02C:
         return 0;
     case 0x020:
         return inten;
-    case 0x100:
-        return chans[chan].chan_status.value;
+    case 0x024:
+        return int_event_ris;
+    case 0x028:
+        return int_event_ris & inten;
+    case 0x034:
+    {
+        uint32_t faulting = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            if (chans[i].chan_status.status == FAULTING)
+                faulting |= 1 << i;
+        }
+        return faulting;
+    }
+    case 0x040 ... 0x05C:
+        return chans[(addr - 0x40) / 4].fault_type;
+    case 0x100 ... 0x13C:
+    {
+        auto& chan = chans[(addr >> 3) & 0x7];
+        return (addr & 4) ? chan.pc : chan.chan_status.value;
+    }
     case 0xD00:
         return running;
+    case 0xE00:
+        // CR0: peripheral requests supported, 8 channels, the number of
+        // peripheral request lines, 32 events. The counts are stored minus one.
+        return 1 | (7 << 4) | ((PERIPH_REQUESTS - 1) << 12) | (31 << 17);
     default:
         printf("Read from unknown addr 0x%08x\n", addr);
         exit(1);
     }
 }
 
-void CDMA::Write32(uint32_t addr, uint32_t data)
+template <typename BusAccess>
+void CDMA<BusAccess>::Write32(uint32_t addr, uint32_t data)
 {
-    int chan = (addr >> 4) & 0x7;
-
     switch (addr & 0xFFF)
     {
     case 0x02C:
+        int_event_ris &= ~data;
         break;
     case 0x020:
         inten = data;
@@ -124,3 +782,19 @@ void CDMA::Write32(uint32_t addr, uint32_t data)
         exit(1);
     }
 }
+
+template <typename BusAccess>
+void CDMA<BusAccess>::Dump(const char* name)
+{
+    if (!instrs_run)
+        return;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - first_go).count();
+    printf("[CDMA]: %s moved %lu KB (%.1f%% host copies), %lu instructions over %lu active ticks, "
+        "%.1f MB/s over %.3fs since the first DMAGO\n",
+        name, bytes_moved / 1024, bytes_moved ? bytes_direct * 100.0 / bytes_moved : 0.0,
+        instrs_run, active_ticks, seconds > 0 ? bytes_moved / seconds / (1024 * 1024) : 0.0, seconds);
+}
+
+template class CDMA<Bus::ARM11Access>;
+template class CDMA<Bus::ARM9Access>;
@@ -1,36 +1,108 @@
 #pragma once
 
-#include <functional>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include <stdint-gcc.h>
 
-typedef std::function<void(uint32_t, uint32_t)> write_func_t;
-typedef std::function<uint32_t(uint32_t)> read_func_t;
-typedef std::function<uint8_t(uint32_t)> read8_func_t;
+// Passed to the bus' RaiseIrq when a channel faults
+constexpr int CDMA_ABORT_EVENT = -1;
 
+// BusAccess is one of the accessor structs in Bus.h. It provides static
+// Read8/Read32/Write8/Write32, GetPtr (host pointer for a whole guest range,
+// or nullptr if it isn't plain memory) and RaiseIrq (event number, or
+// CDMA_ABORT_EVENT), so the transfer loops call straight into the bus.
+// Instantiated for both CPUs in cdma.cpp.
+template <typename BusAccess>
 class CDMA
 {
 private:
-    write_func_t write32_func;
-    read_func_t read32_func;
-    read8_func_t read8_func;
-
     enum ChannelStatus
     {
-        STOPPED,
-        EXECUTING,
-        CACHE_MISS,
-        UPDATING_PC,
-        WAITING_FOR_EVENT,
-        AT_BARRIER,
-        RESERVED0,
-        WAIT_FOR_PERIPHERAL,
-        KILLING,
-        COMPLETING,
-        RESERVED1,
-        FAULTING_COMPLETING,
-        FAULTING
+        STOPPED = 0,
+        EXECUTING = 1,
+        CACHE_MISS = 2,
+        UPDATING_PC = 3,
+        WAITING_FOR_EVENT = 4,
+        AT_BARRIER = 5,
+        WAIT_FOR_PERIPHERAL = 7,
+        KILLING = 8,
+        COMPLETING = 9,
+        FAULTING_COMPLETING = 14,
+        FAULTING = 15
+    };
+
+    // Internal form of the PL330 instruction set. Variants that only
+    // differ in their encoding (DMALD/DMALDP, DMANOP/DMARMB/DMAWMB...)
+    // share an op, conditional variants carry their condition instead.
+    enum Op : uint8_t
+    {
+        OP_END,
+        OP_KILL,
+        OP_NOP,
+        OP_MOV,
+        OP_ADDH,
+        OP_LD,
+        OP_ST,
+        OP_STZ,
+        OP_LP,
+        OP_LPEND,
+        OP_WFP,
+        OP_FLUSHP,
+        OP_SEV,
+        OP_WFE,
+        OP_UNDEFINED
+    };
+
+    enum Cond : uint8_t
+    {
+        COND_ALWAYS,
+        COND_SINGLE,
+        COND_BURST
+    };
+
+    enum MovReg : uint8_t
+    {
+        REG_SAR = 0,
+        REG_CCR = 1,
+        REG_DAR = 2
+    };
+
+    struct Instr
+    {
+        Op op;
+        Cond cond;
+        // Register (MOV/ADDH), loop counter (LP/LPEND), event, peripheral
+        // or request type (WFP), depending on the op
+        uint8_t arg;
+        // Set on a DMALD that starts a LD/ST/LPEND loop which can be run as
+        // one host copy
+        bool bulk_loop;
+        // Byte offset from the start of the program, for CPC
+        uint16_t offset;
+        // Index of the loop start for LPEND
+        uint16_t target;
+        uint32_t imm;
+    };
+
+    struct Program
+    {
+        uint32_t base;
+        std::vector<uint8_t> raw;
+        std::vector<Instr> instrs;
     };
 
+    // Decoded programs keyed by their start address. Channels hold their own
+    // reference, so a program rewritten by the guest can be redecoded while
+    // another channel is still running the old copy.
+    std::unordered_map<uint32_t, std::shared_ptr<const Program>> program_cache;
+
+    static constexpr int MFIFO_SIZE = 1024;
+
+    // Peripheral request lines wired to the controller, 0x00-0x11
+    static constexpr int PERIPH_REQUESTS = 18;
+
     struct Channel
     {
         union
@@ -38,7 +110,7 @@ private:
             uint32_t value;
             struct
             {
-                uint32_t status : 3;
+                uint32_t status : 4;
                 uint32_t wakeup_number : 5;
                 uint32_t : 5;
                 uint32_t dmawfp_burst : 1;
@@ -50,20 +122,60 @@ private:
         } chan_status;
 
         uint32_t pc;
+
+        uint32_t sar, dar, ccr;
+        uint32_t lc[2];
+        uint32_t fault_type;
+
+        std::shared_ptr<const Program> program;
+        size_t index;
+
+        // Request type set by DMAWFP, used by the conditional variants
+        bool burst_request;
+        bool last_request;
+
+        uint8_t mfifo[MFIFO_SIZE];
+        uint32_t mfifo_head, mfifo_size;
     } chans[8]; // Channels 0-7
 
     uint32_t inten;
+    uint32_t int_event_ris;
+    uint32_t pending_events;
 
     uint32_t instr0, instr1;
     bool running = false;
 
+    // Throughput stats, reported at exit. Direct bytes were copied between
+    // host pointers instead of going through the bus a beat at a time. The
+    // clock is only read on the first DMAGO and at exit, Tick just counts.
+    uint64_t bytes_moved = 0;
+    uint64_t bytes_direct = 0;
+    uint64_t instrs_run = 0;
+    uint64_t active_ticks = 0;
+    std::chrono::steady_clock::time_point first_go;
+
+    std::shared_ptr<const Program> GetProgram(uint32_t pc);
+    std::shared_ptr<const Program> DecodeProgram(uint32_t pc);
+    int DecodeInstr(uint32_t addr, uint8_t* bytes, Instr& instr);
+
+    void Fault(Channel& chan, uint32_t type);
+    void SignalEvent(int event);
+
+    bool CondPasses(const Channel& chan, Cond cond);
+    void Load(Channel& chan, uint32_t beats);
+    void Store(Channel& chan, uint32_t beats, bool zero);
+    bool BulkLoop(Channel& chan, const Instr& ld);
+
     void ExecChannel(Channel& chan);
 public:
-    CDMA(write_func_t write, read_func_t read, read8_func_t read8);
+    CDMA();
 
     void run();
-    void Tick();
+    // Returns whether any channel is executing
+    bool Tick();
 
     uint32_t Read32(uint32_t addr);
     void Write32(uint32_t addr, uint32_t data);
-};
\ No newline at end of file
+
+    void Dump(const char* name);
+};
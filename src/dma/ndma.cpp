@@ -3,7 +3,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <cassert>
+#include <string.h>
+#include <algorithm>
 #include <memory/Bus.h>
+#include <scheduler/scheduler.h>
+#include <crypto/aes.h>
+#include <crypto/sha.h>
+#include <storage/emmc.h>
 
 struct NdmaChannel
 {
@@ -28,17 +34,36 @@ struct NdmaChannel
     } ctrl = {0};
     uint32_t source_addr = 0, dest_addr = 0;
     uint32_t transfer_count = 0, write_count = 0;
+    uint32_t block_timing;
     uint32_t fill_data;
     uint32_t int_source, int_dest;
+
+    // Words left before a non-repeating peripheral transfer completes
+    uint32_t remaining;
+    // Words already moved in the current logical block
+    uint32_t block_pos;
+    // Bumped on every start so stale completion events are ignored
+    uint32_t generation;
 } ndma_channels[8];
 
+uint32_t ndma_gcnt = 0;
+
+// Immediate transfers are copied when their completion event fires, so the
+// ARM9 keeps running in the meantime like it would on hardware
+constexpr uint32_t NDMA_WORDS_PER_CYCLE = 4;
+
+// Startup requests raised while a block is already being transferred (a
+// block feeding the AES input FIFO can make output ready, for instance)
+uint32_t pending_requests = 0;
+bool servicing_requests = false;
+
 uint32_t NDMA::Read32(uint32_t addr)
 {
     addr &= 0xFF;
 
     if (addr == 0x00)
     {
-        return 0;
+        return ndma_gcnt;
     }
     else if (addr >= 4)
     {
@@ -52,6 +77,16 @@ uint32_t NDMA::Read32(uint32_t addr)
         {
         case 0x00:
             return ndma_channels[chan].source_addr;
+        case 0x04:
+            return ndma_channels[chan].dest_addr;
+        case 0x08:
+            return ndma_channels[chan].transfer_count;
+        case 0x0C:
+            return ndma_channels[chan].write_count;
+        case 0x10:
+            return ndma_channels[chan].block_timing;
+        case 0x14:
+            return ndma_channels[chan].fill_data;
         case 0x18:
             printf("[NDMA]: Reading DMACNT from channel %d\n", chan);
             return ndma_channels[chan].ctrl.value;
@@ -63,10 +98,136 @@ uint32_t NDMA::Read32(uint32_t addr)
     return 0;
 }
 
-void RunNDMA(int chan_num)
+// Lowest address and length in bytes touched by a block of 'words' words
+// starting at 'addr' and moving by 'step' bytes per word
+static void get_span(uint32_t addr, uint32_t words, int step, uint32_t& start, uint32_t& len)
+{
+    if (step == 0)
+    {
+        start = addr;
+        len = 4;
+    }
+    else
+    {
+        len = words * 4;
+        start = (step > 0) ? addr : addr - (len - 4);
+    }
+}
+
+static bool host_overlap(uint8_t* a, uint32_t a_len, uint8_t* b, uint32_t b_len)
+{
+    return a < b + b_len && b < a + a_len;
+}
+
+// Word by word through the bus, needed whenever either side is MMIO
+void CopyBlockSlow(uint32_t src, uint32_t dest, uint32_t words, int src_step, int dest_step)
+{
+    for (uint32_t i = 0; i < words; i++)
+    {
+        uint32_t word = Bus::ARM9::Read32(src + (i * src_step));
+        Bus::ARM9::Write32(dest + (i * dest_step), word);
+    }
+}
+
+// RAM to RAM blocks resolved to host pointers. The result always matches
+// the word by word loop, including for overlapping ranges.
+bool CopyBlockFast(uint32_t src, uint32_t dest, uint32_t words, int src_step, int dest_step)
+{
+    if (!words || words > 0x40000000)
+        return false;
+
+    uint32_t src_start, src_len, dest_start, dest_len;
+    get_span(src, words, src_step, src_start, src_len);
+    get_span(dest, words, dest_step, dest_start, dest_len);
+
+    // Spans that wrap around the address space go through the bus
+    if (src_start > src || dest_start > dest)
+        return false;
+
+    uint8_t* src_ptr = Bus::ARM9::GetPtr(src_start, src_len, false);
+    uint8_t* dest_ptr = Bus::ARM9::GetPtr(dest_start, dest_len, true);
+    if (!src_ptr || !dest_ptr)
+        return false;
+
+    bool overlap = host_overlap(src_ptr, src_len, dest_ptr, dest_len);
+
+    if (src_step == 0)
+    {
+        uint32_t value;
+        memcpy(&value, src_ptr, 4);
+
+        if (dest_step == 0)
+            memcpy(dest_ptr, &value, 4);
+        else if (((uintptr_t)dest_ptr & 3) == 0)
+            std::fill_n((uint32_t*)dest_ptr, words, value);
+        else
+        {
+            for (uint32_t i = 0; i < words; i++)
+                memcpy(dest_ptr + i * 4, &value, 4);
+        }
+        return true;
+    }
+
+    // Increasing copies behave like memmove unless the destination runs
+    // ahead of the source, decreasing ones unless it trails behind
+    bool same_direction = src_step == dest_step;
+    if (same_direction && (!overlap || (src_step > 0 ? dest_ptr <= src_ptr : dest_ptr >= src_ptr)))
+    {
+        memmove(dest_ptr, src_ptr, src_len);
+        return true;
+    }
+
+    if (dest_step == 0 && !overlap)
+    {
+        uint8_t* last = (src_step > 0) ? src_ptr + src_len - 4 : src_ptr;
+        memcpy(dest_ptr, last, 4);
+        return true;
+    }
+
+    // Anything else still runs the exact loop, just without the bus decode
+    uint8_t* src_first = (src_step > 0) ? src_ptr : src_ptr + src_len - 4;
+    uint8_t* dest_first = (dest_step > 0) ? dest_ptr : dest_ptr + dest_len - 4;
+    for (uint32_t i = 0; i < words; i++)
+    {
+        uint32_t word;
+        memcpy(&word, src_first + (ptrdiff_t)i * src_step, 4);
+        memcpy(dest_first + (ptrdiff_t)i * dest_step, &word, 4);
+    }
+    return true;
+}
+
+void FillBlock(uint32_t dest, uint32_t words, int dest_step, uint32_t value)
+{
+    uint32_t dest_start, dest_len;
+    get_span(dest, words, dest_step, dest_start, dest_len);
+
+    uint8_t* dest_ptr = nullptr;
+    if (words && words <= 0x40000000 && dest_start <= dest)
+        dest_ptr = Bus::ARM9::GetPtr(dest_start, dest_len, true);
+
+    if (!dest_ptr)
+    {
+        for (uint32_t i = 0; i < words; i++)
+            Bus::ARM9::Write32(dest + (i * dest_step), value);
+    }
+    else if (dest_step == 0)
+        memcpy(dest_ptr, &value, 4);
+    else if (((uintptr_t)dest_ptr & 3) == 0)
+        std::fill_n((uint32_t*)dest_ptr, words, value);
+    else
+    {
+        for (uint32_t i = 0; i < words; i++)
+            memcpy(dest_ptr + i * 4, &value, 4);
+    }
+}
+
+// Moves 'words' words of a channel. Addresses reload once the logical block
+// (write_count words) is done.
+void TransferWords(int chan_num, uint32_t words, bool end_of_block)
 {
     auto& chan = ndma_channels[chan_num];
     int dest_multiplier, src_multiplier;
+    bool fill = false;
 
     switch (chan.ctrl.dest_addr_update)
     {
@@ -74,7 +235,7 @@ void RunNDMA(int chan_num)
     case 1: dest_multiplier = -4; break;
     case 2: dest_multiplier = 0; break;
     default:
-        printf("[NDMA]: Unhandled destination update mode %d\n", chan.ctrl.dest_addr_reload);
+        printf("[NDMA]: Unhandled destination update mode %d\n", chan.ctrl.dest_addr_update);
         exit(1);
     }
 
@@ -83,36 +244,162 @@ void RunNDMA(int chan_num)
     case 0: src_multiplier = 4; break;
     case 1: src_multiplier = -4; break;
     case 2: src_multiplier = 0; break;
-    default:
-        printf("[NDMA]: Unhandled source update mode %d\n", chan.ctrl.dest_addr_reload);
-        exit(1);
+    case 3: src_multiplier = 0; fill = true; break;
     }
 
-    uint32_t block_size = chan.write_count;
+    if (fill)
+        FillBlock(chan.int_dest, words, dest_multiplier, chan.fill_data);
+    else if (!CopyBlockFast(chan.int_source, chan.int_dest, words, src_multiplier, dest_multiplier))
+        CopyBlockSlow(chan.int_source, chan.int_dest, words, src_multiplier, dest_multiplier);
 
-    for (int i = 0; i < block_size; i++)
-    {
-        uint32_t word = Bus::ARM9::Read32(chan.int_source + (i * src_multiplier));
-        Bus::ARM9::Write32(chan.int_dest + (i * dest_multiplier), word);
-    }
+    if (end_of_block && chan.ctrl.dest_addr_reload)
+        chan.int_dest = chan.dest_addr;
+    else
+        chan.int_dest += (words * dest_multiplier);
 
-    if (!chan.ctrl.dest_addr_reload)
-        chan.int_dest += (block_size * dest_multiplier);
+    if (end_of_block && chan.ctrl.source_addr_reload)
+        chan.int_source = chan.source_addr;
+    else
+        chan.int_source += (words * src_multiplier);
+}
 
-    if (!chan.ctrl.source_addr_reload)
-        chan.int_source += (block_size * src_multiplier);
+void CompleteNDMA(int chan_num)
+{
+    auto& chan = ndma_channels[chan_num];
 
     chan.ctrl.start = 0;
     if (chan.ctrl.ie)
         Bus::SetInterruptPending9(chan_num);
 }
 
+void FinishImmediate(int chan_num, uint32_t generation)
+{
+    auto& chan = ndma_channels[chan_num];
+    if (!chan.ctrl.start || chan.generation != generation)
+        return;
+
+    TransferWords(chan_num, chan.write_count, true);
+    CompleteNDMA(chan_num);
+}
+
+// Timers and the card slots only signal edges, the other peripherals hold
+// their request up for as long as they can take or give data
+static bool has_request_line(int mode)
+{
+    return mode == NDMA::STARTUP_SDMMC || (mode >= NDMA::STARTUP_AES_IN && mode <= NDMA::STARTUP_SHA_OUT);
+}
+
+static bool request_raised(int mode)
+{
+    switch (mode)
+    {
+    case NDMA::STARTUP_SDMMC:
+        return eMMC::DataRequested();
+    case NDMA::STARTUP_AES_IN:
+        return AES::InputRequested();
+    case NDMA::STARTUP_AES_OUT:
+        return AES::OutputRequested();
+    case NDMA::STARTUP_SHA_IN:
+        return SHA::InputRequested();
+    case NDMA::STARTUP_SHA_OUT:
+        return SHA::OutputRequested();
+    default:
+        return false;
+    }
+}
+
+// Each request moves one physical block (2^phys_block_size words), and the
+// channel keeps going while the request stays up, but never past the end of
+// the logical block. Repeating channels never complete on their own.
+void RunPeripheralBlocks(int chan_num)
+{
+    auto& chan = ndma_channels[chan_num];
+    uint32_t physical = 1u << chan.ctrl.phys_block_size;
+
+    bool end_of_block;
+    do
+    {
+        uint32_t words = std::min(physical, chan.write_count - chan.block_pos);
+        if (!chan.ctrl.repeat_mode)
+            words = std::min(words, chan.remaining);
+        if (!words)
+            return;
+
+        chan.block_pos += words;
+        end_of_block = chan.block_pos == chan.write_count;
+        if (end_of_block)
+            chan.block_pos = 0;
+
+        TransferWords(chan_num, words, end_of_block);
+
+        if (!chan.ctrl.repeat_mode)
+        {
+            chan.remaining -= words;
+            if (!chan.remaining)
+            {
+                CompleteNDMA(chan_num);
+                return;
+            }
+        }
+    } while (!end_of_block && request_raised(chan.ctrl.startup_mode));
+}
+
+void NDMA::TriggerStartup(int mode)
+{
+    pending_requests |= 1 << mode;
+    if (servicing_requests)
+        return;
+
+    servicing_requests = true;
+    while (pending_requests)
+    {
+        uint32_t requests = pending_requests;
+        pending_requests = 0;
+
+        for (int i = 0; i < 8; i++)
+        {
+            auto& chan = ndma_channels[i];
+            int startup = chan.ctrl.startup_mode;
+            if (!chan.ctrl.start || startup >= STARTUP_IMMEDIATE || !(requests & (1 << startup)))
+                continue;
+
+            // Requests queued up while servicing may have been answered since
+            if (!has_request_line(startup) || request_raised(startup))
+                RunPeripheralBlocks(i);
+        }
+    }
+    servicing_requests = false;
+}
+
+void StartNDMA(int chan_num)
+{
+    auto& chan = ndma_channels[chan_num];
+
+    chan.int_dest = chan.dest_addr;
+    chan.int_source = chan.source_addr;
+    chan.remaining = chan.transfer_count;
+    chan.block_pos = 0;
+    chan.generation++;
+
+    if (chan.ctrl.startup_mode >= NDMA::STARTUP_IMMEDIATE)
+    {
+        uint32_t generation = chan.generation;
+        uint64_t cycles = std::max<uint64_t>(1, chan.write_count / NDMA_WORDS_PER_CYCLE);
+        Scheduler::ScheduleEvent(cycles, [chan_num, generation] { FinishImmediate(chan_num, generation); });
+    }
+    else if (request_raised(chan.ctrl.startup_mode))
+        NDMA::TriggerStartup(chan.ctrl.startup_mode);
+    else
+        printf("[NDMA]: Channel %d waiting on startup mode %d\n", chan_num, chan.ctrl.startup_mode);
+}
+
 void NDMA::Write32(uint32_t addr, uint32_t  data)
 {
     addr &= 0xFF;
 
     if (addr == 0x00)
     {
+        ndma_gcnt = data;
         return;
     }
     else if (addr >= 4)
@@ -142,6 +429,7 @@ void NDMA::Write32(uint32_t addr, uint32_t  data)
             ndma_channels[chan].write_count = data;
             break;
         case 0x10:
+            ndma_channels[chan].block_timing = data;
             break;
         case 0x14:
             printf("[NDMA]: Setting channel %d fill data to 0x%08x\n", chan, data);
@@ -155,12 +443,7 @@ void NDMA::Write32(uint32_t addr, uint32_t  data)
             ndma_channels[chan].ctrl.value = data;
 
             if (!old_busy && ndma_channels[chan].ctrl.start)
-            {
-                ndma_channels[chan].int_dest = ndma_channels[chan].dest_addr;
-                ndma_channels[chan].int_source = ndma_channels[chan].int_dest;
-                assert(ndma_channels[chan].ctrl.startup_mode >= 0x10);
-                RunNDMA(chan);
-            }
+                StartNDMA(chan);
 
             break;
         }
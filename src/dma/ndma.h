@@ -5,7 +5,28 @@
 namespace NDMA
 {
 
+enum StartupMode
+{
+    STARTUP_TIMER0 = 0,
+    STARTUP_TIMER1 = 1,
+    STARTUP_TIMER2 = 2,
+    STARTUP_TIMER3 = 3,
+    STARTUP_CTRCARD0 = 4,
+    STARTUP_CTRCARD1 = 5,
+    STARTUP_SDMMC = 6,
+    STARTUP_SDIO = 7,
+    STARTUP_AES_IN = 8,
+    STARTUP_AES_OUT = 9,
+    STARTUP_SHA_IN = 10,
+    STARTUP_SHA_OUT = 11,
+    STARTUP_IMMEDIATE = 0x10
+};
+
 uint32_t Read32(uint32_t addr);
 void Write32(uint32_t addr, uint32_t data);
 
+// Called by peripherals when they are ready for (or have) data, runs a block
+// on every started channel using that startup mode
+void TriggerStartup(int mode);
+
 }
\ No newline at end of file
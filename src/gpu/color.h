@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+
+struct Color
+{
+    uint8_t r, g, b, a;
+};
+
+// Pixel formats shared by color buffers and the display hardware
+enum ColorFormat
+{
+    COLOR_RGBA8,
+    COLOR_RGB8,
+    COLOR_RGB5A1,
+    COLOR_RGB565,
+    COLOR_RGBA4,
+};
+
+inline uint32_t ColorFormatBpp(uint32_t format)
+{
+    switch (format)
+    {
+    case COLOR_RGBA8: return 4;
+    case COLOR_RGB8: return 3;
+    default: return 2;
+    }
+}
+
+inline uint8_t expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+inline uint8_t expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+inline uint8_t expand4(uint32_t v) { return v * 17; }
+
+// Pixels are stored as little-endian words with red in the top bits
+inline Color DecodeColor(uint32_t format, const uint8_t* src)
+{
+    uint16_t v = src[0] | (src[1] << 8);
+    switch (format)
+    {
+    case COLOR_RGBA8:
+        return {src[3], src[2], src[1], src[0]};
+    case COLOR_RGB8:
+        return {src[2], src[1], src[0], 255};
+    case COLOR_RGB5A1:
+        return {expand5(v >> 11), expand5((v >> 6) & 0x1F), expand5((v >> 1) & 0x1F), (uint8_t)((v & 1) * 255)};
+    case COLOR_RGB565:
+        return {expand5(v >> 11), expand6((v >> 5) & 0x3F), expand5(v & 0x1F), 255};
+    default:
+        return {expand4(v >> 12), expand4((v >> 8) & 0xF), expand4((v >> 4) & 0xF), expand4(v & 0xF)};
+    }
+}
+
+inline void EncodeColor(uint32_t format, Color c, uint8_t* dst)
+{
+    uint16_t v;
+    switch (format)
+    {
+    case COLOR_RGBA8:
+        dst[0] = c.a;
+        dst[1] = c.b;
+        dst[2] = c.g;
+        dst[3] = c.r;
+        return;
+    case COLOR_RGB8:
+        dst[0] = c.b;
+        dst[1] = c.g;
+        dst[2] = c.r;
+        return;
+    case COLOR_RGB5A1:
+        v = ((c.r >> 3) << 11) | ((c.g >> 3) << 6) | ((c.b >> 3) << 1) | (c.a >> 7);
+        break;
+    case COLOR_RGB565:
+        v = ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+        break;
+    default:
+        v = ((c.r >> 4) << 12) | ((c.g >> 4) << 8) | ((c.b >> 4) << 4) | (c.a >> 4);
+        break;
+    }
+    dst[0] = v & 0xFF;
+    dst[1] = v >> 8;
+}
@@ -0,0 +1,629 @@
+#include "combiner.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <gpu/pica_regs.h>
+
+// First register of each stage: source, operand, combiner, constant color
+// and scale follow it
+const static uint32_t stage_regs[TEV_STAGES] = {0x0C0, 0x0C8, 0x0D0, 0x0D8, 0x0F0, 0x0F8};
+
+struct TexUnitRegs
+{
+    uint32_t border, dim, param, addr, type;
+};
+
+const static TexUnitRegs texunit_regs[TEXTURE_UNITS] =
+{
+    {PICA_REG_TEXUNIT0_BORDER_COLOR, PICA_REG_TEXUNIT0_DIM, PICA_REG_TEXUNIT0_PARAM, PICA_REG_TEXUNIT0_ADDR1, PICA_REG_TEXUNIT0_TYPE},
+    {PICA_REG_TEXUNIT1_BORDER_COLOR, PICA_REG_TEXUNIT1_DIM, PICA_REG_TEXUNIT1_PARAM, PICA_REG_TEXUNIT1_ADDR, PICA_REG_TEXUNIT1_TYPE},
+    {PICA_REG_TEXUNIT2_BORDER_COLOR, PICA_REG_TEXUNIT2_DIM, PICA_REG_TEXUNIT2_PARAM, PICA_REG_TEXUNIT2_ADDR, PICA_REG_TEXUNIT2_TYPE},
+};
+
+// Stage inputs. The generic shader keeps a quad's worth of each by number,
+// sources that aren't emulated all read the zeroed fragment lighting slot.
+enum TevSource
+{
+    TEV_SRC_PRIMARY = 0x0,
+    TEV_SRC_ZERO = 0x1,
+    TEV_SRC_TEXTURE0 = 0x3,
+    TEV_SRC_TEXTURE1 = 0x4,
+    TEV_SRC_TEXTURE2 = 0x5,
+    TEV_SRC_BUFFER = 0xD,
+    TEV_SRC_CONSTANT = 0xE,
+    TEV_SRC_PREVIOUS = 0xF,
+    TEV_SOURCE_COUNT,
+};
+
+enum TevOp
+{
+    TEV_REPLACE,
+    TEV_MODULATE,
+    TEV_ADD,
+    TEV_ADD_SIGNED,
+    TEV_LERP,
+    TEV_SUBTRACT,
+    TEV_DOT3_RGB,
+    TEV_DOT3_RGBA,
+    TEV_MULTIPLY_ADD,
+    TEV_ADD_MULTIPLY,
+    TEV_OP_COUNT,
+};
+
+const static int op_inputs[TEV_OP_COUNT] = {1, 2, 2, 2, 3, 2, 2, 2, 3, 3};
+
+enum TexWrap
+{
+    WRAP_CLAMP_TO_EDGE,
+    WRAP_CLAMP_TO_BORDER,
+    WRAP_REPEAT,
+    WRAP_MIRRORED_REPEAT,
+};
+
+// Operands are a quad's worth of one input: rgb as a Color with alpha
+// unused, or just the alpha
+typedef void (*RgbOperand)(const Color src[4], Color out[4]);
+typedef void (*AlphaOperand)(const Color src[4], uint8_t out[4]);
+typedef void (*RgbCombiner)(const Color in[3][4], Color out[4]);
+typedef void (*AlphaCombiner)(const uint8_t in[3][4], uint8_t out[4]);
+
+struct TevStage
+{
+    int index;
+    uint8_t rgb_op, alpha_op;
+    uint8_t rgb_src[3], alpha_src[3];
+    uint8_t rgb_mod[3], alpha_mod[3];
+    int rgb_inputs, alpha_inputs;
+
+    RgbOperand rgb_operand[3];
+    AlphaOperand alpha_operand[3];
+    RgbCombiner combine_rgb;
+    AlphaCombiner combine_alpha;
+    // Dot3_RGBA writes the dot product to alpha too, ignoring the alpha op
+    bool alpha_from_rgb;
+    uint32_t rgb_shift, alpha_shift;
+    // Bytes of the result that go to the combiner buffer
+    uint32_t buffer_mask;
+};
+
+struct TevProgram
+{
+    FragmentShader shader;
+    bool specialized;
+    // Stages that do nothing are left out, unless something reads the
+    // combiner buffer, which moves along with every stage
+    TevStage stages[TEV_STAGES];
+    int stage_count;
+    bool samples[TEXTURE_UNITS];
+};
+
+void TevProgramDeleter::operator()(TevProgram* program) const
+{
+    delete program;
+}
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint8_t to_u8(float v)
+{
+    return fminf(fmaxf(v, 0.0f), 1.0f) * 255.0f + 0.5f;
+}
+
+static inline Color unpack_color(uint32_t value)
+{
+    return {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+}
+
+static inline Color primary_color(const float attr[RASTER_ATTRIB_COUNT][4], int lane)
+{
+    return {to_u8(attr[RASTER_COLOR_R][lane]), to_u8(attr[RASTER_COLOR_G][lane]),
+        to_u8(attr[RASTER_COLOR_B][lane]), to_u8(attr[RASTER_COLOR_A][lane])};
+}
+
+// Texel coordinate along one axis, -1 for the border color
+static inline int wrap(float coord, int size, uint32_t mode)
+{
+    int x = floorf(fminf(fmaxf(coord * size, -16777216.0f), 16777216.0f));
+    if ((uint32_t)x < (uint32_t)size)
+        return x;
+
+    switch (mode)
+    {
+    case WRAP_CLAMP_TO_BORDER:
+        return -1;
+    case WRAP_REPEAT:
+        x %= size;
+        return x < 0 ? x + size : x;
+    case WRAP_MIRRORED_REPEAT:
+        x %= size * 2;
+        if (x < 0)
+            x += size * 2;
+        return x < size ? x : size * 2 - 1 - x;
+    default:
+        return std::clamp(x, 0, size - 1);
+    }
+}
+
+// Nearest texel
+static inline Color sample(const TevTexture& tex, const float attr[RASTER_ATTRIB_COUNT][4], int lane)
+{
+    int x = wrap(attr[tex.coord][lane], tex.width, tex.wrap_s);
+    int y = wrap(attr[tex.coord + 1][lane], tex.height, tex.wrap_t);
+    if (x < 0 || y < 0)
+        return tex.border;
+    return tex.texels[y * tex.width + x];
+}
+
+template <int Op>
+static inline uint8_t combine(int a, int b, int c)
+{
+    switch (Op)
+    {
+    case TEV_MODULATE: return a * b / 255;
+    case TEV_ADD: return std::min(a + b, 255);
+    case TEV_ADD_SIGNED: return std::clamp(a + b - 128, 0, 255);
+    case TEV_LERP: return (a * c + b * (255 - c)) / 255;
+    case TEV_SUBTRACT: return std::max(a - b, 0);
+    case TEV_MULTIPLY_ADD: return std::min(a * b / 255 + c, 255);
+    case TEV_ADD_MULTIPLY: return std::min(a + b, 255) * c / 255;
+    default: return a;
+    }
+}
+
+template <int Mod>
+static void rgb_operand(const Color src[4], Color out[4])
+{
+    for (int lane = 0; lane < 4; lane++)
+    {
+        Color c = src[lane];
+        switch (Mod)
+        {
+        case 0x1: out[lane] = {(uint8_t)(255 - c.r), (uint8_t)(255 - c.g), (uint8_t)(255 - c.b), 0}; break;
+        case 0x2: out[lane] = {c.a, c.a, c.a, 0}; break;
+        case 0x3: out[lane] = {(uint8_t)(255 - c.a), (uint8_t)(255 - c.a), (uint8_t)(255 - c.a), 0}; break;
+        case 0x4: out[lane] = {c.r, c.r, c.r, 0}; break;
+        case 0x5: out[lane] = {(uint8_t)(255 - c.r), (uint8_t)(255 - c.r), (uint8_t)(255 - c.r), 0}; break;
+        case 0x8: out[lane] = {c.g, c.g, c.g, 0}; break;
+        case 0x9: out[lane] = {(uint8_t)(255 - c.g), (uint8_t)(255 - c.g), (uint8_t)(255 - c.g), 0}; break;
+        case 0xC: out[lane] = {c.b, c.b, c.b, 0}; break;
+        case 0xD: out[lane] = {(uint8_t)(255 - c.b), (uint8_t)(255 - c.b), (uint8_t)(255 - c.b), 0}; break;
+        default: out[lane] = c; break;
+        }
+    }
+}
+
+template <int Mod>
+static void alpha_operand(const Color src[4], uint8_t out[4])
+{
+    for (int lane = 0; lane < 4; lane++)
+    {
+        Color c = src[lane];
+        switch (Mod)
+        {
+        case 0: out[lane] = c.a; break;
+        case 1: out[lane] = 255 - c.a; break;
+        case 2: out[lane] = c.r; break;
+        case 3: out[lane] = 255 - c.r; break;
+        case 4: out[lane] = c.g; break;
+        case 5: out[lane] = 255 - c.g; break;
+        case 6: out[lane] = c.b; break;
+        default: out[lane] = 255 - c.b; break;
+        }
+    }
+}
+
+template <int Op>
+static void combine_rgb(const Color in[3][4], Color out[4])
+{
+    for (int lane = 0; lane < 4; lane++)
+    {
+        const Color& a = in[0][lane];
+        const Color& b = in[1][lane];
+        const Color& c = in[2][lane];
+        if (Op == TEV_DOT3_RGB || Op == TEV_DOT3_RGBA)
+        {
+            // Inputs map to -1..1, the result is clamped back to 0..1
+            int dot = (a.r * 2 - 255) * (b.r * 2 - 255) + (a.g * 2 - 255) * (b.g * 2 - 255) + (a.b * 2 - 255) * (b.b * 2 - 255);
+            uint8_t v = std::clamp(dot / 255, 0, 255);
+            out[lane] = {v, v, v, 0};
+        }
+        else
+            out[lane] = {combine<Op>(a.r, b.r, c.r), combine<Op>(a.g, b.g, c.g), combine<Op>(a.b, b.b, c.b), 0};
+    }
+}
+
+template <int Op>
+static void combine_alpha(const uint8_t in[3][4], uint8_t out[4])
+{
+    for (int lane = 0; lane < 4; lane++)
+        out[lane] = combine<Op>(in[0][lane], in[1][lane], in[2][lane]);
+}
+
+template <size_t... I>
+static constexpr std::array<RgbOperand, sizeof...(I)> make_rgb_operands(std::index_sequence<I...>)
+{
+    return {&rgb_operand<I>...};
+}
+
+template <size_t... I>
+static constexpr std::array<AlphaOperand, sizeof...(I)> make_alpha_operands(std::index_sequence<I...>)
+{
+    return {&alpha_operand<I>...};
+}
+
+template <size_t... I>
+static constexpr std::array<RgbCombiner, sizeof...(I)> make_rgb_combiners(std::index_sequence<I...>)
+{
+    return {&combine_rgb<I>...};
+}
+
+template <size_t... I>
+static constexpr std::array<AlphaCombiner, sizeof...(I)> make_alpha_combiners(std::index_sequence<I...>)
+{
+    return {&combine_alpha<I>...};
+}
+
+const static auto rgb_operands = make_rgb_operands(std::make_index_sequence<16>());
+const static auto alpha_operands = make_alpha_operands(std::make_index_sequence<8>());
+const static auto rgb_combiners = make_rgb_combiners(std::make_index_sequence<TEV_OP_COUNT>());
+const static auto alpha_combiners = make_alpha_combiners(std::make_index_sequence<TEV_OP_COUNT>());
+
+// Runs the decoded stages over a quad
+static void shade_generic(const void* ctx, const float attr[RASTER_ATTRIB_COUNT][4], Color out[4])
+{
+    const TevContext& context = *(const TevContext*)ctx;
+    const TevProgram& program = *context.program;
+
+    Color values[TEV_SOURCE_COUNT][4];
+    for (int lane = 0; lane < 4; lane++)
+    {
+        values[TEV_SRC_PRIMARY][lane] = primary_color(attr, lane);
+        values[TEV_SRC_ZERO][lane] = {};
+        values[TEV_SRC_BUFFER][lane] = {};
+        values[TEV_SRC_PREVIOUS][lane] = {};
+    }
+    for (int unit = 0; unit < TEXTURE_UNITS; unit++)
+    {
+        if (!program.samples[unit])
+            continue;
+        for (int lane = 0; lane < 4; lane++)
+            values[TEV_SRC_TEXTURE0 + unit][lane] = sample(context.textures[unit], attr, lane);
+    }
+
+    // A stage reads the buffer as the stage two before it left it: the
+    // first stage reads zero, the second the buffer color
+    uint32_t next_buffer[4];
+    uint32_t buffer_color;
+    memcpy(&buffer_color, &context.buffer_color, 4);
+    std::fill(next_buffer, next_buffer + 4, buffer_color);
+
+    for (int s = 0; s < program.stage_count; s++)
+    {
+        const TevStage& stage = program.stages[s];
+        for (int lane = 0; lane < 4; lane++)
+            values[TEV_SRC_CONSTANT][lane] = context.constants[stage.index];
+
+        Color rgb_in[3][4];
+        uint8_t alpha_in[3][4];
+        for (int k = 0; k < stage.rgb_inputs; k++)
+            stage.rgb_operand[k](values[stage.rgb_src[k]], rgb_in[k]);
+        for (int k = 0; k < stage.alpha_inputs; k++)
+            stage.alpha_operand[k](values[stage.alpha_src[k]], alpha_in[k]);
+
+        Color result[4];
+        uint8_t alpha[4];
+        stage.combine_rgb(rgb_in, result);
+        if (stage.alpha_from_rgb)
+        {
+            for (int lane = 0; lane < 4; lane++)
+                alpha[lane] = result[lane].r;
+        }
+        else
+            stage.combine_alpha(alpha_in, alpha);
+
+        memcpy(values[TEV_SRC_BUFFER], next_buffer, sizeof(next_buffer));
+        for (int lane = 0; lane < 4; lane++)
+        {
+            Color& c = values[TEV_SRC_PREVIOUS][lane];
+            c.r = std::min(result[lane].r << stage.rgb_shift, 255);
+            c.g = std::min(result[lane].g << stage.rgb_shift, 255);
+            c.b = std::min(result[lane].b << stage.rgb_shift, 255);
+            c.a = std::min(alpha[lane] << stage.alpha_shift, 255);
+
+            uint32_t packed;
+            memcpy(&packed, &c, 4);
+            next_buffer[lane] = (next_buffer[lane] & ~stage.buffer_mask) | (packed & stage.buffer_mask);
+        }
+    }
+
+    memcpy(out, values[TEV_SRC_PREVIOUS], sizeof(Color) * 4);
+}
+
+// Inputs a single-stage shader can be instantiated for
+enum SingleSource
+{
+    ONE_PRIMARY,
+    ONE_TEXTURE0,
+    ONE_TEXTURE1,
+    ONE_TEXTURE2,
+    ONE_CONSTANT,
+    ONE_SOURCE_COUNT,
+};
+
+// Replace, Modulate and Add
+constexpr int SINGLE_OPS = 3;
+
+template <int Src>
+static inline Color fetch(const TevContext& context, const float attr[RASTER_ATTRIB_COUNT][4], int lane)
+{
+    if constexpr (Src == ONE_PRIMARY)
+        return primary_color(attr, lane);
+    else if constexpr (Src == ONE_CONSTANT)
+        return context.constants[context.program->stages[0].index];
+    else
+        return sample(context.textures[Src - ONE_TEXTURE0], attr, lane);
+}
+
+// One stage combining the same inputs for rgb and alpha, unmodified
+template <int Op, int Src0, int Src1>
+static void shade_single(const void* ctx, const float attr[RASTER_ATTRIB_COUNT][4], Color out[4])
+{
+    const TevContext& context = *(const TevContext*)ctx;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        Color a = fetch<Src0>(context, attr, lane);
+        if constexpr (Op == TEV_REPLACE)
+            out[lane] = a;
+        else
+        {
+            Color b = fetch<Src1>(context, attr, lane);
+            out[lane] = {combine<Op>(a.r, b.r, 0), combine<Op>(a.g, b.g, 0), combine<Op>(a.b, b.b, 0), combine<Op>(a.a, b.a, 0)};
+        }
+    }
+}
+
+template <size_t... I>
+static constexpr std::array<FragmentShader, sizeof...(I)> make_single_shaders(std::index_sequence<I...>)
+{
+    return {&shade_single<I / (ONE_SOURCE_COUNT * ONE_SOURCE_COUNT), (I / ONE_SOURCE_COUNT) % ONE_SOURCE_COUNT, I % ONE_SOURCE_COUNT>...};
+}
+
+const static auto single_shaders = make_single_shaders(std::make_index_sequence<SINGLE_OPS * ONE_SOURCE_COUNT * ONE_SOURCE_COUNT>());
+
+static int source_slot(uint32_t source)
+{
+    switch (source)
+    {
+    case TEV_SRC_PRIMARY:
+    case TEV_SRC_TEXTURE0:
+    case TEV_SRC_TEXTURE1:
+    case TEV_SRC_TEXTURE2:
+    case TEV_SRC_BUFFER:
+    case TEV_SRC_CONSTANT:
+    case TEV_SRC_PREVIOUS:
+        return source;
+    default:
+        return TEV_SRC_ZERO;
+    }
+}
+
+static int single_source(uint32_t slot)
+{
+    switch (slot)
+    {
+    case TEV_SRC_PRIMARY: return ONE_PRIMARY;
+    case TEV_SRC_TEXTURE0: return ONE_TEXTURE0;
+    case TEV_SRC_TEXTURE1: return ONE_TEXTURE1;
+    case TEV_SRC_TEXTURE2: return ONE_TEXTURE2;
+    case TEV_SRC_CONSTANT: return ONE_CONSTANT;
+    default: return -1;
+    }
+}
+
+static bool is_passthrough(const TevStage& stage)
+{
+    return stage.rgb_op == TEV_REPLACE && stage.alpha_op == TEV_REPLACE &&
+        stage.rgb_src[0] == TEV_SRC_PREVIOUS && stage.alpha_src[0] == TEV_SRC_PREVIOUS &&
+        stage.rgb_mod[0] == 0 && stage.alpha_mod[0] == 0 && !stage.rgb_shift && !stage.alpha_shift;
+}
+
+// A shader instantiated for the program, if there is one
+static FragmentShader specialize(const TevProgram& program)
+{
+    if (program.stage_count != 1)
+        return nullptr;
+
+    const TevStage& stage = program.stages[0];
+    if (stage.rgb_op != stage.alpha_op || stage.rgb_op >= SINGLE_OPS || stage.rgb_shift || stage.alpha_shift)
+        return nullptr;
+
+    int src[2] = {};
+    for (int k = 0; k < stage.rgb_inputs; k++)
+    {
+        if (stage.rgb_mod[k] || stage.alpha_mod[k] || stage.rgb_src[k] != stage.alpha_src[k])
+            return nullptr;
+        src[k] = single_source(stage.rgb_src[k]);
+        if (src[k] < 0)
+            return nullptr;
+    }
+    if (stage.rgb_inputs == 1)
+        src[1] = src[0];
+    return single_shaders[(stage.rgb_op * ONE_SOURCE_COUNT + src[0]) * ONE_SOURCE_COUNT + src[1]];
+}
+
+static TevProgram* compile_program(const uint32_t* regs)
+{
+    TevProgram* program = new TevProgram();
+    uint32_t update = regs[PICA_REG_TEXENV_UPDATE_BUFFER];
+
+    TevStage stages[TEV_STAGES];
+    bool reads_buffer = false;
+    for (int s = 0; s < TEV_STAGES; s++)
+    {
+        const uint32_t* r = &regs[stage_regs[s]];
+        uint32_t source = r[0], operand = r[1], combiner = r[2], scale = r[4];
+        TevStage& stage = stages[s];
+
+        stage.index = s;
+        stage.rgb_op = combiner & 0xF;
+        stage.alpha_op = (combiner >> 16) & 0xF;
+        if (stage.rgb_op >= TEV_OP_COUNT)
+            stage.rgb_op = TEV_REPLACE;
+        if (stage.alpha_op >= TEV_OP_COUNT)
+            stage.alpha_op = TEV_REPLACE;
+        stage.rgb_inputs = op_inputs[stage.rgb_op];
+        stage.alpha_from_rgb = stage.rgb_op == TEV_DOT3_RGBA;
+        stage.alpha_inputs = stage.alpha_from_rgb ? 0 : op_inputs[stage.alpha_op];
+
+        for (int k = 0; k < 3; k++)
+        {
+            stage.rgb_src[k] = source_slot((source >> (k * 4)) & 0xF);
+            stage.alpha_src[k] = source_slot((source >> (16 + k * 4)) & 0xF);
+            stage.rgb_mod[k] = (operand >> (k * 4)) & 0xF;
+            stage.alpha_mod[k] = (operand >> (12 + k * 4)) & 7;
+            stage.rgb_operand[k] = rgb_operands[stage.rgb_mod[k]];
+            stage.alpha_operand[k] = alpha_operands[stage.alpha_mod[k]];
+        }
+        for (int k = 0; k < stage.rgb_inputs; k++)
+            reads_buffer |= stage.rgb_src[k] == TEV_SRC_BUFFER;
+        for (int k = 0; k < stage.alpha_inputs; k++)
+            reads_buffer |= stage.alpha_src[k] == TEV_SRC_BUFFER;
+
+        stage.combine_rgb = rgb_combiners[stage.rgb_op];
+        stage.combine_alpha = alpha_combiners[stage.alpha_op];
+        stage.rgb_shift = std::min(scale & 3, 2u);
+        stage.alpha_shift = std::min((scale >> 16) & 3, 2u);
+
+        // Only the first four stages can write the buffer
+        stage.buffer_mask = 0;
+        if (s < 4 && ((update >> (8 + s)) & 1))
+            stage.buffer_mask |= 0x00FFFFFF;
+        if (s < 4 && ((update >> (12 + s)) & 1))
+            stage.buffer_mask |= 0xFF000000;
+    }
+
+    for (int s = 0; s < TEV_STAGES; s++)
+    {
+        if (reads_buffer || !is_passthrough(stages[s]))
+            program->stages[program->stage_count++] = stages[s];
+    }
+
+    for (int s = 0; s < program->stage_count; s++)
+    {
+        const TevStage& stage = program->stages[s];
+        for (int k = 0; k < 3; k++)
+        {
+            for (int unit = 0; unit < TEXTURE_UNITS; unit++)
+            {
+                uint8_t slot = TEV_SRC_TEXTURE0 + unit;
+                if ((k < stage.rgb_inputs && stage.rgb_src[k] == slot) || (k < stage.alpha_inputs && stage.alpha_src[k] == slot))
+                    program->samples[unit] = true;
+            }
+        }
+    }
+
+    program->shader = specialize(*program);
+    program->specialized = program->shader != nullptr;
+    if (!program->shader)
+        program->shader = shade_generic;
+    return program;
+}
+
+const TevProgram* PicaCombiner::GetProgram(const uint32_t* regs)
+{
+    // Constant colors aren't part of the program, they're read per draw
+    uint64_t hash = mix(regs[PICA_REG_TEXENV_UPDATE_BUFFER] & 0xFF00);
+    for (int s = 0; s < TEV_STAGES; s++)
+    {
+        const uint32_t* r = &regs[stage_regs[s]];
+        hash = mix(hash ^ r[0]);
+        hash = mix(hash ^ r[1]);
+        hash = mix(hash ^ r[2]);
+        hash = mix(hash ^ r[4]);
+    }
+
+    auto& entry = cache[hash];
+    if (!entry)
+    {
+        entry.reset(compile_program(regs));
+        if (entry->specialized)
+            programs_specialized++;
+        else
+            programs_generic++;
+    }
+    return entry.get();
+}
+
+void PicaCombiner::Configure(const uint32_t* regs, TextureCache& textures)
+{
+    const static Color no_texel = {};
+
+    const TevProgram* program = GetProgram(regs);
+    context.program = program;
+    if (program->specialized)
+        draws_specialized++;
+    else
+        draws_generic++;
+
+    for (int s = 0; s < TEV_STAGES; s++)
+        context.constants[s] = unpack_color(regs[stage_regs[s] + 3]);
+    context.buffer_color = unpack_color(regs[PICA_REG_TEXENV_BUFFER_COLOR]);
+
+    // Textures that are disabled or can't be used read as transparent black
+    uint32_t config = regs[PICA_REG_TEXUNIT_CONFIG];
+    for (int unit = 0; unit < TEXTURE_UNITS; unit++)
+    {
+        TevTexture& tex = context.textures[unit];
+        tex = {&no_texel, 1, 1, WRAP_CLAMP_TO_EDGE, WRAP_CLAMP_TO_EDGE, {}, RASTER_TEX0_U + unit * 2};
+        // Texture 2 can take texture 1's coordinates
+        if (unit == 2 && ((config >> 13) & 1))
+            tex.coord = RASTER_TEX1_U;
+        if (!program->samples[unit] || !((config >> unit) & 1))
+            continue;
+
+        const TexUnitRegs& r = texunit_regs[unit];
+        uint32_t width = (regs[r.dim] >> 16) & 0x7FF;
+        uint32_t height = regs[r.dim] & 0x7FF;
+        uint32_t addr = regs[r.addr] * 8;
+        uint32_t format = regs[r.type] & 0xF;
+        const Color* texels = textures.Lookup(addr, format, width, height);
+        if (!texels)
+        {
+            printf("[TEV]: Texture %d at 0x%08x (%ux%u, format %u) can't be used\n", unit, addr, width, height, format);
+            continue;
+        }
+
+        tex.texels = texels;
+        tex.width = width;
+        tex.height = height;
+        tex.wrap_t = (regs[r.param] >> 8) & 7;
+        tex.wrap_s = (regs[r.param] >> 12) & 7;
+        tex.border = unpack_color(regs[r.border]);
+    }
+}
+
+FragmentShader PicaCombiner::GetShader() const
+{
+    return context.program->shader;
+}
+
+void PicaCombiner::Dump()
+{
+    if (draws_specialized || draws_generic)
+    {
+        printf("[TEV]: %lu combiner setups (%lu specialized), %lu draws specialized, %lu generic\n",
+            programs_specialized + programs_generic, programs_specialized, draws_specialized, draws_generic);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+#include "rasterizer.h"
+#include "texture.h"
+
+constexpr int TEV_STAGES = 6;
+constexpr int TEXTURE_UNITS = 3;
+
+struct TevProgram;
+struct TevProgramDeleter
+{
+    void operator()(TevProgram* program) const;
+};
+
+// A texture unit as fragment shaders sample it, set up once per draw
+struct TevTexture
+{
+    const Color* texels;
+    uint32_t width, height;
+    uint32_t wrap_s, wrap_t;
+    Color border;
+    // Which RasterVertex attribute holds the coordinates
+    int coord;
+};
+
+// What the fragment shader reads besides the fragment's attributes
+struct TevContext
+{
+    const TevProgram* program;
+    TevTexture textures[TEXTURE_UNITS];
+    Color constants[TEV_STAGES];
+    Color buffer_color;
+};
+
+// The texture combiner (TEV). Each combination of stage settings is
+// specialized once into a fragment shader and kept in a cache keyed by a
+// hash of the stage registers. Single-stage setups over the primary color,
+// textures and constant get a shader instantiated for them that's fully
+// inlined. Everything else runs on a generic shader over a table of the
+// stage's operations, decoded with their inputs resolved, so fragments
+// never branch on how the stages are set up.
+//
+// Fragment lighting and procedural textures aren't emulated, their colors
+// read as zero. Textures are sampled nearest, fog isn't applied.
+class PicaCombiner
+{
+private:
+    std::unordered_map<uint64_t, std::unique_ptr<TevProgram, TevProgramDeleter>> cache;
+    TevContext context = {};
+
+    uint64_t programs_specialized = 0;
+    uint64_t programs_generic = 0;
+    uint64_t draws_specialized = 0;
+    uint64_t draws_generic = 0;
+
+    const TevProgram* GetProgram(const uint32_t* regs);
+public:
+    // Picks the shader for the stage registers and looks up the enabled
+    // textures, which stay valid until the texture cache's next Trim
+    void Configure(const uint32_t* regs, TextureCache& textures);
+
+    FragmentShader GetShader() const;
+    const void* GetContext() const { return &context; }
+
+    void Dump();
+};
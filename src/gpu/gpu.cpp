@@ -1,52 +1,370 @@
 #include "gpu.h"
 
-#include <fstream>
+#include <string.h>
+#include <algorithm>
+#include <app/capture.h>
+#include <app/presenter.h>
+#include <arm/mpcore_pmr.h>
+#include <gpu/lcd.h>
+#include <memory/arena.h>
+#include <memory/Bus.h>
+#include <memory/memdump.h>
+#include <scheduler/scheduler.h>
+
+// Rough GX engine throughput, in bytes written per scheduler cycle
+constexpr uint64_t GX_FILL_BYTES_PER_CYCLE = 16;
+constexpr uint64_t GX_TRANSFER_BYTES_PER_CYCLE = 4;
+
+// Byte-enable mask of a command header to a bit mask
+const static uint32_t byte_masks[16] =
+{
+    0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF,
+    0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
+    0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF,
+    0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF,
+};
+
+PicaGpu::PicaGpu()
+{
+    for (uint32_t i = 0; i < PICA_REG_COUNT; i++)
+        reg_handlers[i] = nullptr;
+
+    reg_handlers[PICA_REG_FINALIZE] = &PicaGpu::OnFinalize;
+    reg_handlers[PICA_REG_DRAWARRAYS] = &PicaGpu::OnDraw;
+    reg_handlers[PICA_REG_DRAWELEMENTS] = &PicaGpu::OnDraw;
+    reg_handlers[PICA_REG_CMDBUF_JUMP0] = &PicaGpu::OnCmdBufJump;
+    reg_handlers[PICA_REG_CMDBUF_JUMP1] = &PicaGpu::OnCmdBufJump;
+    reg_handlers[PICA_REG_FIXEDATTRIB_INDEX] = &PicaGpu::OnFixedAttrib;
+    for (uint32_t i = 0; i < 3; i++)
+        reg_handlers[PICA_REG_FIXEDATTRIB_DATA0 + i] = &PicaGpu::OnFixedAttrib;
+
+    reg_handlers[PICA_REG_VSH_FLOATUNIFORM_INDEX] = &PicaGpu::OnShaderUpload;
+    reg_handlers[PICA_REG_VSH_CODETRANSFER_INDEX] = &PicaGpu::OnShaderUpload;
+    reg_handlers[PICA_REG_VSH_OPDESCS_INDEX] = &PicaGpu::OnShaderUpload;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        reg_handlers[PICA_REG_VSH_FLOATUNIFORM_DATA + i] = &PicaGpu::OnShaderUpload;
+        reg_handlers[PICA_REG_VSH_CODETRANSFER_DATA + i] = &PicaGpu::OnShaderUpload;
+        reg_handlers[PICA_REG_VSH_OPDESCS_DATA + i] = &PicaGpu::OnShaderUpload;
+    }
+}
 
 void PicaGpu::Reset()
 {
-    vram_a = new uint8_t[3*1024*1024];
-    vram_b = new uint8_t[3*1024*1024];
-    vram_a_base = 0x18000000;
-    vram_b_base = 0x18300000;
+    vram = Arena::GetHostPtr(Arena::REGION_VRAM);
+
+    memset(ext_regs, 0, sizeof(ext_regs));
+    memset(regs, 0, sizeof(regs));
+    in_cmdlist = false;
+    pending_jump = -1;
+    fill_busy[0] = fill_busy[1] = false;
+    transfer_busy = false;
+    event_generation++;
+    shader.Reset();
+    vertex_loader.Reset();
+    textures.Clear();
+
+    uint64_t generation = event_generation;
+    Scheduler::ScheduleEvent(LCD::FRAME_CYCLES, [this, generation] { OnVBlank(generation); });
+}
+
+void PicaGpu::InvalidateMemory(uint32_t addr, uint32_t size)
+{
+    textures.Invalidate(addr, size);
 }
 
 void PicaGpu::Dump()
 {
-    std::ofstream file_a("vram_a.bin"), file_b("vram_b.bin");
-    for (int i = 0; i < 3*1024*1024; i++)
+    MemDump::Add("vram_a", vram, 3*1024*1024);
+    MemDump::Add("vram_b", vram + 3*1024*1024, 3*1024*1024);
+
+    if (cmdlists_run)
+        printf("[PICA]: %lu command lists, %lu register writes, %lu draws\n", cmdlists_run, cmdlist_writes, draw_calls);
+    if (frames)
+        printf("[LCD]: %lu frames\n", frames);
+    if (fills_run || transfers_run)
+        printf("[GX]: %lu memory fills, %lu transfers\n", fills_run, transfers_run);
+    vertex_loader.Dump();
+    shader.Dump();
+    combiner.Dump();
+    rasterizer.Dump();
+    textures.Dump();
+}
+
+void PicaGpu::WriteReg(uint32_t reg, uint32_t value, uint32_t mask)
+{
+    if (reg >= PICA_REG_COUNT)
     {
-        file_a << vram_a[i];
-        file_b << vram_b[i];
+        printf("[PICA]: Write 0x%08x to unknown register 0x%03x\n", value, reg);
+        return;
     }
 
-    file_a.close();
-    file_b.close();
+    regs[reg] = (regs[reg] & ~mask) | (value & mask);
+
+    if (reg_handlers[reg])
+        (this->*reg_handlers[reg])(reg);
+}
+
+// Command lists are pairs of words: a parameter, then a header naming the
+// register (bits 0-15), the byte-enable mask (16-19), how many extra
+// parameters follow (20-27), and whether they go to consecutive registers
+// (31) or all to the same one. Each command is padded to 8 bytes.
+void PicaGpu::RunCommandLists()
+{
+    in_cmdlist = true;
+
+    while (pending_jump >= 0)
+    {
+        int buffer = pending_jump;
+        pending_jump = -1;
+
+        uint32_t addr = regs[PICA_REG_CMDBUF_ADDR0 + buffer] * 8;
+        uint32_t size = regs[PICA_REG_CMDBUF_SIZE0 + buffer] * 8;
+        const uint32_t* words = (const uint32_t*)Bus::ARM11::GetPtr(addr, size, false);
+        if (!words)
+        {
+            printf("[PICA]: Command list at 0x%08x (0x%x bytes) isn't in memory\n", addr, size);
+            break;
+        }
+
+        cmdlists_run++;
+
+        uint32_t count = size / 4;
+        uint32_t pos = 0;
+        while (pos + 2 <= count && pending_jump < 0)
+        {
+            uint32_t header = words[pos + 1];
+            uint32_t reg = header & 0xFFFF;
+            uint32_t mask = byte_masks[(header >> 16) & 0xF];
+            uint32_t extra = (header >> 20) & 0xFF;
+            bool consecutive = header >> 31;
+
+            if (pos + 2 + extra > count)
+            {
+                printf("[PICA]: Command list at 0x%08x overruns its size\n", addr);
+                break;
+            }
+
+            WriteReg(reg, words[pos], mask);
+            for (uint32_t i = 0; i < extra; i++)
+            {
+                if (consecutive)
+                    reg++;
+                WriteReg(reg, words[pos + 2 + i], mask);
+            }
+
+            cmdlist_writes += 1 + extra;
+            pos += 2 + extra + (extra & 1);
+        }
+    }
+
+    in_cmdlist = false;
+}
+
+void PicaGpu::OnCmdBufJump(uint32_t reg)
+{
+    pending_jump = reg - PICA_REG_CMDBUF_JUMP0;
+    if (!in_cmdlist)
+        RunCommandLists();
+}
+
+void PicaGpu::OnFinalize(uint32_t)
+{
+    MPCore_PMR::AssertHWIrq(PICA_IRQ_P3D);
+}
+
+void PicaGpu::OnDraw(uint32_t reg)
+{
+    draw_calls++;
+    if (!rasterizer.Configure(regs))
+        return;
+
+    shader.Prepare(regs);
+    if (!vertex_loader.Run(regs, reg == PICA_REG_DRAWELEMENTS, shader))
+        return;
+
+    // Decoded textures stay put until the next Trim, which makes between
+    // draws the time for it
+    textures.Trim();
+    combiner.Configure(regs, textures);
+    rasterizer.SetFragmentShader(combiner.GetShader(), combiner.GetContext());
+
+    const std::vector<RasterVertex>& triangles = vertex_loader.Triangles();
+    rasterizer.DrawTriangles(triangles.data(), triangles.size());
+
+    // The rasterizer writes straight to memory, which the texture cache
+    // doesn't see
+    const RasterState& target = rasterizer.GetState();
+    if (target.color_write)
+        InvalidateMemory(target.color_addr, target.color_size);
+    if (target.depth_write || target.stencil_write)
+        InvalidateMemory(target.depth_addr, target.depth_size);
 }
 
-uint32_t PicaGpu::Read32(uint32_t addr)
+// The data registers are FIFOs, each write appends to what's being uploaded
+void PicaGpu::OnShaderUpload(uint32_t reg)
 {
-    if (addr >= vram_a_base && addr < vram_a_base+0x300000)
-        return *(uint32_t*)&vram_a[addr & 0x2FFFFF];
-    if (addr >= vram_b_base && addr < vram_b_base+0x300000)
-        return *(uint32_t*)&vram_b[addr & 0x2FFFFF];
-    
-    printf("[PICA]: Read from unknown addr 0x%08x\n", addr);
-    exit(1);
+    uint32_t value = regs[reg];
+    if (reg == PICA_REG_VSH_FLOATUNIFORM_INDEX)
+        shader.SetUniformIndex(value);
+    else if (reg == PICA_REG_VSH_CODETRANSFER_INDEX)
+        shader.SetCodeIndex(value);
+    else if (reg == PICA_REG_VSH_OPDESCS_INDEX)
+        shader.SetOpdescIndex(value);
+    else if (reg < PICA_REG_VSH_CODETRANSFER_INDEX)
+        shader.WriteUniform(value);
+    else if (reg < PICA_REG_VSH_OPDESCS_INDEX)
+        shader.WriteCode(value);
+    else
+        shader.WriteOpdesc(value);
 }
 
-void PicaGpu::Write32(uint32_t addr, uint32_t data)
+void PicaGpu::OnFixedAttrib(uint32_t reg)
 {
-    if (addr >= vram_a_base && addr < vram_a_base+0x300000)
+    if (reg == PICA_REG_FIXEDATTRIB_INDEX)
+        vertex_loader.SetFixedAttribIndex(regs[reg]);
+    else
+        vertex_loader.WriteFixedAttrib(reg - PICA_REG_FIXEDATTRIB_DATA0, regs[reg]);
+}
+
+uint32_t PicaGpu::ReadExternal32(uint32_t addr)
+{
+    return ext_regs[(addr & 0xFFF) / 4];
+}
+
+void PicaGpu::WriteExternal32(uint32_t addr, uint32_t data)
+{
+    uint32_t offset = addr & 0xFFF;
+    ext_regs[offset / 4] = data;
+
+    switch (offset)
+    {
+    case GX::GX_REG_PSC0_CONTROL:
+    case GX::GX_REG_PSC1_CONTROL:
+        if (data & 1)
+            StartMemoryFill(offset == GX::GX_REG_PSC1_CONTROL);
+        break;
+    case GX::GX_REG_PPF_CONTROL:
+        if (data & 1)
+            StartTransfer();
+        break;
+    }
+}
+
+void PicaGpu::StartMemoryFill(int unit)
+{
+    if (fill_busy[unit])
+    {
+        printf("[GX]: Memory fill %d started while busy\n", unit);
+        return;
+    }
+
+    const uint32_t* regs = &ext_regs[(unit ? GX::GX_REG_PSC1_START : GX::GX_REG_PSC0_START) / 4];
+    GX::FillJob job = {regs[0], regs[1], regs[2], regs[3]};
+    uint64_t bytes = job.end > job.start ? (uint64_t)(job.end - job.start) * 8 : 0;
+    uint64_t generation = event_generation;
+    fill_busy[unit] = true;
+    Scheduler::ScheduleEvent(std::max<uint64_t>(1, bytes / GX_FILL_BYTES_PER_CYCLE),
+        [this, unit, job, generation] { FinishMemoryFill(unit, job, generation); });
+}
+
+void PicaGpu::FinishMemoryFill(int unit, GX::FillJob job, uint64_t generation)
+{
+    if (generation != event_generation)
+        return;
+
+    uint32_t dest = 0;
+    uint32_t size = GX::MemoryFill(job, dest);
+    InvalidateMemory(dest, size);
+    fills_run++;
+
+    uint32_t& control = ext_regs[(unit ? GX::GX_REG_PSC1_CONTROL : GX::GX_REG_PSC0_CONTROL) / 4];
+    control = (control & ~1) | 2;
+    fill_busy[unit] = false;
+    MPCore_PMR::AssertHWIrq(unit ? GX::GX_IRQ_PSC1 : GX::GX_IRQ_PSC0);
+}
+
+void PicaGpu::StartTransfer()
+{
+    if (transfer_busy)
     {
-        *(uint32_t*)&vram_a[addr & 0x2FFFFF] = data;
+        printf("[GX]: Transfer started while busy\n");
         return;
     }
-    if (addr >= vram_b_base && addr < vram_b_base+0x300000)
+
+    GX::TransferJob job;
+    memcpy(job.regs, &ext_regs[GX::GX_REG_PPF_INPUT_ADDR / 4], sizeof(job.regs));
+
+    // Timed by the size of the output, assuming 32-bit pixels for transfers
+    uint64_t bytes;
+    if (job.Reg(GX::GX_REG_PPF_FLAGS) & GX::GX_TRANSFER_TEXTURE_COPY)
+        bytes = job.Reg(GX::GX_REG_PPF_COPY_SIZE);
+    else
     {
-        *(uint32_t*)&vram_b[addr & 0x2FFFFF] = data;
+        uint32_t dim = job.Reg(GX::GX_REG_PPF_OUTPUT_DIM);
+        bytes = (uint64_t)(dim & 0xFFFF) * (dim >> 16) * 4;
+    }
+
+    uint64_t generation = event_generation;
+    transfer_busy = true;
+    Scheduler::ScheduleEvent(std::max<uint64_t>(1, bytes / GX_TRANSFER_BYTES_PER_CYCLE),
+        [this, job, generation] { FinishTransfer(job, generation); });
+}
+
+void PicaGpu::FinishTransfer(GX::TransferJob job, uint64_t generation)
+{
+    if (generation != event_generation)
+        return;
+
+    uint32_t dest = 0, size;
+    if (job.Reg(GX::GX_REG_PPF_FLAGS) & GX::GX_TRANSFER_TEXTURE_COPY)
+        size = GX::TextureCopy(job, dest);
+    else
+        size = GX::DisplayTransfer(job, transfer_scratch, dest);
+    InvalidateMemory(dest, size);
+    transfers_run++;
+
+    ext_regs[GX::GX_REG_PPF_CONTROL / 4] &= ~1;
+    transfer_busy = false;
+    MPCore_PMR::AssertHWIrq(GX::GX_IRQ_PPF);
+}
+
+uint32_t PicaGpu::ReadInternal32(uint32_t addr)
+{
+    return regs[((addr - 0x10401000) / 4) % PICA_REG_COUNT];
+}
+
+void PicaGpu::WriteInternal32(uint32_t addr, uint32_t data)
+{
+    WriteReg((addr - 0x10401000) / 4, data, 0xFFFFFFFF);
+}
+
+void PicaGpu::OnVBlank(uint64_t generation)
+{
+    if (generation != event_generation)
         return;
+
+    frames++;
+    MPCore_PMR::AssertHWIrq(LCD::LCD_IRQ_VBLANK_TOP);
+    MPCore_PMR::AssertHWIrq(LCD::LCD_IRQ_VBLANK_BOTTOM);
+
+    // Captured frames are composed in the capture's buffer, the presenter
+    // gets a copy
+    bool present = Presenter::IsRunning();
+    bool capture = Capture::WantsFrame(frames);
+    if (present || capture)
+    {
+        uint32_t* frame = capture ? Capture::BeginFrame() : Presenter::BeginFrame();
+        LCD::ComposeFrame(ext_regs, frame);
+        if (present)
+        {
+            if (capture)
+                memcpy(Presenter::BeginFrame(), frame, LCD::FRAME_WIDTH * LCD::FRAME_HEIGHT * 4);
+            Presenter::EndFrame();
+        }
+        if (capture)
+            Capture::EndFrame(frames);
     }
-    
-    printf("[PICA]: Write to unknown addr 0x%08x\n", addr);
-    exit(1);
+
+    Scheduler::ScheduleEvent(LCD::FRAME_CYCLES, [this, generation] { OnVBlank(generation); });
 }
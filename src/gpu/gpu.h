@@ -4,16 +4,84 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include "combiner.h"
+#include "gx.h"
+#include "pica_regs.h"
+#include "rasterizer.h"
+#include "shader.h"
+#include "texture.h"
+#include "vertex_loader.h"
 
 class PicaGpu
 {
 private:
-    uint8_t* vram_a, *vram_b;
-    uint32_t vram_a_base, vram_b_base;
+    // Both VRAM banks, owned by the memory arena
+    uint8_t* vram;
+
+    // External (GX/LCD) registers at 0x10400000, as last written
+    uint32_t ext_regs[0x400];
+
+    // Internal registers, as last written. Writes to a register with a
+    // handler call it after the shadow is updated.
+    typedef void (PicaGpu::*RegHandler)(uint32_t reg);
+    uint32_t regs[PICA_REG_COUNT];
+    RegHandler reg_handlers[PICA_REG_COUNT];
+
+    // Command list state. A jump while a list is running only takes effect
+    // once the current command is done.
+    bool in_cmdlist = false;
+    int pending_jump = -1;
+
+    PicaRasterizer rasterizer;
+    PicaCombiner combiner;
+    PicaShader shader;
+    PicaVertexLoader vertex_loader;
+    TextureCache textures;
+
+    // GX jobs and VBlank run as scheduler events. Events from before a
+    // reset see a stale generation and drop themselves.
+    bool fill_busy[2] = {};
+    bool transfer_busy = false;
+    uint64_t event_generation = 0;
+    GX::TransferScratch transfer_scratch;
+
+    uint64_t cmdlists_run = 0;
+    uint64_t cmdlist_writes = 0;
+    uint64_t draw_calls = 0;
+    uint64_t fills_run = 0;
+    uint64_t transfers_run = 0;
+    uint64_t frames = 0;
+
+    void WriteReg(uint32_t reg, uint32_t value, uint32_t mask);
+    void RunCommandLists();
+
+    void OnCmdBufJump(uint32_t reg);
+    void OnFinalize(uint32_t);
+    void OnDraw(uint32_t reg);
+    void OnShaderUpload(uint32_t reg);
+    void OnFixedAttrib(uint32_t reg);
+
+    void StartMemoryFill(int unit);
+    void FinishMemoryFill(int unit, GX::FillJob job, uint64_t generation);
+    void StartTransfer();
+    void FinishTransfer(GX::TransferJob job, uint64_t generation);
+
+    void OnVBlank(uint64_t generation);
 public:
+    PicaGpu();
+
     void Reset();
+
+    // Something wrote to [addr, addr+size) behind the GPU's back
+    void InvalidateMemory(uint32_t addr, uint32_t size);
+
+    // Adds VRAM to the exit dump
     void Dump();
 
-    uint32_t Read32(uint32_t addr);
-    void Write32(uint32_t addr, uint32_t data);
-};
\ No newline at end of file
+    uint32_t ReadExternal32(uint32_t addr);
+    void WriteExternal32(uint32_t addr, uint32_t data);
+
+    // Internal registers through 0x10401000
+    uint32_t ReadInternal32(uint32_t addr);
+    void WriteInternal32(uint32_t addr, uint32_t data);
+};
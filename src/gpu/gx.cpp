@@ -0,0 +1,293 @@
+#include "gx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <gpu/color.h>
+#include <gpu/morton.h>
+#include <gpu/texture.h>
+#include <memory/Bus.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum TransferScale
+{
+    SCALE_NONE,
+    SCALE_X,
+    SCALE_XY,
+};
+
+// Repeats a 1-4 byte pattern over [dst, dst+size)
+static void fill_pattern(uint8_t* dst, uint32_t size, uint32_t value, uint32_t width)
+{
+    // Three 16-byte blocks hold a whole number of repeats of every width
+    alignas(16) uint8_t pattern[48];
+    for (uint32_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = value >> ((i % width) * 8);
+
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    __m128i block[3];
+    for (int b = 0; b < 3; b++)
+        block[b] = _mm_load_si128((const __m128i*)(pattern + b * 16));
+    for (; i + 48 <= size; i += 48)
+    {
+        _mm_storeu_si128((__m128i*)(dst + i), block[0]);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), block[1]);
+        _mm_storeu_si128((__m128i*)(dst + i + 32), block[2]);
+    }
+#else
+    for (; i + 48 <= size; i += 48)
+        memcpy(dst + i, pattern, 48);
+#endif
+    memcpy(dst + i, pattern, size - i);
+}
+
+uint32_t GX::MemoryFill(const FillJob& job, uint32_t& dest)
+{
+    uint32_t start = job.start * 8;
+    uint32_t end = job.end * 8;
+    uint8_t* dst = end > start ? Bus::GetPhysicalPtr(start, end - start) : nullptr;
+    if (!dst)
+    {
+        printf("[GX]: Memory fill of 0x%08x-0x%08x isn't in memory\n", start, end);
+        return 0;
+    }
+
+    uint32_t width = (job.control & 0x200) ? 4 : (job.control & 0x100) ? 3 : 2;
+    fill_pattern(dst, end - start, job.value, width);
+    dest = start;
+    return end - start;
+}
+
+// Encodes count colors to a color buffer format
+static void encode_pixels(uint32_t format, const Color* src, uint32_t count, uint8_t* dst)
+{
+    uint32_t bpp = ColorFormatBpp(format);
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    if (format == COLOR_RGBA8)
+    {
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+            _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+        }
+    }
+    else if (format != COLOR_RGB8)
+    {
+        const __m128i ff = _mm_set1_epi32(0xFF);
+        for (; i + 8 <= count; i += 8)
+        {
+            // Channels of eight pixels as 16-bit lanes
+            __m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 4));
+            __m128i r = _mm_packs_epi32(_mm_and_si128(lo, ff), _mm_and_si128(hi, ff));
+            __m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), ff), _mm_and_si128(_mm_srli_epi32(hi, 8), ff));
+            __m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), ff), _mm_and_si128(_mm_srli_epi32(hi, 16), ff));
+            __m128i a = _mm_packs_epi32(_mm_srli_epi32(lo, 24), _mm_srli_epi32(hi, 24));
+
+            __m128i v;
+            if (format == COLOR_RGB565)
+            {
+                v = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(r, 3), 11), _mm_slli_epi16(_mm_srli_epi16(g, 2), 5));
+                v = _mm_or_si128(v, _mm_srli_epi16(b, 3));
+            }
+            else if (format == COLOR_RGB5A1)
+            {
+                v = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(r, 3), 11), _mm_slli_epi16(_mm_srli_epi16(g, 3), 6));
+                v = _mm_or_si128(v, _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(b, 3), 1), _mm_srli_epi16(a, 7)));
+            }
+            else
+            {
+                v = _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(r, 4), 12), _mm_slli_epi16(_mm_srli_epi16(g, 4), 8));
+                v = _mm_or_si128(v, _mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(b, 4), 4), _mm_srli_epi16(a, 4)));
+            }
+            _mm_storeu_si128((__m128i*)(dst + i * 2), v);
+        }
+    }
+#endif
+    for (; i < count; i++)
+        EncodeColor(format, src[i], dst + i * bpp);
+}
+
+// Averages each horizontal pair of pixels, over two rows if row1 is given
+static void downscale_row(const Color* row0, const Color* row1, uint32_t count, Color* out)
+{
+    int shift = row1 ? 2 : 1;
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i * 2));
+        __m128i lo = _mm_unpacklo_epi8(a, zero);
+        __m128i hi = _mm_unpackhi_epi8(a, zero);
+        if (row1)
+        {
+            __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i * 2));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(b, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(b, zero));
+        }
+        // Each half of lo and hi is one source pixel
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_srli_epi16(_mm_unpacklo_epi64(lo, hi), shift);
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const Color* p = row0 + i * 2;
+        const Color* q = row1 ? row1 + i * 2 : nullptr;
+        int r = p[0].r + p[1].r + (q ? q[0].r + q[1].r : 0);
+        int g = p[0].g + p[1].g + (q ? q[0].g + q[1].g : 0);
+        int b = p[0].b + p[1].b + (q ? q[0].b + q[1].b : 0);
+        int a = p[0].a + p[1].a + (q ? q[0].a + q[1].a : 0);
+        out[i] = {(uint8_t)(r >> shift), (uint8_t)(g >> shift), (uint8_t)(b >> shift), (uint8_t)(a >> shift)};
+    }
+}
+
+uint32_t GX::DisplayTransfer(const TransferJob& job, TransferScratch& scratch, uint32_t& dest)
+{
+    uint32_t in_addr = job.Reg(GX_REG_PPF_INPUT_ADDR) * 8;
+    uint32_t out_addr = job.Reg(GX_REG_PPF_OUTPUT_ADDR) * 8;
+    uint32_t out_dim = job.Reg(GX_REG_PPF_OUTPUT_DIM);
+    uint32_t in_dim = job.Reg(GX_REG_PPF_INPUT_DIM);
+    uint32_t flags = job.Reg(GX_REG_PPF_FLAGS);
+
+    uint32_t in_format = (flags >> 8) & 7;
+    uint32_t out_format = (flags >> 12) & 7;
+    uint32_t scale = (flags >> 24) & 3;
+    if (in_format > COLOR_RGBA4 || out_format > COLOR_RGBA4 || scale > SCALE_XY)
+    {
+        printf("[GX]: Unsupported display transfer flags 0x%08x\n", flags);
+        return 0;
+    }
+
+    bool in_tiled = !(flags & GX_TRANSFER_INPUT_LINEAR);
+    bool out_tiled = (flags & GX_TRANSFER_NO_SWIZZLE) ? in_tiled : !in_tiled;
+    uint32_t scale_x = scale != SCALE_NONE;
+    uint32_t scale_y = scale == SCALE_XY;
+
+    uint32_t in_w = in_dim & 0xFFFF, in_h = in_dim >> 16;
+    uint32_t out_w = std::min((out_dim & 0xFFFF) >> scale_x, in_w >> scale_x);
+    uint32_t out_h = std::min((out_dim >> 16) >> scale_y, in_h >> scale_y);
+    if (!out_w || !out_h || (in_tiled && ((in_w | in_h) & 7)) || (out_tiled && ((out_w | out_h) & 7)))
+    {
+        printf("[GX]: Bad display transfer size %ux%u -> %ux%u\n", in_w, in_h, out_dim & 0xFFFF, out_dim >> 16);
+        return 0;
+    }
+
+    uint32_t in_size = in_w * in_h * ColorFormatBpp(in_format);
+    uint32_t out_size = out_w * out_h * ColorFormatBpp(out_format);
+    const uint8_t* src = Bus::GetPhysicalPtr(in_addr, in_size);
+    uint8_t* dst = Bus::GetPhysicalPtr(out_addr, out_size);
+    if (!src || !dst)
+    {
+        printf("[GX]: Display transfer 0x%08x -> 0x%08x isn't in memory\n", in_addr, out_addr);
+        return 0;
+    }
+
+    // Decode, scale and flip through linear scratch images
+    std::vector<Color>& input = scratch.input;
+    std::vector<Color>& output = scratch.output;
+    input.resize(in_w * in_h);
+    output.resize(out_w * out_h);
+    if (in_tiled)
+        DecodeTexture(in_format, src, in_w, in_h, input.data());
+    else
+        DecodePixels(in_format, src, in_w * in_h, input.data());
+
+    for (uint32_t y = 0; y < out_h; y++)
+    {
+        const Color* row = &input[(y << scale_y) * in_w];
+        Color* out_row = &output[((flags & GX_TRANSFER_FLIP) ? out_h - 1 - y : y) * out_w];
+        if (scale_x)
+            downscale_row(row, scale_y ? row + in_w : nullptr, out_w, out_row);
+        else
+            memcpy(out_row, row, out_w * sizeof(Color));
+    }
+
+    if (!out_tiled)
+        encode_pixels(out_format, output.data(), out_w * out_h, dst);
+    else
+    {
+        uint32_t bpp = ColorFormatBpp(out_format);
+        Color tile[64];
+        for (uint32_t ty = 0; ty < out_h; ty += 8)
+        {
+            for (uint32_t tx = 0; tx < out_w; tx += 8)
+            {
+                for (uint32_t y = 0; y < 8; y++)
+                {
+                    for (uint32_t x = 0; x < 8; x++)
+                        tile[MortonInterleave(x, y)] = output[(ty + y) * out_w + tx + x];
+                }
+                encode_pixels(out_format, tile, 64, dst + TiledPixelIndex(tx, ty, out_w) * bpp);
+            }
+        }
+    }
+
+    dest = out_addr;
+    return out_size;
+}
+
+uint32_t GX::TextureCopy(const TransferJob& job, uint32_t& dest)
+{
+    uint32_t in_addr = job.Reg(GX_REG_PPF_INPUT_ADDR) * 8;
+    uint32_t out_addr = job.Reg(GX_REG_PPF_OUTPUT_ADDR) * 8;
+    uint32_t size = job.Reg(GX_REG_PPF_COPY_SIZE) & ~0xF;
+    uint32_t in_line = job.Reg(GX_REG_PPF_COPY_INPUT_LINE);
+    uint32_t out_line = job.Reg(GX_REG_PPF_COPY_OUTPUT_LINE);
+
+    // Line widths and gaps count 16-byte units
+    uint32_t in_width = (in_line & 0xFFFF) * 16, in_gap = (in_line >> 16) * 16;
+    uint32_t out_width = (out_line & 0xFFFF) * 16, out_gap = (out_line >> 16) * 16;
+    if (!size || !in_width || !out_width)
+    {
+        printf("[GX]: Bad texture copy, size 0x%x, lines 0x%08x 0x%08x\n", size, in_line, out_line);
+        return 0;
+    }
+
+    uint32_t in_span = (size + in_width - 1) / in_width * (in_width + in_gap);
+    uint32_t out_span = (size + out_width - 1) / out_width * (out_width + out_gap);
+    const uint8_t* src = Bus::GetPhysicalPtr(in_addr, in_span);
+    uint8_t* dst = Bus::GetPhysicalPtr(out_addr, out_span);
+    if (!src || !dst)
+    {
+        printf("[GX]: Texture copy 0x%08x -> 0x%08x isn't in memory\n", in_addr, out_addr);
+        return 0;
+    }
+
+    uint32_t in_pos = 0, out_pos = 0;
+    for (uint32_t remaining = size; remaining;)
+    {
+        uint32_t chunk = std::min({in_width - in_pos, out_width - out_pos, remaining});
+        memcpy(dst, src, chunk);
+        src += chunk;
+        dst += chunk;
+        remaining -= chunk;
+
+        in_pos += chunk;
+        if (in_pos == in_width)
+        {
+            src += in_gap;
+            in_pos = 0;
+        }
+        out_pos += chunk;
+        if (out_pos == out_width)
+        {
+            dst += out_gap;
+            out_pos = 0;
+        }
+    }
+
+    dest = out_addr;
+    return out_span;
+}
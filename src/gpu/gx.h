@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <gpu/color.h>
+
+// The GPU's memory engines, driven through the external registers: two
+// memory fill units (PSC0/PSC1) and the transfer engine (PPF), which does
+// display transfers and texture copies. The functions here do a job's work
+// in one go, PicaGpu takes care of the registers and of timing.
+namespace GX
+{
+
+// Offsets from 0x10400000
+enum GxReg
+{
+    GX_REG_PSC0_START = 0x010,
+    GX_REG_PSC0_END = 0x014,
+    GX_REG_PSC0_VALUE = 0x018,
+    GX_REG_PSC0_CONTROL = 0x01C,
+    GX_REG_PSC1_START = 0x020,
+    GX_REG_PSC1_CONTROL = 0x02C,
+
+    GX_REG_PPF_INPUT_ADDR = 0xC00,
+    GX_REG_PPF_OUTPUT_ADDR = 0xC04,
+    GX_REG_PPF_OUTPUT_DIM = 0xC08,
+    GX_REG_PPF_INPUT_DIM = 0xC0C,
+    GX_REG_PPF_FLAGS = 0xC10,
+    GX_REG_PPF_CONTROL = 0xC18,
+    GX_REG_PPF_COPY_SIZE = 0xC20,
+    GX_REG_PPF_COPY_INPUT_LINE = 0xC24,
+    GX_REG_PPF_COPY_OUTPUT_LINE = 0xC28,
+};
+
+constexpr int GX_IRQ_PSC0 = 0x28;
+constexpr int GX_IRQ_PSC1 = 0x29;
+constexpr int GX_IRQ_PPF = 0x2C;
+
+// A fill unit's registers (START through CONTROL), as written
+struct FillJob
+{
+    uint32_t start, end, value, control;
+};
+
+// The transfer engine's registers, GX_REG_PPF_INPUT_ADDR onwards
+struct TransferJob
+{
+    uint32_t regs[11];
+
+    uint32_t Reg(GxReg reg) const { return regs[(reg - GX_REG_PPF_INPUT_ADDR) / 4]; }
+};
+
+// Linear images a display transfer decodes into and scales through, kept
+// by the caller so their allocations carry over between transfers
+struct TransferScratch
+{
+    std::vector<Color> input, output;
+};
+
+// PPF_FLAGS bits
+constexpr uint32_t GX_TRANSFER_FLIP = 1 << 0;
+constexpr uint32_t GX_TRANSFER_INPUT_LINEAR = 1 << 1;
+constexpr uint32_t GX_TRANSFER_TEXTURE_COPY = 1 << 3;
+constexpr uint32_t GX_TRANSFER_NO_SWIZZLE = 1 << 5;
+
+// Each returns the size of the range it wrote and sets dest to its start,
+// for invalidation. 0 if the job was invalid.
+uint32_t MemoryFill(const FillJob& job, uint32_t& dest);
+uint32_t DisplayTransfer(const TransferJob& job, TransferScratch& scratch, uint32_t& dest);
+uint32_t TextureCopy(const TransferJob& job, uint32_t& dest);
+
+}
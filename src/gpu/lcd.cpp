@@ -0,0 +1,72 @@
+#include "lcd.h"
+
+#include <string.h>
+#include <gpu/color.h>
+#include <gpu/texture.h>
+#include <memory/Bus.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+bool LCD::ConvertScreen(const uint32_t* ext_regs, bool bottom, uint32_t* dst, uint32_t pitch)
+{
+    const uint32_t* regs = &ext_regs[(bottom ? LCD_REG_BOTTOM : LCD_REG_TOP) / 4];
+    uint32_t select = regs[LCD_REG_FB_SELECT / 4] & 1;
+    uint32_t addr = regs[(select ? LCD_REG_FB_LEFT_B : LCD_REG_FB_LEFT_A) / 4];
+    uint32_t format = regs[LCD_REG_FB_FORMAT / 4] & 7;
+    if (format > COLOR_RGBA4)
+        return false;
+
+    uint32_t width = bottom ? BOTTOM_WIDTH : TOP_WIDTH;
+    uint32_t bpp = ColorFormatBpp(format);
+    uint32_t stride = regs[LCD_REG_FB_STRIDE / 4];
+    if (stride < SCREEN_HEIGHT * bpp)
+        stride = SCREEN_HEIGHT * bpp;
+
+    const uint8_t* src = Bus::GetPhysicalPtr(addr, stride * (width - 1) + SCREEN_HEIGHT * bpp);
+    if (!src)
+        return false;
+
+    // Four framebuffer columns at a time, then 4x4 blocks of them are
+    // transposed into place
+    alignas(16) Color columns[4][SCREEN_HEIGHT];
+    for (uint32_t x = 0; x < width; x += 4)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+            DecodePixels(format, src + (x + i) * stride, SCREEN_HEIGHT, columns[i]);
+
+        for (uint32_t i = 0; i < SCREEN_HEIGHT; i += 4)
+        {
+            // Pixel i of a column is row 239 - i of the screen
+            uint32_t* out = dst + (SCREEN_HEIGHT - 1 - i) * pitch + x;
+#if defined(__SSE2__)
+            __m128 c0 = _mm_load_ps((const float*)&columns[0][i]);
+            __m128 c1 = _mm_load_ps((const float*)&columns[1][i]);
+            __m128 c2 = _mm_load_ps((const float*)&columns[2][i]);
+            __m128 c3 = _mm_load_ps((const float*)&columns[3][i]);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_storeu_ps((float*)out, c0);
+            _mm_storeu_ps((float*)(out - pitch), c1);
+            _mm_storeu_ps((float*)(out - pitch * 2), c2);
+            _mm_storeu_ps((float*)(out - pitch * 3), c3);
+#else
+            for (uint32_t j = 0; j < 4; j++)
+            {
+                for (uint32_t k = 0; k < 4; k++)
+                    memcpy(out - pitch * j + k, &columns[k][i + j], 4);
+            }
+#endif
+        }
+    }
+    return true;
+}
+
+void LCD::ComposeFrame(const uint32_t* ext_regs, uint32_t* dst)
+{
+    uint32_t* bottom = dst + SCREEN_HEIGHT * FRAME_WIDTH;
+    if (!ConvertScreen(ext_regs, false, dst, FRAME_WIDTH))
+        memset(dst, 0, SCREEN_HEIGHT * FRAME_WIDTH * 4);
+    memset(bottom, 0, SCREEN_HEIGHT * FRAME_WIDTH * 4);
+    ConvertScreen(ext_regs, true, bottom + BOTTOM_X, FRAME_WIDTH);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// The LCD side of the GPU's external registers: which framebuffer each
+// screen shows, and turning it into an upright image
+namespace LCD
+{
+
+// Offsets from 0x10400000, the bottom screen's registers are at +0x100
+enum LcdReg
+{
+    LCD_REG_TOP = 0x400,
+    LCD_REG_BOTTOM = 0x500,
+
+    LCD_REG_FB_LEFT_A = 0x68,
+    LCD_REG_FB_LEFT_B = 0x6C,
+    LCD_REG_FB_FORMAT = 0x70,
+    LCD_REG_FB_SELECT = 0x78,
+    LCD_REG_FB_STRIDE = 0x90,
+};
+
+constexpr int LCD_IRQ_VBLANK_TOP = 0x2A;
+constexpr int LCD_IRQ_VBLANK_BOTTOM = 0x2B;
+
+constexpr uint32_t TOP_WIDTH = 400;
+constexpr uint32_t BOTTOM_WIDTH = 320;
+constexpr uint32_t SCREEN_HEIGHT = 240;
+
+// Both screens stacked, the bottom one centered under the top one
+constexpr uint32_t FRAME_WIDTH = TOP_WIDTH;
+constexpr uint32_t FRAME_HEIGHT = SCREEN_HEIGHT * 2;
+constexpr uint32_t BOTTOM_X = (TOP_WIDTH - BOTTOM_WIDTH) / 2;
+
+// ARM9 clock over the refresh rate (59.83Hz), in scheduler cycles
+constexpr uint64_t FRAME_CYCLES = 2240576;
+
+// Converts the framebuffer a screen currently shows into RGBA rows, top row
+// first. The LCDs are mounted sideways, so framebuffers are stored a column
+// at a time, bottom to top. Returns false, leaving dst alone, if the
+// framebuffer isn't in memory or its format is invalid.
+bool ConvertScreen(const uint32_t* ext_regs, bool bottom, uint32_t* dst, uint32_t pitch);
+
+// Both screens into a FRAME_WIDTH x FRAME_HEIGHT image, black where there's
+// nothing to show
+void ComposeFrame(const uint32_t* ext_regs, uint32_t* dst);
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// PICA framebuffers and textures are made of 8x8 tiles, stored left to right
+// and then top to bottom. The pixels inside a tile are in Morton (Z) order:
+// the bits of x and y interleave, x in the low bit.
+inline uint32_t MortonInterleave(uint32_t x, uint32_t y)
+{
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+}
+
+// Index of pixel (x, y) in a tiled image width pixels wide
+inline uint32_t TiledPixelIndex(uint32_t x, uint32_t y, uint32_t width)
+{
+    return (y & ~7) * width + (x & ~7) * 8 + MortonInterleave(x & 7, y & 7);
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// PICA200 internal register indices. The CPU sees register n at
+// 0x10401000 + n*4, command lists address them by index directly.
+constexpr uint32_t PICA_REG_COUNT = 0x300;
+
+enum PicaReg : uint32_t
+{
+    PICA_REG_FINALIZE = 0x010,
+
+    PICA_REG_CULL_MODE = 0x040,
+    PICA_REG_VIEWPORT_WIDTH = 0x041,
+    PICA_REG_VIEWPORT_INVW = 0x042,
+    PICA_REG_VIEWPORT_HEIGHT = 0x043,
+    PICA_REG_VIEWPORT_INVH = 0x044,
+    PICA_REG_DEPTHMAP_SCALE = 0x04D,
+    PICA_REG_DEPTHMAP_OFFSET = 0x04E,
+    PICA_REG_SH_OUTMAP_TOTAL = 0x04F,
+    PICA_REG_SH_OUTMAP_O0 = 0x050,
+    PICA_REG_VIEWPORT_XY = 0x068,
+    PICA_REG_SH_OUTATTR_MODE = 0x06F,
+
+    PICA_REG_TEXUNIT_CONFIG = 0x080,
+    PICA_REG_TEXUNIT0_BORDER_COLOR = 0x081,
+    PICA_REG_TEXUNIT0_DIM = 0x082,
+    PICA_REG_TEXUNIT0_PARAM = 0x083,
+    PICA_REG_TEXUNIT0_ADDR1 = 0x085,
+    PICA_REG_TEXUNIT0_TYPE = 0x08E,
+    PICA_REG_TEXUNIT1_BORDER_COLOR = 0x091,
+    PICA_REG_TEXUNIT1_DIM = 0x092,
+    PICA_REG_TEXUNIT1_PARAM = 0x093,
+    PICA_REG_TEXUNIT1_ADDR = 0x095,
+    PICA_REG_TEXUNIT1_TYPE = 0x096,
+    PICA_REG_TEXUNIT2_BORDER_COLOR = 0x099,
+    PICA_REG_TEXUNIT2_DIM = 0x09A,
+    PICA_REG_TEXUNIT2_PARAM = 0x09B,
+    PICA_REG_TEXUNIT2_ADDR = 0x09D,
+    PICA_REG_TEXUNIT2_TYPE = 0x09E,
+
+    PICA_REG_TEXENV0_SOURCE = 0x0C0,
+    PICA_REG_TEXENV_UPDATE_BUFFER = 0x0E0,
+    PICA_REG_TEXENV_BUFFER_COLOR = 0x0FD,
+
+    PICA_REG_COLOR_OPERATION = 0x100,
+    PICA_REG_BLEND_FUNC = 0x101,
+    PICA_REG_LOGIC_OP = 0x102,
+    PICA_REG_BLEND_COLOR = 0x103,
+    PICA_REG_FRAGOP_ALPHA_TEST = 0x104,
+    PICA_REG_STENCIL_TEST = 0x105,
+    PICA_REG_STENCIL_OP = 0x106,
+    PICA_REG_DEPTH_COLOR_MASK = 0x107,
+    PICA_REG_FRAMEBUFFER_INVALIDATE = 0x110,
+    PICA_REG_FRAMEBUFFER_FLUSH = 0x111,
+    PICA_REG_COLORBUFFER_READ = 0x112,
+    PICA_REG_COLORBUFFER_WRITE = 0x113,
+    PICA_REG_DEPTHBUFFER_READ = 0x114,
+    PICA_REG_DEPTHBUFFER_WRITE = 0x115,
+    PICA_REG_DEPTHBUFFER_FORMAT = 0x116,
+    PICA_REG_COLORBUFFER_FORMAT = 0x117,
+    PICA_REG_DEPTHBUFFER_LOC = 0x11C,
+    PICA_REG_COLORBUFFER_LOC = 0x11D,
+    PICA_REG_FRAMEBUFFER_DIM = 0x11E,
+
+    PICA_REG_ATTRIBBUFFERS_LOC = 0x200,
+    PICA_REG_ATTRIBBUFFERS_FORMAT_LOW = 0x201,
+    PICA_REG_ATTRIBBUFFERS_FORMAT_HIGH = 0x202,
+    PICA_REG_ATTRIBBUFFER0_OFFSET = 0x203,
+    PICA_REG_INDEXBUFFER_CONFIG = 0x227,
+    PICA_REG_NUMVERTICES = 0x228,
+    PICA_REG_VERTEX_OFFSET = 0x22A,
+    PICA_REG_FIXEDATTRIB_INDEX = 0x232,
+    PICA_REG_FIXEDATTRIB_DATA0 = 0x233,
+    PICA_REG_DRAWARRAYS = 0x22E,
+    PICA_REG_DRAWELEMENTS = 0x22F,
+
+    PICA_REG_CMDBUF_SIZE0 = 0x238,
+    PICA_REG_CMDBUF_SIZE1 = 0x239,
+    PICA_REG_CMDBUF_ADDR0 = 0x23A,
+    PICA_REG_CMDBUF_ADDR1 = 0x23B,
+    PICA_REG_CMDBUF_JUMP0 = 0x23C,
+    PICA_REG_CMDBUF_JUMP1 = 0x23D,
+
+    PICA_REG_VSH_NUM_ATTR = 0x242,
+    PICA_REG_PRIMITIVE_CONFIG = 0x25E,
+    PICA_REG_RESTART_PRIMITIVE = 0x25F,
+
+    PICA_REG_VSH_BOOLUNIFORM = 0x2B0,
+    PICA_REG_VSH_INTUNIFORM_I0 = 0x2B1,
+    PICA_REG_VSH_INPUTBUFFER_CONFIG = 0x2B9,
+    PICA_REG_VSH_ENTRYPOINT = 0x2BA,
+    PICA_REG_VSH_ATTRIBUTES_PERMUTATION_LOW = 0x2BB,
+    PICA_REG_VSH_ATTRIBUTES_PERMUTATION_HIGH = 0x2BC,
+    PICA_REG_VSH_OUTMAP_MASK = 0x2BD,
+    PICA_REG_VSH_CODETRANSFER_END = 0x2BF,
+    PICA_REG_VSH_FLOATUNIFORM_INDEX = 0x2C0,
+    PICA_REG_VSH_FLOATUNIFORM_DATA = 0x2C1,
+    PICA_REG_VSH_CODETRANSFER_INDEX = 0x2CB,
+    PICA_REG_VSH_CODETRANSFER_DATA = 0x2CC,
+    PICA_REG_VSH_OPDESCS_INDEX = 0x2D5,
+    PICA_REG_VSH_OPDESCS_DATA = 0x2D6,
+};
+
+// Interrupt raised when a command list writes PICA_REG_FINALIZE
+constexpr int PICA_IRQ_P3D = 0x2D;
+
+// The PICA's 24-bit floats: sign, 7-bit exponent biased by 63, 16-bit
+// mantissa. Denormals flush to zero.
+inline float f24_to_float(uint32_t value)
+{
+    uint32_t sign = (value >> 23) & 1;
+    uint32_t exponent = (value >> 16) & 0x7F;
+    uint32_t mantissa = value & 0xFFFF;
+
+    uint32_t bits;
+    if (exponent == 0)
+        bits = sign << 31;
+    else if (exponent == 0x7F)
+        bits = (sign << 31) | (0xFF << 23) | (mantissa << 7);
+    else
+        bits = (sign << 31) | ((exponent - 63 + 127) << 23) | (mantissa << 7);
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Four float24s packed into three words, w first
+inline void f24x4_to_float(const uint32_t words[3], float out[4])
+{
+    out[3] = f24_to_float(words[0] >> 8);
+    out[2] = f24_to_float(((words[0] & 0xFF) << 16) | (words[1] >> 16));
+    out[1] = f24_to_float(((words[1] & 0xFFFF) << 8) | (words[2] >> 24));
+    out[0] = f24_to_float(words[2] & 0xFFFFFF);
+}
@@ -0,0 +1,849 @@
+#include "rasterizer.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <gpu/morton.h>
+#include <gpu/pica_regs.h>
+#include <memory/Bus.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Hosts with AVX rasterize eight pixels at a time, picked at runtime so the
+// default build still runs on any x86-64. The wide path does the same float
+// operations in the same order, without FMAs, so frames don't depend on the
+// host.
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define RASTER_AVX 1
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+int PicaRasterizer::requested_workers = -1;
+
+enum CompareFunc
+{
+    COMPARE_NEVER,
+    COMPARE_ALWAYS,
+    COMPARE_EQUAL,
+    COMPARE_NOT_EQUAL,
+    COMPARE_LESS,
+    COMPARE_LESS_EQUAL,
+    COMPARE_GREATER,
+    COMPARE_GREATER_EQUAL,
+};
+
+enum CullMode
+{
+    CULL_NONE,
+    CULL_COUNTER_CLOCKWISE,
+    CULL_CLOCKWISE,
+};
+
+static bool compare(uint32_t func, uint32_t a, uint32_t b)
+{
+    switch (func)
+    {
+    case COMPARE_NEVER: return false;
+    case COMPARE_ALWAYS: return true;
+    case COMPARE_EQUAL: return a == b;
+    case COMPARE_NOT_EQUAL: return a != b;
+    case COMPARE_LESS: return a < b;
+    case COMPARE_LESS_EQUAL: return a <= b;
+    case COMPARE_GREATER: return a > b;
+    default: return a >= b;
+    }
+}
+
+static uint8_t stencil_op(uint32_t op, uint8_t value, uint8_t ref)
+{
+    switch (op)
+    {
+    case 0: return value;
+    case 1: return 0;
+    case 2: return ref;
+    case 3: return value == 255 ? 255 : value + 1;
+    case 4: return value == 0 ? 0 : value - 1;
+    case 5: return ~value;
+    case 6: return value + 1;
+    default: return value - 1;
+    }
+}
+
+static Color blend_factor(uint32_t factor, Color src, Color dst, Color constant)
+{
+    uint8_t f;
+    switch (factor)
+    {
+    case 0: return {0, 0, 0, 0};
+    case 1: return {255, 255, 255, 255};
+    case 2: return src;
+    case 3: return {(uint8_t)(255 - src.r), (uint8_t)(255 - src.g), (uint8_t)(255 - src.b), (uint8_t)(255 - src.a)};
+    case 4: return dst;
+    case 5: return {(uint8_t)(255 - dst.r), (uint8_t)(255 - dst.g), (uint8_t)(255 - dst.b), (uint8_t)(255 - dst.a)};
+    case 6: return {src.a, src.a, src.a, src.a};
+    case 7: f = 255 - src.a; return {f, f, f, f};
+    case 8: return {dst.a, dst.a, dst.a, dst.a};
+    case 9: f = 255 - dst.a; return {f, f, f, f};
+    case 10: return constant;
+    case 11: return {(uint8_t)(255 - constant.r), (uint8_t)(255 - constant.g), (uint8_t)(255 - constant.b), (uint8_t)(255 - constant.a)};
+    case 12: return {constant.a, constant.a, constant.a, constant.a};
+    case 13: f = 255 - constant.a; return {f, f, f, f};
+    default: f = std::min<uint8_t>(src.a, 255 - dst.a); return {f, f, f, 255};
+    }
+}
+
+static uint8_t blend_channel(uint32_t equation, uint8_t src, uint8_t dst, uint8_t src_factor, uint8_t dst_factor)
+{
+    int s = (src * src_factor + 127) / 255;
+    int d = (dst * dst_factor + 127) / 255;
+    switch (equation)
+    {
+    case 0: return std::min(s + d, 255);
+    case 1: return std::max(s - d, 0);
+    case 2: return std::max(d - s, 0);
+    case 3: return std::min(src, dst);
+    default: return std::max(src, dst);
+    }
+}
+
+static uint8_t logic_op(uint32_t op, uint8_t src, uint8_t dst)
+{
+    switch (op)
+    {
+    case 0: return 0;
+    case 1: return src & dst;
+    case 2: return src & ~dst;
+    case 3: return src;
+    case 4: return 255;
+    case 5: return ~src;
+    case 6: return dst;
+    case 7: return ~dst;
+    case 8: return ~(src & dst);
+    case 9: return src | dst;
+    case 10: return ~(src | dst);
+    case 11: return src ^ dst;
+    case 12: return ~(src ^ dst);
+    case 13: return ~src & dst;
+    case 14: return src | ~dst;
+    default: return ~src | dst;
+    }
+}
+
+// Primary color only, for draws that haven't been given a fragment shader
+static void shade_vertex_color(const float attr[RASTER_ATTRIB_COUNT][4], Color out[4])
+{
+    for (int lane = 0; lane < 4; lane++)
+    {
+        out[lane].r = std::clamp(attr[RASTER_COLOR_R][lane], 0.0f, 1.0f) * 255.0f + 0.5f;
+        out[lane].g = std::clamp(attr[RASTER_COLOR_G][lane], 0.0f, 1.0f) * 255.0f + 0.5f;
+        out[lane].b = std::clamp(attr[RASTER_COLOR_B][lane], 0.0f, 1.0f) * 255.0f + 0.5f;
+        out[lane].a = std::clamp(attr[RASTER_COLOR_A][lane], 0.0f, 1.0f) * 255.0f + 0.5f;
+    }
+}
+
+void PicaRasterizer::SetWorkerCount(int count)
+{
+    requested_workers = count;
+}
+
+bool PicaRasterizer::Configure(const uint32_t* regs)
+{
+    state.width = regs[PICA_REG_FRAMEBUFFER_DIM] & 0x7FF;
+    state.height = ((regs[PICA_REG_FRAMEBUFFER_DIM] >> 12) & 0x3FF) + 1;
+
+    state.color_format = (regs[PICA_REG_COLORBUFFER_FORMAT] >> 16) & 7;
+    state.color_bpp = ColorFormatBpp(state.color_format);
+    state.depth_format = regs[PICA_REG_DEPTHBUFFER_FORMAT] & 3;
+    state.depth_bpp = state.depth_format == 0 ? 2 : state.depth_format == 3 ? 4 : 3;
+
+    uint32_t pixels = state.width * state.height;
+    state.color_addr = regs[PICA_REG_COLORBUFFER_LOC] * 8;
+    state.color_size = pixels * state.color_bpp;
+    state.depth_addr = regs[PICA_REG_DEPTHBUFFER_LOC] * 8;
+    state.depth_size = pixels * state.depth_bpp;
+    state.color_buffer = Bus::GetPhysicalPtr(state.color_addr, state.color_size);
+    state.depth_buffer = state.depth_addr ? Bus::GetPhysicalPtr(state.depth_addr, state.depth_size) : nullptr;
+    if (!state.color_buffer || !pixels)
+    {
+        printf("[RAST]: Color buffer at 0x%08x (%ux%u) isn't in memory\n", state.color_addr, state.width, state.height);
+        state.color_buffer = nullptr;
+        return false;
+    }
+
+    state.viewport_half_w = f24_to_float(regs[PICA_REG_VIEWPORT_WIDTH]);
+    state.viewport_half_h = f24_to_float(regs[PICA_REG_VIEWPORT_HEIGHT]);
+    state.viewport_x = (int32_t)(regs[PICA_REG_VIEWPORT_XY] << 22) >> 22;
+    state.viewport_y = (int32_t)(regs[PICA_REG_VIEWPORT_XY] << 6) >> 22;
+    state.depth_scale = f24_to_float(regs[PICA_REG_DEPTHMAP_SCALE]);
+    state.depth_offset = f24_to_float(regs[PICA_REG_DEPTHMAP_OFFSET]);
+    state.cull_mode = regs[PICA_REG_CULL_MODE] & 3;
+
+    uint32_t alpha = regs[PICA_REG_FRAGOP_ALPHA_TEST];
+    state.alpha_test = alpha & 1;
+    state.alpha_func = (alpha >> 4) & 7;
+    state.alpha_ref = alpha >> 8;
+
+    // Only the D24S8 format has a stencil buffer. With D24 the byte after a
+    // pixel's depth is the next pixel's, so neither the test nor the write
+    // may touch it.
+    uint32_t stencil = regs[PICA_REG_STENCIL_TEST];
+    uint32_t stencil_ops = regs[PICA_REG_STENCIL_OP];
+    bool has_stencil = state.depth_buffer && state.depth_format == 3;
+    state.stencil_test = has_stencil && (stencil & 1);
+    state.stencil_func = (stencil >> 4) & 7;
+    state.stencil_write_mask = stencil >> 8;
+    state.stencil_ref = stencil >> 16;
+    state.stencil_input_mask = stencil >> 24;
+    state.stencil_fail = stencil_ops & 7;
+    state.stencil_zfail = (stencil_ops >> 4) & 7;
+    state.stencil_zpass = (stencil_ops >> 8) & 7;
+    state.stencil_write = has_stencil && (stencil & 1) && (regs[PICA_REG_DEPTHBUFFER_WRITE] & 1);
+
+    uint32_t depth_color = regs[PICA_REG_DEPTH_COLOR_MASK];
+    state.depth_test = state.depth_buffer && (depth_color & 1);
+    state.depth_func = (depth_color >> 4) & 7;
+    state.depth_write = state.depth_buffer && ((depth_color >> 12) & 1) && (regs[PICA_REG_DEPTHBUFFER_WRITE] & 2);
+    state.color_mask = (depth_color >> 8) & 0xF;
+    state.color_write = state.color_mask && regs[PICA_REG_COLORBUFFER_WRITE];
+
+    uint32_t blend = regs[PICA_REG_BLEND_FUNC];
+    uint32_t blend_color = regs[PICA_REG_BLEND_COLOR];
+    state.blend = (regs[PICA_REG_COLOR_OPERATION] >> 8) & 1;
+    state.blend_eq_rgb = blend & 7;
+    state.blend_eq_a = (blend >> 8) & 7;
+    state.blend_src_rgb = (blend >> 16) & 0xF;
+    state.blend_dst_rgb = (blend >> 20) & 0xF;
+    state.blend_src_a = (blend >> 24) & 0xF;
+    state.blend_dst_a = blend >> 28;
+    state.blend_color = {(uint8_t)blend_color, (uint8_t)(blend_color >> 8), (uint8_t)(blend_color >> 16), (uint8_t)(blend_color >> 24)};
+    state.logic_op = regs[PICA_REG_LOGIC_OP] & 0xF;
+    state.color_replace = !state.blend && state.logic_op == 3 && state.color_mask == 0xF;
+
+    tiles_x = (state.width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (state.height + TILE_SIZE - 1) / TILE_SIZE;
+    if (bins.size() < tiles_x * tiles_y)
+        bins.resize(tiles_x * tiles_y);
+    return true;
+}
+
+void PicaRasterizer::SetFragmentShader(FragmentShader shader, const void* ctx)
+{
+    state.shader = shader;
+    state.shader_ctx = ctx;
+}
+
+// Screen space has its origin at the bottom left, and so does framebuffer
+// memory: its first row is the bottom one
+bool PicaRasterizer::SetupTriangle(const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2, Triangle& tri)
+{
+    const RasterVertex* v[3] = {v0, v1, v2};
+    float sx[3], sy[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        // Clipping leaves w at epsilon or more, this only catches NaNs
+        float w = v[i]->pos[3];
+        if (!(w > 0.0f))
+            return false;
+
+        float inv_w = 1.0f / w;
+        // Snap to the hardware's 4 bits of subpixel precision
+        sx[i] = roundf(((v[i]->pos[0] * inv_w + 1.0f) * state.viewport_half_w + state.viewport_x) * 16.0f) / 16.0f;
+        sy[i] = roundf(((v[i]->pos[1] * inv_w + 1.0f) * state.viewport_half_h + state.viewport_y) * 16.0f) / 16.0f;
+        tri.z[i] = v[i]->pos[2] * inv_w * state.depth_scale + state.depth_offset;
+        tri.inv_w[i] = inv_w;
+        for (int j = 0; j < RASTER_ATTRIB_COUNT; j++)
+            tri.attr[i][j] = v[i]->attr[j];
+    }
+
+    float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+    if (!(fabsf(area) > 0.0f))
+        return false;
+
+    bool ccw = area > 0.0f;
+    if ((state.cull_mode == CULL_COUNTER_CLOCKWISE && ccw) || (state.cull_mode == CULL_CLOCKWISE && !ccw))
+        return false;
+
+    // Two triangles sharing an edge get exactly negated coefficients for it,
+    // so every pixel on the edge goes to exactly one of them
+    float sign = ccw ? 1.0f : -1.0f;
+    for (int k = 0; k < 3; k++)
+    {
+        int a = (k + 1) % 3;
+        int b = (k + 2) % 3;
+        tri.edge_a[k] = (sy[a] - sy[b]) * sign;
+        tri.edge_b[k] = (sx[b] - sx[a]) * sign;
+        tri.edge_c[k] = (sx[a] * sy[b] - sy[a] * sx[b]) * sign;
+        tri.edge_inclusive[k] = tri.edge_a[k] > 0.0f || (tri.edge_a[k] == 0.0f && tri.edge_b[k] > 0.0f);
+    }
+    tri.inv_area = 1.0f / (area * sign);
+
+    tri.min_x = std::max<int>(0, floorf(std::min({sx[0], sx[1], sx[2]})));
+    tri.min_y = std::max<int>(0, floorf(std::min({sy[0], sy[1], sy[2]})));
+    tri.max_x = std::min<float>(state.width - 1, ceilf(std::max({sx[0], sx[1], sx[2]})));
+    tri.max_y = std::min<float>(state.height - 1, ceilf(std::max({sy[0], sy[1], sy[2]})));
+    return tri.min_x <= tri.max_x && tri.min_y <= tri.max_y;
+}
+
+void PicaRasterizer::BinTriangle(uint32_t index)
+{
+    const Triangle& tri = triangles[index];
+
+    for (int ty = tri.min_y / TILE_SIZE; ty <= tri.max_y / TILE_SIZE; ty++)
+    {
+        for (int tx = tri.min_x / TILE_SIZE; tx <= tri.max_x / TILE_SIZE; tx++)
+        {
+            // Skip tiles entirely outside one of the edges, checking the
+            // pixel center nearest to its inside
+            float x0 = tx * TILE_SIZE + 0.5f, x1 = x0 + TILE_SIZE - 1;
+            float y0 = ty * TILE_SIZE + 0.5f, y1 = y0 + TILE_SIZE - 1;
+            bool outside = false;
+            for (int k = 0; k < 3 && !outside; k++)
+            {
+                float e = tri.edge_a[k] * (tri.edge_a[k] > 0 ? x1 : x0) + tri.edge_b[k] * (tri.edge_b[k] > 0 ? y1 : y0) + tri.edge_c[k];
+                outside = e < 0.0f;
+            }
+            if (outside)
+                continue;
+
+            std::vector<uint32_t>& bin = bins[ty * tiles_x + tx];
+            if (bin.empty())
+                active_tiles.push_back(ty * tiles_x + tx);
+            bin.push_back(index);
+        }
+    }
+}
+
+// Planes of the PICA's clip volume: in front of the camera, and 0 >= z >= -w.
+// X and Y aren't clipped, the rasterizer's bounding box takes care of them.
+constexpr int CLIP_PLANES = 3;
+constexpr float CLIP_EPSILON = 1e-5f;
+constexpr int MAX_CLIPPED_VERTICES = 3 + CLIP_PLANES;
+
+// Positive inside the plane
+static float clip_distance(const RasterVertex& v, int plane)
+{
+    switch (plane)
+    {
+    case 0: return v.pos[3] - CLIP_EPSILON;
+    case 1: return -v.pos[2];
+    default: return v.pos[2] + v.pos[3];
+    }
+}
+
+static bool inside_clip_volume(const RasterVertex* v)
+{
+    for (int plane = 0; plane < CLIP_PLANES; plane++)
+    {
+        if (!(clip_distance(v[0], plane) >= 0.0f && clip_distance(v[1], plane) >= 0.0f && clip_distance(v[2], plane) >= 0.0f))
+            return false;
+    }
+    return true;
+}
+
+// Where the edge from inside vertex a to outside vertex b meets the plane.
+// Always interpolated from the inside, so triangles sharing an edge get the
+// same vertex.
+static RasterVertex clip_edge(const RasterVertex& a, const RasterVertex& b, float da, float db)
+{
+    float t = da / (da - db);
+    RasterVertex v;
+    for (int i = 0; i < 4; i++)
+        v.pos[i] = a.pos[i] + (b.pos[i] - a.pos[i]) * t;
+    for (int i = 0; i < RASTER_ATTRIB_COUNT; i++)
+        v.attr[i] = a.attr[i] + (b.attr[i] - a.attr[i]) * t;
+    return v;
+}
+
+// Clips a triangle to the clip volume, returns the number of vertices of
+// the polygon left, which keeps the triangle's winding
+static int clip_triangle(const RasterVertex* tri, RasterVertex out[MAX_CLIPPED_VERTICES])
+{
+    RasterVertex buffer[MAX_CLIPPED_VERTICES];
+    RasterVertex* in = out;
+    RasterVertex* next = buffer;
+    int count = 3;
+    std::copy(tri, tri + 3, in);
+
+    for (int plane = 0; plane < CLIP_PLANES && count; plane++)
+    {
+        int kept = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const RasterVertex& a = in[i];
+            const RasterVertex& b = in[(i + 1) % count];
+            float da = clip_distance(a, plane);
+            float db = clip_distance(b, plane);
+            if (da >= 0.0f)
+                next[kept++] = a;
+            if (da >= 0.0f && db < 0.0f)
+                next[kept++] = clip_edge(a, b, da, db);
+            else if (da < 0.0f && db >= 0.0f)
+                next[kept++] = clip_edge(b, a, db, da);
+        }
+        std::swap(in, next);
+        count = kept;
+    }
+
+    if (in != out)
+        std::copy(in, in + count, out);
+    return count;
+}
+
+void PicaRasterizer::DrawTriangles(const RasterVertex* vertices, size_t count)
+{
+    if (!state.color_buffer)
+        return;
+
+    triangles.resize(count / 3);
+    uint32_t setup = 0;
+    auto add = [&](const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2)
+    {
+        if (setup == triangles.size())
+            triangles.emplace_back();
+        if (SetupTriangle(v0, v1, v2, triangles[setup]))
+            BinTriangle(setup++);
+    };
+
+    for (size_t i = 0; i + 2 < count; i += 3)
+    {
+        if (inside_clip_volume(&vertices[i]))
+        {
+            add(&vertices[i], &vertices[i + 1], &vertices[i + 2]);
+            continue;
+        }
+
+        // Crosses the camera plane or the depth range, draw what's inside
+        // as a fan
+        RasterVertex polygon[MAX_CLIPPED_VERTICES];
+        int corners = clip_triangle(&vertices[i], polygon);
+        for (int k = 1; k + 1 < corners; k++)
+            add(&polygon[0], &polygon[k], &polygon[k + 1]);
+    }
+    triangles_drawn += setup;
+
+    if (active_tiles.size() > 1)
+    {
+        StartWorkers();
+
+        std::unique_lock<std::mutex> guard(lock);
+        next_tile = 0;
+        workers_busy = worker_count;
+        work_generation++;
+        work_ready.notify_all();
+        guard.unlock();
+
+        RunTiles();
+
+        guard.lock();
+        work_done.wait(guard, [this] { return workers_busy == 0; });
+    }
+    else
+    {
+        next_tile = 0;
+        RunTiles();
+    }
+
+    for (uint32_t tile : active_tiles)
+        bins[tile].clear();
+    active_tiles.clear();
+}
+
+void PicaRasterizer::RunTiles()
+{
+    uint64_t fragments = 0;
+    uint32_t i;
+    while ((i = next_tile++) < active_tiles.size())
+        fragments += RasterizeTile(active_tiles[i]);
+    fragments_shaded += fragments;
+}
+
+void PicaRasterizer::StartWorkers()
+{
+    if (worker_count >= 0)
+        return;
+
+    worker_count = requested_workers;
+    if (worker_count < 0)
+        worker_count = std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1) - 1, 15);
+
+    // They sleep on the condition variable until the next draw
+    for (int i = 0; i < worker_count; i++)
+        workers.emplace_back(&PicaRasterizer::WorkerLoop, this);
+}
+
+PicaRasterizer::~PicaRasterizer()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void PicaRasterizer::WorkerLoop()
+{
+    uint64_t seen = 0;
+    while (1)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [&] { return stopping || work_generation != seen; });
+            if (stopping)
+                return;
+            seen = work_generation;
+        }
+
+        RunTiles();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--workers_busy == 0)
+            work_done.notify_all();
+    }
+}
+
+// Coverage and perspective-correct weights for the four pixels starting at
+// (x, y). Returns the mask of covered pixels.
+static int eval_quad(const float* edge_a, const float* edge_b, const float* edge_c, const bool* inclusive,
+    float inv_area, const float* inv_w, const float* z, int x, int y, float weights[3][4], float depth[4])
+{
+    float fy = y + 0.5f;
+
+#if defined(__SSE2__)
+    __m128 xs = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+    __m128 zero = _mm_setzero_ps();
+    __m128 l[3];
+    int mask = 0xF;
+    for (int k = 0; k < 3; k++)
+    {
+        __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[k]), xs), _mm_set1_ps(edge_b[k] * fy + edge_c[k]));
+        mask &= _mm_movemask_ps(inclusive[k] ? _mm_cmpge_ps(e, zero) : _mm_cmpgt_ps(e, zero));
+        l[k] = _mm_mul_ps(e, _mm_set1_ps(inv_area));
+    }
+    if (!mask)
+        return 0;
+
+    __m128 q0 = _mm_mul_ps(l[0], _mm_set1_ps(inv_w[0]));
+    __m128 q1 = _mm_mul_ps(l[1], _mm_set1_ps(inv_w[1]));
+    __m128 q2 = _mm_mul_ps(l[2], _mm_set1_ps(inv_w[2]));
+    __m128 r = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(q0, q1), q2));
+    _mm_storeu_ps(weights[0], _mm_mul_ps(q0, r));
+    _mm_storeu_ps(weights[1], _mm_mul_ps(q1, r));
+    _mm_storeu_ps(weights[2], _mm_mul_ps(q2, r));
+
+    __m128 d = _mm_mul_ps(l[0], _mm_set1_ps(z[0]));
+    d = _mm_add_ps(d, _mm_mul_ps(l[1], _mm_set1_ps(z[1])));
+    d = _mm_add_ps(d, _mm_mul_ps(l[2], _mm_set1_ps(z[2])));
+    _mm_storeu_ps(depth, d);
+    return mask;
+#else
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        float fx = x + lane + 0.5f;
+        float l[3];
+        bool inside = true;
+        for (int k = 0; k < 3; k++)
+        {
+            float e = edge_a[k] * fx + (edge_b[k] * fy + edge_c[k]);
+            inside &= inclusive[k] ? e >= 0.0f : e > 0.0f;
+            l[k] = e * inv_area;
+        }
+        if (!inside)
+            continue;
+
+        mask |= 1 << lane;
+        float q[3] = {l[0] * inv_w[0], l[1] * inv_w[1], l[2] * inv_w[2]};
+        float r = 1.0f / (q[0] + q[1] + q[2]);
+        for (int k = 0; k < 3; k++)
+            weights[k][lane] = q[k] * r;
+        depth[lane] = l[0] * z[0] + l[1] * z[1] + l[2] * z[2];
+    }
+    return mask;
+#endif
+}
+
+static void interpolate(const float attr[3][RASTER_ATTRIB_COUNT], const float weights[3][4], float out[RASTER_ATTRIB_COUNT][4])
+{
+#if defined(__SSE2__)
+    __m128 w0 = _mm_loadu_ps(weights[0]);
+    __m128 w1 = _mm_loadu_ps(weights[1]);
+    __m128 w2 = _mm_loadu_ps(weights[2]);
+    for (int i = 0; i < RASTER_ATTRIB_COUNT; i++)
+    {
+        __m128 v = _mm_mul_ps(w0, _mm_set1_ps(attr[0][i]));
+        v = _mm_add_ps(v, _mm_mul_ps(w1, _mm_set1_ps(attr[1][i])));
+        v = _mm_add_ps(v, _mm_mul_ps(w2, _mm_set1_ps(attr[2][i])));
+        _mm_storeu_ps(out[i], v);
+    }
+#else
+    for (int i = 0; i < RASTER_ATTRIB_COUNT; i++)
+    {
+        for (int lane = 0; lane < 4; lane++)
+            out[i][lane] = weights[0][lane] * attr[0][i] + weights[1][lane] * attr[1][i] + weights[2][lane] * attr[2][i];
+    }
+#endif
+}
+
+#if defined(RASTER_AVX)
+// eval_quad over the eight pixels starting at (x, y)
+TARGET_AVX
+static int eval_octet(const float* edge_a, const float* edge_b, const float* edge_c, const bool* inclusive,
+    float inv_area, const float* inv_w, const float* z, int x, int y, float weights[3][8], float depth[8])
+{
+    __m256 xs = _mm256_add_ps(_mm256_set1_ps(x + 0.5f), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 l[3];
+    int mask = 0xFF;
+    for (int k = 0; k < 3; k++)
+    {
+        __m256 e = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edge_a[k]), xs), _mm256_set1_ps(edge_b[k] * (y + 0.5f) + edge_c[k]));
+        mask &= _mm256_movemask_ps(inclusive[k] ? _mm256_cmp_ps(e, zero, _CMP_GE_OQ) : _mm256_cmp_ps(e, zero, _CMP_GT_OQ));
+        l[k] = _mm256_mul_ps(e, _mm256_set1_ps(inv_area));
+    }
+    if (!mask)
+        return 0;
+
+    __m256 q0 = _mm256_mul_ps(l[0], _mm256_set1_ps(inv_w[0]));
+    __m256 q1 = _mm256_mul_ps(l[1], _mm256_set1_ps(inv_w[1]));
+    __m256 q2 = _mm256_mul_ps(l[2], _mm256_set1_ps(inv_w[2]));
+    __m256 r = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_add_ps(q0, q1), q2));
+    _mm256_storeu_ps(weights[0], _mm256_mul_ps(q0, r));
+    _mm256_storeu_ps(weights[1], _mm256_mul_ps(q1, r));
+    _mm256_storeu_ps(weights[2], _mm256_mul_ps(q2, r));
+
+    __m256 d = _mm256_mul_ps(l[0], _mm256_set1_ps(z[0]));
+    d = _mm256_add_ps(d, _mm256_mul_ps(l[1], _mm256_set1_ps(z[1])));
+    d = _mm256_add_ps(d, _mm256_mul_ps(l[2], _mm256_set1_ps(z[2])));
+    _mm256_storeu_ps(depth, d);
+    return mask;
+}
+
+// interpolate for both quads of an octet, split back into the shader's
+// four-lane layout
+TARGET_AVX
+static void interpolate_octet(const float attr[3][RASTER_ATTRIB_COUNT], const float weights[3][8],
+    float lo[RASTER_ATTRIB_COUNT][4], float hi[RASTER_ATTRIB_COUNT][4])
+{
+    __m256 w0 = _mm256_loadu_ps(weights[0]);
+    __m256 w1 = _mm256_loadu_ps(weights[1]);
+    __m256 w2 = _mm256_loadu_ps(weights[2]);
+    for (int i = 0; i < RASTER_ATTRIB_COUNT; i++)
+    {
+        __m256 v = _mm256_mul_ps(w0, _mm256_set1_ps(attr[0][i]));
+        v = _mm256_add_ps(v, _mm256_mul_ps(w1, _mm256_set1_ps(attr[1][i])));
+        v = _mm256_add_ps(v, _mm256_mul_ps(w2, _mm256_set1_ps(attr[2][i])));
+        _mm256_storeu2_m128(hi[i], lo[i], v);
+    }
+}
+
+static const bool has_avx = __builtin_cpu_supports("avx");
+#endif
+
+uint64_t PicaRasterizer::ShadeQuad(int x, int y, int mask, const float attr[RASTER_ATTRIB_COUNT][4], const float depth[4])
+{
+    Color colors[4];
+    if (state.shader)
+        state.shader(state.shader_ctx, attr, colors);
+    else
+        shade_vertex_color(attr, colors);
+
+    uint64_t fragments = 0;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (mask & (1 << lane))
+        {
+            WriteFragment(x + lane, y, depth[lane], colors[lane]);
+            fragments++;
+        }
+    }
+    return fragments;
+}
+
+uint64_t PicaRasterizer::RasterizeTile(uint32_t tile)
+{
+#if defined(RASTER_AVX)
+    if (has_avx)
+        return RasterizeTileWide(tile);
+#endif
+
+    int tile_x = (tile % tiles_x) * TILE_SIZE;
+    int tile_y = (tile / tiles_x) * TILE_SIZE;
+    uint64_t fragments = 0;
+
+    for (uint32_t index : bins[tile])
+    {
+        const Triangle& tri = triangles[index];
+        int x0 = std::max(tile_x, tri.min_x) & ~3;
+        int x1 = std::min(tile_x + TILE_SIZE - 1, tri.max_x);
+        int y0 = std::max(tile_y, tri.min_y);
+        int y1 = std::min(tile_y + TILE_SIZE - 1, tri.max_y);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x += 4)
+            {
+                float weights[3][4], depth[4];
+                int mask = eval_quad(tri.edge_a, tri.edge_b, tri.edge_c, tri.edge_inclusive, tri.inv_area,
+                    tri.inv_w, tri.z, x, y, weights, depth);
+                // Past the right edge of the framebuffer
+                if (x1 - x < 3)
+                    mask &= (1 << (x1 - x + 1)) - 1;
+                if (!mask)
+                    continue;
+
+                float attr[RASTER_ATTRIB_COUNT][4];
+                interpolate(tri.attr, weights, attr);
+                fragments += ShadeQuad(x, y, mask, attr, depth);
+            }
+        }
+    }
+
+    return fragments;
+}
+
+#if defined(RASTER_AVX)
+TARGET_AVX
+uint64_t PicaRasterizer::RasterizeTileWide(uint32_t tile)
+{
+    int tile_x = (tile % tiles_x) * TILE_SIZE;
+    int tile_y = (tile / tiles_x) * TILE_SIZE;
+    uint64_t fragments = 0;
+
+    for (uint32_t index : bins[tile])
+    {
+        const Triangle& tri = triangles[index];
+        int x0 = std::max(tile_x, tri.min_x) & ~3;
+        int x1 = std::min(tile_x + TILE_SIZE - 1, tri.max_x);
+        int y0 = std::max(tile_y, tri.min_y);
+        int y1 = std::min(tile_y + TILE_SIZE - 1, tri.max_y);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x += 8)
+            {
+                float weights[3][8], depth[8];
+                int mask = eval_octet(tri.edge_a, tri.edge_b, tri.edge_c, tri.edge_inclusive, tri.inv_area,
+                    tri.inv_w, tri.z, x, y, weights, depth);
+                if (x1 - x < 7)
+                    mask &= (1 << (x1 - x + 1)) - 1;
+                if (!mask)
+                    continue;
+
+                float lo[RASTER_ATTRIB_COUNT][4], hi[RASTER_ATTRIB_COUNT][4];
+                interpolate_octet(tri.attr, weights, lo, hi);
+                if (mask & 0xF)
+                    fragments += ShadeQuad(x, y, mask & 0xF, lo, depth);
+                if (mask >> 4)
+                    fragments += ShadeQuad(x + 4, y, mask >> 4, hi, depth + 4);
+            }
+        }
+    }
+
+    return fragments;
+}
+#endif
+
+void PicaRasterizer::WriteFragment(uint32_t x, uint32_t y, float z, Color color)
+{
+    if (state.alpha_test && !compare(state.alpha_func, color.a, state.alpha_ref))
+        return;
+
+    uint32_t index = TiledPixelIndex(x, y, state.width);
+
+    if (state.depth_buffer)
+    {
+        uint8_t* ptr = state.depth_buffer + index * state.depth_bpp;
+        uint32_t stored = ptr[0] | (ptr[1] << 8);
+        uint32_t depth_max = 0xFFFF;
+        if (state.depth_bpp > 2)
+        {
+            stored |= ptr[2] << 16;
+            depth_max = 0xFFFFFF;
+        }
+
+        uint8_t stencil = state.depth_bpp == 4 ? ptr[3] : 0;
+        uint8_t new_stencil = stencil;
+        bool pass = true;
+        if (state.stencil_test)
+        {
+            pass = compare(state.stencil_func, state.stencil_ref & state.stencil_input_mask, stencil & state.stencil_input_mask);
+            if (!pass)
+                new_stencil = stencil_op(state.stencil_fail, stencil, state.stencil_ref);
+        }
+
+        uint32_t depth = std::clamp(z, 0.0f, 1.0f) * depth_max;
+        if (pass)
+        {
+            pass = !state.depth_test || compare(state.depth_func, depth, stored);
+            if (state.stencil_test)
+                new_stencil = stencil_op(pass ? state.stencil_zpass : state.stencil_zfail, stencil, state.stencil_ref);
+        }
+
+        if (state.stencil_write)
+            ptr[3] = (new_stencil & state.stencil_write_mask) | (stencil & ~state.stencil_write_mask);
+        if (!pass)
+            return;
+
+        if (state.depth_write)
+        {
+            ptr[0] = depth;
+            ptr[1] = depth >> 8;
+            if (state.depth_bpp > 2)
+                ptr[2] = depth >> 16;
+        }
+    }
+
+    if (!state.color_write)
+        return;
+
+    uint8_t* ptr = state.color_buffer + index * state.color_bpp;
+    if (state.color_replace)
+    {
+        EncodeColor(state.color_format, color, ptr);
+        return;
+    }
+
+    Color dst = DecodeColor(state.color_format, ptr);
+    Color out;
+    if (state.blend)
+    {
+        Color src_rgb = blend_factor(state.blend_src_rgb, color, dst, state.blend_color);
+        Color dst_rgb = blend_factor(state.blend_dst_rgb, color, dst, state.blend_color);
+        Color src_a = blend_factor(state.blend_src_a, color, dst, state.blend_color);
+        Color dst_a = blend_factor(state.blend_dst_a, color, dst, state.blend_color);
+        out.r = blend_channel(state.blend_eq_rgb, color.r, dst.r, src_rgb.r, dst_rgb.r);
+        out.g = blend_channel(state.blend_eq_rgb, color.g, dst.g, src_rgb.g, dst_rgb.g);
+        out.b = blend_channel(state.blend_eq_rgb, color.b, dst.b, src_rgb.b, dst_rgb.b);
+        out.a = blend_channel(state.blend_eq_a, color.a, dst.a, src_a.a, dst_a.a);
+    }
+    else
+    {
+        out.r = logic_op(state.logic_op, color.r, dst.r);
+        out.g = logic_op(state.logic_op, color.g, dst.g);
+        out.b = logic_op(state.logic_op, color.b, dst.b);
+        out.a = logic_op(state.logic_op, color.a, dst.a);
+    }
+
+    if (state.color_mask != 0xF)
+    {
+        out.r = (state.color_mask & 1) ? out.r : dst.r;
+        out.g = (state.color_mask & 2) ? out.g : dst.g;
+        out.b = (state.color_mask & 4) ? out.b : dst.b;
+        out.a = (state.color_mask & 8) ? out.a : dst.a;
+    }
+
+    EncodeColor(state.color_format, out, ptr);
+}
+
+void PicaRasterizer::Dump()
+{
+    if (triangles_drawn)
+        printf("[RAST]: %lu triangles, %lu fragments shaded on %d threads\n", triangles_drawn, fragments_shaded.load(),
+            std::max(worker_count, 0) + 1);
+}
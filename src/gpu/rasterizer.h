@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "color.h"
+
+enum RasterAttrib
+{
+    RASTER_COLOR_R,
+    RASTER_COLOR_G,
+    RASTER_COLOR_B,
+    RASTER_COLOR_A,
+    RASTER_TEX0_U,
+    RASTER_TEX0_V,
+    RASTER_TEX1_U,
+    RASTER_TEX1_V,
+    RASTER_TEX2_U,
+    RASTER_TEX2_V,
+    RASTER_ATTRIB_COUNT
+};
+
+// A vertex as it leaves the vertex shader: clip-space position, plus the
+// attributes that get interpolated across the triangle
+struct RasterVertex
+{
+    float pos[4];
+    float attr[RASTER_ATTRIB_COUNT];
+};
+
+// Shades four horizontally adjacent fragments. attr[i][lane] is attribute i
+// of each fragment, lanes that aren't covered are shaded and thrown away.
+typedef void (*FragmentShader)(const void* ctx, const float attr[RASTER_ATTRIB_COUNT][4], Color out[4]);
+
+// The framebuffer and per-fragment registers, decoded once per draw
+struct RasterState
+{
+    uint8_t* color_buffer;
+    uint8_t* depth_buffer;
+    uint32_t color_addr, color_size;
+    uint32_t depth_addr, depth_size;
+    uint32_t width, height;
+    uint32_t color_format, color_bpp;
+    uint32_t depth_format, depth_bpp;
+
+    float viewport_half_w, viewport_half_h;
+    float viewport_x, viewport_y;
+    float depth_scale, depth_offset;
+    uint32_t cull_mode;
+
+    bool alpha_test;
+    uint32_t alpha_func;
+    uint8_t alpha_ref;
+
+    bool stencil_test, stencil_write;
+    uint32_t stencil_func;
+    uint8_t stencil_ref, stencil_input_mask, stencil_write_mask;
+    uint32_t stencil_fail, stencil_zfail, stencil_zpass;
+
+    bool depth_test, depth_write;
+    uint32_t depth_func;
+
+    bool color_write;
+    uint8_t color_mask;
+    bool blend;
+    uint32_t blend_eq_rgb, blend_eq_a;
+    uint32_t blend_src_rgb, blend_dst_rgb, blend_src_a, blend_dst_a;
+    Color blend_color;
+    uint32_t logic_op;
+    // Plain copy of the fragment color, nothing to read back
+    bool color_replace;
+
+    FragmentShader shader;
+    const void* shader_ctx;
+};
+
+// Software rasterizer for the PICA. Triangles are set up on the calling
+// thread and binned into screen tiles, then the tiles are shaded in parallel
+// by a pool of workers, the caller included. A tile only ever belongs to one
+// thread and keeps the triangles in submission order, so results don't
+// depend on the number of threads.
+class PicaRasterizer
+{
+private:
+    struct Triangle
+    {
+        // Edge k is opposite vertex k, e(x, y) = a*x + b*y + c is positive
+        // inside. Pixels exactly on an edge belong to it if it's inclusive.
+        float edge_a[3], edge_b[3], edge_c[3];
+        bool edge_inclusive[3];
+        float inv_area;
+        float z[3], inv_w[3];
+        float attr[3][RASTER_ATTRIB_COUNT];
+        int min_x, min_y, max_x, max_y;
+    };
+
+    RasterState state = {};
+
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins;
+    std::vector<uint32_t> active_tiles;
+    uint32_t tiles_x, tiles_y;
+
+    // Worker pool, started on the first draw that spans more than one tile
+    // and stopped by the destructor
+    std::mutex lock;
+    std::condition_variable work_ready, work_done;
+    uint64_t work_generation = 0;
+    int workers_busy = 0;
+    int worker_count = -1;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> next_tile;
+
+    uint64_t triangles_drawn = 0;
+    std::atomic<uint64_t> fragments_shaded = 0;
+
+    bool SetupTriangle(const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2, Triangle& tri);
+    void BinTriangle(uint32_t index);
+    void RunTiles();
+    uint64_t RasterizeTile(uint32_t tile);
+    // RasterizeTile eight pixels at a time, for hosts with AVX
+    uint64_t RasterizeTileWide(uint32_t tile);
+    uint64_t ShadeQuad(int x, int y, int mask, const float attr[RASTER_ATTRIB_COUNT][4], const float depth[4]);
+    void WriteFragment(uint32_t x, uint32_t y, float z, Color color);
+    void WorkerLoop();
+    void StartWorkers();
+
+    static int requested_workers;
+public:
+    static constexpr int TILE_SIZE = 32;
+
+    ~PicaRasterizer();
+
+    // Worker threads besides the emulation thread, -1 for one per spare core
+    static void SetWorkerCount(int count);
+
+    // Decodes the framebuffer and per-fragment registers. Returns false if
+    // the framebuffer isn't in memory, draws are dropped until the next call.
+    bool Configure(const uint32_t* regs);
+    // Without a shader, fragments take the primary color
+    void SetFragmentShader(FragmentShader shader, const void* ctx);
+    const RasterState& GetState() const { return state; }
+
+    // Draws count / 3 independent triangles
+    void DrawTriangles(const RasterVertex* vertices, size_t count);
+    uint64_t FragmentsShaded() const { return fragments_shaded; }
+
+    void Dump();
+};
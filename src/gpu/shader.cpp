@@ -0,0 +1,483 @@
+#include "shader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <gpu/pica_regs.h>
+#include <gpu/shader_isa.h>
+
+// Programs can loop forever on a jump, give up on a vertex after this many
+// instructions
+constexpr int MAX_STEPS = 1 << 16;
+
+struct CallFrame
+{
+    uint32_t final_pc;
+    uint32_t return_pc;
+    uint32_t loop_pc;
+    int32_t repeat;
+    int32_t increment;
+    bool is_loop;
+};
+
+// Batched engine, see shader_batch.cpp
+CompiledShader* compile_shader(const uint32_t* code, const uint32_t* opdescs, bool jit);
+uint32_t native_op_count(const CompiledShader* shader);
+bool wide_jit(const CompiledShader* shader);
+bool run_compiled(CompiledShader* shader, ShaderBatch* const* batches, int batch_count, const float (*uniforms)[4],
+    const float (*uniforms_wide)[4][4], const uint8_t (*int_uniforms)[3], uint16_t bool_uniforms, uint32_t entry_point);
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+void PicaShader::Reset()
+{
+    memset(code, 0, sizeof(code));
+    memset(opdescs, 0, sizeof(opdescs));
+    memset(uniforms, 0, sizeof(uniforms));
+    memset(int_uniforms, 0, sizeof(int_uniforms));
+    bool_uniforms = 0;
+    entry_point = 0;
+    code_index = opdesc_index = uniform_index = 0;
+    uniform_words = 0;
+    program_dirty = uniforms_dirty = true;
+    compiled = nullptr;
+}
+
+void PicaShader::SetJit(bool enabled)
+{
+    jit_enabled = enabled;
+    cache.clear();
+    compiled = nullptr;
+    program_dirty = true;
+}
+
+void PicaShader::SetCodeIndex(uint32_t value)
+{
+    code_index = value & 0xFFF;
+}
+
+void PicaShader::WriteCode(uint32_t value)
+{
+    if (code_index < SHADER_CODE_SIZE)
+        code[code_index] = value;
+    code_index++;
+    program_dirty = true;
+}
+
+void PicaShader::SetOpdescIndex(uint32_t value)
+{
+    opdesc_index = value & 0x7F;
+}
+
+void PicaShader::WriteOpdesc(uint32_t value)
+{
+    opdescs[opdesc_index] = value;
+    opdesc_index = (opdesc_index + 1) & 0x7F;
+    program_dirty = true;
+}
+
+void PicaShader::SetUniformIndex(uint32_t value)
+{
+    uniform_index = value & 0xFF;
+    uniform_f32 = value >> 31;
+    uniform_words = 0;
+}
+
+// Vectors are uploaded w first, either as four float32 words or as four
+// float24s packed into three words
+void PicaShader::WriteUniform(uint32_t value)
+{
+    uniform_buffer[uniform_words++] = value;
+    if (uniform_words < (uniform_f32 ? 4 : 3))
+        return;
+    uniform_words = 0;
+
+    float v[4];
+    if (uniform_f32)
+    {
+        for (int i = 0; i < 4; i++)
+            memcpy(&v[3 - i], &uniform_buffer[i], 4);
+    }
+    else
+        f24x4_to_float(uniform_buffer, v);
+
+    if (uniform_index < SHADER_FLOAT_UNIFORMS)
+    {
+        memcpy(uniforms[uniform_index], v, sizeof(v));
+        uniforms_dirty = true;
+    }
+    uniform_index++;
+}
+
+void PicaShader::Prepare(const uint32_t* regs)
+{
+    bool_uniforms = regs[PICA_REG_VSH_BOOLUNIFORM] & 0xFFFF;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t value = regs[PICA_REG_VSH_INTUNIFORM_I0 + i];
+        int_uniforms[i][0] = value;
+        int_uniforms[i][1] = value >> 8;
+        int_uniforms[i][2] = value >> 16;
+    }
+    entry_point = regs[PICA_REG_VSH_ENTRYPOINT] & 0xFFFF;
+
+    if (program_dirty)
+    {
+        uint64_t hash = 0;
+        for (uint32_t word : code)
+            hash = mix(hash ^ word);
+        for (uint32_t word : opdescs)
+            hash = mix(hash ^ word);
+
+        auto it = cache.find(hash);
+        if (it == cache.end() || memcmp(it->second.code, code, sizeof(code)) ||
+            memcmp(it->second.opdescs, opdescs, sizeof(opdescs)))
+        {
+            if (it == cache.end() && cache.size() >= SHADER_CACHE_SIZE)
+            {
+                cache.clear();
+                cache_flushes++;
+            }
+
+            CacheEntry& entry = cache[hash];
+            memcpy(entry.code, code, sizeof(code));
+            memcpy(entry.opdescs, opdescs, sizeof(opdescs));
+            entry.shader.reset(compile_shader(code, opdescs, jit_enabled));
+            programs_compiled++;
+            native_ops += native_op_count(entry.shader.get());
+            compiled = entry.shader.get();
+        }
+        else
+            compiled = it->second.shader.get();
+        program_dirty = false;
+    }
+
+    if (uniforms_dirty)
+    {
+        for (int i = 0; i < SHADER_FLOAT_UNIFORMS; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                    uniforms_wide[i][c][lane] = uniforms[i][c];
+            }
+        }
+        uniforms_dirty = false;
+    }
+}
+
+void PicaShader::Run(ShaderBatch& batch)
+{
+    batches_run++;
+    ShaderBatch* batches[1] = {&batch};
+    if (compiled && run_compiled(compiled, batches, 1, uniforms, uniforms_wide, int_uniforms, bool_uniforms, entry_point))
+        return;
+
+    // The vertices took different paths, do them one by one
+    batches_diverged++;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        float input[SHADER_INPUTS][4], output[SHADER_OUTPUTS][4];
+        for (int reg = 0; reg < SHADER_INPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+                input[reg][c] = batch.input[reg][c][lane];
+        }
+
+        Interpret(input, output);
+
+        for (int reg = 0; reg < SHADER_OUTPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+                batch.output[reg][c][lane] = output[reg][c];
+        }
+    }
+}
+
+void PicaShader::Run(ShaderBatch& first, ShaderBatch& second)
+{
+    ShaderBatch* batches[2] = {&first, &second};
+    if (compiled && wide_jit(compiled) &&
+        run_compiled(compiled, batches, 2, uniforms, uniforms_wide, int_uniforms, bool_uniforms, entry_point))
+    {
+        batches_run += 2;
+        batches_wide += 2;
+        return;
+    }
+
+    // No AVX, or the eight lanes split on a branch, each half may still
+    // agree on its own
+    Run(first);
+    Run(second);
+}
+
+void PicaShader::Interpret(const float input[SHADER_INPUTS][4], float output[SHADER_OUTPUTS][4])
+{
+    const static float zero[4] = {};
+    float temp[16][4] = {};
+    int32_t address[3] = {};
+    bool cmp[2] = {};
+    CallFrame stack[16];
+    int depth = 0;
+
+    memset(output, 0, sizeof(float) * SHADER_OUTPUTS * 4);
+
+    auto call = [&](uint32_t pc, uint32_t count, uint32_t return_pc, int32_t repeat, int32_t increment, bool is_loop)
+    {
+        if (depth < 16)
+            stack[depth++] = {pc + count, return_pc, pc, repeat, increment, is_loop};
+    };
+
+    auto read = [&](uint32_t reg, int32_t offset, uint32_t selector, bool negate, float* out)
+    {
+        const float* src;
+        if (reg < SH_SRC_TEMP)
+            src = input[reg];
+        else if (reg < SH_SRC_UNIFORM)
+            src = temp[reg - SH_SRC_TEMP];
+        else
+        {
+            int32_t index = reg - SH_SRC_UNIFORM + offset;
+            src = index >= 0 && index < SHADER_FLOAT_UNIFORMS ? uniforms[index] : zero;
+        }
+
+        for (int c = 0; c < 4; c++)
+            out[c] = negate ? -src[sh_component(selector, c)] : src[sh_component(selector, c)];
+    };
+
+    uint32_t pc = entry_point;
+    for (int step = 0; step < MAX_STEPS; step++)
+    {
+        while (depth && pc == stack[depth - 1].final_pc)
+        {
+            CallFrame& frame = stack[depth - 1];
+            address[2] += frame.increment;
+            if (frame.repeat-- == 0)
+            {
+                pc = frame.return_pc;
+                depth--;
+            }
+            else
+                pc = frame.loop_pc;
+        }
+
+        if (pc >= SHADER_CODE_SIZE)
+            return;
+
+        uint32_t instr = code[pc];
+        uint32_t op = sh_opcode(instr);
+
+        if (op < SH_BREAK || op >= SH_CMP)
+        {
+            ShaderOperands ops = sh_decode(instr);
+            uint32_t desc = opdescs[ops.desc];
+            int32_t offset = ops.relative ? address[ops.relative - 1] : 0;
+
+            float s[3][4];
+            for (int i = 0; i < 3; i++)
+                read(ops.src[i], i == ops.relative_src ? offset : 0, sh_selector(desc, i), sh_negate(desc, i), s[i]);
+
+            float r[4];
+            switch (op)
+            {
+            case SH_ADD:
+                for (int c = 0; c < 4; c++)
+                    r[c] = s[0][c] + s[1][c];
+                break;
+            case SH_MUL:
+                for (int c = 0; c < 4; c++)
+                    r[c] = sh_mul(s[0][c], s[1][c]);
+                break;
+            case SH_DP3:
+            case SH_DP4:
+            case SH_DPH:
+            case SH_DPHI:
+            {
+                float dot = sh_mul(s[0][0], s[1][0]) + sh_mul(s[0][1], s[1][1]) + sh_mul(s[0][2], s[1][2]);
+                if (op == SH_DP4)
+                    dot += sh_mul(s[0][3], s[1][3]);
+                else if (op != SH_DP3)
+                    dot += s[1][3];
+                r[0] = r[1] = r[2] = r[3] = dot;
+                break;
+            }
+            case SH_DST:
+            case SH_DSTI:
+                r[0] = 1.0f;
+                r[1] = sh_mul(s[0][1], s[1][1]);
+                r[2] = s[0][2];
+                r[3] = s[1][3];
+                break;
+            case SH_EX2:
+                r[0] = r[1] = r[2] = r[3] = exp2f(s[0][0]);
+                break;
+            case SH_LG2:
+                r[0] = r[1] = r[2] = r[3] = log2f(s[0][0]);
+                break;
+            case SH_LITP:
+                r[0] = fmaxf(s[0][0], 0.0f);
+                r[1] = fminf(fmaxf(s[0][1], -127.9961f), 127.9961f);
+                r[2] = s[0][2];
+                r[3] = fmaxf(s[0][3], 0.0f);
+                cmp[0] = s[0][0] >= 0.0f;
+                cmp[1] = s[0][3] >= 0.0f;
+                break;
+            case SH_SGE:
+            case SH_SGEI:
+                for (int c = 0; c < 4; c++)
+                    r[c] = s[0][c] >= s[1][c] ? 1.0f : 0.0f;
+                break;
+            case SH_SLT:
+            case SH_SLTI:
+                for (int c = 0; c < 4; c++)
+                    r[c] = s[0][c] < s[1][c] ? 1.0f : 0.0f;
+                break;
+            case SH_FLR:
+                for (int c = 0; c < 4; c++)
+                    r[c] = floorf(s[0][c]);
+                break;
+            case SH_MAX:
+                for (int c = 0; c < 4; c++)
+                    r[c] = s[0][c] > s[1][c] ? s[0][c] : s[1][c];
+                break;
+            case SH_MIN:
+                for (int c = 0; c < 4; c++)
+                    r[c] = s[0][c] < s[1][c] ? s[0][c] : s[1][c];
+                break;
+            case SH_RCP:
+                r[0] = r[1] = r[2] = r[3] = 1.0f / s[0][0];
+                break;
+            case SH_RSQ:
+                r[0] = r[1] = r[2] = r[3] = 1.0f / sqrtf(s[0][0]);
+                break;
+            case SH_MOV:
+                memcpy(r, s[0], sizeof(r));
+                break;
+            case SH_MOVA:
+                for (int c = 0; c < 2; c++)
+                {
+                    if (sh_dest_enabled(desc, c))
+                        address[c] = (int32_t)s[0][c];
+                }
+                pc++;
+                continue;
+            case SH_CMP:
+                cmp[0] = sh_compare((instr >> 24) & 7, s[0][0], s[1][0]);
+                cmp[1] = sh_compare((instr >> 21) & 7, s[0][1], s[1][1]);
+                pc++;
+                continue;
+            case SH_MAD:
+            case SH_MADI:
+                for (int c = 0; c < 4; c++)
+                    r[c] = sh_mul(s[0][c], s[1][c]) + s[2][c];
+                break;
+            default:
+                pc++;
+                continue;
+            }
+
+            float* dest = nullptr;
+            if (ops.dest < SH_DEST_TEMP)
+                dest = output[ops.dest];
+            else if (ops.dest < SH_DEST_TEMP + 16)
+                dest = temp[ops.dest - SH_DEST_TEMP];
+            if (dest)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    if (sh_dest_enabled(desc, c))
+                        dest[c] = r[c];
+                }
+            }
+            pc++;
+            continue;
+        }
+
+        uint32_t dest = sh_flow_dest(instr);
+        uint32_t count = sh_flow_count(instr);
+        bool condition = sh_condition(instr, cmp[0], cmp[1]);
+        bool bool_uniform = (bool_uniforms >> sh_flow_bool(instr)) & 1;
+
+        switch (op)
+        {
+        case SH_END:
+            return;
+        case SH_BREAKC:
+        case SH_BREAK:
+            if (op == SH_BREAK || condition)
+            {
+                while (depth && !stack[depth - 1].is_loop)
+                    depth--;
+                if (depth)
+                {
+                    pc = stack[--depth].return_pc;
+                    continue;
+                }
+            }
+            pc++;
+            break;
+        case SH_CALL:
+            call(dest, count, pc + 1, 0, 0, false);
+            pc = dest;
+            break;
+        case SH_CALLC:
+        case SH_CALLU:
+            if (op == SH_CALLC ? condition : bool_uniform)
+            {
+                call(dest, count, pc + 1, 0, 0, false);
+                pc = dest;
+            }
+            else
+                pc++;
+            break;
+        case SH_IFC:
+        case SH_IFU:
+            if (op == SH_IFC ? condition : bool_uniform)
+            {
+                call(pc + 1, dest - pc - 1, dest + count, 0, 0, false);
+                pc++;
+            }
+            else
+            {
+                call(dest, count, dest + count, 0, 0, false);
+                pc = dest;
+            }
+            break;
+        case SH_LOOP:
+        {
+            const uint8_t* i = int_uniforms[sh_flow_int(instr)];
+            address[2] = i[1];
+            call(pc + 1, dest - pc, dest + 1, i[0], (int8_t)i[2], true);
+            pc++;
+            break;
+        }
+        case SH_JMPC:
+            pc = condition ? dest : pc + 1;
+            break;
+        case SH_JMPU:
+            pc = bool_uniform == !(count & 1) ? dest : pc + 1;
+            break;
+        default:
+            pc++;
+            break;
+        }
+    }
+}
+
+void PicaShader::Dump()
+{
+    if (!batches_run)
+        return;
+    printf("[SHADER]: %lu programs compiled (%lu ops to native code), %lu cache flushes\n",
+        programs_compiled, native_ops, cache_flushes);
+    printf("[SHADER]: %lu vertex batches, %lu of them eight lanes wide, %lu rerun on the interpreter\n",
+        batches_run, batches_wide, batches_diverged);
+}
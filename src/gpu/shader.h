@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+
+constexpr int SHADER_CODE_SIZE = 512;
+constexpr int SHADER_OPDESC_COUNT = 128;
+constexpr int SHADER_FLOAT_UNIFORMS = 96;
+constexpr int SHADER_INPUTS = 16;
+constexpr int SHADER_OUTPUTS = 16;
+
+// Programs kept compiled at once, the cache starts over when it fills up
+constexpr size_t SHADER_CACHE_SIZE = 64;
+
+// Four vertices side by side, component-major: input[reg][comp][lane]
+struct ShaderBatch
+{
+    alignas(16) float input[SHADER_INPUTS][4][4];
+    alignas(16) float output[SHADER_OUTPUTS][4][4];
+};
+
+struct CompiledShader;
+struct CompiledShaderDeleter
+{
+    void operator()(CompiledShader* shader) const;
+};
+
+// The PICA's vertex shader unit. Programs and uniforms are uploaded through
+// the GPU registers, each draw then runs the program over its vertices.
+//
+// Vertices normally go through a decoded form of the program that runs four
+// of them at once with SSE, one vertex per lane. It's built once per program
+// and kept in a cache keyed by a hash of the code and operand descriptors.
+// On x86-64 the arithmetic between branches is compiled to native code, ops
+// the JIT doesn't handle run from the decoded table. With AVX, two batches
+// can go through the native code together, eight lanes wide. A batch whose
+// vertices disagree on a branch is rerun on the interpreter, one vertex at a
+// time.
+class PicaShader
+{
+private:
+    uint32_t code[SHADER_CODE_SIZE];
+    uint32_t opdescs[SHADER_OPDESC_COUNT];
+    float uniforms[SHADER_FLOAT_UNIFORMS][4];
+    uint8_t int_uniforms[4][3];
+    uint16_t bool_uniforms;
+    uint32_t entry_point;
+
+    uint32_t code_index = 0;
+    uint32_t opdesc_index = 0;
+    uint32_t uniform_index = 0;
+    bool uniform_f32 = false;
+    uint32_t uniform_buffer[4];
+    int uniform_words = 0;
+
+    bool program_dirty = true;
+    bool uniforms_dirty = true;
+    bool jit_enabled = true;
+    CompiledShader* compiled = nullptr;
+
+    // Entries keep the words they were compiled from, so a hash collision
+    // gets compiled over instead of running the wrong program
+    struct CacheEntry
+    {
+        uint32_t code[SHADER_CODE_SIZE];
+        uint32_t opdescs[SHADER_OPDESC_COUNT];
+        std::unique_ptr<CompiledShader, CompiledShaderDeleter> shader;
+    };
+    std::unordered_map<uint64_t, CacheEntry> cache;
+
+    // Float uniforms broadcast to all four lanes, for the batched engine
+    alignas(16) float uniforms_wide[SHADER_FLOAT_UNIFORMS][4][4];
+
+    uint64_t programs_compiled = 0;
+    uint64_t native_ops = 0;
+    uint64_t batches_run = 0;
+    uint64_t batches_wide = 0;
+    uint64_t batches_diverged = 0;
+    uint64_t cache_flushes = 0;
+public:
+    void Reset();
+
+    // Whether programs get compiled to native code, on by default. Drops
+    // the programs compiled so far.
+    void SetJit(bool enabled);
+
+    void SetCodeIndex(uint32_t value);
+    void WriteCode(uint32_t value);
+    void SetOpdescIndex(uint32_t value);
+    void WriteOpdesc(uint32_t value);
+    void SetUniformIndex(uint32_t value);
+    void WriteUniform(uint32_t value);
+
+    // Picks up the bool/int uniforms and entry point from the registers and
+    // gets the current program ready, call before running a draw's vertices
+    void Prepare(const uint32_t* regs);
+
+    // Runs the program over four vertices
+    void Run(ShaderBatch& batch);
+    // Same over eight, in one pass where the host has AVX
+    void Run(ShaderBatch& first, ShaderBatch& second);
+
+    // Reference implementation, one vertex at a time
+    void Interpret(const float input[SHADER_INPUTS][4], float output[SHADER_OUTPUTS][4]);
+
+    void Dump();
+};
@@ -0,0 +1,617 @@
+// Batched shader engine: the program is decoded once into a table of
+// operations with their registers, swizzles and masks resolved, which then
+// runs four vertices at a time, one per SSE lane. Registers are kept
+// component-major, so swizzles pick whole vectors and dot products need no
+// shuffles. Straight runs of ops are also compiled to native code where the
+// host allows it (shader_jit.cpp), the table covers everything else.
+
+#include "shader_batch.h"
+
+#include <math.h>
+#include <string.h>
+#include <gpu/shader_isa.h>
+
+#if defined(__SSE2__)
+
+constexpr int MAX_STEPS = 1 << 16;
+
+void CompiledShaderDeleter::operator()(CompiledShader* shader) const
+{
+    jit_free(shader);
+    delete shader;
+}
+
+static inline __m128 negate_ps(__m128 v)
+{
+    return _mm_xor_ps(v, _mm_set1_ps(-0.0f));
+}
+
+// 0 * inf is 0 on the PICA
+static inline __m128 mul_ps(__m128 a, __m128 b)
+{
+    __m128 r = _mm_mul_ps(a, b);
+    __m128 bad = _mm_and_ps(_mm_cmpunord_ps(r, r), _mm_cmpord_ps(a, b));
+    return _mm_andnot_ps(bad, r);
+}
+
+static inline __m128 floor_ps(__m128 v)
+{
+    // Anything this large is already an integer (or not a number)
+    __m128 small = _mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), v), _mm_set1_ps(8388608.0f));
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+    return _mm_or_ps(_mm_and_ps(small, t), _mm_andnot_ps(small, v));
+}
+
+static inline void fetch(const BatchState& s, const BatchSource& src, uint32_t relative, __m128 out[4])
+{
+    const __m128* reg;
+    __m128 gathered[4];
+
+    if (!src.uniform)
+        reg = s.regs[src.index];
+    else if (!src.relative)
+        reg = s.uniforms_wide[src.index];
+    else if (relative == 3 || (s.address[relative - 1][0] == s.address[relative - 1][1] &&
+        s.address[relative - 1][0] == s.address[relative - 1][2] && s.address[relative - 1][0] == s.address[relative - 1][3]))
+    {
+        int32_t index = src.index + (relative == 3 ? s.loop : s.address[relative - 1][0]);
+        reg = index >= 0 && index < SHADER_FLOAT_UNIFORMS ? s.uniforms_wide[index] : s.regs[REG_ZERO];
+    }
+    else
+    {
+        // Each vertex indexes its own uniform, skinning matrices for example
+        alignas(16) float lanes[4][4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int32_t index = src.index + s.address[relative - 1][lane];
+            bool valid = index >= 0 && index < SHADER_FLOAT_UNIFORMS;
+            for (int c = 0; c < 4; c++)
+                lanes[c][lane] = valid ? s.uniforms[index][c] : 0.0f;
+        }
+        for (int c = 0; c < 4; c++)
+            gathered[c] = _mm_load_ps(lanes[c]);
+        reg = gathered;
+    }
+
+    for (int c = 0; c < 4; c++)
+        out[c] = src.negate ? negate_ps(reg[src.comp[c]]) : reg[src.comp[c]];
+}
+
+static inline void store(BatchState& s, const BatchOp& op, const __m128 r[4])
+{
+    for (int c = 0; c < 4; c++)
+    {
+        if (op.mask & (8 >> c))
+            s.regs[op.dest][c] = r[c];
+    }
+}
+
+static inline void store_all(BatchState& s, const BatchOp& op, __m128 r)
+{
+    __m128 v[4] = {r, r, r, r};
+    store(s, op, v);
+}
+
+static void op_add(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_add_ps(a[c], b[c]);
+    store(s, op, r);
+}
+
+static void op_mul(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = mul_ps(a[c], b[c]);
+    store(s, op, r);
+}
+
+static void op_dp3(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    store_all(s, op, _mm_add_ps(_mm_add_ps(mul_ps(a[0], b[0]), mul_ps(a[1], b[1])), mul_ps(a[2], b[2])));
+}
+
+static void op_dp4(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    __m128 dot = _mm_add_ps(_mm_add_ps(mul_ps(a[0], b[0]), mul_ps(a[1], b[1])), mul_ps(a[2], b[2]));
+    store_all(s, op, _mm_add_ps(dot, mul_ps(a[3], b[3])));
+}
+
+static void op_dph(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    __m128 dot = _mm_add_ps(_mm_add_ps(mul_ps(a[0], b[0]), mul_ps(a[1], b[1])), mul_ps(a[2], b[2]));
+    store_all(s, op, _mm_add_ps(dot, b[3]));
+}
+
+static void op_dst(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    __m128 r[4] = {_mm_set1_ps(1.0f), mul_ps(a[1], b[1]), a[2], b[3]};
+    store(s, op, r);
+}
+
+// Transcendentals run per lane, with the same libm calls as the interpreter
+template <float (*F)(float)>
+static void op_scalar(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    alignas(16) float v[4];
+    _mm_store_ps(v, a[0]);
+    for (int lane = 0; lane < 4; lane++)
+        v[lane] = F(v[lane]);
+    store_all(s, op, _mm_load_ps(v));
+}
+
+static void op_litp(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    __m128 zero = _mm_setzero_ps();
+    __m128 r[4] =
+    {
+        _mm_max_ps(a[0], zero),
+        _mm_min_ps(_mm_max_ps(a[1], _mm_set1_ps(-127.9961f)), _mm_set1_ps(127.9961f)),
+        a[2],
+        _mm_max_ps(a[3], zero),
+    };
+    s.cmp[0] = _mm_movemask_ps(_mm_cmpge_ps(a[0], zero));
+    s.cmp[1] = _mm_movemask_ps(_mm_cmpge_ps(a[3], zero));
+    store(s, op, r);
+}
+
+static void op_sge(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_and_ps(_mm_cmpge_ps(a[c], b[c]), _mm_set1_ps(1.0f));
+    store(s, op, r);
+}
+
+static void op_slt(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_and_ps(_mm_cmplt_ps(a[c], b[c]), _mm_set1_ps(1.0f));
+    store(s, op, r);
+}
+
+static void op_flr(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    for (int c = 0; c < 4; c++)
+        r[c] = floor_ps(a[c]);
+    store(s, op, r);
+}
+
+// maxps/minps return the second operand when the comparison fails, same as
+// the hardware with NaNs
+static void op_max(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_max_ps(a[c], b[c]);
+    store(s, op, r);
+}
+
+static void op_min(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_min_ps(a[c], b[c]);
+    store(s, op, r);
+}
+
+static void op_rcp(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    store_all(s, op, _mm_div_ps(_mm_set1_ps(1.0f), a[0]));
+}
+
+static void op_rsq(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    store_all(s, op, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a[0])));
+}
+
+static void op_mov(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    store(s, op, a);
+}
+
+static void op_mova(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4];
+    fetch(s, op.src[0], op.relative, a);
+    for (int c = 0; c < 2; c++)
+    {
+        if (op.mask & (8 >> c))
+            _mm_storeu_si128((__m128i*)s.address[c], _mm_cvttps_epi32(a[c]));
+    }
+}
+
+static int compare_lanes(uint32_t func, __m128 a, __m128 b)
+{
+    switch (func)
+    {
+    case 0: return _mm_movemask_ps(_mm_cmpeq_ps(a, b));
+    case 1: return _mm_movemask_ps(_mm_cmpneq_ps(a, b));
+    case 2: return _mm_movemask_ps(_mm_cmplt_ps(a, b));
+    case 3: return _mm_movemask_ps(_mm_cmple_ps(a, b));
+    case 4: return _mm_movemask_ps(_mm_cmpgt_ps(a, b));
+    case 5: return _mm_movemask_ps(_mm_cmpge_ps(a, b));
+    default: return 0xF;
+    }
+}
+
+static void op_cmp(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    s.cmp[0] = compare_lanes((op.instr >> 24) & 7, a[0], b[0]);
+    s.cmp[1] = compare_lanes((op.instr >> 21) & 7, a[1], b[1]);
+}
+
+static void op_mad(BatchState& s, const BatchOp& op)
+{
+    __m128 a[4], b[4], c3[4], r[4];
+    fetch(s, op.src[0], op.relative, a);
+    fetch(s, op.src[1], op.relative, b);
+    fetch(s, op.src[2], op.relative, c3);
+    for (int c = 0; c < 4; c++)
+        r[c] = _mm_add_ps(mul_ps(a[c], b[c]), c3[c]);
+    store(s, op, r);
+}
+
+static BatchHandler handler(uint32_t opcode)
+{
+    switch (opcode)
+    {
+    case SH_ADD: return op_add;
+    case SH_DP3: return op_dp3;
+    case SH_DP4: return op_dp4;
+    case SH_DPH:
+    case SH_DPHI: return op_dph;
+    case SH_DST:
+    case SH_DSTI: return op_dst;
+    case SH_EX2: return op_scalar<exp2f>;
+    case SH_LG2: return op_scalar<log2f>;
+    case SH_LITP: return op_litp;
+    case SH_MUL: return op_mul;
+    case SH_SGE:
+    case SH_SGEI: return op_sge;
+    case SH_SLT:
+    case SH_SLTI: return op_slt;
+    case SH_FLR: return op_flr;
+    case SH_MAX: return op_max;
+    case SH_MIN: return op_min;
+    case SH_RCP: return op_rcp;
+    case SH_RSQ: return op_rsq;
+    case SH_MOVA: return op_mova;
+    case SH_MOV: return op_mov;
+    case SH_CMP: return op_cmp;
+    case SH_MAD:
+    case SH_MADI: return op_mad;
+    default: return nullptr;
+    }
+}
+
+CompiledShader* compile_shader(const uint32_t* code, const uint32_t* opdescs, bool jit)
+{
+    CompiledShader* shader = new CompiledShader();
+
+    for (int pc = 0; pc < SHADER_CODE_SIZE; pc++)
+    {
+        BatchOp& op = shader->ops[pc];
+        op.instr = code[pc];
+        op.opcode = sh_opcode(op.instr);
+        op.exec = handler(op.opcode);
+        if (!op.exec)
+            continue;
+
+        ShaderOperands operands = sh_decode(op.instr);
+        uint32_t desc = opdescs[operands.desc];
+        op.relative = operands.relative;
+        op.mask = desc & 0xF;
+
+        if (operands.dest < SH_DEST_TEMP)
+            op.dest = REG_OUTPUT + operands.dest;
+        else if (operands.dest < SH_DEST_TEMP + 16)
+            op.dest = REG_TEMP + operands.dest - SH_DEST_TEMP;
+        else
+            op.dest = REG_DISCARD;
+
+        for (int i = 0; i < 3; i++)
+        {
+            BatchSource& src = op.src[i];
+            uint32_t reg = operands.src[i];
+            src.uniform = reg >= SH_SRC_UNIFORM;
+            src.relative = src.uniform && i == operands.relative_src && operands.relative;
+            if (reg < SH_SRC_TEMP)
+                src.index = REG_INPUT + reg;
+            else if (reg < SH_SRC_UNIFORM)
+                src.index = REG_TEMP + reg - SH_SRC_TEMP;
+            else
+                src.index = reg - SH_SRC_UNIFORM;
+
+            // Out of range and not relative, it can only ever read zero
+            if (src.uniform && !src.relative && src.index >= SHADER_FLOAT_UNIFORMS)
+            {
+                src.uniform = false;
+                src.index = REG_ZERO;
+            }
+
+            uint32_t selector = sh_selector(desc, i);
+            for (int c = 0; c < 4; c++)
+                src.comp[c] = sh_component(selector, c);
+            src.negate = sh_negate(desc, i);
+        }
+    }
+
+    if (jit)
+        jit_compile(shader);
+    return shader;
+}
+
+struct BatchFrame
+{
+    uint32_t final_pc;
+    uint32_t return_pc;
+    uint32_t loop_pc;
+    int32_t repeat;
+    int32_t increment;
+    bool is_loop;
+};
+
+// Lanes for which a flow condition holds
+static int condition_lanes(uint32_t instr, const int* cmp)
+{
+    int x = (instr >> 25) & 1 ? cmp[0] : ~cmp[0] & 0xF;
+    int y = (instr >> 24) & 1 ? cmp[1] : ~cmp[1] & 0xF;
+    switch ((instr >> 22) & 3)
+    {
+    case 0: return x | y;
+    case 1: return x & y;
+    case 2: return x;
+    default: return y;
+    }
+}
+
+// Runs the program over one batch, or two in lockstep when the shader has
+// wide blocks. Table ops run on each state in turn. Returns false, leaving
+// the outputs undefined, if the lanes disagree on a branch.
+bool run_compiled(CompiledShader* shader, ShaderBatch* const* batches, int batch_count, const float (*uniforms)[4],
+    const float (*uniforms_wide)[4][4], const uint8_t (*int_uniforms)[3], uint16_t bool_uniforms, uint32_t entry_point)
+{
+    alignas(32) BatchState states[2];
+    for (int i = 0; i < batch_count; i++)
+    {
+        BatchState& s = states[i];
+        for (int reg = 0; reg < SHADER_INPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+                s.regs[REG_INPUT + reg][c] = _mm_load_ps(batches[i]->input[reg][c]);
+        }
+        for (int reg = REG_TEMP; reg < REG_COUNT; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+                s.regs[reg][c] = _mm_setzero_ps();
+        }
+        s.uniforms_wide = (const __m128 (*)[4])uniforms_wide;
+        s.uniforms = uniforms;
+        memset(s.address, 0, sizeof(s.address));
+        s.loop = 0;
+        s.cmp[0] = s.cmp[1] = 0;
+    }
+
+    const JitBlock* blocks = batch_count == 2 ? shader->wide_blocks : shader->blocks;
+    int all_lanes = batch_count == 2 ? 0xFF : 0xF;
+
+    BatchFrame stack[16];
+    int depth = 0;
+    auto call = [&](uint32_t pc, uint32_t count, uint32_t return_pc, int32_t repeat, int32_t increment, bool is_loop)
+    {
+        if (depth < 16)
+            stack[depth++] = {pc + count, return_pc, pc, repeat, increment, is_loop};
+    };
+
+    uint32_t pc = entry_point;
+    for (int step = 0; step < MAX_STEPS; step++)
+    {
+        while (depth && pc == stack[depth - 1].final_pc)
+        {
+            BatchFrame& frame = stack[depth - 1];
+            for (int i = 0; i < batch_count; i++)
+                states[i].loop += frame.increment;
+            if (frame.repeat-- == 0)
+            {
+                pc = frame.return_pc;
+                depth--;
+            }
+            else
+                pc = frame.loop_pc;
+        }
+
+        if (pc >= SHADER_CODE_SIZE)
+            break;
+
+        const JitBlock& block = blocks[pc];
+        if (block.code)
+        {
+            block.code(states);
+            pc += block.length;
+            step += block.length - 1;
+            continue;
+        }
+
+        const BatchOp& op = shader->ops[pc];
+        if (op.exec)
+        {
+            for (int i = 0; i < batch_count; i++)
+                op.exec(states[i], op);
+            pc++;
+            continue;
+        }
+
+        uint32_t dest = sh_flow_dest(op.instr);
+        uint32_t count = sh_flow_count(op.instr);
+        bool bool_uniform = (bool_uniforms >> sh_flow_bool(op.instr)) & 1;
+
+        // Conditions on cmp are per vertex, the batch can only follow them
+        // while every lane agrees
+        bool condition = false;
+        if (op.opcode == SH_BREAKC || op.opcode == SH_CALLC || op.opcode == SH_IFC || op.opcode == SH_JMPC)
+        {
+            int lanes = condition_lanes(op.instr, states[0].cmp);
+            if (batch_count == 2)
+                lanes |= condition_lanes(op.instr, states[1].cmp) << 4;
+            if (lanes != 0 && lanes != all_lanes)
+                return false;
+            condition = lanes;
+        }
+
+        switch (op.opcode)
+        {
+        case SH_END:
+            // Out of the code and past any frame
+            pc = UINT32_MAX;
+            break;
+        case SH_BREAKC:
+        case SH_BREAK:
+            if (op.opcode == SH_BREAK || condition)
+            {
+                while (depth && !stack[depth - 1].is_loop)
+                    depth--;
+                if (depth)
+                {
+                    pc = stack[--depth].return_pc;
+                    break;
+                }
+            }
+            pc++;
+            break;
+        case SH_CALL:
+            call(dest, count, pc + 1, 0, 0, false);
+            pc = dest;
+            break;
+        case SH_CALLC:
+        case SH_CALLU:
+            if (op.opcode == SH_CALLC ? condition : bool_uniform)
+            {
+                call(dest, count, pc + 1, 0, 0, false);
+                pc = dest;
+            }
+            else
+                pc++;
+            break;
+        case SH_IFC:
+        case SH_IFU:
+            if (op.opcode == SH_IFC ? condition : bool_uniform)
+            {
+                call(pc + 1, dest - pc - 1, dest + count, 0, 0, false);
+                pc++;
+            }
+            else
+            {
+                call(dest, count, dest + count, 0, 0, false);
+                pc = dest;
+            }
+            break;
+        case SH_LOOP:
+        {
+            const uint8_t* i = int_uniforms[sh_flow_int(op.instr)];
+            for (int j = 0; j < batch_count; j++)
+                states[j].loop = i[1];
+            call(pc + 1, dest - pc, dest + 1, i[0], (int8_t)i[2], true);
+            pc++;
+            break;
+        }
+        case SH_JMPC:
+            pc = condition ? dest : pc + 1;
+            break;
+        case SH_JMPU:
+            pc = bool_uniform == !(count & 1) ? dest : pc + 1;
+            break;
+        default:
+            pc++;
+            break;
+        }
+    }
+
+    for (int i = 0; i < batch_count; i++)
+    {
+        for (int reg = 0; reg < SHADER_OUTPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+                _mm_store_ps(batches[i]->output[reg][c], states[i].regs[REG_OUTPUT + reg][c]);
+        }
+    }
+    return true;
+}
+
+bool wide_jit(const CompiledShader* shader)
+{
+    return shader->wide;
+}
+
+#else
+
+void CompiledShaderDeleter::operator()(CompiledShader* shader) const
+{
+    delete shader;
+}
+
+CompiledShader* compile_shader(const uint32_t* code, const uint32_t* opdescs, bool jit)
+{
+    return new CompiledShader();
+}
+
+bool run_compiled(CompiledShader* shader, ShaderBatch* const* batches, int batch_count, const float (*uniforms)[4],
+    const float (*uniforms_wide)[4][4], const uint8_t (*int_uniforms)[3], uint16_t bool_uniforms, uint32_t entry_point)
+{
+    return false;
+}
+
+bool wide_jit(const CompiledShader* shader)
+{
+    return false;
+}
+
+#endif
+
+uint32_t native_op_count(const CompiledShader* shader)
+{
+    return shader->native_ops;
+}
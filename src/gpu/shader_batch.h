@@ -0,0 +1,94 @@
+#pragma once
+
+// Internal to the batched shader engine and its JIT, see shader_batch.cpp
+// and shader_jit.cpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include "shader.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+// Batch register file: inputs, temporaries, outputs, then a register that
+// always reads as zero and one that swallows writes to invalid destinations
+constexpr int REG_INPUT = 0;
+constexpr int REG_TEMP = 16;
+constexpr int REG_OUTPUT = 32;
+constexpr int REG_ZERO = 48;
+constexpr int REG_DISCARD = 49;
+constexpr int REG_COUNT = 50;
+
+struct BatchState
+{
+    __m128 regs[REG_COUNT][4];
+    const __m128 (*uniforms_wide)[4];
+    const float (*uniforms)[4];
+    // a0.x and a0.y per lane, aL is the same for every lane
+    int32_t address[2][4];
+    int32_t loop;
+    // cmp.x and cmp.y as lane masks
+    int cmp[2];
+};
+
+struct BatchSource
+{
+    bool uniform;
+    // Uniform index offset per lane by an address register
+    bool relative;
+    uint16_t index;
+    uint8_t comp[4];
+    bool negate;
+};
+
+struct BatchOp;
+typedef void (*BatchHandler)(BatchState& s, const BatchOp& op);
+
+struct BatchOp
+{
+    BatchHandler exec;
+    uint32_t instr;
+    uint32_t opcode;
+    BatchSource src[3];
+    uint16_t dest;
+    uint8_t mask;
+    uint32_t relative;
+};
+
+// Native code for a straight run of ops, which runs them all and leaves pc
+// at the op after the last one. Wide blocks take two states side by side,
+// the second right after the first.
+typedef void (*JitCode)(BatchState* s);
+struct JitBlock
+{
+    JitCode code;
+    uint32_t length;
+};
+
+struct CompiledShader
+{
+    BatchOp ops[SHADER_CODE_SIZE];
+    // Indexed by the pc each block starts at
+    JitBlock blocks[SHADER_CODE_SIZE];
+    // The same blocks eight lanes wide, on hosts with AVX
+    JitBlock wide_blocks[SHADER_CODE_SIZE];
+    bool wide;
+    uint8_t* jit_memory;
+    size_t jit_size;
+    uint32_t native_ops;
+};
+
+// Compiles the shader's ops to native code where it can, leaves the rest to
+// their handlers. Does nothing on hosts the JIT doesn't support.
+void jit_compile(CompiledShader* shader);
+void jit_free(CompiledShader* shader);
+
+#else
+
+// No SIMD on this host, every batch goes through the interpreter
+struct CompiledShader
+{
+    uint32_t native_ops;
+};
+
+#endif
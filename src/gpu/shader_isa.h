@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stdint.h>
+
+// PICA shader instruction encoding, shared by the interpreter and the
+// batched engine
+enum ShaderOpcode
+{
+    SH_ADD = 0x00,
+    SH_DP3 = 0x01,
+    SH_DP4 = 0x02,
+    SH_DPH = 0x03,
+    SH_DST = 0x04,
+    SH_EX2 = 0x05,
+    SH_LG2 = 0x06,
+    SH_LITP = 0x07,
+    SH_MUL = 0x08,
+    SH_SGE = 0x09,
+    SH_SLT = 0x0A,
+    SH_FLR = 0x0B,
+    SH_MAX = 0x0C,
+    SH_MIN = 0x0D,
+    SH_RCP = 0x0E,
+    SH_RSQ = 0x0F,
+    SH_MOVA = 0x12,
+    SH_MOV = 0x13,
+    SH_DPHI = 0x18,
+    SH_DSTI = 0x19,
+    SH_SGEI = 0x1A,
+    SH_SLTI = 0x1B,
+    SH_BREAK = 0x20,
+    SH_NOP = 0x21,
+    SH_END = 0x22,
+    SH_BREAKC = 0x23,
+    SH_CALL = 0x24,
+    SH_CALLC = 0x25,
+    SH_CALLU = 0x26,
+    SH_IFU = 0x27,
+    SH_IFC = 0x28,
+    SH_LOOP = 0x29,
+    SH_EMIT = 0x2A,
+    SH_SETEMIT = 0x2B,
+    SH_JMPC = 0x2C,
+    SH_JMPU = 0x2D,
+    SH_CMP = 0x2E, // 0x2E-0x2F
+    SH_MADI = 0x30, // 0x30-0x37
+    SH_MAD = 0x38, // 0x38-0x3F
+};
+
+// Source registers: v0-v15, r0-r15, then the float uniforms c0-c95. Only
+// 7-bit source fields can reach the uniforms.
+constexpr uint32_t SH_SRC_TEMP = 0x10;
+constexpr uint32_t SH_SRC_UNIFORM = 0x20;
+// Destination registers: o0-o15, then r0-r15
+constexpr uint32_t SH_DEST_TEMP = 0x10;
+
+// Normalizes the opcode field, CMP and MAD(I) use its low bits for operands
+inline uint32_t sh_opcode(uint32_t instr)
+{
+    uint32_t op = instr >> 26;
+    if (op >= SH_MAD)
+        return SH_MAD;
+    if (op >= SH_MADI)
+        return SH_MADI;
+    if (op >= SH_CMP)
+        return SH_CMP;
+    return op;
+}
+
+// Operand descriptors: a destination mask with x in bit 3, then a negate
+// flag and four 2-bit component selectors (x in the top bits) per source
+inline bool sh_dest_enabled(uint32_t desc, int comp) { return (desc >> (3 - comp)) & 1; }
+inline uint32_t sh_selector(uint32_t desc, int src) { return (desc >> (5 + src * 9)) & 0xFF; }
+inline bool sh_negate(uint32_t desc, int src) { return (desc >> (4 + src * 9)) & 1; }
+inline int sh_component(uint32_t selector, int comp) { return (selector >> (6 - comp * 2)) & 3; }
+
+// Decoded register fields of an arithmetic instruction. The relative index
+// (0: none, 1: a0.x, 2: a0.y, 3: aL) applies to whichever source is 7 bits.
+struct ShaderOperands
+{
+    uint32_t dest;
+    uint32_t src[3];
+    uint32_t desc;
+    uint32_t relative;
+    int relative_src;
+};
+
+inline ShaderOperands sh_decode(uint32_t instr)
+{
+    ShaderOperands ops = {};
+    uint32_t op = sh_opcode(instr);
+
+    if (op == SH_MAD || op == SH_MADI)
+    {
+        ops.dest = (instr >> 24) & 0x1F;
+        ops.relative = (instr >> 22) & 3;
+        ops.src[0] = (instr >> 17) & 0x1F;
+        if (op == SH_MAD)
+        {
+            ops.src[1] = (instr >> 10) & 0x7F;
+            ops.src[2] = (instr >> 5) & 0x1F;
+            ops.relative_src = 1;
+        }
+        else
+        {
+            ops.src[1] = (instr >> 12) & 0x1F;
+            ops.src[2] = (instr >> 5) & 0x7F;
+            ops.relative_src = 2;
+        }
+        ops.desc = instr & 0x1F;
+        return ops;
+    }
+
+    bool inverted = op == SH_DPHI || op == SH_DSTI || op == SH_SGEI || op == SH_SLTI;
+    ops.dest = (instr >> 21) & 0x1F;
+    ops.relative = (instr >> 19) & 3;
+    if (inverted)
+    {
+        ops.src[0] = (instr >> 14) & 0x1F;
+        ops.src[1] = (instr >> 7) & 0x7F;
+        ops.relative_src = 1;
+    }
+    else
+    {
+        ops.src[0] = (instr >> 12) & 0x7F;
+        ops.src[1] = (instr >> 7) & 0x1F;
+        ops.relative_src = 0;
+    }
+    ops.desc = instr & 0x7F;
+    return ops;
+}
+
+// Flow control fields
+inline uint32_t sh_flow_dest(uint32_t instr) { return (instr >> 10) & 0xFFF; }
+inline uint32_t sh_flow_count(uint32_t instr) { return instr & 0xFF; }
+inline uint32_t sh_flow_bool(uint32_t instr) { return (instr >> 22) & 0xF; }
+inline uint32_t sh_flow_int(uint32_t instr) { return (instr >> 22) & 3; }
+
+// Conditions on the cmp flags: refx/refy are what each flag is compared to
+inline bool sh_condition(uint32_t instr, bool cmp_x, bool cmp_y)
+{
+    bool ref_y = (instr >> 24) & 1;
+    bool ref_x = (instr >> 25) & 1;
+    bool x = ref_x == cmp_x;
+    bool y = ref_y == cmp_y;
+    switch ((instr >> 22) & 3)
+    {
+    case 0: return x || y;
+    case 1: return x && y;
+    case 2: return x;
+    default: return y;
+    }
+}
+
+// CMP ops per component, x in bits 24-26 and y in 21-23
+inline bool sh_compare(uint32_t op, float a, float b)
+{
+    switch (op)
+    {
+    case 0: return a == b;
+    case 1: return a != b;
+    case 2: return a < b;
+    case 3: return a <= b;
+    case 4: return a > b;
+    case 5: return a >= b;
+    default: return true;
+    }
+}
+
+// PICA multiplies treat 0 * inf as 0
+inline float sh_mul(float a, float b)
+{
+    float r = a * b;
+    if (r != r && a == a && b == b)
+        return 0.0f;
+    return r;
+}
@@ -0,0 +1,694 @@
+// Shader JIT: straight runs of arithmetic ops are compiled to x86-64 SSE code
+// that works on the batch engine's register file directly. Swizzles, negates
+// and write masks turn into plain loads, xors and stores, so an op costs a
+// handful of instructions instead of a call through the op table. Hosts with
+// AVX also get each block eight lanes wide, over two batch states at once.
+//
+// Blocks end at anything the engine has to see between ops: flow control,
+// branch targets and the ends of call, if and loop bodies, which the
+// dispatcher checks frames against. Ops the JIT doesn't handle (EX2 and LG2,
+// which go through libm, and uniforms indexed by an address register) end a
+// block too and run from the table. Each op is emitted with the same float
+// operations in the same order as its handler, so both paths give the same
+// bits.
+
+#include "shader_batch.h"
+
+#include <string.h>
+#include <vector>
+#include <gpu/shader_isa.h>
+
+#if defined(__SSE2__)
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+
+enum GpReg
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RSI = 6,
+    RDI = 7,
+};
+
+enum SseOp
+{
+    SSE_MOVMSKPS = 0x50,
+    SSE_SQRTPS = 0x51,
+    SSE_ANDPS = 0x54,
+    SSE_ANDNPS = 0x55,
+    SSE_ORPS = 0x56,
+    SSE_XORPS = 0x57,
+    SSE_ADDPS = 0x58,
+    SSE_MULPS = 0x59,
+    SSE_CVTDQ2PS = 0x5B,
+    SSE_SUBPS = 0x5C,
+    SSE_MINPS = 0x5D,
+    SSE_DIVPS = 0x5E,
+    SSE_MAXPS = 0x5F,
+    SSE_CMPPS = 0xC2,
+};
+
+enum CmpPredicate
+{
+    CMP_EQ = 0,
+    CMP_LT = 1,
+    CMP_LE = 2,
+    CMP_UNORD = 3,
+    CMP_NEQ = 4,
+    CMP_ORD = 7,
+};
+
+// Constants the generated code reads, addressed through rdx. Eight lanes
+// each, SSE code only reads the first four.
+struct alignas(32) JitConstants
+{
+    uint32_t sign[8];
+    uint32_t abs[8];
+    float one[8];
+    float no_fraction[8];
+    float litp_min[8];
+    float litp_max[8];
+};
+
+#define LANES8(x) {x, x, x, x, x, x, x, x}
+static const JitConstants constants =
+{
+    LANES8(0x80000000),
+    LANES8(0x7FFFFFFF),
+    LANES8(1.0f),
+    LANES8(8388608.0f),
+    LANES8(-127.9961f),
+    LANES8(127.9961f),
+};
+#undef LANES8
+
+static const bool has_avx = __builtin_cpu_supports("avx");
+
+// Register state: rdi holds the BatchState, rsi its wide uniforms (the plain
+// ones for AVX code, which broadcasts them) and rdx the constants. Results
+// are built in xmm8-xmm11 and only stored once every source is read, as an
+// op may overwrite its own sources. xmm0-xmm7 are scratch.
+constexpr int RESULT = 8;
+
+static bool unary(uint8_t op)
+{
+    return op == SSE_MOVMSKPS || op == SSE_SQRTPS || op == SSE_CVTDQ2PS;
+}
+
+class JitEmitter
+{
+public:
+    std::vector<uint8_t> code;
+    // Emit 256-bit AVX code over two BatchStates, the second half_stride
+    // bytes after the first, instead of SSE code over one
+    bool wide = false;
+    int32_t half_stride = sizeof(BatchState);
+
+    void Byte(uint8_t value) { code.push_back(value); }
+
+    void Dword(uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            Byte(value >> (i * 8));
+    }
+
+    void Qword(uint64_t value)
+    {
+        Dword(value);
+        Dword(value >> 32);
+    }
+
+    void ModRmMem(int reg, int base, int32_t disp)
+    {
+        if (disp >= -128 && disp < 128)
+        {
+            Byte(0x40 | ((reg & 7) << 3) | base);
+            Byte(disp);
+        }
+        else
+        {
+            Byte(0x80 | ((reg & 7) << 3) | base);
+            Dword(disp);
+        }
+    }
+
+    // Everything before the opcode: the legacy prefix, REX and 0F for SSE,
+    // or a three byte VEX with the prefix folded in. reg and rm are the
+    // ModRM fields, src the extra VEX source (-1 for none). map 1 is 0F,
+    // 2 is 0F38 and 3 is 0F3A.
+    void Prefix(uint8_t prefix, int reg, int rm, int src, bool vex, int map = 1, bool ymm = true)
+    {
+        if (!vex)
+        {
+            if (prefix)
+                Byte(prefix);
+            if (reg >= 8 || rm >= 8)
+                Byte(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+            Byte(0x0F);
+            return;
+        }
+
+        uint8_t pp = prefix == 0x66 ? 1 : prefix == 0xF3 ? 2 : prefix == 0xF2 ? 3 : 0;
+        Byte(0xC4);
+        Byte((reg >= 8 ? 0 : 0x80) | 0x40 | (rm >= 8 ? 0 : 0x20) | map);
+        Byte(((~(src < 0 ? 0 : src) & 0xF) << 3) | (ymm ? 4 : 0) | pp);
+    }
+
+    // prefix 0F op, register to register. With AVX, binary ops take dst as
+    // their first source too, so both forms compute dst = dst op src.
+    void SseRR(uint8_t prefix, uint8_t op, int dst, int src, bool binary = true)
+    {
+        Prefix(prefix, dst, src, binary ? dst : -1, wide);
+        Byte(op);
+        Byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    // prefix 0F op, with [base + disp] as the r/m operand
+    void SseRM(uint8_t prefix, uint8_t op, int reg, int base, int32_t disp, bool binary = true)
+    {
+        Prefix(prefix, reg, base, binary ? reg : -1, wide);
+        Byte(op);
+        ModRmMem(reg, base, disp);
+    }
+
+    void Load(int xmm, int base, int32_t disp) { SseRM(0, 0x28, xmm, base, disp, false); }
+    void Store(int base, int32_t disp, int xmm) { SseRM(0, 0x29, xmm, base, disp, false); }
+    void Move(int dst, int src) { SseRR(0, 0x28, dst, src, false); }
+    void Op(SseOp op, int dst, int src) { SseRR(0, op, dst, src, !unary(op)); }
+    void OpMem(SseOp op, int dst, int base, int32_t disp) { SseRM(0, op, dst, base, disp, !unary(op)); }
+
+    void Cmp(int dst, int src, CmpPredicate predicate)
+    {
+        SseRR(0, SSE_CMPPS, dst, src);
+        Byte(predicate);
+    }
+
+    void CmpMem(int dst, int base, int32_t disp, CmpPredicate predicate)
+    {
+        SseRM(0, SSE_CMPPS, dst, base, disp);
+        Byte(predicate);
+    }
+
+    void Cvttps2dq(int dst, int src) { SseRR(0xF3, 0x5B, dst, src, false); }
+    void Cvtdq2ps(int dst, int src) { SseRR(0, SSE_CVTDQ2PS, dst, src, false); }
+    void StoreUnaligned(int base, int32_t disp, int xmm) { SseRM(0xF3, 0x7F, xmm, base, disp, false); }
+    void Movmskps(int gp, int xmm) { SseRR(0, SSE_MOVMSKPS, gp, xmm, false); }
+
+    // AVX only: the lower half of ymm from [base + disp] (vmovups) and the
+    // upper half from the same place in the second state (vinsertf128)
+    void LoadHalves(int ymm, int base, int32_t disp)
+    {
+        Prefix(0, ymm, base, -1, true, 1, false);
+        Byte(0x10);
+        ModRmMem(ymm, base, disp);
+        Prefix(0x66, ymm, base, ymm, true, 3);
+        Byte(0x18);
+        ModRmMem(ymm, base, disp + half_stride);
+        Byte(1);
+    }
+
+    // vmovups and vextractf128, the other way around
+    void StoreHalves(int base, int32_t disp, int ymm)
+    {
+        Prefix(0, ymm, base, -1, true, 1, false);
+        Byte(0x11);
+        ModRmMem(ymm, base, disp);
+        Prefix(0x66, ymm, base, -1, true, 3);
+        Byte(0x19);
+        ModRmMem(ymm, base, disp + half_stride);
+        Byte(1);
+    }
+
+    // vbroadcastss ymm, [base + disp]
+    void Broadcast(int ymm, int base, int32_t disp)
+    {
+        Prefix(0x66, ymm, base, -1, true, 2);
+        Byte(0x18);
+        ModRmMem(ymm, base, disp);
+    }
+
+    void Vzeroupper()
+    {
+        Byte(0xC5);
+        Byte(0xF8);
+        Byte(0x77);
+    }
+
+    void MoveGp32(int dst, int src)
+    {
+        Byte(0x89);
+        Byte(0xC0 | (src << 3) | dst);
+    }
+
+    void AndImm8(int gp, uint8_t value)
+    {
+        Byte(0x83);
+        Byte(0xE0 | gp);
+        Byte(value);
+    }
+
+    void ShrImm8(int gp, uint8_t value)
+    {
+        Byte(0xC1);
+        Byte(0xE8 | gp);
+        Byte(value);
+    }
+
+    void StoreGp32(int base, int32_t disp, int gp)
+    {
+        Byte(0x89);
+        ModRmMem(gp, base, disp);
+    }
+
+    void MoveImm32(int gp, uint32_t value)
+    {
+        Byte(0xB8 + gp);
+        Dword(value);
+    }
+
+    void LoadGp64(int gp, int base, int32_t disp)
+    {
+        Byte(0x48);
+        Byte(0x8B);
+        ModRmMem(gp, base, disp);
+    }
+
+    void MoveImm64(int gp, uint64_t value)
+    {
+        Byte(0x48);
+        Byte(0xB8 + gp);
+        Qword(value);
+    }
+
+    void Ret() { Byte(0xC3); }
+};
+
+static int32_t reg_offset(int reg, int comp)
+{
+    return offsetof(BatchState, regs) + (reg * 4 + comp) * sizeof(__m128);
+}
+
+static void load_source(JitEmitter& e, const BatchSource& src, int comp, int xmm)
+{
+    if (e.wide && src.uniform)
+        e.Broadcast(xmm, RSI, (src.index * 4 + src.comp[comp]) * sizeof(float));
+    else if (e.wide)
+        e.LoadHalves(xmm, RDI, reg_offset(src.index, src.comp[comp]));
+    else if (src.uniform)
+        e.Load(xmm, RSI, (src.index * 4 + src.comp[comp]) * sizeof(__m128));
+    else
+        e.Load(xmm, RDI, reg_offset(src.index, src.comp[comp]));
+
+    if (src.negate)
+        e.OpMem(SSE_XORPS, xmm, RDX, offsetof(JitConstants, sign));
+}
+
+// dst = a * b with 0 * inf as 0, like mul_ps. Clobbers a and tmp.
+static void emit_mul(JitEmitter& e, int dst, int a, int b, int tmp)
+{
+    e.Move(dst, a);
+    e.Op(SSE_MULPS, dst, b);
+    e.Move(tmp, dst);
+    e.Cmp(tmp, dst, CMP_UNORD);
+    e.Cmp(a, b, CMP_ORD);
+    e.Op(SSE_ANDPS, tmp, a);
+    e.Op(SSE_ANDNPS, tmp, dst);
+    e.Move(dst, tmp);
+}
+
+// dst = floor(v) like floor_ps. Clobbers xmm1-xmm3.
+static void emit_floor(JitEmitter& e, int dst, int v)
+{
+    e.Move(1, v);
+    e.OpMem(SSE_ANDPS, 1, RDX, offsetof(JitConstants, abs));
+    e.CmpMem(1, RDX, offsetof(JitConstants, no_fraction), CMP_LT);
+    e.Cvttps2dq(2, v);
+    e.Cvtdq2ps(2, 2);
+    e.Move(3, v);
+    e.Cmp(3, 2, CMP_LT);
+    e.OpMem(SSE_ANDPS, 3, RDX, offsetof(JitConstants, one));
+    e.Op(SSE_SUBPS, 2, 3);
+    e.Op(SSE_ANDPS, 2, 1);
+    e.Op(SSE_ANDNPS, 1, v);
+    e.Op(SSE_ORPS, 1, 2);
+    e.Move(dst, 1);
+}
+
+// Stores the masked components of the results, or of result 0 for ops that
+// write the same value everywhere
+static void store_result(JitEmitter& e, const BatchOp& op, bool broadcast)
+{
+    for (int c = 0; c < 4; c++)
+    {
+        if (!(op.mask & (8 >> c)))
+            continue;
+        if (e.wide)
+            e.StoreHalves(RDI, reg_offset(op.dest, c), RESULT + (broadcast ? 0 : c));
+        else
+            e.Store(RDI, reg_offset(op.dest, c), RESULT + (broadcast ? 0 : c));
+    }
+}
+
+// Stores the lane mask in eax as cmp.x or cmp.y. Wide masks have the second
+// state's lanes in bits 4-7.
+static void store_cmp(JitEmitter& e, int flag)
+{
+    int32_t offset = offsetof(BatchState, cmp) + flag * sizeof(int);
+    if (e.wide)
+    {
+        e.MoveGp32(RCX, RAX);
+        e.ShrImm8(RCX, 4);
+        e.AndImm8(RAX, 0xF);
+        e.StoreGp32(RDI, offset + e.half_stride, RCX);
+    }
+    e.StoreGp32(RDI, offset, RAX);
+}
+
+// Sets cmp.x or cmp.y from a CMP function applied to a and b, like
+// compare_lanes
+static void emit_compare(JitEmitter& e, uint32_t func, int a, int b, int flag)
+{
+    switch (func)
+    {
+    case 0: e.Cmp(a, b, CMP_EQ); e.Movmskps(RAX, a); break;
+    case 1: e.Cmp(a, b, CMP_NEQ); e.Movmskps(RAX, a); break;
+    case 2: e.Cmp(a, b, CMP_LT); e.Movmskps(RAX, a); break;
+    case 3: e.Cmp(a, b, CMP_LE); e.Movmskps(RAX, a); break;
+    case 4: e.Cmp(b, a, CMP_LT); e.Movmskps(RAX, b); break;
+    case 5: e.Cmp(b, a, CMP_LE); e.Movmskps(RAX, b); break;
+    default: e.MoveImm32(RAX, e.wide ? 0xFF : 0xF); break;
+    }
+    store_cmp(e, flag);
+}
+
+static bool can_compile(const BatchOp& op)
+{
+    if (!op.exec)
+        return false;
+
+    for (const BatchSource& src : op.src)
+    {
+        if (src.relative)
+            return false;
+    }
+
+    switch (op.opcode)
+    {
+    case SH_EX2:
+    case SH_LG2:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static void emit_op(JitEmitter& e, const BatchOp& op)
+{
+    const BatchSource* src = op.src;
+
+    switch (op.opcode)
+    {
+    case SH_ADD:
+        for (int c = 0; c < 4; c++)
+        {
+            load_source(e, src[0], c, RESULT + c);
+            load_source(e, src[1], c, 1);
+            e.Op(SSE_ADDPS, RESULT + c, 1);
+        }
+        store_result(e, op, false);
+        break;
+    case SH_MUL:
+        for (int c = 0; c < 4; c++)
+        {
+            load_source(e, src[0], c, 0);
+            load_source(e, src[1], c, 1);
+            emit_mul(e, RESULT + c, 0, 1, 2);
+        }
+        store_result(e, op, false);
+        break;
+    case SH_MAD:
+    case SH_MADI:
+        for (int c = 0; c < 4; c++)
+        {
+            load_source(e, src[0], c, 0);
+            load_source(e, src[1], c, 1);
+            emit_mul(e, RESULT + c, 0, 1, 2);
+            load_source(e, src[2], c, 1);
+            e.Op(SSE_ADDPS, RESULT + c, 1);
+        }
+        store_result(e, op, false);
+        break;
+    case SH_DP3:
+    case SH_DP4:
+    case SH_DPH:
+    case SH_DPHI:
+    {
+        int terms = op.opcode == SH_DP4 ? 4 : 3;
+        for (int c = 0; c < terms; c++)
+        {
+            load_source(e, src[0], c, 0);
+            load_source(e, src[1], c, 1);
+            emit_mul(e, c ? 4 : RESULT, 0, 1, 2);
+            if (c)
+                e.Op(SSE_ADDPS, RESULT, 4);
+        }
+        if (op.opcode == SH_DPH || op.opcode == SH_DPHI)
+        {
+            load_source(e, src[1], 3, 1);
+            e.Op(SSE_ADDPS, RESULT, 1);
+        }
+        store_result(e, op, true);
+        break;
+    }
+    case SH_DST:
+    case SH_DSTI:
+        e.Load(RESULT, RDX, offsetof(JitConstants, one));
+        load_source(e, src[0], 1, 0);
+        load_source(e, src[1], 1, 1);
+        emit_mul(e, RESULT + 1, 0, 1, 2);
+        load_source(e, src[0], 2, RESULT + 2);
+        load_source(e, src[1], 3, RESULT + 3);
+        store_result(e, op, false);
+        break;
+    case SH_LITP:
+        load_source(e, src[0], 0, 0);
+        load_source(e, src[0], 1, RESULT + 1);
+        load_source(e, src[0], 2, RESULT + 2);
+        load_source(e, src[0], 3, 3);
+        e.Op(SSE_XORPS, 7, 7);
+        e.Move(4, 7);
+        e.Cmp(4, 0, CMP_LE);
+        e.Movmskps(RAX, 4);
+        store_cmp(e, 0);
+        e.Move(4, 7);
+        e.Cmp(4, 3, CMP_LE);
+        e.Movmskps(RAX, 4);
+        store_cmp(e, 1);
+        e.Move(RESULT, 0);
+        e.Op(SSE_MAXPS, RESULT, 7);
+        e.OpMem(SSE_MAXPS, RESULT + 1, RDX, offsetof(JitConstants, litp_min));
+        e.OpMem(SSE_MINPS, RESULT + 1, RDX, offsetof(JitConstants, litp_max));
+        e.Move(RESULT + 3, 3);
+        e.Op(SSE_MAXPS, RESULT + 3, 7);
+        store_result(e, op, false);
+        break;
+    case SH_SGE:
+    case SH_SGEI:
+    case SH_SLT:
+    case SH_SLTI:
+    {
+        bool ge = op.opcode == SH_SGE || op.opcode == SH_SGEI;
+        for (int c = 0; c < 4; c++)
+        {
+            // a >= b is computed as b <= a, which is false for NaNs
+            load_source(e, src[ge ? 1 : 0], c, RESULT + c);
+            load_source(e, src[ge ? 0 : 1], c, 1);
+            e.Cmp(RESULT + c, 1, ge ? CMP_LE : CMP_LT);
+            e.OpMem(SSE_ANDPS, RESULT + c, RDX, offsetof(JitConstants, one));
+        }
+        store_result(e, op, false);
+        break;
+    }
+    case SH_FLR:
+        for (int c = 0; c < 4; c++)
+        {
+            load_source(e, src[0], c, 0);
+            emit_floor(e, RESULT + c, 0);
+        }
+        store_result(e, op, false);
+        break;
+    case SH_MAX:
+    case SH_MIN:
+        for (int c = 0; c < 4; c++)
+        {
+            load_source(e, src[0], c, RESULT + c);
+            load_source(e, src[1], c, 1);
+            e.Op(op.opcode == SH_MAX ? SSE_MAXPS : SSE_MINPS, RESULT + c, 1);
+        }
+        store_result(e, op, false);
+        break;
+    case SH_RCP:
+    case SH_RSQ:
+        load_source(e, src[0], 0, 0);
+        if (op.opcode == SH_RSQ)
+            e.Op(SSE_SQRTPS, 0, 0);
+        e.Load(RESULT, RDX, offsetof(JitConstants, one));
+        e.Op(SSE_DIVPS, RESULT, 0);
+        store_result(e, op, true);
+        break;
+    case SH_MOV:
+        for (int c = 0; c < 4; c++)
+            load_source(e, src[0], c, RESULT + c);
+        store_result(e, op, false);
+        break;
+    case SH_MOVA:
+        for (int c = 0; c < 2; c++)
+        {
+            if (op.mask & (8 >> c))
+            {
+                load_source(e, src[0], c, 0);
+                e.Cvttps2dq(0, 0);
+                if (e.wide)
+                    e.StoreHalves(RDI, offsetof(BatchState, address) + c * sizeof(__m128i), 0);
+                else
+                    e.StoreUnaligned(RDI, offsetof(BatchState, address) + c * sizeof(__m128i), 0);
+            }
+        }
+        break;
+    case SH_CMP:
+        for (int c = 0; c < 2; c++)
+        {
+            load_source(e, src[0], c, 0);
+            load_source(e, src[1], c, 1);
+            emit_compare(e, (op.instr >> (c ? 21 : 24)) & 7, 0, 1, c);
+        }
+        break;
+    }
+}
+
+// Marks every pc a flow instruction can send the engine to, or that ends a
+// frame. Both have to start a block.
+static void find_leaders(const CompiledShader* shader, bool leaders[SHADER_CODE_SIZE + 1])
+{
+    for (int pc = 0; pc < SHADER_CODE_SIZE; pc++)
+    {
+        uint32_t opcode = shader->ops[pc].opcode;
+        if (opcode < SH_BREAK || opcode >= SH_CMP)
+            continue;
+
+        uint32_t instr = shader->ops[pc].instr;
+        uint32_t dest = sh_flow_dest(instr);
+        uint32_t count = sh_flow_count(instr);
+        uint32_t targets[] = {(uint32_t)pc + 1, dest, dest + 1, dest + count};
+        for (uint32_t target : targets)
+        {
+            if (target <= SHADER_CODE_SIZE)
+                leaders[target] = true;
+        }
+    }
+}
+
+// Emits every block at e.wide's width, noting where each one starts
+static void emit_blocks(JitEmitter& e, CompiledShader* shader, const bool* leaders, JitBlock* blocks, uint32_t* offsets)
+{
+    for (int pc = 0; pc < SHADER_CODE_SIZE;)
+    {
+        if (!can_compile(shader->ops[pc]))
+        {
+            pc++;
+            continue;
+        }
+
+        int start = pc;
+        offsets[start] = e.code.size();
+        if (e.wide)
+            e.LoadGp64(RSI, RDI, offsetof(BatchState, uniforms));
+        else
+            e.LoadGp64(RSI, RDI, offsetof(BatchState, uniforms_wide));
+        e.MoveImm64(RDX, (uint64_t)&constants);
+        do
+        {
+            emit_op(e, shader->ops[pc]);
+            pc++;
+        } while (pc < SHADER_CODE_SIZE && !leaders[pc] && can_compile(shader->ops[pc]));
+        if (e.wide)
+            e.Vzeroupper();
+        e.Ret();
+
+        blocks[start].length = pc - start;
+    }
+}
+
+void jit_compile(CompiledShader* shader)
+{
+    bool leaders[SHADER_CODE_SIZE + 1] = {};
+    find_leaders(shader, leaders);
+
+    JitEmitter e;
+    uint32_t offsets[SHADER_CODE_SIZE], wide_offsets[SHADER_CODE_SIZE];
+
+    emit_blocks(e, shader, leaders, shader->blocks, offsets);
+    for (int pc = 0; pc < SHADER_CODE_SIZE; pc++)
+        shader->native_ops += shader->blocks[pc].length;
+
+    if (has_avx)
+    {
+        e.wide = true;
+        emit_blocks(e, shader, leaders, shader->wide_blocks, wide_offsets);
+    }
+
+    if (e.code.empty())
+        return;
+
+    // Written, then flipped to executable, never both at once
+    void* memory = mmap(nullptr, e.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+        memcpy(memory, e.code.data(), e.code.size());
+        if (mprotect(memory, e.code.size(), PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, e.code.size());
+            memory = MAP_FAILED;
+        }
+    }
+    if (memory == MAP_FAILED)
+    {
+        printf("[SHADER]: Couldn't map %zu bytes of JIT code, using the interpreter\n", e.code.size());
+        memset(shader->blocks, 0, sizeof(shader->blocks));
+        memset(shader->wide_blocks, 0, sizeof(shader->wide_blocks));
+        shader->native_ops = 0;
+        return;
+    }
+
+    shader->jit_memory = (uint8_t*)memory;
+    shader->jit_size = e.code.size();
+    shader->wide = has_avx;
+    for (int pc = 0; pc < SHADER_CODE_SIZE; pc++)
+    {
+        if (shader->blocks[pc].length)
+            shader->blocks[pc].code = (JitCode)(shader->jit_memory + offsets[pc]);
+        if (shader->wide_blocks[pc].length)
+            shader->wide_blocks[pc].code = (JitCode)(shader->jit_memory + wide_offsets[pc]);
+    }
+}
+
+void jit_free(CompiledShader* shader)
+{
+    if (shader->jit_memory)
+        munmap(shader->jit_memory, shader->jit_size);
+}
+
+#else
+
+// Only x86-64 hosts get native code, elsewhere the table runs everything
+void jit_compile(CompiledShader* shader)
+{
+}
+
+void jit_free(CompiledShader* shader)
+{
+}
+
+#endif
+#endif
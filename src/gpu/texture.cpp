@@ -0,0 +1,431 @@
+#include "texture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <gpu/morton.h>
+#include <memory/arena.h>
+#include <memory/Bus.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr uint32_t VRAM_START = 0x18000000;
+constexpr uint32_t VRAM_SIZE = 0x600000;
+constexpr uint32_t FCRAM_START = 0x20000000;
+constexpr uint32_t FCRAM_SIZE = 0x10000000;
+constexpr uint32_t VRAM_PAGES = VRAM_SIZE >> Arena::PAGE_SHIFT;
+constexpr uint32_t FCRAM_PAGES = FCRAM_SIZE >> Arena::PAGE_SHIFT;
+
+// Decoded textures are dropped all at once past this
+constexpr uint64_t CACHE_BUDGET = 64 << 20;
+
+const static uint8_t texel_bits[TEX_FORMAT_COUNT] = {32, 24, 16, 16, 16, 16, 16, 8, 8, 8, 4, 4, 4, 8};
+
+uint32_t TextureSize(uint32_t format, uint32_t width, uint32_t height)
+{
+    if (format >= TEX_FORMAT_COUNT)
+        return 0;
+    return width * height * texel_bits[format] / 8;
+}
+
+// Position in its tile of each texel of a tile, by Morton index
+struct TilePos
+{
+    uint8_t x, y;
+};
+
+static TilePos tile_pos[64];
+
+static void init_tile_pos()
+{
+    if (tile_pos[1].x)
+        return;
+    for (uint32_t y = 0; y < 8; y++)
+    {
+        for (uint32_t x = 0; x < 8; x++)
+            tile_pos[MortonInterleave(x, y)] = {(uint8_t)x, (uint8_t)y};
+    }
+}
+
+// Decodes one texel of a tile, for formats and hosts without a SIMD kernel
+static Color decode_texel(uint32_t format, const uint8_t* tile, uint32_t i)
+{
+    const uint8_t* p = tile + i * texel_bits[format] / 8;
+    uint8_t nibble = (i & 1) ? p[0] >> 4 : p[0] & 0xF;
+    switch (format)
+    {
+    case TEX_RGBA8: return DecodeColor(COLOR_RGBA8, p);
+    case TEX_RGB8: return DecodeColor(COLOR_RGB8, p);
+    case TEX_RGB5A1: return DecodeColor(COLOR_RGB5A1, p);
+    case TEX_RGB565: return DecodeColor(COLOR_RGB565, p);
+    case TEX_RGBA4: return DecodeColor(COLOR_RGBA4, p);
+    case TEX_IA8: return {p[1], p[1], p[1], p[0]};
+    case TEX_HILO8: return {p[1], p[0], 0, 255};
+    case TEX_I8: return {p[0], p[0], p[0], 255};
+    case TEX_A8: return {0, 0, 0, p[0]};
+    case TEX_IA4: return {expand4(p[0] >> 4), expand4(p[0] >> 4), expand4(p[0] >> 4), expand4(p[0] & 0xF)};
+    case TEX_I4: return {expand4(nibble), expand4(nibble), expand4(nibble), 255};
+    default: return {0, 0, 0, expand4(nibble)};
+    }
+}
+
+static void decode_tile_scalar(uint32_t format, const uint8_t* src, Color* out)
+{
+    for (uint32_t i = 0; i < 64; i++)
+        out[i] = decode_texel(format, src, i);
+}
+
+#if defined(__SSE2__)
+
+// Eight texels as 16-bit channels, into out[0..7]
+static inline void store8(__m128i r, __m128i g, __m128i b, __m128i a, Color* out)
+{
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+    _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(rg, ba));
+}
+
+static inline __m128i expand5x8(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2)); }
+static inline __m128i expand6x8(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 4)); }
+static inline __m128i expand4x8(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 4), v); }
+
+// Eight 8-bit texels, widened to 16 bits
+static inline __m128i load8x8(const uint8_t* src)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)src), _mm_setzero_si128());
+}
+
+// Eight 4-bit texels, low nibble first, widened to 16 bits
+static inline __m128i load8x4(const uint8_t* src)
+{
+    uint32_t bytes;
+    memcpy(&bytes, src, 4);
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+    v = _mm_unpacklo_epi16(v, v);
+    // Even lanes shift their byte up by 4 first, so >> 4 keeps the low nibble
+    v = _mm_mullo_epi16(v, _mm_set1_epi32(0x00010010));
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi16(0xF));
+}
+
+static void decode_tile(uint32_t format, const uint8_t* src, Color* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi16(0xFF);
+    const __m128i mask4 = _mm_set1_epi16(0xF);
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+
+    switch (format)
+    {
+    case TEX_RGBA8:
+        // ABGR in memory, a byte swap per texel
+        for (int i = 0; i < 64; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+            _mm_storeu_si128((__m128i*)(out + i), v);
+        }
+        return;
+    case TEX_RGB5A1:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+            __m128i r = expand5x8(_mm_srli_epi16(v, 11));
+            __m128i g = expand5x8(_mm_and_si128(_mm_srli_epi16(v, 6), mask5));
+            __m128i b = expand5x8(_mm_and_si128(_mm_srli_epi16(v, 1), mask5));
+            __m128i a = _mm_and_si128(_mm_sub_epi16(zero, _mm_and_si128(v, _mm_set1_epi16(1))), ff);
+            store8(r, g, b, a, out + i);
+        }
+        return;
+    case TEX_RGB565:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+            __m128i r = expand5x8(_mm_srli_epi16(v, 11));
+            __m128i g = expand6x8(_mm_and_si128(_mm_srli_epi16(v, 5), mask6));
+            __m128i b = expand5x8(_mm_and_si128(v, mask5));
+            store8(r, g, b, ff, out + i);
+        }
+        return;
+    case TEX_RGBA4:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+            __m128i r = expand4x8(_mm_srli_epi16(v, 12));
+            __m128i g = expand4x8(_mm_and_si128(_mm_srli_epi16(v, 8), mask4));
+            __m128i b = expand4x8(_mm_and_si128(_mm_srli_epi16(v, 4), mask4));
+            __m128i a = expand4x8(_mm_and_si128(v, mask4));
+            store8(r, g, b, a, out + i);
+        }
+        return;
+    case TEX_IA8:
+    case TEX_HILO8:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+            __m128i hi = _mm_srli_epi16(v, 8);
+            __m128i lo = _mm_and_si128(v, ff);
+            if (format == TEX_IA8)
+                store8(hi, hi, hi, lo, out + i);
+            else
+                store8(hi, lo, zero, ff, out + i);
+        }
+        return;
+    case TEX_I8:
+    case TEX_A8:
+    case TEX_IA4:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = load8x8(src + i);
+            if (format == TEX_I8)
+                store8(v, v, v, ff, out + i);
+            else if (format == TEX_A8)
+                store8(zero, zero, zero, v, out + i);
+            else
+            {
+                __m128i intensity = expand4x8(_mm_srli_epi16(v, 4));
+                store8(intensity, intensity, intensity, expand4x8(_mm_and_si128(v, mask4)), out + i);
+            }
+        }
+        return;
+    case TEX_I4:
+    case TEX_A4:
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m128i v = expand4x8(load8x4(src + i / 2));
+            if (format == TEX_I4)
+                store8(v, v, v, ff, out + i);
+            else
+                store8(zero, zero, zero, v, out + i);
+        }
+        return;
+    default:
+        decode_tile_scalar(format, src, out);
+        return;
+    }
+}
+
+#else
+
+static void decode_tile(uint32_t format, const uint8_t* src, Color* out)
+{
+    decode_tile_scalar(format, src, out);
+}
+
+#endif
+
+const static int etc1_modifiers[8][2] =
+{
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183},
+};
+
+// One 4x4 ETC1 block. Texel (x, y) uses bit x * 4 + y of each half of the
+// index word, the block's two halves split it vertically unless flipped.
+static void decode_etc1_block(uint64_t block, uint64_t alpha, bool has_alpha, Color* dst, uint32_t stride)
+{
+    bool flip = (block >> 32) & 1;
+    bool diff = (block >> 33) & 1;
+    int table[2] = {(int)(block >> 37) & 7, (int)(block >> 34) & 7};
+
+    int base[2][3];
+    for (int c = 0; c < 3; c++)
+    {
+        int shift = 56 - c * 8;
+        if (diff)
+        {
+            int v = (block >> (shift + 3)) & 0x1F;
+            int delta = (int)((block >> shift) & 7) << 29 >> 29;
+            base[0][c] = expand5(v);
+            base[1][c] = expand5((v + delta) & 0x1F);
+        }
+        else
+        {
+            base[0][c] = expand4((block >> (shift + 4)) & 0xF);
+            base[1][c] = expand4((block >> shift) & 0xF);
+        }
+    }
+
+    for (int x = 0; x < 4; x++)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            int texel = x * 4 + y;
+            int half = (flip ? y : x) >= 2;
+            int modifier = etc1_modifiers[table[half]][(block >> texel) & 1];
+            if ((block >> (16 + texel)) & 1)
+                modifier = -modifier;
+
+            Color& out = dst[y * stride + x];
+            out.r = std::clamp(base[half][0] + modifier, 0, 255);
+            out.g = std::clamp(base[half][1] + modifier, 0, 255);
+            out.b = std::clamp(base[half][2] + modifier, 0, 255);
+            out.a = has_alpha ? expand4((alpha >> (texel * 4)) & 0xF) : 255;
+        }
+    }
+}
+
+void DecodeTexture(uint32_t format, const uint8_t* src, uint32_t width, uint32_t height, Color* dst)
+{
+    init_tile_pos();
+
+    if (format == TEX_ETC1 || format == TEX_ETC1A4)
+    {
+        bool has_alpha = format == TEX_ETC1A4;
+        uint32_t block_size = has_alpha ? 16 : 8;
+        for (uint32_t ty = 0; ty < height; ty += 8)
+        {
+            for (uint32_t tx = 0; tx < width; tx += 8)
+            {
+                // Four blocks per tile, in Z order
+                for (uint32_t i = 0; i < 4; i++)
+                {
+                    uint64_t alpha = 0, block;
+                    if (has_alpha)
+                        memcpy(&alpha, src, 8);
+                    memcpy(&block, src + block_size - 8, 8);
+                    src += block_size;
+
+                    uint32_t x = tx + (i & 1) * 4;
+                    uint32_t y = ty + (i >> 1) * 4;
+                    decode_etc1_block(block, alpha, has_alpha, dst + y * width + x, width);
+                }
+            }
+        }
+        return;
+    }
+
+    uint32_t tile_bytes = 64 * texel_bits[format] / 8;
+    alignas(16) Color tile[64];
+    for (uint32_t ty = 0; ty < height; ty += 8)
+    {
+        for (uint32_t tx = 0; tx < width; tx += 8)
+        {
+            decode_tile(format, src, tile);
+            src += tile_bytes;
+
+            // Even Morton indices start a horizontal pair, so the tile goes
+            // out two texels at a time
+            for (uint32_t i = 0; i < 64; i += 2)
+            {
+                TilePos pos = tile_pos[i];
+                memcpy(dst + (ty + pos.y) * width + tx + pos.x, tile + i, sizeof(Color) * 2);
+            }
+        }
+    }
+}
+
+void DecodePixels(uint32_t format, const uint8_t* src, uint32_t count, Color* dst)
+{
+    // The tile kernels don't care about layout, so they take 64 at a time
+    uint32_t bpp = ColorFormatBpp(format);
+    uint32_t i = 0;
+    for (; i + 64 <= count; i += 64)
+        decode_tile(format, src + i * bpp, dst + i);
+    for (; i < count; i++)
+        dst[i] = DecodeColor(format, src + i * bpp);
+}
+
+// Index into the page table of a tracked page, -1 for anything else
+static int64_t page_slot(uint32_t addr)
+{
+    if (addr >= VRAM_START && addr < VRAM_START + VRAM_SIZE)
+        return (addr - VRAM_START) >> Arena::PAGE_SHIFT;
+    if (addr >= FCRAM_START && addr - FCRAM_START < FCRAM_SIZE)
+        return VRAM_PAGES + ((addr - FCRAM_START) >> Arena::PAGE_SHIFT);
+    return -1;
+}
+
+TextureCache::TextureCache() : page_writes(VRAM_PAGES + FCRAM_PAGES, 0)
+{
+}
+
+bool TextureCache::IsCurrent(const Entry& entry)
+{
+    int64_t first = page_slot(entry.addr);
+    int64_t last = page_slot(entry.addr + entry.size - 1);
+    for (int64_t slot = first; slot <= last; slot++)
+    {
+        if (page_writes[slot] > entry.decoded_at)
+            return false;
+    }
+    return true;
+}
+
+const Color* TextureCache::Lookup(uint32_t addr, uint32_t format, uint32_t width, uint32_t height)
+{
+    if (format >= TEX_FORMAT_COUNT || !width || !height || width > 1024 || height > 1024 || (width | height) & 7)
+        return nullptr;
+
+    uint32_t size = TextureSize(format, width, height);
+    const uint8_t* src = Bus::GetPhysicalPtr(addr, size);
+    if (!src)
+        return nullptr;
+
+    uint64_t key = addr | ((uint64_t)format << 32) | ((uint64_t)(width / 8 - 1) << 36) | ((uint64_t)(height / 8 - 1) << 44);
+    auto [it, inserted] = entries.try_emplace(key);
+    Entry& entry = it->second;
+    if (inserted)
+    {
+        int64_t first = page_slot(addr);
+        int64_t last = page_slot(addr + size - 1);
+        entry.addr = addr;
+        entry.size = size;
+        // Both ends in the same tracked range
+        entry.tracked = first >= 0 && last >= 0 && (first < VRAM_PAGES) == (last < VRAM_PAGES);
+        entry.texels.resize(width * height);
+        cached_bytes += width * height * sizeof(Color);
+    }
+    else if (entry.tracked && IsCurrent(entry))
+    {
+        hits++;
+        return entry.texels.data();
+    }
+
+    entry.decoded_at = write_seq;
+    DecodeTexture(format, src, width, height, entry.texels.data());
+    decodes++;
+    if (entry.tracked)
+        Arena::Watch(addr, size);
+    return entry.texels.data();
+}
+
+void TextureCache::Invalidate(uint32_t addr, uint32_t size)
+{
+    if (!size)
+        return;
+
+    uint64_t seq = ++write_seq;
+    uint64_t end = (uint64_t)addr + size;
+    for (uint64_t page = addr & ~(uint64_t)(Arena::PAGE_SIZE - 1); page < end; page += Arena::PAGE_SIZE)
+    {
+        int64_t slot = page_slot(page);
+        if (slot >= 0)
+            page_writes[slot] = seq;
+    }
+    Arena::Unwatch(addr, size);
+    invalidations++;
+}
+
+void TextureCache::Trim()
+{
+    if (cached_bytes > CACHE_BUDGET)
+        Clear();
+}
+
+void TextureCache::Clear()
+{
+    entries.clear();
+    cached_bytes = 0;
+}
+
+void TextureCache::Dump()
+{
+    if (!decodes)
+        return;
+    printf("[TEX]: %lu lookups hit the cache, %lu decodes, %lu invalidations\n", hits, decodes, invalidations);
+    printf("[TEX]: %zu textures cached, %lu KB\n", entries.size(), cached_bytes >> 10);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "color.h"
+
+// Texture formats, as in the texture units' TYPE registers
+enum TextureFormat
+{
+    TEX_RGBA8,
+    TEX_RGB8,
+    TEX_RGB5A1,
+    TEX_RGB565,
+    TEX_RGBA4,
+    TEX_IA8,
+    TEX_HILO8,
+    TEX_I8,
+    TEX_A8,
+    TEX_IA4,
+    TEX_I4,
+    TEX_A4,
+    TEX_ETC1,
+    TEX_ETC1A4,
+    TEX_FORMAT_COUNT
+};
+
+// Size in bytes of a width x height texture, 0 for a format that doesn't exist
+uint32_t TextureSize(uint32_t format, uint32_t width, uint32_t height);
+
+// Untiles and decodes a texture into width * height colors, rows in memory
+// order. Textures are stored as 8x8 tiles with their pixels in Morton order,
+// ETC1 ones as 8x8 tiles of four 4x4 blocks. Both sizes must be multiples
+// of 8.
+void DecodeTexture(uint32_t format, const uint8_t* src, uint32_t width, uint32_t height, Color* dst);
+
+// Decodes count consecutive pixels of a color buffer format (ColorFormat,
+// which matches the first five texture formats)
+void DecodePixels(uint32_t format, const uint8_t* src, uint32_t count, Color* dst);
+
+// Decoded textures, keyed by address, format and size. The cache tracks the
+// pages of VRAM and FCRAM it has decoded from: CPU writes are caught by
+// watching those pages (see Arena::Watch), the GPU's own writes have to be
+// reported through Invalidate. A texture is decoded again on its next use
+// if anything wrote to its pages since.
+class TextureCache
+{
+private:
+    struct Entry
+    {
+        uint32_t addr, size;
+        // Textures outside VRAM and FCRAM are decoded on every lookup
+        bool tracked;
+        uint64_t decoded_at;
+        std::vector<Color> texels;
+    };
+
+    // Write sequence number of each tracked page, VRAM pages first
+    std::vector<uint64_t> page_writes;
+    uint64_t write_seq = 0;
+
+    std::unordered_map<uint64_t, Entry> entries;
+    uint64_t cached_bytes = 0;
+
+    uint64_t hits = 0;
+    uint64_t decodes = 0;
+    uint64_t invalidations = 0;
+
+    bool IsCurrent(const Entry& entry);
+public:
+    TextureCache();
+
+    // The decoded texture at physical address addr, nullptr if it isn't in
+    // memory or the format is invalid. The pointer stays valid until the
+    // next Trim or Clear.
+    const Color* Lookup(uint32_t addr, uint32_t format, uint32_t width, uint32_t height);
+
+    // Marks [addr, addr+size) as written
+    void Invalidate(uint32_t addr, uint32_t size);
+
+    // Drops everything once the cache has grown past its budget, call
+    // between draws
+    void Trim();
+    void Clear();
+    void Dump();
+};
@@ -0,0 +1,439 @@
+#include "vertex_loader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <gpu/pica_regs.h>
+#include <memory/Bus.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr int VERTEX_LOADERS = 12;
+
+// Indices are at most 16 bits
+constexpr uint32_t INDEX_RANGE = 0x10000;
+
+// How many batches ahead of the one being loaded to prefetch attribute data
+constexpr size_t PREFETCH_BATCHES = 2;
+
+enum AttribType
+{
+    ATTRIB_BYTE,
+    ATTRIB_UBYTE,
+    ATTRIB_SHORT,
+    ATTRIB_FLOAT,
+};
+
+enum Topology
+{
+    TOPOLOGY_LIST,
+    TOPOLOGY_STRIP,
+    TOPOLOGY_FAN,
+    // Same as a list without a geometry shader
+    TOPOLOGY_GEOMETRY,
+};
+
+const static uint32_t attrib_bytes[4] = {1, 1, 2, 4};
+
+// Where an output semantic goes in a RasterVertex, position first, -1 for
+// what the rasterizer has no use for
+static int output_slot(uint32_t semantic)
+{
+    if (semantic < 4)
+        return semantic;
+    // Color, then texture coordinates 0 and 1
+    if (semantic >= 8 && semantic < 16)
+        return 4 + RASTER_COLOR_R + semantic - 8;
+    if (semantic == 22 || semantic == 23)
+        return 4 + RASTER_TEX2_U + semantic - 22;
+    return -1;
+}
+
+PicaVertexLoader::PicaVertexLoader() : cache_stamp(INDEX_RANGE, 0), cache_slot(INDEX_RANGE, 0)
+{
+}
+
+void PicaVertexLoader::Reset()
+{
+    memset(fixed_values, 0, sizeof(fixed_values));
+    fixed_index = 0;
+}
+
+void PicaVertexLoader::SetFixedAttribIndex(uint32_t value)
+{
+    fixed_index = value & 0xF;
+}
+
+void PicaVertexLoader::WriteFixedAttrib(uint32_t word, uint32_t value)
+{
+    fixed_buffer[word] = value;
+    if (word < 2)
+        return;
+
+    if (fixed_index < VERTEX_ATTRIBS)
+        f24x4_to_float(fixed_buffer, fixed_values[fixed_index++]);
+    else if (fixed_index == 0xF)
+        printf("[VERTEX]: Immediate-mode vertices aren't supported\n");
+}
+
+// Attribute buffer layout, vertex shader inputs and output map, from the
+// registers. Each of the 12 loaders reads a run of attributes (or padding)
+// per vertex from its own buffer. Attributes no loader reads take their
+// fixed value.
+void PicaVertexLoader::Configure(const uint32_t* regs)
+{
+    base_addr = (regs[PICA_REG_ATTRIBBUFFERS_LOC] & 0x1FFFFFFE) * 8;
+
+    uint32_t format_high = regs[PICA_REG_ATTRIBBUFFERS_FORMAT_HIGH];
+    uint64_t formats = regs[PICA_REG_ATTRIBBUFFERS_FORMAT_LOW] | (uint64_t)format_high << 32;
+    uint32_t fixed_mask = (format_high >> 16) & 0xFFF;
+    uint32_t count = (format_high >> 28) + 1;
+    uint64_t permutation = regs[PICA_REG_VSH_ATTRIBUTES_PERMUTATION_LOW] |
+        (uint64_t)regs[PICA_REG_VSH_ATTRIBUTES_PERMUTATION_HIGH] << 32;
+
+    attribs.clear();
+    bool loaded[VERTEX_ATTRIBS] = {};
+    for (int l = 0; l < VERTEX_LOADERS; l++)
+    {
+        const uint32_t* loader = &regs[PICA_REG_ATTRIBBUFFER0_OFFSET + l * 3];
+        uint32_t addr = base_addr + (loader[0] & 0x0FFFFFFF);
+        uint64_t components = loader[1] | (uint64_t)(loader[2] & 0xFFFF) << 32;
+        uint32_t stride = (loader[2] >> 16) & 0xFF;
+        uint32_t component_count = loader[2] >> 28;
+
+        uint32_t pos = 0;
+        for (uint32_t c = 0; c < component_count; c++)
+        {
+            uint32_t id = (components >> (c * 4)) & 0xF;
+            if (id >= VERTEX_ATTRIBS)
+            {
+                pos += (id - 11) * 4;
+                continue;
+            }
+
+            uint32_t type = (formats >> (id * 4)) & 3;
+            uint32_t size = ((formats >> (id * 4 + 2)) & 3) + 1;
+            // Each attribute is aligned to its element size
+            pos = (pos + attrib_bytes[type] - 1) & ~(attrib_bytes[type] - 1);
+            if (id < count && !((fixed_mask >> id) & 1) && !loaded[id])
+            {
+                int input = (permutation >> (id * 4)) & 0xF;
+                attribs.push_back({addr + pos, stride, attrib_bytes[type] * size, type, size, input, nullptr});
+                loaded[id] = true;
+            }
+            pos += attrib_bytes[type] * size;
+        }
+    }
+
+    for (uint32_t i = 0; i < VERTEX_ATTRIBS; i++)
+        fixed_inputs[i] = i < count && !loaded[i] ? (permutation >> (i * 4)) & 0xF : -1;
+
+    // The nth output map describes the nth output register the shader writes
+    std::fill(output_map, output_map + 4 + RASTER_ATTRIB_COUNT, -1);
+    uint32_t output_mask = regs[PICA_REG_VSH_OUTMAP_MASK] & 0xFFFF;
+    uint32_t total = std::min(regs[PICA_REG_SH_OUTMAP_TOTAL] & 7, 7u);
+    int reg = -1;
+    for (uint32_t i = 0; i < total; i++)
+    {
+        do
+            reg++;
+        while (reg < SHADER_OUTPUTS && !((output_mask >> reg) & 1));
+        if (reg >= SHADER_OUTPUTS)
+            break;
+
+        uint32_t map = regs[PICA_REG_SH_OUTMAP_O0 + i];
+        for (int c = 0; c < 4; c++)
+        {
+            int slot = output_slot((map >> (c * 8)) & 0x1F);
+            if (slot >= 0)
+                output_map[slot] = reg * 4 + c;
+        }
+    }
+}
+
+// Fills unique with the vertices to shade and order with the draw's
+// vertices as positions in it, then finds the attribute data they need
+bool PicaVertexLoader::ReadIndices(const uint32_t* regs, bool indexed)
+{
+    uint32_t count = regs[PICA_REG_NUMVERTICES];
+    if (!count)
+        return false;
+
+    order.resize(count);
+    unique.clear();
+    if (indexed)
+    {
+        uint32_t config = regs[PICA_REG_INDEXBUFFER_CONFIG];
+        bool wide = config >> 31;
+        uint32_t addr = base_addr + (config & 0x0FFFFFFF);
+        const uint8_t* indices = Bus::GetPhysicalPtr(addr, count << wide);
+        if (!indices)
+        {
+            printf("[VERTEX]: Index buffer at 0x%08x isn't in memory\n", addr);
+            return false;
+        }
+
+        // A new stamp empties the cache
+        if (++draw_stamp == 0)
+        {
+            std::fill(cache_stamp.begin(), cache_stamp.end(), 0);
+            draw_stamp = 1;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t index = indices[i];
+            if (wide)
+            {
+                uint16_t value;
+                memcpy(&value, indices + i * 2, 2);
+                index = value;
+            }
+
+            if (cache_stamp[index] != draw_stamp)
+            {
+                cache_stamp[index] = draw_stamp;
+                cache_slot[index] = unique.size();
+                unique.push_back(index);
+            }
+            order[i] = cache_slot[index];
+        }
+        indices_read += count;
+        cache_hits += count - unique.size();
+    }
+    else
+    {
+        uint32_t first = regs[PICA_REG_VERTEX_OFFSET];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            order[i] = i;
+            unique.push_back(first + i);
+        }
+    }
+
+    uint32_t last = *std::max_element(unique.begin(), unique.end());
+    for (Attrib& attrib : attribs)
+    {
+        attrib.data = Bus::GetPhysicalPtr(attrib.addr, last * attrib.stride + attrib.bytes);
+        if (!attrib.data)
+        {
+            printf("[VERTEX]: Attribute buffer at 0x%08x isn't in memory\n", attrib.addr);
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(__SSE2__)
+
+// One vertex's copy of an attribute, missing components read as (0, 0, 0, 1)
+static inline __m128 load_attrib(uint32_t type, uint32_t size, const uint8_t* src)
+{
+    alignas(16) uint8_t bytes[16] = {};
+    memcpy(bytes, src, attrib_bytes[type] * size);
+    __m128i raw = _mm_load_si128((const __m128i*)bytes);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128 value;
+    switch (type)
+    {
+    case ATTRIB_BYTE:
+        raw = _mm_unpacklo_epi8(raw, raw);
+        value = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 24));
+        break;
+    case ATTRIB_UBYTE:
+        raw = _mm_unpacklo_epi8(raw, zero);
+        value = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+        break;
+    case ATTRIB_SHORT:
+        value = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16));
+        break;
+    default:
+        value = _mm_castsi128_ps(raw);
+        break;
+    }
+    return size < 4 ? _mm_or_ps(value, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f)) : value;
+}
+
+void PicaVertexLoader::LoadBatch(const uint32_t vertex[4], ShaderBatch& batch)
+{
+    for (const Attrib& attrib : attribs)
+    {
+        __m128 v0 = load_attrib(attrib.type, attrib.size, attrib.data + vertex[0] * attrib.stride);
+        __m128 v1 = load_attrib(attrib.type, attrib.size, attrib.data + vertex[1] * attrib.stride);
+        __m128 v2 = load_attrib(attrib.type, attrib.size, attrib.data + vertex[2] * attrib.stride);
+        __m128 v3 = load_attrib(attrib.type, attrib.size, attrib.data + vertex[3] * attrib.stride);
+
+        // One vertex per register to one component per register
+        _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+        float (*dst)[4] = batch.input[attrib.input];
+        _mm_store_ps(dst[0], v0);
+        _mm_store_ps(dst[1], v1);
+        _mm_store_ps(dst[2], v2);
+        _mm_store_ps(dst[3], v3);
+    }
+}
+
+#else
+
+static float load_component(uint32_t type, const uint8_t* src)
+{
+    switch (type)
+    {
+    case ATTRIB_BYTE: return (int8_t)src[0];
+    case ATTRIB_UBYTE: return src[0];
+    case ATTRIB_SHORT:
+    {
+        int16_t value;
+        memcpy(&value, src, 2);
+        return value;
+    }
+    default:
+    {
+        float value;
+        memcpy(&value, src, 4);
+        return value;
+    }
+    }
+}
+
+void PicaVertexLoader::LoadBatch(const uint32_t vertex[4], ShaderBatch& batch)
+{
+    for (const Attrib& attrib : attribs)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            const uint8_t* src = attrib.data + vertex[lane] * attrib.stride;
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                float value = c == 3 ? 1.0f : 0.0f;
+                if (c < attrib.size)
+                    value = load_component(attrib.type, src + c * attrib_bytes[attrib.type]);
+                batch.input[attrib.input][c][lane] = value;
+            }
+        }
+    }
+}
+
+#endif
+
+void PicaVertexLoader::StoreVertex(const ShaderBatch& batch, int lane, RasterVertex& vertex)
+{
+    const float* outputs = &batch.output[0][0][0];
+    for (int i = 0; i < 4 + RASTER_ATTRIB_COUNT; i++)
+    {
+        int src = output_map[i];
+        float value = src >= 0 ? outputs[src * 4 + lane] : i == 3 ? 1.0f : 0.0f;
+        if (i < 4)
+            vertex.pos[i] = value;
+        else
+            vertex.attr[i - 4] = value;
+    }
+}
+
+void PicaVertexLoader::Assemble(uint32_t topology)
+{
+    size_t count = order.size();
+    auto emit = [this](size_t a, size_t b, size_t c)
+    {
+        triangles.push_back(vertices[order[a]]);
+        triangles.push_back(vertices[order[b]]);
+        triangles.push_back(vertices[order[c]]);
+    };
+
+    switch (topology)
+    {
+    case TOPOLOGY_STRIP:
+        // Every other triangle swaps its first two vertices to keep the
+        // strip's winding
+        for (size_t i = 2; i < count; i++)
+        {
+            if (i & 1)
+                emit(i - 1, i - 2, i);
+            else
+                emit(i - 2, i - 1, i);
+        }
+        break;
+    case TOPOLOGY_FAN:
+        for (size_t i = 2; i < count; i++)
+            emit(0, i - 1, i);
+        break;
+    default:
+        for (size_t i = 0; i + 2 < count; i += 3)
+            emit(i, i + 1, i + 2);
+        break;
+    }
+}
+
+bool PicaVertexLoader::Run(const uint32_t* regs, bool indexed, PicaShader& shader)
+{
+    triangles.clear();
+    Configure(regs);
+    if (!ReadIndices(regs, indexed))
+        return false;
+
+    // Fixed attributes are the same for every vertex, they're only set once
+    ShaderBatch batches[2] = {};
+    for (ShaderBatch& batch : batches)
+    {
+        for (int i = 0; i < VERTEX_ATTRIBS; i++)
+        {
+            if (fixed_inputs[i] < 0)
+                continue;
+            for (int c = 0; c < 4; c++)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                    batch.input[fixed_inputs[i]][c][lane] = fixed_values[i][c];
+            }
+        }
+    }
+
+    // Two batches at a time, which the shader can run eight lanes wide
+    vertices.resize(unique.size());
+    for (size_t first = 0; first < unique.size(); first += 8)
+    {
+        // A partial batch repeats its last vertex in the spare lanes
+        size_t lanes = std::min<size_t>(8, unique.size() - first);
+        uint32_t vertex[8];
+        for (size_t lane = 0; lane < 8; lane++)
+            vertex[lane] = unique[first + std::min(lane, lanes - 1)];
+
+        // Indexed vertices come in no particular order, start fetching the
+        // attributes of the batches after these
+        size_t ahead = first + PREFETCH_BATCHES * 4;
+        for (size_t i = ahead; i < std::min(ahead + 8, unique.size()); i++)
+        {
+            for (const Attrib& attrib : attribs)
+                __builtin_prefetch(attrib.data + unique[i] * attrib.stride);
+        }
+
+        LoadBatch(vertex, batches[0]);
+        if (lanes > 4)
+        {
+            LoadBatch(vertex + 4, batches[1]);
+            shader.Run(batches[0], batches[1]);
+        }
+        else
+            shader.Run(batches[0]);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+            StoreVertex(batches[lane / 4], lane % 4, vertices[first + lane]);
+    }
+    vertices_shaded += unique.size();
+
+    Assemble((regs[PICA_REG_PRIMITIVE_CONFIG] >> 8) & 3);
+    return !triangles.empty();
+}
+
+void PicaVertexLoader::Dump()
+{
+    if (!vertices_shaded)
+        return;
+
+    printf("[VERTEX]: %lu vertices shaded", vertices_shaded);
+    if (indices_read)
+        printf(", %lu indices with %.1f%% post-transform cache hits", indices_read, cache_hits * 100.0 / indices_read);
+    printf("\n");
+}
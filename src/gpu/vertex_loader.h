@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "rasterizer.h"
+#include "shader.h"
+
+constexpr int VERTEX_ATTRIBS = 12;
+
+// Turns a draw's vertices into triangles for the rasterizer. Attributes are
+// read from the attribute buffers and converted to floats four vertices at
+// a time, straight into the shader's lanes. Indexed draws go through a
+// post-transform cache: each distinct index is shaded once per draw, however
+// many triangles share it.
+class PicaVertexLoader
+{
+private:
+    struct Attrib
+    {
+        // Physical address in vertex 0, the vertex stride, and the bytes
+        // one vertex's copy takes up
+        uint32_t addr;
+        uint32_t stride;
+        uint32_t bytes;
+        uint32_t type, size;
+        int input;
+        const uint8_t* data;
+    };
+
+    uint32_t base_addr;
+    std::vector<Attrib> attribs;
+
+    // Shader input that a fixed attribute goes to, -1 if it's loaded
+    int fixed_inputs[VERTEX_ATTRIBS];
+    float fixed_values[VERTEX_ATTRIBS][4];
+    uint32_t fixed_index = 0;
+    uint32_t fixed_buffer[3];
+
+    // Shader output register and component of each RasterVertex value,
+    // position first, -1 if nothing writes it
+    int output_map[4 + RASTER_ATTRIB_COUNT];
+
+    // Post-transform cache: the slot in vertices of each index shaded during
+    // the draw numbered draw_stamp
+    std::vector<uint32_t> cache_stamp, cache_slot;
+    uint32_t draw_stamp = 0;
+
+    std::vector<uint32_t> unique;
+    std::vector<uint32_t> order;
+    std::vector<RasterVertex> vertices;
+    std::vector<RasterVertex> triangles;
+
+    uint64_t vertices_shaded = 0;
+    uint64_t indices_read = 0;
+    uint64_t cache_hits = 0;
+
+    void Configure(const uint32_t* regs);
+    bool ReadIndices(const uint32_t* regs, bool indexed);
+    void LoadBatch(const uint32_t vertex[4], ShaderBatch& batch);
+    void StoreVertex(const ShaderBatch& batch, int lane, RasterVertex& vertex);
+    void Assemble(uint32_t topology);
+public:
+    PicaVertexLoader();
+
+    void Reset();
+
+    // Fixed attributes are uploaded three words at a time, like float24
+    // uniforms
+    void SetFixedAttribIndex(uint32_t value);
+    void WriteFixedAttrib(uint32_t word, uint32_t value);
+
+    // Shades the draw's vertices, shader.Prepare has to have been called.
+    // Returns false if the draw has nothing to show or its buffers aren't in
+    // memory, otherwise Triangles holds its independent triangles.
+    bool Run(const uint32_t* regs, bool indexed, PicaShader& shader);
+    const std::vector<RasterVertex>& Triangles() const { return triangles; }
+
+    void Dump();
+};
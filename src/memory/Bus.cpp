@@ -2,26 +2,32 @@
 #include <crypto/rsa.h>
 #include <crypto/sha.h>
 #include <crypto/aes.h>
+#include <crypto/ctr_cache.h>
 #include <dma/cdma.h>
 #include <dma/ndma.h>
 #include <i2c/i2c.h>
 #include <pxi/pxi.h>
+#include <pxi/pxi_trace.h>
 #include <timers/arm9_timers.h>
 #include <string.h>
 #include <storage/emmc.h>
 #include <gpu/gpu.h>
-
-uint8_t* bios9, *bios11, *boot9, *boot11;
-uint8_t* bios9_locked, *bios11_locked;
-uint8_t* axi_wram;
-CDMA* dma11, *dma9;
+#include <scheduler/scheduler.h>
+#include "mmio.h"
+#include "arena.h"
+#include "fastmem.h"
+#include "memdump.h"
+#include <arm/mpcore_pmr.h>
+
+// Whether the upper halves of the boot ROMs have been locked out
+bool boot9_locked = false, boot11_locked = false;
+CDMA<Bus::ARM11Access>* dma11;
+CDMA<Bus::ARM9Access>* dma9;
 PicaGpu* gpu;
 
 uint64_t otp_console_id;
 uint8_t twlunitinfo;
 
-uint8_t itcm[0x8000], dtcm[0x4000];
-uint8_t arm9_wram[0x100000];
 uint32_t itcm_start, itcm_size;
 uint32_t dtcm_start, dtcm_size;
 
@@ -29,40 +35,274 @@ uint8_t *otp, otp_locked[256], otp_free[256];
 
 uint16_t socinfo;
 
+// New 3DS: FCRAM doubles, and the ARM9 gets extra WRAM (when enabled through
+// EXTMEMCNT9) and the ARM11 the QTM RAM
+bool is_new3ds = false;
+bool arm9_ext_mem = false;
+
 uint32_t irq_ie = 0, irq_if = 0;
 
+bool dma_active = false;
+uint64_t fast_forwarded_cycles = 0;
+
+// Rebuild a CPU's view of memory, whenever its layout changes
+static void map_arm11()
+{
+    using namespace Arena;
+    const MMIO::Cpu cpu = MMIO::CPU_ARM11;
+
+    Clear(cpu);
+    Map(cpu, 0x00000000, 0x20000, boot11_locked ? REGION_BOOT11_LOCKED : REGION_BOOT11, false);
+    Map(cpu, 0x18000000, 0x600000, REGION_VRAM, true);
+    Map(cpu, 0x1FF80000, 0x80000, REGION_AXI_WRAM, true);
+    Map(cpu, 0x20000000, is_new3ds ? 0x10000000 : 0x8000000, REGION_FCRAM, true);
+    if (is_new3ds)
+        Map(cpu, 0x1F000000, 0x400000, REGION_QTM_RAM, true);
+}
+
+static void map_arm9()
+{
+    using namespace Arena;
+    const MMIO::Cpu cpu = MMIO::CPU_ARM9;
+
+    // Lowest priority first: the TCMs shadow everything, and the boot ROM
+    // shadows the TCMs
+    Clear(cpu);
+    Map(cpu, 0x08000000, 0x100000, REGION_ARM9_WRAM, true);
+    if (arm9_ext_mem)
+        Map(cpu, 0x08100000, 0x80000, REGION_ARM9_WRAM_EXT, true);
+    Map(cpu, 0x1FF80000, 0x80000, REGION_AXI_WRAM, true);
+    Map(cpu, 0x20000000, is_new3ds ? 0x10000000 : 0x8000000, REGION_FCRAM, true);
+    if (dtcm_size)
+        Map(cpu, dtcm_start, dtcm_size, REGION_DTCM, true);
+    if (itcm_size)
+        Map(cpu, itcm_start, itcm_size, REGION_ITCM, true);
+    Map(cpu, 0xFFFF0000, 0x10000, boot9_locked ? REGION_BOOT9_LOCKED : REGION_BOOT9, false);
+}
+
+// Loads a boot ROM, the locked copy only keeps the lower half
+static void load_boot_rom(const std::string& path, Arena::Region rom, Arena::Region locked)
+{
+    uint8_t* data = Arena::GetHostPtr(rom);
+    uint32_t size = Arena::GetRegionSize(rom);
+
+    std::ifstream file(path, std::ios::binary);
+    file.read((char*)data, size);
+
+    memcpy(Arena::GetHostPtr(locked), data, size / 2);
+    memset(Arena::GetHostPtr(locked) + size / 2, 0, size / 2);
+}
+
+// Constant registers and write sinks for hardware that isn't emulated yet
+template <uint8_t value> static uint8_t read8_const(uint32_t) { return value; }
+template <uint16_t value> static uint16_t read16_const(uint32_t) { return value; }
+template <uint32_t value> static uint32_t read32_const(uint32_t) { return value; }
+static void write8_ignore(uint32_t, uint8_t) {}
+static void write16_ignore(uint32_t, uint16_t) {}
+static void write32_ignore(uint32_t, uint32_t) {}
+
+// Writes to memory the GPU is watching, see Arena::Watch. The GPU forgets
+// whatever it derived from the page and lifts the watch, then the write goes
+// through as normal.
+template <MMIO::Cpu cpu, typename T>
+static void write_watched(uint32_t addr, T data)
+{
+    gpu->InvalidateMemory(addr, sizeof(T));
+    uint8_t* ptr = Arena::GetRangePtr(cpu, addr, sizeof(T), true);
+    if (ptr)
+        memcpy(ptr, &data, sizeof(T));
+}
+
+template <MMIO::Cpu cpu>
+static void register_watched(uint32_t start, uint32_t size)
+{
+    MMIO::Register(cpu, start, size, {.name = "watched memory",
+        .write8 = write_watched<cpu, uint8_t>,
+        .write16 = write_watched<cpu, uint16_t>,
+        .write32 = write_watched<cpu, uint32_t>});
+}
+
+static void register_mmio11()
+{
+    using namespace MMIO;
+    const Cpu cpu = CPU_ARM11;
+
+    // CFG11 and friends
+    Register(cpu, 0x10140000, 0x10, {.name = "CFG11", .write8 = write8_ignore});
+    Register(cpu, 0x10140FFC, 2, {.name = "SOCINFO", .read16 = [](uint32_t) -> uint16_t { return socinfo; }});
+    Register(cpu, 0x10141200, 4, {.name = "CFG11", .read32 = read32_const<0>, .write32 = write32_ignore});
+    Register(cpu, 0x10141204, 1, {.name = "CFG11", .read8 = read8_const<0>, .write8 = write8_ignore});
+    Register(cpu, 0x10141208, 1, {.name = "CFG11", .read8 = read8_const<0>, .write8 = write8_ignore});
+    Register(cpu, 0x10141220, 1, {.name = "CFG11", .read8 = read8_const<2>, .write8 = write8_ignore});
+    Register(cpu, 0x10146000, 2, {.name = "HID", .read16 = read16_const<0xFFF>});
+    Register(cpu, 0x10147000, 1, {.name = "GPIO", .read8 = read8_const<0>});
+
+    // I2C buses
+    Register(cpu, 0x10161000, 2, {.name = "I2C", .read8 = I2C::Read8, .write8 = I2C::Write8});
+    Register(cpu, 0x10161002, 4, {.name = "I2C", .write16 = I2C::Write16});
+    Register(cpu, 0x10144000, 2, {.name = "I2C", .read8 = I2C::Read8, .write8 = I2C::Write8});
+    Register(cpu, 0x10144002, 4, {.name = "I2C", .write16 = I2C::Write16});
+    Register(cpu, 0x10148000, 2, {.name = "I2C", .read8 = I2C::Read8, .write8 = I2C::Write8});
+    Register(cpu, 0x10148002, 4, {.name = "I2C", .write16 = I2C::Write16});
+
+    // PXI
+    Register(cpu, 0x10163000, 4, {.name = "PXI", 
+        .read32 = [](uint32_t) { return PXI::ReadSync11(); },
+        .write32 = [](uint32_t, uint32_t data) { PXI::WriteSync11(data); }});
+    Register(cpu, 0x10163004, 2, {.name = "PXI", 
+        .read16 = [](uint32_t) { return PXI::ReadCnt11(); },
+        .write16 = [](uint32_t, uint16_t data) { PXI::WriteCnt11(data); }});
+    Register(cpu, 0x10163008, 4, {.name = "PXI", .write32 = [](uint32_t, uint32_t data) { PXI::WriteSend11(data); }});
+    Register(cpu, 0x1016300C, 4, {.name = "PXI", .read32 = [](uint32_t) { return PXI::ReadRecv11(); }});
+
+    Register(cpu, 0x10200000, 0x1000, {.name = "CDMA",
+        .read32 = [](uint32_t addr) { return dma11->Read32(addr); },
+        .write32 = [](uint32_t addr, uint32_t data) { dma11->Write32(addr, data); }});
+    Register(cpu, 0x10202014, 4, {.name = "LCD", .write32 = write32_ignore});
+
+    // GPU external registers, then the PICA's own
+    Register(cpu, 0x10400000, 0x1000, {.name = "GPU",
+        .read32 = [](uint32_t addr) { return gpu->ReadExternal32(addr); },
+        .write32 = [](uint32_t addr, uint32_t data) { gpu->WriteExternal32(addr, data); }});
+    Register(cpu, 0x10401000, PICA_REG_COUNT * 4, {.name = "PICA",
+        .read32 = [](uint32_t addr) { return gpu->ReadInternal32(addr); },
+        .write32 = [](uint32_t addr, uint32_t data) { gpu->WriteInternal32(addr, data); }});
+
+    register_watched<cpu>(0x18000000, 0x600000);
+    register_watched<cpu>(0x20000000, is_new3ds ? 0x10000000 : 0x8000000);
+}
+
+static void register_mmio9()
+{
+    using namespace MMIO;
+    const Cpu cpu = CPU_ARM9;
+
+    // CFG9
+    Register(cpu, 0x10000000, 1, {.name = "CFG9", .read8 = read8_const<1>,
+        .write8 = [](uint32_t, uint8_t data)
+        {
+            if ((data & 1) && !boot9_locked)
+            {
+                boot9_locked = true;
+                map_arm9();
+            }
+            if (data & 2)
+                otp = otp_locked;
+        }});
+    Register(cpu, 0x10000001, 1, {.name = "CFG9", .read8 = read8_const<1>,
+        .write8 = [](uint32_t, uint8_t data)
+        {
+            if ((data & 1) && !boot11_locked)
+            {
+                boot11_locked = true;
+                map_arm11();
+            }
+        }});
+    Register(cpu, 0x10000002, 1, {.name = "CFG9", .read8 = read8_const<0>, .write8 = write8_ignore});
+    Register(cpu, 0x10000008, 1, {.name = "CFG9", .read8 = read8_const<0>, .write8 = write8_ignore});
+    Register(cpu, 0x10000020, 4, {.name = "CFG9", .write32 = write32_ignore});
+    if (is_new3ds)
+    {
+        Register(cpu, 0x10000200, 4, {.name = "CFG9",
+            .read32 = [](uint32_t) -> uint32_t { return arm9_ext_mem; },
+            .write32 = [](uint32_t, uint32_t data)
+            {
+                if ((data & 1) != arm9_ext_mem)
+                {
+                    arm9_ext_mem = data & 1;
+                    map_arm9();
+                }
+            }});
+    }
+    Register(cpu, 0x10010010, 1, {.name = "CFG9", .read8 = read8_const<0>});
+    Register(cpu, 0x10010014, 1, {.name = "CFG9",
+        .read8 = [](uint32_t) { return twlunitinfo; },
+        .write8 = [](uint32_t, uint8_t data) { twlunitinfo = data; }});
+
+    // IRQ
+    Register(cpu, 0x10001000, 4, {.name = "IRQ",
+        .read32 = [](uint32_t) { return irq_ie; },
+        .write32 = [](uint32_t, uint32_t data)
+        {
+            irq_ie = data;
+            printf("[IRQ9]: Setting IE to 0x%08x\n", data);
+        }});
+    Register(cpu, 0x10001004, 4, {.name = "IRQ",
+        .read32 = [](uint32_t) { return irq_if; },
+        .write32 = [](uint32_t, uint32_t data)
+        {
+            irq_if &= ~data;
+            printf("[IRQ9]: Write 0x%08x to IF\n", data);
+        }});
+
+    Register(cpu, 0x10002000, 0x1000, {.name = "NDMA", .read32 = NDMA::Read32, .write32 = NDMA::Write32});
+    Register(cpu, 0x10003000, 0x10, {.name = "TIMER", .read16 = Timers::Read16, .write16 = Timers::Write16});
+
+    Register(cpu, 0x10006000, 0x1000, {.name = "SDMMC", .read16 = eMMC::Read16, .write16 = eMMC::Write16});
+    Register(cpu, 0x1000610C, 4, {.name = "SDMMC", .read32 = [](uint32_t) { return eMMC::read_fifo32(); }});
+
+    // PXI
+    Register(cpu, 0x10008000, 4, {.name = "PXI", 
+        .read32 = [](uint32_t) { return PXI::ReadSync9(); },
+        .write32 = [](uint32_t, uint32_t data) { PXI::WriteSync9(data); }});
+    Register(cpu, 0x10008004, 2, {.name = "PXI", 
+        .read16 = [](uint32_t) { return PXI::ReadCnt9(); },
+        .write16 = [](uint32_t, uint16_t data) { PXI::WriteCnt9(data); }});
+    Register(cpu, 0x10008008, 4, {.name = "PXI", .write32 = [](uint32_t, uint32_t data) { PXI::WriteSend9(data); }});
+    Register(cpu, 0x1000800C, 4, {.name = "PXI", .read32 = [](uint32_t) { return PXI::ReadRecv9(); }});
+
+    // Crypto engines
+    Register(cpu, 0x10009006, 2, {.name = "AES", .write16 = [](uint32_t, uint16_t data) { AES::WriteBlockCount(data); }});
+    Register(cpu, 0x10009010, 1, {.name = "AES", .write8 = [](uint32_t, uint8_t data) { AES::WriteKEYSEL(data); }});
+    Register(cpu, 0x10009011, 1, {.name = "AES",
+        .read8 = [](uint32_t) { return AES::ReadKEYCNT(); },
+        .write8 = [](uint32_t, uint8_t data) { AES::WriteKEYCNT(data); }});
+    Register(cpu, 0x10009000, 0x1000, {.name = "AES", .read32 = AES::Read32, .write32 = AES::Write32});
+    Register(cpu, 0x1000A040, 0x40, {.name = "SHA", .read8 = SHA::ReadHash});
+    Register(cpu, 0x1000A000, 0x1000, {.name = "SHA", .read32 = SHA::Read32, .write32 = SHA::Write32});
+    Register(cpu, 0x1000B000, 0x1000, {.name = "RSA", .read8 = RSA::Read8, .read32 = RSA::Read32, .write8 = RSA::Write8});
+    Register(cpu, 0x1000B000, 0x901, {.name = "RSA", .write32 = RSA::Write32});
+
+    Register(cpu, 0x1000C000, 0x1000, {.name = "XDMA",
+        .read32 = [](uint32_t addr) { return dma9->Read32(addr); },
+        .write32 = [](uint32_t addr, uint32_t data) { dma9->Write32(addr, data); }});
+
+    // OTP, the console ID registers live right behind it
+    Register(cpu, 0x10012000, 0x100, {.name = "OTP", .read32 = [](uint32_t addr) { return *(uint32_t*)&otp[addr & 0xFF]; }});
+    Register(cpu, 0x10012100, 4, {.name = "OTP", .write32 = [](uint32_t, uint32_t data)
+        {
+            otp_console_id &= ~0xFFFFFFFFF;
+            otp_console_id |= data;
+        }});
+    Register(cpu, 0x10012104, 4, {.name = "OTP", .write32 = [](uint32_t, uint32_t data)
+        {
+            otp_console_id &= 0xFFFFFFFFF;
+            otp_console_id |= ((uint64_t)data << 32);
+        }});
+
+    // ARM11-side registers the ARM9 can also see
+    Register(cpu, 0x10140FFC, 4, {.name = "SOCINFO", .read32 = read32_const<0x5>});
+    Register(cpu, 0x10144000, 5, {.name = "I2C", .read8 = I2C::Read8, .write8 = I2C::Write8});
+    Register(cpu, 0x10146000, 4, {.name = "HID", .read16 = read16_const<0xFFF>, .read32 = read32_const<0xFFF>});
+    Register(cpu, 0x10160000, 0x1000, {.name = "SPI", .read8 = read8_const<0>, .write8 = write8_ignore, .write16 = write16_ignore});
+
+    Register(cpu, 0xC0000000, 0x10000000, {.name = "unmapped", .write32 = write32_ignore});
+
+    register_watched<cpu>(0x20000000, is_new3ds ? 0x10000000 : 0x8000000);
+}
+
 void Bus::Initialize(std::string bios9Path, std::string bios11Path, bool isnew)
 {
-    std::ifstream file(bios9Path, std::ios::ate | std::ios::binary);
-    size_t size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    bios9 = new uint8_t[size];
-    file.read((char*)bios9, size);
-    file.close();
-    boot9 = bios9;
-    bios9_locked = new uint8_t[size];
-    memcpy(bios9_locked, bios9, 0x8000);
-    memset(bios9_locked+0x8000, 0, size-0x8000);
-
-
-    file.open(bios11Path, std::ios::ate | std::ios::binary);
-    size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    bios11 = new uint8_t[size];
-    file.read((char*)bios11, size);
-    file.close();
-    boot11 = bios11;
-    bios11_locked = new uint8_t[size];
-    memcpy(bios11_locked, bios11, 0x8000);
-    memset(bios11_locked+0x8000, 0, size-0x8000);
-
-    axi_wram = new uint8_t[0x80000];
-    dma11 = new CDMA(std::bind(&ARM11::Write32, std::placeholders::_1, std::placeholders::_2), 
-                        std::bind(&ARM11::Read32, std::placeholders::_1),
-                        std::bind(&ARM11::Read8, std::placeholders::_1));
-    dma9 = new CDMA(std::bind(&ARM9::Write32, std::placeholders::_1, std::placeholders::_2), 
-                        std::bind(&ARM9::Read32, std::placeholders::_1),
-                        std::bind(&ARM9::Read8, std::placeholders::_1));
+    is_new3ds = isnew;
+
+    Arena::Initialize();
+    load_boot_rom(bios9Path, Arena::REGION_BOOT9, Arena::REGION_BOOT9_LOCKED);
+    load_boot_rom(bios11Path, Arena::REGION_BOOT11, Arena::REGION_BOOT11_LOCKED);
+    map_arm9();
+    map_arm11();
+
+    dma11 = new CDMA<ARM11Access>();
+    dma9 = new CDMA<ARM9Access>();
     
     if (isnew)
         socinfo = 7;
@@ -105,41 +345,94 @@ void Bus::Initialize(std::string bios9Path, std::string bios11Path, bool isnew)
     eMMC::Initialize("nand.bin");
 
     gpu = new PicaGpu();
+
+    register_mmio11();
+    register_mmio9();
 }
 
-void Bus::Dump()
+static void dump_region(const char* name, Arena::Region region)
 {
-    std::ofstream outfile("axi_wram.bin");
-    outfile.write((char*)axi_wram, 0x80000);
-    outfile.close();
+    MemDump::Add(name, Arena::GetHostPtr(region), Arena::GetRegionSize(region));
+}
 
-    outfile.open("dtcm.bin");
-    outfile.write((char*)dtcm, sizeof(dtcm));
-    outfile.close();
+void Bus::Dump()
+{
+    dump_region("axi_wram", Arena::REGION_AXI_WRAM);
+    dump_region("dtcm", Arena::REGION_DTCM);
+    dump_region("itcm", Arena::REGION_ITCM);
+    dump_region("arm9_ram", Arena::REGION_ARM9_WRAM);
 
-    outfile.open("itcm.bin");
-    outfile.write((char*)itcm, sizeof(itcm));
-    outfile.close();
+    gpu->Dump();
+    MemDump::Write("memory.bin");
 
-    outfile.open("arm9_ram.bin");
-    outfile.write((char*)arm9_wram, sizeof(arm9_wram));
-    outfile.close();
+    CtrCache::Dump();
+    PxiTrace::Dump();
+    MMIO::Dump();
+    Fastmem::Dump();
+    dma11->Dump("ARM11");
+    dma9->Dump("ARM9");
 
-    gpu->Dump();
+    if (fast_forwarded_cycles)
+        printf("[BUS]: Fast-forwarded %lu idle cycles\n", fast_forwarded_cycles);
 }
 
 void Bus::Reset()
 {
+    Scheduler::Reset();
+    PxiTrace::Reset();
     AES::Reset();
     gpu->Reset();
 }
 
+// Advances the timeline, events change device state behind the CPUs' backs
+static void advance(uint64_t cycles)
+{
+    if (Scheduler::GetNextEventTime() <= Scheduler::GetCurrentTime() + cycles)
+        MMIO::NotifyChange();
+    Scheduler::Advance(cycles);
+}
+
 void Bus::Run()
 {
+    dma_active = false;
     for (int i = 0; i < 2; i++)
-        dma11->Tick();
-    dma9->Tick();
+        dma_active |= dma11->Tick();
+    dma_active |= dma9->Tick();
+
+    // A running channel may change its registers on any cycle
+    if (dma_active)
+        MMIO::NotifyChange();
+
     Timers::Tick();
+    advance(1);
+}
+
+void Bus::FastForward()
+{
+    if (dma_active || Timers::IsRunning())
+        return;
+
+    uint64_t next = Scheduler::GetNextEventTime();
+    uint64_t now = Scheduler::GetCurrentTime();
+    if (next == UINT64_MAX || next <= now + 1)
+        return;
+
+    fast_forwarded_cycles += next - now;
+    advance(next - now);
+}
+
+void Bus::ARM11Access::RaiseIrq(int event)
+{
+    // Events 0-9 have their own IRQs, 0x3A is the abort line
+    if (event == CDMA_ABORT_EVENT)
+        MPCore_PMR::AssertHWIrq(0x3A);
+    else if (event < 10)
+        MPCore_PMR::AssertHWIrq(0x30 + event);
+}
+
+void Bus::ARM9Access::RaiseIrq(int event)
+{
+    SetInterruptPending9(event == CDMA_ABORT_EVENT ? 29 : 28);
 }
 
 bool Bus::GetInterruptPending9()
@@ -150,454 +443,121 @@ bool Bus::GetInterruptPending9()
 void Bus::SetInterruptPending9(uint32_t interrupt)
 {
     irq_if |= (1 << interrupt);
+    MMIO::NotifyChange();
 }
 
 uint8_t Bus::ARM11::Read8(uint32_t addr)
 {
-    if (addr < 0x20000)
-        return boot11[addr & 0xFFFF];
-    if (addr > 0x1FF80000 && addr < 0x20000000)
-        return axi_wram[addr & 0x7FFFF];
-    
-    switch (addr)
-    {
-    case 0x10141204:
-    case 0x10141208:
-    case 0x10147000:
-        return 0;
-    case 0x10141220:
-        return 2;
-    case 0x10161001:
-    case 0x10144000:
-    case 0x10144001:
-    case 0x10148001:
-        return I2C::Read8(addr);
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint8_t>(MMIO::CPU_ARM11, addr))
+        return *(uint8_t*)ptr;
 
-    printf("Read8 from unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read8(MMIO::CPU_ARM11, addr);
 }
 
 uint16_t Bus::ARM11::Read16(uint32_t addr)
 {
-    if (addr < 0x20000)
-        return *(uint16_t*)&boot11[addr & 0xFFFF];
-    if (addr > 0x1FF80000 && addr < 0x20000000)
-        return *(uint16_t*)&axi_wram[addr & 0x7FFFF];
-    
-    switch (addr)
-    {
-    case 0x10146000:
-        return 0xFFF;
-    case 0x10140FFC:
-        return socinfo;
-    case 0x10163004:
-        return PXI::ReadCnt11();
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint16_t>(MMIO::CPU_ARM11, addr))
+        return *(uint16_t*)ptr;
 
-    printf("Read16 from unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read16(MMIO::CPU_ARM11, addr);
 }
 
 uint32_t Bus::ARM11::Read32(uint32_t addr)
 {
-    if (addr < 0x20000)
-        return *(uint32_t*)&boot11[addr & 0xFFFF];
-    if (addr > 0x1FF80000 && addr < 0x20000000)
-        return *(uint32_t*)&axi_wram[addr & 0x7FFFF];
-    if (addr >= 0x18000000 && addr < 0x18C00000)
-        return gpu->Read32(addr);
-    
-    switch (addr)
-    {
-    case 0x10141200:
-    case 0x10400030:
-    case 0x10400004:
-        return 0;
-    case 0x10200020:
-    case 0x1020002C:
-    case 0x10200100:
-    case 0x10200d00:
-        return dma11->Read32(addr);
-    case 0x10163000:
-        return PXI::ReadSync11();
-    case 0x1016300C:
-        return PXI::ReadRecv11();
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint32_t>(MMIO::CPU_ARM11, addr))
+        return *(uint32_t*)ptr;
 
-    printf("Read32 from unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read32(MMIO::CPU_ARM11, addr);
 }
 
 void Bus::ARM11::Write8(uint32_t addr, uint8_t data)
 {
-    if (addr > 0x1FF80000 && addr < 0x20000000)
-    {
-        axi_wram[addr & 0x7FFFF] = data;
-        return;
-    }
-    else if (addr >= 0x10140000 && addr < 0x10140010)
-        return;
-    
-    switch (addr)
+    if (uint8_t* ptr = Arena::WritePtr<uint8_t>(MMIO::CPU_ARM11, addr))
     {
-    case 0x10141204:
-    case 0x10141208:
-    case 0x10141220:
-        return;
-    case 0x10144000:
-    case 0x10161000:
-    case 0x10148000:
-    case 0x10161001:
-    case 0x10144001:
-    case 0x10148001:
-        I2C::Write8(addr, data);
+        *(uint8_t*)ptr = data;
         return;
     }
 
-    printf("Write8 0x%02x to unknown addr 0x%08x\n", data, addr);
-    exit(1);
+    MMIO::Write8(MMIO::CPU_ARM11, addr, data);
 }
 
 void Bus::ARM11::Write16(uint32_t addr, uint16_t data)
 {
-    if (addr > 0x1FF80000 && addr < 0x20000000)
+    if (uint8_t* ptr = Arena::WritePtr<uint16_t>(MMIO::CPU_ARM11, addr))
     {
-        *(uint16_t*)&axi_wram[addr & 0x7FFFF] = data;
+        *(uint16_t*)ptr = data;
         return;
     }
 
-    switch (addr)
-    {
-    case 0x10161002:
-    case 0x10161004:
-    case 0x10144002:
-    case 0x10144004:
-    case 0x10148002:
-    case 0x10148004:
-        I2C::Write16(addr, data);
-        return;
-    case 0x10163004:
-        PXI::WriteCnt11(data);
-        return;
-    }
-
-    printf("Write16 unknown addr 0x%08x\n", addr);
-    exit(1);
+    MMIO::Write16(MMIO::CPU_ARM11, addr, data);
 }
 
 void Bus::ARM11::Write32(uint32_t addr, uint32_t data)
 {
-    if (addr > 0x1FF80000 && addr < 0x20000000)
-    {
-        *(uint32_t*)&axi_wram[addr & 0x7FFFF] = data;
-        return;
-    }
-    if (addr >= 0x18000000 && addr < 0x18C00000)
-        return gpu->Write32(addr, data);
-
-    switch (addr)
+    if (uint8_t* ptr = Arena::WritePtr<uint32_t>(MMIO::CPU_ARM11, addr))
     {
-    case 0x10141200:
-    case 0x10400030:
-    case 0x10202014:
-    case 0x10400004:
+        *(uint32_t*)ptr = data;
         return;
-    case 0x10200020:
-    case 0x1020002C:
-    case 0x10200d04:
-    case 0x10200d08:
-    case 0x10200d0c:
-        return dma11->Write32(addr, data);
-    case 0x10163000:
-        return PXI::WriteSync11(data);
     }
 
-    printf("Write32 unknown addr 0x%08x\n", addr);
-    exit(1);
+    MMIO::Write32(MMIO::CPU_ARM11, addr, data);
 }
 
 uint8_t Bus::ARM9::Read8(uint32_t addr)
 {
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
-        return dtcm[addr & 0x3FFF];
-    if (addr >= itcm_start && addr < itcm_start+itcm_size)
-        return itcm[addr & 0x7FFF];
-    if (addr >= 0xFFFF0000)
-        return boot9[addr & 0xFFFF];
-    if (addr >= 0x08000000 && addr < 0x08100000)
-        return arm9_wram[addr & 0xFFFFF];
-    if (addr >= 0x1000A040 && addr < 0x1000A080)
-        return SHA::ReadHash(addr);
-    if (addr >= 0x1000B000 && addr < 0x1000C000)
-        return RSA::Read8(addr);
-    if (addr >= 0x10160000 && addr < 0x10161000)
-        return 0;
-    if (addr >= 0x1ff80000 && addr < 0x20000000)
-       return axi_wram[addr & 0x7FFFF];
-    
-    switch (addr)
-    {
-    case 0x10000000:
-    case 0x10000001:
-        return 0x1;
-    case 0x10000002:
-    case 0x10010010:
-    case 0x10000008:
-        return 0;
-    case 0x10010014:
-        return twlunitinfo;
-    case 0x10009011:
-        return AES::ReadKEYCNT();
-    case 0x10144000 ... 0x10144004:
-        return I2C::Read8(addr);
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint8_t>(MMIO::CPU_ARM9, addr))
+        return *(uint8_t*)ptr;
 
-    printf("Read8 unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read8(MMIO::CPU_ARM9, addr);
 }
 
-bool firstPadRead = true;
-
 uint16_t Bus::ARM9::Read16(uint32_t addr)
 {
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
-    {
-        return *(uint16_t*)&dtcm[addr & 0x3FFF];
-    }
-    if (addr >= 0xFFFF0000)
-        return *(uint16_t*)&boot9[addr & 0xFFFF];
-    if (addr >= 0x10006000 && addr < 0x10007000)
-        return eMMC::Read16(addr);
-    if (addr >= 0x08000000 && addr < 0x08100000)
-        return *(uint16_t*)&arm9_wram[addr & 0xFFFFF];
-    
-    switch (addr)
-    {
-    case 0x10003000 ... 0x1000300E:
-        return Timers::Read16(addr);
-    case 0x10146000:
-		return 0xFFF;
-    case 0x10008004:
-        return PXI::ReadCnt9();
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint16_t>(MMIO::CPU_ARM9, addr))
+        return *(uint16_t*)ptr;
 
-    printf("[ARM9]: Read16 unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read16(MMIO::CPU_ARM9, addr);
 }
 
 uint32_t Bus::ARM9::Read32(uint32_t addr)
 {
-    if (addr >= 0xFFFF0000)
-        return *(uint32_t*)&boot9[addr & 0xFFFF];
-    if (addr >= itcm_start && addr < itcm_start+itcm_size)
-        return *(uint32_t*)&itcm[addr & 0x7FFF];
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
-        return *(uint32_t*)&dtcm[addr & 0x3FFF];
-    if (addr >= 0x1FF80000 && addr < 0x20000000)
-        return *(uint32_t*)&axi_wram[addr & 0x7FFFF];
-    if (addr >= 0x08000000 && addr < 0x08100000)
-        return *(uint32_t*)&arm9_wram[addr & 0xFFFFF];
-    if (addr >= 0x10002000 && addr < 0x10003000)
-        return NDMA::Read32(addr);
-    if (addr >= 0x10009000 && addr < 0x1000A000)
-        return AES::Read32(addr);
-    if (addr >= 0x1000A000 && addr < 0x1000B000)
-        return SHA::Read32(addr);
-    if (addr >= 0x1000B000 && addr < 0x1000C000)
-        return RSA::Read32(addr);
-    if (addr >= 0x10012000 && addr < 0x10012100)
-        return *(uint32_t*)&otp[addr & 0xFF];
-    
-    switch (addr)
-    {
-    case 0x10001000: return irq_ie;
-    case 0x10001004: return irq_if;
-    case 0x1000201C:
-    case 0x1000610c:
-        return eMMC::read_fifo32();
-    case 0x1000C020:
-    case 0x1000C02C:
-    case 0x1000c100:
-    case 0x1000cd04:
-    case 0x1000cd08:
-    case 0x1000cd0c:
-    case 0x1000cd00:
-        return dma9->Read32(addr);
-    case 0x10008000:
-        return PXI::ReadSync9();
-    case 0x10140FFC:
-        return 0x5;
-    case 0x10146000:
-		return 0xFFF;
-    }
+    if (uint8_t* ptr = Arena::ReadPtr<uint32_t>(MMIO::CPU_ARM9, addr))
+        return *(uint32_t*)ptr;
 
-    printf("[ARM9]: Read32 unknown addr 0x%08x\n", addr);
-    exit(1);
+    return MMIO::Read32(MMIO::CPU_ARM9, addr);
 }
 
 void Bus::ARM9::Write8(uint32_t addr, uint8_t data)
 {
-    if (addr >= itcm_start && addr < itcm_start+itcm_size)
-    {
-        itcm[addr & 0x7FFF] = data;
-        return;
-    }
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
+    if (uint8_t* ptr = Arena::WritePtr<uint8_t>(MMIO::CPU_ARM9, addr))
     {
-        dtcm[addr & 0x3FFF] = data;
-        return;
-    }
-    if (addr >= 0x08000000 && addr < 0x08100000)
-    {
-        arm9_wram[addr & 0xFFFFF] = data;
-        return;
-    }
-    if (addr >= 0x1000B000 && addr < 0x1000C000)
-        return RSA::Write8(addr, data);
-    if (addr >= 0x1ff80000 && addr < 0x20000000)
-    {
-        axi_wram[addr & 0x7FFFF] = data;
-        return;
-    }
-    if (addr >= 0x10160000 && addr < 0x10161000)
-        return;
-
-    switch (addr)
-    {
-    case 0x10000000:
-    {
-        if (data & 1)
-            boot9 = bios9_locked;
-        if (data & 2)
-            otp = otp_locked;
-        return;
-    }
-    case 0x10000001:
-        if (data & 1)
-            boot11 = bios11_locked;
-        return;
-    case 0x10000002:
-    case 0x10000008:
-        return;
-    case 0x10009010:
-        AES::WriteKEYSEL(data);
-        return;
-    case 0x10009011:
-        AES::WriteKEYCNT(data);
-        return;
-    case 0x10010014:
-        twlunitinfo = data;
-        return;
-    case 0x10144000 ... 0x10144004:
-        I2C::Write8(addr, data);
+        *(uint8_t*)ptr = data;
         return;
     }
 
-    printf("Write8 unknown addr 0x%08x\n", addr);
-    exit(1);
+    MMIO::Write8(MMIO::CPU_ARM9, addr, data);
 }
 
 void Bus::ARM9::Write16(uint32_t addr, uint16_t data)
 {
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
-    {
-        *(uint16_t*)&dtcm[addr & 0x3FFF] = data;
-        return;
-    }
-    if (addr >= 0x10006000 && addr < 0x10007000)
-        return eMMC::Write16(addr, data);
-    if (addr >= 0x10160000 && addr < 0x10161000)
-        return;
-    if (addr >= 0x08000000 && addr < 0x08100000)
+    if (uint8_t* ptr = Arena::WritePtr<uint16_t>(MMIO::CPU_ARM9, addr))
     {
-        *(uint16_t*)&arm9_wram[addr & 0xFFFFF] = data;
+        *(uint16_t*)ptr = data;
         return;
     }
 
-    switch (addr)
-    {
-    case 0x10003000 ... 0x1000300E:
-        return Timers::Write16(addr, data);
-    case 0x10008004:
-        return PXI::WriteCnt9(data);
-    case 0x10009006:
-        AES::WriteBlockCount(data);
-        return;
-    }
-
-    printf("Write16 unknown addr 0x%08x\n", addr);
-    exit(1);
+    MMIO::Write16(MMIO::CPU_ARM9, addr, data);
 }
 
 void Bus::ARM9::Write32(uint32_t addr, uint32_t data)
 {
-    if (addr >= itcm_start && addr < itcm_start+itcm_size)
+    if (uint8_t* ptr = Arena::WritePtr<uint32_t>(MMIO::CPU_ARM9, addr))
     {
-        *(uint32_t*)&itcm[addr & 0x7FFF] = data;
-        return;
-    }
-    if (addr >= dtcm_start && addr < dtcm_start+dtcm_size)
-    {
-        *(uint32_t*)&dtcm[addr & 0x3FFF] = data;
-        return;
-    }
-    if (addr >= 0x08000000 && addr < 0x08100000)
-    {
-        *(uint32_t*)&arm9_wram[addr & 0xFFFFF] = data;
-        return;
-    }
-    if (addr >= 0x1ff80000 && addr < 0x20000000)
-    {
-        *(uint32_t*)&axi_wram[addr & 0x7FFFF] = data;
+        *(uint32_t*)ptr = data;
         return;
     }
 
-    if (addr >= 0x10002000 && addr < 0x10003000)
-        return NDMA::Write32(addr, data);
-    if (addr >= 0x10009000 && addr < 0x1000A000)
-        return AES::Write32(addr, data);
-    if (addr >= 0x1000A000 && addr < 0x1000B000)
-        return SHA::Write32(addr, data);
-    if ((addr & 0xF0000000) == 0xC0000000)
-        return;
-
-    switch (addr)
-    {
-    case 0x10001000:
-        irq_ie = data;
-        printf("[IRQ9]: Setting IE to 0x%08x\n", data);
-        return;
-    case 0x10001004:
-        irq_if &= ~data;
-        printf("[IRQ9]: Write 0x%08x to IF\n", data);
-        return;
-    case 0x1000C020:
-    case 0x1000C02C:
-    case 0x1000cd04:
-    case 0x1000cd08:
-    case 0x1000cd0c:
-        return dma9->Write32(addr, data);
-    case 0x10008000:
-        return PXI::WriteSync9(data);
-    case 0x10008008:
-        return PXI::WriteSend9(data);
-    case 0x1000B000 ... 0x1000B900:
-        return RSA::Write32(addr, data);
-    case 0x10012100:
-        otp_console_id &= ~0xFFFFFFFFF;
-        otp_console_id |= data;
-        return;
-    case 0x10012104:
-        otp_console_id &= 0xFFFFFFFFF;
-        otp_console_id |= ((uint64_t)data << 32);
-        return;
-    case 0x10000020:
-        return;
-    }
-
-    printf("[ARM9]: Write32 unknown addr 0x%08x\n", addr);
-    exit(1);
+    MMIO::Write32(MMIO::CPU_ARM9, addr, data);
 }
 
 void Bus::ARM9::RemapTCM(uint32_t addr, uint32_t size, bool itcm)
@@ -614,4 +574,38 @@ void Bus::ARM9::RemapTCM(uint32_t addr, uint32_t size, bool itcm)
         dtcm_size = size;
         printf("Remapping DTCM to 0x%08x, 0x%08x bytes\n", addr, size);
     }
+    map_arm9();
+}
+
+
+uint8_t* Bus::GetPhysicalPtr(uint32_t addr, uint32_t size)
+{
+    struct PhysicalRange
+    {
+        uint32_t start, size;
+        Arena::Region region;
+    };
+    const PhysicalRange ranges[] =
+    {
+        {0x18000000, 0x600000, Arena::REGION_VRAM},
+        {0x1FF80000, 0x80000, Arena::REGION_AXI_WRAM},
+        {0x20000000, is_new3ds ? 0x10000000u : 0x8000000u, Arena::REGION_FCRAM},
+    };
+
+    for (const PhysicalRange& range : ranges)
+    {
+        if (addr >= range.start && (uint64_t)addr + size <= (uint64_t)range.start + range.size)
+            return Arena::GetHostPtr(range.region) + (addr - range.start);
+    }
+    return nullptr;
+}
+
+uint8_t* Bus::ARM11::GetPtr(uint32_t addr, uint32_t size, bool write)
+{
+    return Arena::GetRangePtr(MMIO::CPU_ARM11, addr, size, write);
+}
+
+uint8_t* Bus::ARM9::GetPtr(uint32_t addr, uint32_t size, bool write)
+{
+    return Arena::GetRangePtr(MMIO::CPU_ARM9, addr, size, write);
 }
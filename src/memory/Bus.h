@@ -13,9 +13,18 @@ void Dump();
 void Reset();
 void Run();
 
+// Skips ahead to the next scheduled event, for when every CPU is asleep.
+// Does nothing while a DMA channel or timer needs ticking every cycle.
+void FastForward();
+
 bool GetInterruptPending9();
 void SetInterruptPending9(uint32_t interrupt);
 
+// Host pointer to [addr, addr+size) of the RAM the GPU works on (VRAM, AXI
+// WRAM and FCRAM, by physical address), nullptr if it's anything else.
+// Ignores what the CPUs have mapped and any watched pages.
+uint8_t* GetPhysicalPtr(uint32_t addr, uint32_t size);
+
 namespace ARM11
 {
 
@@ -27,6 +36,10 @@ void Write8(uint32_t addr, uint8_t data);
 void Write16(uint32_t addr, uint16_t data);
 void Write32(uint32_t addr, uint32_t data);
 
+// Host pointer to [addr, addr+size) if the whole range is plain memory,
+// nullptr otherwise (see ARM9::GetPtr)
+uint8_t* GetPtr(uint32_t addr, uint32_t size, bool write);
+
 }
 
 namespace ARM9
@@ -42,6 +55,32 @@ void Write32(uint32_t addr, uint32_t data);
 
 void RemapTCM(uint32_t addr, uint32_t size, bool itcm);
 
+// Host pointer to [addr, addr+size) if the whole range is plain memory,
+// nullptr if any part of it is MMIO, unmapped or read-only (for writes)
+uint8_t* GetPtr(uint32_t addr, uint32_t size, bool write);
+
 }
 
+// Static views of each CPU's bus for code templated on it (CDMA), so the
+// accesses compile to direct calls instead of going through std::function
+struct ARM11Access
+{
+    static uint8_t Read8(uint32_t addr) { return ARM11::Read8(addr); }
+    static uint32_t Read32(uint32_t addr) { return ARM11::Read32(addr); }
+    static void Write8(uint32_t addr, uint8_t data) { ARM11::Write8(addr, data); }
+    static void Write32(uint32_t addr, uint32_t data) { ARM11::Write32(addr, data); }
+    static uint8_t* GetPtr(uint32_t addr, uint32_t size, bool write) { return ARM11::GetPtr(addr, size, write); }
+    static void RaiseIrq(int event);
+};
+
+struct ARM9Access
+{
+    static uint8_t Read8(uint32_t addr) { return ARM9::Read8(addr); }
+    static uint32_t Read32(uint32_t addr) { return ARM9::Read32(addr); }
+    static void Write8(uint32_t addr, uint8_t data) { ARM9::Write8(addr, data); }
+    static void Write32(uint32_t addr, uint32_t data) { ARM9::Write32(addr, data); }
+    static uint8_t* GetPtr(uint32_t addr, uint32_t size, bool write) { return ARM9::GetPtr(addr, size, write); }
+    static void RaiseIrq(int event);
+};
+
 }
\ No newline at end of file
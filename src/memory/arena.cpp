@@ -0,0 +1,221 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr uint64_t VIEW_SIZE = 1ull << 32;
+
+const static uint32_t region_sizes[Arena::REGION_COUNT] =
+{
+    0x10000,    // BOOT9
+    0x10000,    // BOOT9_LOCKED
+    0x10000,    // BOOT11
+    0x10000,    // BOOT11_LOCKED
+    0x8000,     // ITCM
+    0x4000,     // DTCM
+    0x100000,   // ARM9_WRAM
+    0x80000,    // AXI_WRAM
+    0x600000,   // VRAM
+    0x10000000, // FCRAM, sized for the New 3DS, the old one maps half
+    0x80000,    // ARM9_WRAM_EXT
+    0x400000,   // QTM_RAM
+};
+
+Arena::View Arena::views[MMIO::CPU_COUNT];
+
+int arena_fd = -1;
+uint8_t* arena_host;
+uint32_t region_offsets[Arena::REGION_COUNT];
+
+static void set_pages(uint64_t* bits, uint32_t addr, uint64_t size, bool value)
+{
+    for (uint64_t page = addr >> Arena::PAGE_SHIFT; page < (addr + size) >> Arena::PAGE_SHIFT; page++)
+    {
+        if (value)
+            bits[page / 64] |= 1ull << (page % 64);
+        else
+            bits[page / 64] &= ~(1ull << (page % 64));
+    }
+}
+
+void Arena::Initialize()
+{
+    uint32_t total = 0;
+    for (int i = 0; i < REGION_COUNT; i++)
+    {
+        region_offsets[i] = total;
+        total += region_sizes[i];
+    }
+
+    arena_fd = memfd_create("3ds-memory", 0);
+    if (arena_fd < 0 || ftruncate(arena_fd, total) < 0)
+    {
+        printf("[ARENA]: Couldn't create guest memory\n");
+        exit(1);
+    }
+
+    arena_host = (uint8_t*)mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, arena_fd, 0);
+    if (arena_host == MAP_FAILED)
+    {
+        printf("[ARENA]: Couldn't map guest memory\n");
+        exit(1);
+    }
+
+    for (int cpu = 0; cpu < MMIO::CPU_COUNT; cpu++)
+    {
+        void* base = mmap(nullptr, VIEW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            printf("[ARENA]: Couldn't reserve the %s address space\n", cpu == MMIO::CPU_ARM9 ? "ARM9" : "ARM11");
+            exit(1);
+        }
+        views[cpu].base = (uint8_t*)base;
+    }
+}
+
+uint8_t* Arena::GetHostPtr(Region region)
+{
+    return arena_host + region_offsets[region];
+}
+
+uint32_t Arena::GetRegionSize(Region region)
+{
+    return region_sizes[region];
+}
+
+void Arena::Clear(MMIO::Cpu cpu)
+{
+    View& view = views[cpu];
+    mmap(view.base, VIEW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    memset(view.readable, 0, sizeof(view.readable));
+    memset(view.writable, 0, sizeof(view.writable));
+}
+
+void Arena::Map(MMIO::Cpu cpu, uint32_t addr, uint32_t size, Region region, bool writable)
+{
+    // Mappings are made of whole host pages. The guest never maps anything
+    // smaller, except for tiny TCM configurations, which get a full page.
+    uint64_t start = addr & ~(PAGE_SIZE - 1);
+    uint64_t end = std::min<uint64_t>(((uint64_t)addr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1), VIEW_SIZE);
+
+    View& view = views[cpu];
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    uint32_t region_size = region_sizes[region];
+
+    // Mirrors repeat on region-sized boundaries, same as masking the address
+    for (uint64_t mirror = start; mirror < end;)
+    {
+        uint64_t offset = mirror % region_size;
+        uint64_t len = std::min<uint64_t>(region_size - offset, end - mirror);
+        void* ptr = mmap(view.base + mirror, len, prot, MAP_SHARED | MAP_FIXED | MAP_NORESERVE, arena_fd,
+            region_offsets[region] + offset);
+        if (ptr == MAP_FAILED)
+        {
+            printf("[ARENA]: Couldn't map region %d at 0x%08lx\n", region, mirror);
+            exit(1);
+        }
+        mirror += len;
+    }
+
+    set_pages(view.readable, start, end - start, true);
+    set_pages(view.writable, start, end - start, writable);
+
+    // Watched pages stay read-only under a new writable mapping, and stop
+    // being watched under a read-only one
+    if (!writable)
+    {
+        set_pages(view.watched, start, end - start, false);
+        return;
+    }
+    for (uint64_t page = start >> PAGE_SHIFT; page < end >> PAGE_SHIFT; page++)
+    {
+        if ((view.watched[page / 64] >> (page % 64)) & 1)
+        {
+            view.writable[page / 64] &= ~(1ull << (page % 64));
+            mprotect(view.base + (page << PAGE_SHIFT), PAGE_SIZE, PROT_READ);
+        }
+    }
+}
+
+// Flips the write permission of each page in [start, end) that passes the
+// filter, one mprotect per run of consecutive pages
+template <typename Filter>
+static void set_write_protect(Arena::View& view, uint64_t start, uint64_t end, bool watch, Filter filter)
+{
+    using namespace Arena;
+    uint64_t run = 0, run_len = 0;
+    auto flush = [&]()
+    {
+        if (run_len)
+            mprotect(view.base + (run << PAGE_SHIFT), run_len << PAGE_SHIFT, watch ? PROT_READ : PROT_READ | PROT_WRITE);
+        run_len = 0;
+    };
+
+    for (uint64_t page = start; page < end; page++)
+    {
+        uint64_t bit = 1ull << (page % 64);
+        if (!filter(page / 64, bit))
+        {
+            flush();
+            continue;
+        }
+
+        if (watch)
+        {
+            view.writable[page / 64] &= ~bit;
+            view.watched[page / 64] |= bit;
+        }
+        else
+        {
+            view.writable[page / 64] |= bit;
+            view.watched[page / 64] &= ~bit;
+        }
+        if (!run_len)
+            run = page;
+        run_len++;
+    }
+    flush();
+}
+
+void Arena::Watch(uint32_t addr, uint32_t size)
+{
+    uint64_t start = addr >> PAGE_SHIFT;
+    uint64_t end = std::min<uint64_t>(((uint64_t)addr + size + PAGE_SIZE - 1) >> PAGE_SHIFT, PAGE_COUNT);
+    for (View& view : views)
+    {
+        set_write_protect(view, start, end, true,
+            [&](uint64_t word, uint64_t bit) { return (view.writable[word] & bit) != 0; });
+    }
+}
+
+void Arena::Unwatch(uint32_t addr, uint32_t size)
+{
+    uint64_t start = addr >> PAGE_SHIFT;
+    uint64_t end = std::min<uint64_t>(((uint64_t)addr + size + PAGE_SIZE - 1) >> PAGE_SHIFT, PAGE_COUNT);
+    for (View& view : views)
+    {
+        // A page might have been unmapped since it was watched
+        set_write_protect(view, start, end, false,
+            [&](uint64_t word, uint64_t bit) { return (view.watched[word] & view.readable[word] & bit) != 0; });
+    }
+}
+
+uint8_t* Arena::GetRangePtr(MMIO::Cpu cpu, uint32_t addr, uint32_t size, bool write)
+{
+    if (!size || (uint64_t)addr + size > VIEW_SIZE)
+        return nullptr;
+
+    const View& view = views[cpu];
+    const uint64_t* bits = write ? view.writable : view.readable;
+    for (uint64_t page = addr >> PAGE_SHIFT; page <= ((uint64_t)addr + size - 1) >> PAGE_SHIFT; page++)
+    {
+        if (!((bits[page / 64] >> (page % 64)) & 1))
+            return nullptr;
+    }
+
+    return view.base + addr;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory/mmio.h>
+
+// Guest memory. All RAM and ROM lives in one shared memory object, and each
+// CPU gets its own 4GB reservation of host address space that mirrors the
+// guest's. The regions a CPU can see are mapped into its view at their guest
+// addresses, everything else is left inaccessible as a guard. A guest
+// address is turned into a host pointer by adding it to the view base, after
+// checking the page's permission bit.
+//
+// The memory object is sparse: pages are only backed once something touches
+// them, so reserving the New 3DS' 256MB of FCRAM costs nothing up front.
+namespace Arena
+{
+
+enum Region
+{
+    REGION_BOOT9,
+    REGION_BOOT9_LOCKED,
+    REGION_BOOT11,
+    REGION_BOOT11_LOCKED,
+    REGION_ITCM,
+    REGION_DTCM,
+    REGION_ARM9_WRAM,
+    REGION_AXI_WRAM,
+    REGION_VRAM,
+    REGION_FCRAM,
+    // New 3DS only
+    REGION_ARM9_WRAM_EXT,
+    REGION_QTM_RAM,
+    REGION_COUNT
+};
+
+constexpr uint32_t PAGE_SHIFT = 12;
+constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+constexpr uint32_t PAGE_COUNT = 1 << (32 - PAGE_SHIFT);
+
+struct View
+{
+    uint8_t* base;
+    uint64_t readable[PAGE_COUNT / 64];
+    uint64_t writable[PAGE_COUNT / 64];
+    // Writable pages that are temporarily read-only, see Watch()
+    uint64_t watched[PAGE_COUNT / 64];
+};
+
+extern View views[MMIO::CPU_COUNT];
+
+void Initialize();
+
+// Pointer to a whole region, independent of where (or if) it's mapped
+uint8_t* GetHostPtr(Region region);
+uint32_t GetRegionSize(Region region);
+
+// Drops every mapping of a CPU's view
+void Clear(MMIO::Cpu cpu);
+
+// Maps region at [addr, addr+size), mirrored if size is larger than the
+// region. Later mappings replace earlier ones where they overlap, so map in
+// increasing priority.
+void Map(MMIO::Cpu cpu, uint32_t addr, uint32_t size, Region region, bool writable);
+
+static inline bool page_set(const uint64_t* bits, uint32_t addr)
+{
+    uint32_t page = addr >> PAGE_SHIFT;
+    return (bits[page / 64] >> (page % 64)) & 1;
+}
+
+// Makes the writable pages of [addr, addr+size) read-only in every view, so
+// CPU writes there miss the fast paths (fastmem included) and end up in the
+// MMIO handlers registered over the range. Those call Unwatch() to give the
+// pages back before doing the write. Survives remapping, until unwatched.
+void Watch(uint32_t addr, uint32_t size);
+void Unwatch(uint32_t addr, uint32_t size);
+
+// Host pointer for a sizeof(T) access, nullptr if it isn't plain memory
+template <typename T>
+inline uint8_t* ReadPtr(MMIO::Cpu cpu, uint32_t addr)
+{
+    const View& view = views[cpu];
+    if (!page_set(view.readable, addr))
+        return nullptr;
+    if ((addr & (PAGE_SIZE - 1)) > PAGE_SIZE - sizeof(T) && !page_set(view.readable, addr + sizeof(T) - 1))
+        return nullptr;
+    return view.base + addr;
+}
+
+template <typename T>
+inline uint8_t* WritePtr(MMIO::Cpu cpu, uint32_t addr)
+{
+    const View& view = views[cpu];
+    if (!page_set(view.writable, addr))
+        return nullptr;
+    if ((addr & (PAGE_SIZE - 1)) > PAGE_SIZE - sizeof(T) && !page_set(view.writable, addr + sizeof(T) - 1))
+        return nullptr;
+    return view.base + addr;
+}
+
+// Host pointer for [addr, addr+size) if all of it is mapped (mirrors
+// included, they're contiguous in the view), nullptr otherwise
+uint8_t* GetRangePtr(MMIO::Cpu cpu, uint32_t addr, uint32_t size, bool write);
+
+}
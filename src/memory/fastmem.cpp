@@ -0,0 +1,202 @@
+#include "fastmem.h"
+
+#include <stdio.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <memory/Bus.h>
+
+bool Fastmem::enabled = false;
+
+uint64_t fastmem_faults = 0;
+
+static MMIO::Cpu owner(uint8_t* base)
+{
+    return base == Arena::views[MMIO::CPU_ARM9].base ? MMIO::CPU_ARM9 : MMIO::CPU_ARM11;
+}
+
+uint8_t Fastmem::SlowRead8(uint8_t* base, uint32_t addr)
+{
+    return owner(base) == MMIO::CPU_ARM9 ? Bus::ARM9::Read8(addr) : Bus::ARM11::Read8(addr);
+}
+
+uint16_t Fastmem::SlowRead16(uint8_t* base, uint32_t addr)
+{
+    return owner(base) == MMIO::CPU_ARM9 ? Bus::ARM9::Read16(addr) : Bus::ARM11::Read16(addr);
+}
+
+uint32_t Fastmem::SlowRead32(uint8_t* base, uint32_t addr)
+{
+    return owner(base) == MMIO::CPU_ARM9 ? Bus::ARM9::Read32(addr) : Bus::ARM11::Read32(addr);
+}
+
+void Fastmem::SlowWrite8(uint8_t* base, uint32_t addr, uint8_t data)
+{
+    if (owner(base) == MMIO::CPU_ARM9)
+        Bus::ARM9::Write8(addr, data);
+    else
+        Bus::ARM11::Write8(addr, data);
+}
+
+void Fastmem::SlowWrite16(uint8_t* base, uint32_t addr, uint16_t data)
+{
+    if (owner(base) == MMIO::CPU_ARM9)
+        Bus::ARM9::Write16(addr, data);
+    else
+        Bus::ARM11::Write16(addr, data);
+}
+
+void Fastmem::SlowWrite32(uint8_t* base, uint32_t addr, uint32_t data)
+{
+    if (owner(base) == MMIO::CPU_ARM9)
+        Bus::ARM9::Write32(addr, data);
+    else
+        Bus::ARM11::Write32(addr, data);
+}
+
+#if defined(__x86_64__)
+
+// Each stub zero-extends the address (the ABI leaves the upper half of rsi
+// undefined) and then makes exactly one access, the only instruction in it
+// that can fault. Neither touches the stack or the argument registers, so
+// when the access faults, the handler can point rip at the matching slow
+// path and it runs as if the caller had called it directly.
+asm(R"(
+    .text
+    .p2align 4
+    .globl fastmem_load8
+    .hidden fastmem_load8
+    .type fastmem_load8, @function
+fastmem_load8:
+    movl %esi, %esi
+fastmem_load8_access:
+    movzbl (%rdi,%rsi), %eax
+    ret
+
+    .p2align 4
+    .globl fastmem_load16
+    .hidden fastmem_load16
+    .type fastmem_load16, @function
+fastmem_load16:
+    movl %esi, %esi
+fastmem_load16_access:
+    movzwl (%rdi,%rsi), %eax
+    ret
+
+    .p2align 4
+    .globl fastmem_load32
+    .hidden fastmem_load32
+    .type fastmem_load32, @function
+fastmem_load32:
+    movl %esi, %esi
+fastmem_load32_access:
+    movl (%rdi,%rsi), %eax
+    ret
+
+    .p2align 4
+    .globl fastmem_store8
+    .hidden fastmem_store8
+    .type fastmem_store8, @function
+fastmem_store8:
+    movl %esi, %esi
+fastmem_store8_access:
+    movb %dl, (%rdi,%rsi)
+    ret
+
+    .p2align 4
+    .globl fastmem_store16
+    .hidden fastmem_store16
+    .type fastmem_store16, @function
+fastmem_store16:
+    movl %esi, %esi
+fastmem_store16_access:
+    movw %dx, (%rdi,%rsi)
+    ret
+
+    .p2align 4
+    .globl fastmem_store32
+    .hidden fastmem_store32
+    .type fastmem_store32, @function
+fastmem_store32:
+    movl %esi, %esi
+fastmem_store32_access:
+    movl %edx, (%rdi,%rsi)
+    ret
+
+    .globl fastmem_load8_access, fastmem_load16_access, fastmem_load32_access
+    .globl fastmem_store8_access, fastmem_store16_access, fastmem_store32_access
+    .hidden fastmem_load8_access, fastmem_load16_access, fastmem_load32_access
+    .hidden fastmem_store8_access, fastmem_store16_access, fastmem_store32_access
+)");
+
+extern "C" char fastmem_load8_access[], fastmem_load16_access[], fastmem_load32_access[];
+extern "C" char fastmem_store8_access[], fastmem_store16_access[], fastmem_store32_access[];
+
+struct FaultTarget
+{
+    void* access;
+    void* slow_path;
+};
+
+const static FaultTarget fault_targets[] =
+{
+    {fastmem_load8_access, (void*)&Fastmem::SlowRead8},
+    {fastmem_load16_access, (void*)&Fastmem::SlowRead16},
+    {fastmem_load32_access, (void*)&Fastmem::SlowRead32},
+    {fastmem_store8_access, (void*)&Fastmem::SlowWrite8},
+    {fastmem_store16_access, (void*)&Fastmem::SlowWrite16},
+    {fastmem_store32_access, (void*)&Fastmem::SlowWrite32},
+};
+
+static struct sigaction old_segv_action;
+
+static void segv_handler(int, siginfo_t*, void* context)
+{
+    ucontext_t* uc = (ucontext_t*)context;
+    greg_t& rip = uc->uc_mcontext.gregs[REG_RIP];
+
+    for (auto& target : fault_targets)
+    {
+        if (rip == (greg_t)target.access)
+        {
+            rip = (greg_t)target.slow_path;
+            fastmem_faults++;
+            return;
+        }
+    }
+
+    // A genuine crash, let it happen the way it would have without us
+    sigaction(SIGSEGV, &old_segv_action, nullptr);
+}
+
+bool Fastmem::Enable()
+{
+    struct sigaction action = {};
+    action.sa_sigaction = segv_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &old_segv_action) < 0)
+    {
+        printf("[FASTMEM]: Couldn't install the fault handler\n");
+        return false;
+    }
+
+    enabled = true;
+    return true;
+}
+
+#else
+
+bool Fastmem::Enable()
+{
+    printf("[FASTMEM]: Not supported on this host\n");
+    return false;
+}
+
+#endif
+
+void Fastmem::Dump()
+{
+    if (enabled)
+        printf("[FASTMEM]: %lu accesses went through the fault handler\n", fastmem_faults);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory/arena.h>
+
+// Fast guest memory access for the CPUs. Loads and stores are single host
+// instructions against the CPU's arena view. Anything that isn't plain memory
+// there (MMIO, unmapped addresses, writes to ROM) faults, and the SIGSEGV
+// handler turns the access into a call to the Bus handlers.
+//
+// Faults are far slower than the bitmap check in the Bus accessors, so this
+// pays off when code mostly touches RAM, not when it hammers registers.
+namespace Fastmem
+{
+
+// Installs the fault handler. Returns false if the host isn't supported, in
+// which case the CPUs keep going through the Bus.
+bool Enable();
+
+extern bool enabled;
+
+void Dump();
+
+// Where faulting accesses end up, they go through the Bus of the CPU that
+// owns base
+uint8_t SlowRead8(uint8_t* base, uint32_t addr);
+uint16_t SlowRead16(uint8_t* base, uint32_t addr);
+uint32_t SlowRead32(uint8_t* base, uint32_t addr);
+void SlowWrite8(uint8_t* base, uint32_t addr, uint8_t data);
+void SlowWrite16(uint8_t* base, uint32_t addr, uint16_t data);
+void SlowWrite32(uint8_t* base, uint32_t addr, uint32_t data);
+
+}
+
+#if defined(__x86_64__)
+// Access stubs, see fastmem.cpp
+extern "C" uint8_t fastmem_load8(uint8_t* base, uint32_t addr);
+extern "C" uint16_t fastmem_load16(uint8_t* base, uint32_t addr);
+extern "C" uint32_t fastmem_load32(uint8_t* base, uint32_t addr);
+extern "C" void fastmem_store8(uint8_t* base, uint32_t addr, uint8_t data);
+extern "C" void fastmem_store16(uint8_t* base, uint32_t addr, uint16_t data);
+extern "C" void fastmem_store32(uint8_t* base, uint32_t addr, uint32_t data);
+#else
+// Never used, Enable() fails on these hosts
+#define fastmem_load8 Fastmem::SlowRead8
+#define fastmem_load16 Fastmem::SlowRead16
+#define fastmem_load32 Fastmem::SlowRead32
+#define fastmem_store8 Fastmem::SlowWrite8
+#define fastmem_store16 Fastmem::SlowWrite16
+#define fastmem_store32 Fastmem::SlowWrite32
+#endif
+
+namespace Fastmem
+{
+
+inline uint8_t Read8(MMIO::Cpu cpu, uint32_t addr) { return fastmem_load8(Arena::views[cpu].base, addr); }
+inline uint16_t Read16(MMIO::Cpu cpu, uint32_t addr) { return fastmem_load16(Arena::views[cpu].base, addr); }
+inline uint32_t Read32(MMIO::Cpu cpu, uint32_t addr) { return fastmem_load32(Arena::views[cpu].base, addr); }
+inline void Write8(MMIO::Cpu cpu, uint32_t addr, uint8_t data) { fastmem_store8(Arena::views[cpu].base, addr, data); }
+inline void Write16(MMIO::Cpu cpu, uint32_t addr, uint16_t data) { fastmem_store16(Arena::views[cpu].base, addr, data); }
+inline void Write32(MMIO::Cpu cpu, uint32_t addr, uint32_t data) { fastmem_store32(Arena::views[cpu].base, addr, data); }
+
+}
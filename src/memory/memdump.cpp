@@ -0,0 +1,106 @@
+#include "memdump.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+constexpr size_t DUMP_ALIGN = 0x1000;
+
+struct DumpRegion
+{
+    const char* name;
+    const void* data;
+    size_t size;
+};
+
+std::vector<DumpRegion> dump_regions;
+
+const static uint8_t dump_padding[DUMP_ALIGN] = {};
+
+void MemDump::Add(const char* name, const void* data, size_t size)
+{
+    dump_regions.push_back({name, data, size});
+}
+
+// writev may stop early, keep going from wherever it did
+static bool write_all(int fd, std::vector<iovec>& iov)
+{
+    size_t index = 0;
+    while (index < iov.size())
+    {
+        int count = std::min<size_t>(iov.size() - index, IOV_MAX);
+        ssize_t written = writev(fd, &iov[index], count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        while (index < iov.size() && (size_t)written >= iov[index].iov_len)
+            written -= iov[index++].iov_len;
+        if (index < iov.size())
+        {
+            iov[index].iov_base = (uint8_t*)iov[index].iov_base + written;
+            iov[index].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+void MemDump::Write(const char* path)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<iovec> iov;
+    std::string manifest = "# name offset size\n";
+    size_t offset = 0;
+
+    for (auto& region : dump_regions)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "%s 0x%zx 0x%zx\n", region.name, offset, region.size);
+        manifest += line;
+
+        iov.push_back({(void*)region.data, region.size});
+        offset += region.size;
+
+        size_t padding = (DUMP_ALIGN - offset % DUMP_ALIGN) % DUMP_ALIGN;
+        if (padding)
+        {
+            iov.push_back({(void*)dump_padding, padding});
+            offset += padding;
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, iov);
+    if (fd >= 0)
+        close(fd);
+
+    std::string manifest_path = std::string(path) + ".txt";
+    FILE* file = fopen(manifest_path.c_str(), "w");
+    if (file)
+    {
+        fwrite(manifest.data(), 1, manifest.size(), file);
+        fclose(file);
+    }
+
+    if (!ok || !file)
+        printf("[DUMP]: Couldn't write %s\n", path);
+    else
+    {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("[DUMP]: Wrote %zu regions (%zuKB) to %s in %.1fms\n", dump_regions.size(), offset / 1024, path, ms);
+    }
+
+    dump_regions.clear();
+}
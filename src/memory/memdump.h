@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+// Exit-time memory dumps. Everything that wants its memory dumped adds it
+// here, then Write() stores all of it in one container file with a single
+// vectored write. Regions start on 4KB boundaries in the container, and a
+// text manifest next to it lists the name, offset and size of each, e.g. for
+// `dd skip=<offset> count=<size> iflag=skip_bytes,count_bytes`.
+namespace MemDump
+{
+
+// data has to stay valid until Write()
+void Add(const char* name, const void* data, size_t size);
+
+// Writes path and path.txt, then forgets the added regions
+void Write(const char* path);
+
+}
@@ -0,0 +1,298 @@
+#include "mmio.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct MmioRange
+{
+    uint32_t start;
+    uint64_t end;
+    MMIO::Handlers handlers;
+};
+
+// Ranges touching a 4KB page, as indices into mmio_ranges in registration
+// (priority) order
+struct MmioPage
+{
+    std::vector<uint16_t> ranges;
+};
+
+struct MmioDirEntry
+{
+    MmioPage pages[256];
+};
+
+std::vector<MmioRange> mmio_ranges[MMIO::CPU_COUNT];
+MmioDirEntry* mmio_dir[MMIO::CPU_COUNT][4096];
+
+enum AccessKind
+{
+    ACCESS_READ8,
+    ACCESS_READ16,
+    ACCESS_READ32,
+    ACCESS_WRITE8,
+    ACCESS_WRITE16,
+    ACCESS_WRITE32
+};
+
+const static char* access_names[] = {"Read8", "Read16", "Read32", "Write8", "Write16", "Write32"};
+const static char* cpu_names[] = {"ARM9", "ARM11"};
+
+// Counts per (cpu, access kind, address)
+std::unordered_map<uint64_t, uint64_t> unknown_accesses;
+
+uint64_t mmio_generation = 0;
+uint64_t mmio_reads = 0;
+
+struct ProfileEntry
+{
+    const char* name;
+    uint64_t count;
+    uint64_t ticks;
+};
+
+// Per (cpu, access kind, address), only filled while profiling
+bool mmio_profiling = false;
+std::string profile_csv_path;
+std::unordered_map<uint64_t, ProfileEntry> profile;
+
+// Used to turn ticks into host time in the report
+uint64_t profile_start_ticks;
+std::chrono::steady_clock::time_point profile_start_time;
+
+static inline uint64_t read_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static inline uint64_t access_key(MMIO::Cpu cpu, AccessKind kind, uint32_t addr)
+{
+    return ((uint64_t)cpu << 40) | ((uint64_t)kind << 32) | addr;
+}
+
+// Runs a handler, charging its host time to the register when profiling
+template <typename F>
+static inline auto call_handler(MMIO::Cpu cpu, AccessKind kind, uint32_t addr, const MmioRange* range, F handler)
+{
+    if (!mmio_profiling)
+        return handler();
+
+    uint64_t start = read_ticks();
+    auto record = [&]
+    {
+        uint64_t elapsed = read_ticks() - start;
+        auto& entry = profile[access_key(cpu, kind, addr)];
+        entry.name = range->handlers.name;
+        entry.count++;
+        entry.ticks += elapsed;
+    };
+
+    if constexpr (std::is_void_v<decltype(handler())>)
+    {
+        handler();
+        record();
+    }
+    else
+    {
+        auto value = handler();
+        record();
+        return value;
+    }
+}
+
+void MMIO::Register(Cpu cpu, uint32_t start, uint32_t size, const Handlers& handlers)
+{
+    auto& ranges = mmio_ranges[cpu];
+    uint16_t index = ranges.size();
+    uint64_t end = (uint64_t)start + size;
+    ranges.push_back({start, end, handlers});
+
+    for (uint64_t page = start >> 12; page <= (end - 1) >> 12; page++)
+    {
+        auto& dir = mmio_dir[cpu][page >> 8];
+        if (!dir)
+            dir = new MmioDirEntry;
+        dir->pages[page & 0xFF].ranges.push_back(index);
+    }
+}
+
+template <typename F>
+static const MmioRange* find(MMIO::Cpu cpu, uint32_t addr, F MMIO::Handlers::*handler)
+{
+    MmioDirEntry* dir = mmio_dir[cpu][addr >> 20];
+    if (!dir)
+        return nullptr;
+
+    for (uint16_t index : dir->pages[(addr >> 12) & 0xFF].ranges)
+    {
+        const MmioRange& range = mmio_ranges[cpu][index];
+        if (addr >= range.start && addr < range.end && range.handlers.*handler)
+            return &range;
+    }
+    return nullptr;
+}
+
+static void unknown_access(MMIO::Cpu cpu, AccessKind kind, uint32_t addr, uint32_t data)
+{
+    if (unknown_accesses[access_key(cpu, kind, addr)]++)
+        return;
+
+    if (kind >= ACCESS_WRITE8)
+        printf("[MMIO]: Unknown %s %s 0x%08x to 0x%08x\n", cpu_names[cpu], access_names[kind], data, addr);
+    else
+        printf("[MMIO]: Unknown %s %s from 0x%08x\n", cpu_names[cpu], access_names[kind], addr);
+}
+
+uint8_t MMIO::Read8(Cpu cpu, uint32_t addr)
+{
+    mmio_reads++;
+    if (auto range = find(cpu, addr, &Handlers::read8))
+        return call_handler(cpu, ACCESS_READ8, addr, range, [&] { return range->handlers.read8(addr); });
+
+    unknown_access(cpu, ACCESS_READ8, addr, 0);
+    return 0;
+}
+
+uint16_t MMIO::Read16(Cpu cpu, uint32_t addr)
+{
+    mmio_reads++;
+    if (auto range = find(cpu, addr, &Handlers::read16))
+        return call_handler(cpu, ACCESS_READ16, addr, range, [&] { return range->handlers.read16(addr); });
+
+    unknown_access(cpu, ACCESS_READ16, addr, 0);
+    return 0;
+}
+
+uint32_t MMIO::Read32(Cpu cpu, uint32_t addr)
+{
+    mmio_reads++;
+    if (auto range = find(cpu, addr, &Handlers::read32))
+        return call_handler(cpu, ACCESS_READ32, addr, range, [&] { return range->handlers.read32(addr); });
+
+    unknown_access(cpu, ACCESS_READ32, addr, 0);
+    return 0;
+}
+
+void MMIO::Write8(Cpu cpu, uint32_t addr, uint8_t data)
+{
+    mmio_generation++;
+    if (auto range = find(cpu, addr, &Handlers::write8))
+        return call_handler(cpu, ACCESS_WRITE8, addr, range, [&] { range->handlers.write8(addr, data); });
+
+    unknown_access(cpu, ACCESS_WRITE8, addr, data);
+}
+
+void MMIO::Write16(Cpu cpu, uint32_t addr, uint16_t data)
+{
+    mmio_generation++;
+    if (auto range = find(cpu, addr, &Handlers::write16))
+        return call_handler(cpu, ACCESS_WRITE16, addr, range, [&] { range->handlers.write16(addr, data); });
+
+    unknown_access(cpu, ACCESS_WRITE16, addr, data);
+}
+
+void MMIO::Write32(Cpu cpu, uint32_t addr, uint32_t data)
+{
+    mmio_generation++;
+    if (auto range = find(cpu, addr, &Handlers::write32))
+        return call_handler(cpu, ACCESS_WRITE32, addr, range, [&] { range->handlers.write32(addr, data); });
+
+    unknown_access(cpu, ACCESS_WRITE32, addr, data);
+}
+
+uint64_t MMIO::GetGeneration()
+{
+    return mmio_generation;
+}
+
+void MMIO::NotifyChange()
+{
+    mmio_generation++;
+}
+
+uint64_t MMIO::GetReadCount()
+{
+    return mmio_reads;
+}
+
+void MMIO::EnableProfiling(const char* csv_path)
+{
+    mmio_profiling = true;
+    profile_csv_path = csv_path;
+    profile_start_ticks = read_ticks();
+    profile_start_time = std::chrono::steady_clock::now();
+}
+
+static void dump_profile()
+{
+    constexpr size_t REPORT_ENTRIES = 32;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - profile_start_time).count();
+    uint64_t total_ticks = read_ticks() - profile_start_ticks;
+    double ns_per_tick = total_ticks ? seconds * 1e9 / total_ticks : 0;
+
+    std::vector<std::pair<uint64_t, ProfileEntry>> sorted(profile.begin(), profile.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second.ticks > b.second.ticks; });
+
+    uint64_t handler_ticks = 0, accesses = 0;
+    for (auto& [key, entry] : sorted)
+    {
+        handler_ticks += entry.ticks;
+        accesses += entry.count;
+    }
+
+    printf("[MMIO]: %lu accesses to %zu registers, %.3fms of %.3fs in handlers\n", accesses, sorted.size(),
+        handler_ticks * ns_per_tick / 1e6, seconds);
+    printf("  %-5s %-7s %-10s %-8s %12s %12s %10s\n", "cpu", "access", "address", "handler", "count", "total us", "ns/access");
+    for (size_t i = 0; i < sorted.size() && i < REPORT_ENTRIES; i++)
+    {
+        auto& [key, entry] = sorted[i];
+        double ns = entry.ticks * ns_per_tick;
+        printf("  %-5s %-7s 0x%08x %-8s %12lu %12.1f %10.1f\n", cpu_names[key >> 40], access_names[(key >> 32) & 0xFF],
+            (uint32_t)key, entry.name, entry.count, ns / 1e3, ns / entry.count);
+    }
+
+    std::ofstream csv(profile_csv_path);
+    csv << "cpu,access,address,handler,count,total_ns\n";
+    for (auto& [key, entry] : sorted)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "%s,%s,0x%08x,%s,%lu,%.0f\n", cpu_names[key >> 40], access_names[(key >> 32) & 0xFF],
+            (uint32_t)key, entry.name, entry.count, entry.ticks * ns_per_tick);
+        csv << line;
+    }
+    printf("[MMIO]: Wrote profile to %s\n", profile_csv_path.c_str());
+}
+
+void MMIO::Dump()
+{
+    if (mmio_profiling)
+        dump_profile();
+
+    if (unknown_accesses.empty())
+        return;
+
+    std::vector<std::pair<uint64_t, uint64_t>> sorted(unknown_accesses.begin(), unknown_accesses.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second > b.second; });
+
+    printf("[MMIO]: %zu unknown registers accessed:\n", sorted.size());
+    for (auto& [key, count] : sorted)
+    {
+        int cpu = key >> 40;
+        int kind = (key >> 32) & 0xFF;
+        printf("  %-5s %-7s 0x%08x: %lu\n", cpu_names[cpu], access_names[kind], (uint32_t)key, count);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+// Registry of memory-mapped I/O handlers. Peripherals register an address
+// range with handlers for the access widths they implement, and the bus
+// dispatches anything that isn't plain memory through here. Lookups go
+// through a two-level page table (1MB directory, 4KB pages), so dispatch
+// cost doesn't depend on how many registers exist.
+//
+// Ranges may overlap, the first registered range that covers an address and
+// has a handler for the access width wins. Accesses nothing handles are
+// logged once per address and counted instead of stopping the emulator;
+// reads return 0.
+namespace MMIO
+{
+
+enum Cpu
+{
+    CPU_ARM9,
+    CPU_ARM11,
+    CPU_COUNT
+};
+
+// Registrations name only the handlers they have, the rest stay null
+struct Handlers
+{
+    const char* name = nullptr;
+    uint8_t (*read8)(uint32_t addr) = nullptr;
+    uint16_t (*read16)(uint32_t addr) = nullptr;
+    uint32_t (*read32)(uint32_t addr) = nullptr;
+    void (*write8)(uint32_t addr, uint8_t data) = nullptr;
+    void (*write16)(uint32_t addr, uint16_t data) = nullptr;
+    void (*write32)(uint32_t addr, uint32_t data) = nullptr;
+};
+
+void Register(Cpu cpu, uint32_t start, uint32_t size, const Handlers& handlers);
+
+uint8_t Read8(Cpu cpu, uint32_t addr);
+uint16_t Read16(Cpu cpu, uint32_t addr);
+uint32_t Read32(Cpu cpu, uint32_t addr);
+
+void Write8(Cpu cpu, uint32_t addr, uint8_t data);
+void Write16(Cpu cpu, uint32_t addr, uint16_t data);
+void Write32(Cpu cpu, uint32_t addr, uint32_t data);
+
+// Generation of the device state MMIO reads can observe. Every register
+// write bumps it, and so does anything else that changes what a read would
+// return (scheduler events, IRQs, reads that pop a FIFO). The CPUs use it to
+// sleep through polling loops until something happens.
+uint64_t GetGeneration();
+void NotifyChange();
+
+// Number of reads dispatched so far, lets a CPU tell whether an access it
+// just made went to a register or to memory
+uint64_t GetReadCount();
+
+// Counts accesses and host time per register, width, CPU and direction
+// from now on. Dump() prints the hottest registers and writes all of them to
+// csv_path.
+void EnableProfiling(const char* csv_path);
+
+// Prints the profile (if enabled) and the unknown accesses seen so far
+void Dump();
+
+}
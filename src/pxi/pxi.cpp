@@ -1,105 +1,228 @@
 #include "pxi.h"
+#include "pxi_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <queue>
+#include <atomic>
 #include <arm/mpcore_pmr.h>
 #include <memory/Bus.h>
+#include <memory/mmio.h>
 
-struct 
+// Each direction is a single-producer/single-consumer ring: only the sending
+// CPU pushes and only the receiving CPU pops, so the two sides never need a
+// lock even when they run on different host threads. The one exception is a
+// flush, issued by the sender, which the consumer tolerates by popping with a
+// compare-exchange on its head.
+template <typename T, uint32_t N>
+class SpscRing
 {
-    uint8_t recv = 0;
-    bool enable_remote_irq = 0;
-} sync11, sync9;
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
 
-struct
+    T entries[N];
+    std::atomic<uint32_t> head{0}, tail{0};
+public:
+    uint32_t Size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool Empty() const { return Size() == 0; }
+    bool Full() const { return Size() >= N; }
+
+    // Producer side, returns false if the ring is full
+    bool Push(T value)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= N)
+            return false;
+
+        entries[t % N] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if the ring is empty
+    bool Pop(T& value)
+    {
+        uint32_t h = head.load(std::memory_order_acquire);
+        T entry;
+        do
+        {
+            if (h == tail.load(std::memory_order_acquire))
+                return false;
+            entry = entries[h % N];
+        } while (!head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel));
+        value = entry;
+        return true;
+    }
+
+    // Producer side, drops everything not yet consumed
+    void Flush()
+    {
+        head.store(tail.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+};
+
+constexpr int PXI_FIFO_SIZE = 16;
+
+struct PxiSide
 {
-    bool send_fifo_empty;
-    bool send_fifo_full;
-    bool send_fifo_empty_irqen;
-    bool recv_fifo_empty;
-    bool recv_fifo_full;
-    bool recv_fifo_not_empty_irqen;
-    bool error;
+    // Byte most recently received through SYNC from the other CPU
+    std::atomic<uint8_t> sync_recv{0};
+    std::atomic<bool> sync_irq_enable{false};
+
+    // CNT bits. The IRQ enables are read by the other CPU when it changes
+    // the FIFO state, the rest is only touched by the owner.
+    std::atomic<bool> send_fifo_empty_irqen{false};
+    std::atomic<bool> recv_fifo_not_empty_irqen{false};
+    bool error = false;
     bool enable_send_recv = true;
-} cnt9, cnt11;
 
-std::queue<uint32_t> fifo11, fifo9;
-uint32_t last_read11, last_read9;
+    uint32_t last_read = 0;
+
+    // Written by this CPU, read by the other one
+    SpscRing<uint32_t, PXI_FIFO_SIZE> send_fifo;
+} side9, side11;
+
+// IRQ lines, per receiving CPU
+void raise_sync_irq9() { Bus::SetInterruptPending9(12); }
+void raise_send_empty_irq9() { Bus::SetInterruptPending9(13); }
+void raise_recv_not_empty_irq9() { Bus::SetInterruptPending9(14); }
+void raise_send_empty_irq11() { MPCore_PMR::AssertHWIrq(0x52); }
+void raise_recv_not_empty_irq11() { MPCore_PMR::AssertHWIrq(0x53); }
+
+void write_cnt(PxiSide& self, PxiSide& remote, uint16_t data, void (*send_empty_irq)(), void (*recv_not_empty_irq)())
+{
+    bool old_send_irqen = self.send_fifo_empty_irqen;
+    bool old_recv_irqen = self.recv_fifo_not_empty_irqen;
+
+    self.send_fifo_empty_irqen = (data >> 2) & 1;
+    self.recv_fifo_not_empty_irqen = (data >> 10) & 1;
+    if ((data >> 14) & 1)
+        self.error = false;
+    self.enable_send_recv = (data >> 15) & 1;
+
+    if ((data >> 3) & 1)
+        self.send_fifo.Flush();
+
+    // Enabling an IRQ while its condition already holds fires it right away
+    if (!old_send_irqen && self.send_fifo_empty_irqen && self.send_fifo.Empty())
+        send_empty_irq();
+    if (!old_recv_irqen && self.recv_fifo_not_empty_irqen && !remote.send_fifo.Empty())
+        recv_not_empty_irq();
+}
+
+uint16_t read_cnt(PxiSide& self, PxiSide& remote)
+{
+    uint32_t reg = self.send_fifo.Empty();
+    reg |= (self.send_fifo.Full() << 1);
+    reg |= (self.send_fifo_empty_irqen << 2);
+    reg |= (remote.send_fifo.Empty() << 8);
+    reg |= (remote.send_fifo.Full() << 9);
+    reg |= (self.recv_fifo_not_empty_irqen << 10);
+    reg |= (self.error << 14);
+    reg |= (self.enable_send_recv << 15);
+    return reg;
+}
+
+void send(PxiSide& self, PxiSide& remote, uint32_t data, void (*remote_recv_irq)())
+{
+    if (!self.enable_send_recv)
+        return;
+
+    bool was_empty = self.send_fifo.Empty();
+    if (!self.send_fifo.Push(data))
+    {
+        self.error = true;
+        return;
+    }
+
+    if (was_empty && remote.recv_fifo_not_empty_irqen)
+        remote_recv_irq();
+}
+
+uint32_t recv(PxiSide& self, PxiSide& remote, void (*remote_send_irq)())
+{
+    if (!self.enable_send_recv)
+        return self.last_read;
+
+    if (!remote.send_fifo.Pop(self.last_read))
+    {
+        self.error = true;
+        return self.last_read;
+    }
+    MMIO::NotifyChange();
+
+    if (remote.send_fifo.Empty() && remote.send_fifo_empty_irqen)
+        remote_send_irq();
+
+    return self.last_read;
+}
 
 void PXI::WriteSync11(uint32_t data)
 {
-    bool send_irq9 = (data >> 31) & 1;
+    PxiTrace::Record(PxiTrace::OP_SYNC11_WRITE, data);
+
+    bool send_irq9 = (data >> 30) & 1;
     uint8_t send_data = (data >> 8) & 0xff;
 
-    if (sync9.enable_remote_irq && send_irq9)
-        Bus::SetInterruptPending9(12);
+    side9.sync_recv = send_data;
+    side11.sync_irq_enable = (data >> 31) & 1;
 
-    sync11.enable_remote_irq = (data >> 31) & 1;
+    if (send_irq9 && side9.sync_irq_enable)
+        raise_sync_irq9();
 
-    sync9.recv = send_data;
     printf("[SYNC11]: Write 0x%08x to ARM9\n", data);
 }
 
 uint32_t PXI::ReadSync11()
 {
-    return (sync11.enable_remote_irq << 31) | sync11.recv;
+    uint32_t reg = ((uint32_t)side11.sync_irq_enable << 31) | (side9.sync_recv << 8) | side11.sync_recv;
+    PxiTrace::Record(PxiTrace::OP_SYNC11_READ, reg);
+    return reg;
 }
 
 void PXI::WriteCnt11(uint16_t data)
 {
-    cnt11.send_fifo_empty_irqen = (data >> 2) & 1;
-    cnt11.recv_fifo_not_empty_irqen = (data >> 10) & 1;
-    cnt11.error &= ~((data >> 14) & 1);
-    cnt11.enable_send_recv = (data >> 15) & 1;
-
-    if ((data >> 3) & 1)
-    {
-        std::queue<uint32_t> empty;
-        fifo11.swap(empty);
-    }
-
+    PxiTrace::Record(PxiTrace::OP_CNT11_WRITE, data);
+    write_cnt(side11, side9, data, raise_send_empty_irq11, raise_recv_not_empty_irq11);
     printf("[CNT11]: Wrote 0x%04x\n", data);
 }
 
 uint16_t PXI::ReadCnt11()
 {
-    cnt11.send_fifo_empty = fifo11.empty();
-    cnt11.send_fifo_full = fifo11.size() == 16;
-    cnt11.recv_fifo_empty = fifo9.empty();
-    cnt11.recv_fifo_full = fifo9.size() == 16;
-
-    uint32_t reg = cnt11.send_fifo_empty;
-    reg |= (cnt11.send_fifo_full << 1);
-    reg |= (cnt11.send_fifo_empty_irqen << 2);
-    reg |= (cnt11.recv_fifo_empty << 8);
-    reg |= (cnt11.recv_fifo_full << 9);
-    reg |= (cnt11.recv_fifo_not_empty_irqen << 10);
-    reg |= (cnt11.error << 14);
-    reg |= (cnt11.enable_send_recv << 15);
+    uint16_t reg = read_cnt(side11, side9);
+    PxiTrace::Record(PxiTrace::OP_CNT11_READ, reg);
     return reg;
 }
 
+void PXI::WriteSend11(uint32_t data)
+{
+    PxiTrace::Record(PxiTrace::OP_SEND11, data);
+    printf("[PXI] Sending 0x%08x to ARM9 FIFO\n", data);
+    send(side11, side9, data, raise_recv_not_empty_irq9);
+}
+
 uint32_t PXI::ReadRecv11()
 {
-    if (fifo9.size())
-    {
-        last_read11 = fifo9.front();
-        fifo9.pop();
-    }
-    printf("[PXI] Reading from FIFO9 (0x%08x)\n", last_read11);
-    return last_read11;
+    uint32_t data = recv(side11, side9, raise_send_empty_irq9);
+    PxiTrace::Record(PxiTrace::OP_RECV11, data);
+    printf("[PXI] Reading from FIFO9 (0x%08x)\n", data);
+    return data;
 }
 
 void PXI::WriteSync9(uint32_t data)
 {
+    PxiTrace::Record(PxiTrace::OP_SYNC9_WRITE, data);
+
     bool send_irq11_51 = (data >> 30) & 1;
     bool send_irq11_50 = (data >> 29) & 1;
     uint8_t send_data = (data >> 8) & 0xff;
 
-    sync9.enable_remote_irq = (data >> 31) & 1;
+    side11.sync_recv = send_data;
+    side9.sync_irq_enable = (data >> 31) & 1;
 
-    if (sync11.enable_remote_irq && (send_irq11_50 || send_irq11_51))
+    if (side11.sync_irq_enable && (send_irq11_50 || send_irq11_51))
     {
         if (send_irq11_50)
             MPCore_PMR::AssertHWIrq(0x50);
@@ -107,52 +230,41 @@ void PXI::WriteSync9(uint32_t data)
             MPCore_PMR::AssertHWIrq(0x51);
     }
 
-    sync11.recv = send_data;
     printf("[SYNC9]: Sent 0x%08x to ARM11\n", data);
 }
 
 uint32_t PXI::ReadSync9()
 {
-    return (sync9.enable_remote_irq << 31) | sync9.recv;
+    uint32_t reg = ((uint32_t)side9.sync_irq_enable << 31) | (side11.sync_recv << 8) | side9.sync_recv;
+    PxiTrace::Record(PxiTrace::OP_SYNC9_READ, reg);
+    return reg;
 }
 
 void PXI::WriteCnt9(uint16_t data)
 {
-    cnt9.send_fifo_empty_irqen = (data >> 2) & 1;
-    cnt9.recv_fifo_not_empty_irqen = (data >> 10) & 1;
-    cnt9.error &= ~((data >> 14) & 1);
-    cnt9.enable_send_recv = (data >> 15) & 1;
-
-    if ((data >> 3) & 1)
-    {
-        std::queue<uint32_t> empty;
-        fifo9.swap(empty);
-        last_read11 = 0;
-    }
-
+    PxiTrace::Record(PxiTrace::OP_CNT9_WRITE, data);
+    write_cnt(side9, side11, data, raise_send_empty_irq9, raise_recv_not_empty_irq9);
     printf("[CNT9]: Wrote 0x%04x\n", data);
 }
 
 uint16_t PXI::ReadCnt9()
 {
-    cnt9.send_fifo_empty = fifo9.empty();
-    cnt9.send_fifo_full = fifo9.size() == 16;
-    cnt9.recv_fifo_empty = fifo11.empty();
-    cnt9.recv_fifo_full = fifo11.size() == 16;
-
-    uint32_t reg = cnt9.send_fifo_empty;
-    reg |= (cnt9.send_fifo_full << 1);
-    reg |= (cnt9.send_fifo_empty_irqen << 2);
-    reg |= (cnt9.recv_fifo_empty << 8);
-    reg |= (cnt9.recv_fifo_full << 9);
-    reg |= (cnt9.recv_fifo_not_empty_irqen << 10);
-    reg |= (cnt9.error << 14);
-    reg |= (cnt9.enable_send_recv << 15);
+    uint16_t reg = read_cnt(side9, side11);
+    PxiTrace::Record(PxiTrace::OP_CNT9_READ, reg);
     return reg;
 }
 
 void PXI::WriteSend9(uint32_t data)
 {
+    PxiTrace::Record(PxiTrace::OP_SEND9, data);
     printf("[PXI] Sending 0x%08x to ARM11 FIFO\n", data);
-    fifo9.push(data);
+    send(side9, side11, data, raise_recv_not_empty_irq11);
+}
+
+uint32_t PXI::ReadRecv9()
+{
+    uint32_t data = recv(side9, side11, raise_send_empty_irq11);
+    PxiTrace::Record(PxiTrace::OP_RECV9, data);
+    printf("[PXI] Reading from FIFO11 (0x%08x)\n", data);
+    return data;
 }
@@ -9,6 +9,7 @@ void WriteSync11(uint32_t data);
 uint32_t ReadSync11();
 void WriteCnt11(uint16_t data);
 uint16_t ReadCnt11();
+void WriteSend11(uint32_t data);
 uint32_t ReadRecv11();
 
 void WriteSync9(uint32_t data);
@@ -16,5 +17,6 @@ uint32_t ReadSync9();
 void WriteCnt9(uint16_t data);
 uint16_t ReadCnt9();
 void WriteSend9(uint32_t data);
+uint32_t ReadRecv9();
 
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "pxi_trace.h"
+#include "pxi.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+#include <scheduler/scheduler.h>
+
+// Log layout: an 8 byte magic, then one record per access made of the op
+// byte, the time since the previous record as an LEB128 varint and the 32-bit
+// little-endian register value. Most accesses are a few cycles apart, so a
+// record is usually 6 bytes.
+const static char trace_magic[8] = {'3', 'D', 'S', 'P', 'X', 'I', '1', 0};
+
+// How long a replayed access waits before retrying when the emulated CPU
+// hasn't caught up yet (nothing to receive, or no room to send)
+constexpr uint64_t REPLAY_RETRY_CYCLES = 16;
+
+struct TraceRecord
+{
+    PxiTrace::Op op;
+    uint64_t delta;
+    uint32_t data;
+};
+
+PxiTrace::Mode trace_mode = PxiTrace::MODE_OFF;
+
+std::ofstream trace_out;
+uint64_t last_record_time = 0;
+uint64_t records_written = 0;
+
+std::vector<TraceRecord> replay_log;
+size_t replay_pos = 0;
+uint64_t replay_stalls = 0;
+
+bool PxiTrace::OpenRecord(const char* path)
+{
+    trace_out.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!trace_out.is_open())
+    {
+        printf("[PXI]: Couldn't create trace %s\n", path);
+        return false;
+    }
+
+    trace_out.write(trace_magic, sizeof(trace_magic));
+    trace_mode = MODE_RECORD;
+    return true;
+}
+
+bool PxiTrace::OpenReplay(const char* path, Mode mode)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (buf.size() < sizeof(trace_magic) || memcmp(buf.data(), trace_magic, sizeof(trace_magic)))
+    {
+        printf("[PXI]: %s is not a PXI trace\n", path);
+        return false;
+    }
+
+    size_t pos = sizeof(trace_magic);
+    while (pos < buf.size())
+    {
+        TraceRecord record;
+        if (buf[pos] >= OP_COUNT)
+            break;
+        record.op = (Op)buf[pos++];
+
+        record.delta = 0;
+        int shift = 0;
+        while (pos < buf.size() && shift < 64)
+        {
+            uint8_t byte = buf[pos++];
+            record.delta |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+            if (!(byte & 0x80))
+                break;
+        }
+
+        if (pos + 4 > buf.size())
+            break;
+        memcpy(&record.data, &buf[pos], 4);
+        pos += 4;
+
+        replay_log.push_back(record);
+    }
+
+    if (pos != buf.size())
+        printf("[PXI]: Trace %s is truncated, replaying %zu records\n", path, replay_log.size());
+
+    trace_mode = mode;
+    return true;
+}
+
+PxiTrace::Mode PxiTrace::GetMode()
+{
+    return trace_mode;
+}
+
+void PxiTrace::Record(Op op, uint32_t data)
+{
+    if (trace_mode != MODE_RECORD)
+        return;
+
+    uint8_t buf[1 + 10 + 4];
+    int len = 0;
+
+    buf[len++] = op;
+
+    uint64_t now = Scheduler::GetCurrentTime();
+    uint64_t delta = now - last_record_time;
+    last_record_time = now;
+    do
+    {
+        uint8_t byte = delta & 0x7F;
+        delta >>= 7;
+        buf[len++] = byte | (delta ? 0x80 : 0);
+    } while (delta);
+
+    memcpy(&buf[len], &data, 4);
+    len += 4;
+
+    trace_out.write((char*)buf, len);
+    records_written++;
+}
+
+// Whether op is an access made by the CPU that isn't being emulated
+static bool is_remote(PxiTrace::Op op)
+{
+    bool arm11_op = op >= PxiTrace::OP_SYNC11_WRITE;
+    return trace_mode == PxiTrace::MODE_REPLAY9 ? arm11_op : !arm11_op;
+}
+
+// Applies one recorded access. Returns false if the emulated CPU isn't at
+// the point the log expects yet, in which case it is retried later.
+static bool apply(const TraceRecord& record)
+{
+    using namespace PxiTrace;
+
+    switch (record.op)
+    {
+    case OP_SYNC9_WRITE:
+        PXI::WriteSync9(record.data);
+        break;
+    case OP_CNT9_WRITE:
+        PXI::WriteCnt9(record.data);
+        break;
+    case OP_SEND9:
+        if (PXI::ReadCnt9() & (1 << 1))
+            return false;
+        PXI::WriteSend9(record.data);
+        break;
+    case OP_RECV9:
+        if (PXI::ReadCnt9() & (1 << 8))
+            return false;
+        PXI::ReadRecv9();
+        break;
+    case OP_SYNC11_WRITE:
+        PXI::WriteSync11(record.data);
+        break;
+    case OP_CNT11_WRITE:
+        PXI::WriteCnt11(record.data);
+        break;
+    case OP_SEND11:
+        if (PXI::ReadCnt11() & (1 << 1))
+            return false;
+        PXI::WriteSend11(record.data);
+        break;
+    case OP_RECV11:
+        if (PXI::ReadCnt11() & (1 << 8))
+            return false;
+        PXI::ReadRecv11();
+        break;
+    default:
+        // SYNC/CNT reads have no side effects
+        break;
+    }
+
+    return true;
+}
+
+static void replay_next()
+{
+    while (replay_pos < replay_log.size())
+    {
+        const TraceRecord& record = replay_log[replay_pos];
+
+        if (is_remote(record.op) && !apply(record))
+        {
+            replay_stalls++;
+            Scheduler::ScheduleEvent(REPLAY_RETRY_CYCLES, replay_next);
+            return;
+        }
+
+        replay_pos++;
+
+        // Keep the recorded spacing between accesses, a stall shifts
+        // everything after it instead of bunching it up
+        if (replay_pos < replay_log.size() && replay_log[replay_pos].delta)
+        {
+            Scheduler::ScheduleEvent(replay_log[replay_pos].delta, replay_next);
+            return;
+        }
+    }
+
+    printf("[PXI]: Replay finished, %zu records, %lu stalls\n", replay_log.size(), replay_stalls);
+}
+
+void PxiTrace::Reset()
+{
+    if (trace_mode != MODE_REPLAY9 && trace_mode != MODE_REPLAY11)
+        return;
+
+    replay_pos = 0;
+    replay_stalls = 0;
+    if (!replay_log.empty())
+        Scheduler::ScheduleEvent(replay_log[0].delta ? replay_log[0].delta : 1, replay_next);
+}
+
+void PxiTrace::Dump()
+{
+    if (trace_mode == MODE_RECORD)
+    {
+        trace_out.flush();
+        printf("[PXI]: Recorded %lu PXI accesses\n", records_written);
+    }
+    else if (trace_mode != MODE_OFF)
+        printf("[PXI]: Replayed %zu of %zu records, %lu stalls\n", replay_pos, replay_log.size(), replay_stalls);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// Capture and replay of PXI traffic. Recording logs every PXI register access
+// of both CPUs with its timestamp. Replaying feeds one CPU the other side's
+// recorded accesses from the log, so that CPU can be run and profiled without
+// emulating the other one.
+namespace PxiTrace
+{
+
+enum Mode
+{
+    MODE_OFF,
+    MODE_RECORD,
+    // Emulate the ARM9, the ARM11 side comes from the log
+    MODE_REPLAY9,
+    // Emulate the ARM11, the ARM9 side comes from the log
+    MODE_REPLAY11
+};
+
+enum Op : uint8_t
+{
+    OP_SYNC9_WRITE,
+    OP_SYNC9_READ,
+    OP_CNT9_WRITE,
+    OP_CNT9_READ,
+    OP_SEND9,
+    OP_RECV9,
+    OP_SYNC11_WRITE,
+    OP_SYNC11_READ,
+    OP_CNT11_WRITE,
+    OP_CNT11_READ,
+    OP_SEND11,
+    OP_RECV11,
+    OP_COUNT
+};
+
+bool OpenRecord(const char* path);
+bool OpenReplay(const char* path, Mode mode);
+Mode GetMode();
+
+// Called by the PXI register handlers, only logs while recording
+void Record(Op op, uint32_t data);
+
+// Schedules the first replayed access, called after the scheduler is reset
+void Reset();
+
+void Dump();
+
+}
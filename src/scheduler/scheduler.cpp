@@ -0,0 +1,63 @@
+#include "scheduler.h"
+
+#include <queue>
+#include <vector>
+
+struct Event
+{
+    uint64_t time;
+    uint64_t id;
+    Scheduler::EventFunc func;
+};
+
+struct EventCompare
+{
+    // Earliest first, and in scheduling order for events due at the same time
+    bool operator()(const Event& a, const Event& b) const
+    {
+        if (a.time != b.time)
+            return a.time > b.time;
+        return a.id > b.id;
+    }
+};
+
+std::priority_queue<Event, std::vector<Event>, EventCompare> events;
+uint64_t current_time = 0;
+uint64_t next_event_id = 0;
+
+void Scheduler::Reset()
+{
+    events = {};
+    current_time = 0;
+    next_event_id = 0;
+}
+
+uint64_t Scheduler::GetCurrentTime()
+{
+    return current_time;
+}
+
+uint64_t Scheduler::GetNextEventTime()
+{
+    if (events.empty())
+        return UINT64_MAX;
+    return events.top().time;
+}
+
+void Scheduler::ScheduleEvent(uint64_t cycles, EventFunc func)
+{
+    events.push({current_time + cycles, next_event_id++, func});
+}
+
+void Scheduler::Advance(uint64_t cycles)
+{
+    current_time += cycles;
+
+    while (!events.empty() && events.top().time <= current_time)
+    {
+        // Events may schedule further events, so pop before running
+        Event event = events.top();
+        events.pop();
+        event.func();
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+
+// Global event timeline. Time is counted in ARM9 steps, and Bus::Run
+// advances it once per system step.
+namespace Scheduler
+{
+
+typedef std::function<void()> EventFunc;
+
+void Reset();
+
+uint64_t GetCurrentTime();
+uint64_t GetNextEventTime();
+
+void ScheduleEvent(uint64_t cycles, EventFunc func);
+void Advance(uint64_t cycles);
+
+}
@@ -3,6 +3,8 @@
 #include <queue>
 #include <string.h>
 #include <memory/Bus.h>
+#include <dma/ndma.h>
+#include <memory/mmio.h>
 
 std::ifstream file, sdfile, *cur_transfer_drive;
 std::ofstream dump;
@@ -129,6 +131,11 @@ void data_ready()
 
     if (sd_data32_irq.rx32rdy_irqen)
         SetIstat(0x01000000);
+
+    // Only a freshly loaded block is worth handing to NDMA, this is also
+    // called once the last word of a block has been read
+    if (eMMC::DataRequested())
+        NDMA::TriggerStartup(NDMA::STARTUP_SDMMC);
 }
 
 void command_end()
@@ -167,6 +174,7 @@ uint16_t read_fifo()
         uint16_t value = *(uint16_t*)&transfer_buf[transfer_pos];
         transfer_pos += 2;
         transfer_size -= 2;
+        MMIO::NotifyChange();
 
 		printf("[EMMC]: Read FIFO16: 0x%04x\n", value);
 
@@ -180,6 +188,11 @@ uint16_t read_fifo()
     return 0;
 }
 
+bool eMMC::DataRequested()
+{
+    return transfer_size > 0;
+}
+
 uint32_t eMMC::read_fifo32()
 {
     if (transfer_size)
@@ -203,9 +216,9 @@ uint32_t eMMC::read_fifo32()
                     transfer_end();
                 else
                 {
-					printf("TODO: NDMA transfer\n");
                     transfer_size = data_blocklen;
                     cur_transfer_drive->read((char*)transfer_buf, transfer_size);
+                    NDMA::TriggerStartup(NDMA::STARTUP_SDMMC);
                 }
             }
             else
@@ -18,4 +18,7 @@ void Write16(uint32_t addr, uint16_t data);
 
 uint32_t read_fifo32();
 
+// Whether read data is waiting for NDMA
+bool DataRequested();
+
 }
\ No newline at end of file
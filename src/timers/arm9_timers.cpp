@@ -1,6 +1,8 @@
 #include "arm9_timers.h"
 
 #include <memory/Bus.h>
+#include <dma/ndma.h>
+#include <memory/mmio.h>
 #include <stdio.h>
 #include <cassert>
 
@@ -38,17 +40,30 @@ void Timers::Tick()
             timers[i].ctr++;
             if (timers[i].ctr == prescalars[timers[i].cnt.prescaler])
             {
+                timers[i].ctr = 0;
                 timers[i].count--;
+                MMIO::NotifyChange();
                 if (timers[i].count <= 0)
                 {
                     timers[i].count = timers[i].reload;
                     Bus::SetInterruptPending9(8 + i);
+                    NDMA::TriggerStartup(NDMA::STARTUP_TIMER0 + i);
                 }
             }
         }
     }
 }
 
+bool Timers::IsRunning()
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (timers[i].cnt.start)
+            return true;
+    }
+    return false;
+}
+
 void Timers::Write16(uint32_t addr, uint16_t data)
 {
     switch (addr)
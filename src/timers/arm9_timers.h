@@ -6,6 +6,7 @@ namespace Timers
 {
 
 void Tick();
+bool IsRunning();
 
 void Write16(uint32_t addr, uint16_t data);
 uint16_t Read16(uint32_t addr);
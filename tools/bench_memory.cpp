@@ -0,0 +1,19 @@
+#include "bench_memory.h"
+#include <memory/Bus.h>
+
+static uint8_t vram[BENCH_VRAM_SIZE];
+static uint8_t fcram[BENCH_FCRAM_SIZE];
+
+uint8_t* Bus::GetPhysicalPtr(uint32_t addr, uint32_t size)
+{
+    if (addr >= BENCH_VRAM && addr - BENCH_VRAM + (uint64_t)size <= BENCH_VRAM_SIZE)
+        return vram + (addr - BENCH_VRAM);
+    if (addr >= BENCH_FCRAM && addr - BENCH_FCRAM + (uint64_t)size <= BENCH_FCRAM_SIZE)
+        return fcram + (addr - BENCH_FCRAM);
+    return nullptr;
+}
+
+uint8_t* BenchPtr(uint32_t addr)
+{
+    return Bus::GetPhysicalPtr(addr, 1);
+}
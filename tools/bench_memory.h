@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Stands in for the bus in the GPU benchmarks: Bus::GetPhysicalPtr over
+// host buffers for VRAM and the start of FCRAM, zeroed at startup
+constexpr uint32_t BENCH_VRAM = 0x18000000;
+constexpr uint32_t BENCH_VRAM_SIZE = 0x600000;
+constexpr uint32_t BENCH_FCRAM = 0x20000000;
+constexpr uint32_t BENCH_FCRAM_SIZE = 0x1000000;
+
+uint8_t* BenchPtr(uint32_t addr);
@@ -0,0 +1,148 @@
+// Checks the built-in bignum backend against GMP's mpz_powm on random
+// 2048-bit operands, then times both on full-size private and public key
+// operations. Usage: bignum_check [iterations] [seed] [seconds per rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <gmp.h>
+#include <crypto/bignum.h>
+
+constexpr int BYTES = 0x100;
+
+static std::mt19937_64 rng;
+
+static void random_bytes(uint8_t* dest, int significant)
+{
+    memset(dest, 0, BYTES);
+    for (int i = BYTES - significant; i < BYTES; i++)
+        dest[i] = rng();
+}
+
+static void reference(const uint8_t* base, const uint8_t* exp, const uint8_t* mod, uint8_t* out)
+{
+    mpz_t b, e, m, r;
+    mpz_inits(b, e, m, r, NULL);
+    mpz_import(b, BYTES, 1, 1, 1, 0, base);
+    mpz_import(e, BYTES, 1, 1, 1, 0, exp);
+    mpz_import(m, BYTES, 1, 1, 1, 0, mod);
+
+    memset(out, 0, BYTES);
+    if (mpz_sgn(m))
+    {
+        mpz_powm(r, b, e, m);
+        size_t count = (mpz_sizeinbase(r, 2) + 7) / 8;
+        mpz_export(out + BYTES - count, NULL, 1, 1, 1, 0, r);
+    }
+    mpz_clears(b, e, m, r, NULL);
+}
+
+// Full-size odd modulus and base, with either a full-size exponent like a
+// private key or 65537 like a public one
+static void make_key_op(uint8_t* base, uint8_t* exp, uint8_t* mod, bool is_public)
+{
+    random_bytes(mod, BYTES);
+    mod[0] |= 0x80;
+    mod[BYTES - 1] |= 1;
+    random_bytes(base, BYTES);
+    base[0] &= 0x7F;
+    if (is_public)
+    {
+        memset(exp, 0, BYTES);
+        exp[BYTES - 3] = 0x01;
+        exp[BYTES - 1] = 0x01;
+    }
+    else
+        random_bytes(exp, BYTES);
+}
+
+template <typename Func>
+static double rate(double seconds, Func&& func)
+{
+    uint64_t runs = 0;
+    double elapsed;
+    auto start = std::chrono::steady_clock::now();
+    do
+    {
+        func();
+        runs++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < seconds);
+    return runs / elapsed;
+}
+
+static void print_hex(const char* name, const uint8_t* value)
+{
+    printf("  %s: ", name);
+    for (int i = 0; i < BYTES; i++)
+        printf("%02x", value[i]);
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    rng.seed(argc > 2 ? strtoull(argv[2], NULL, 0) : 0x3D5);
+    double seconds = argc > 3 ? atof(argv[3]) : 0.2;
+
+    int failures = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        uint8_t base[BYTES], exp[BYTES], mod[BYTES], expected[BYTES], actual[BYTES];
+
+        // Mostly full-size odd moduli like real keys, with some shorter and
+        // even ones for the fallback path. Bases are sometimes larger than
+        // the modulus, exponents are either full-size or small public ones.
+        int mod_size = i % 8 == 7 ? 1 + rng() % BYTES : BYTES;
+        random_bytes(mod, mod_size);
+        mod[BYTES - mod_size] |= 0x80;
+        if (i % 32 != 31)
+            mod[BYTES - 1] |= 1;
+        else
+            mod[BYTES - 1] &= ~1;
+
+        random_bytes(base, i % 4 == 3 ? BYTES : mod_size);
+        if (i % 4 != 3 && memcmp(base, mod, BYTES) >= 0)
+            base[BYTES - mod_size] &= 0x7F;
+
+        static const uint32_t small_exps[] = {0, 1, 3, 65537};
+        if (i % 5 == 4)
+        {
+            memset(exp, 0, BYTES);
+            uint32_t e = small_exps[(i / 5) % 4];
+            for (int j = 0; j < 4; j++)
+                exp[BYTES - 1 - j] = e >> (j * 8);
+        }
+        else
+            random_bytes(exp, BYTES);
+
+        reference(base, exp, mod, expected);
+        Bignum::PowMod(base, exp, mod, actual);
+
+        if (memcmp(expected, actual, BYTES))
+        {
+            printf("Mismatch on iteration %d\n", i);
+            print_hex("base", base);
+            print_hex("exp", exp);
+            print_hex("mod", mod);
+            print_hex("expected", expected);
+            print_hex("actual", actual);
+            failures++;
+        }
+    }
+
+    printf("%d/%d modular exponentiations match mpz_powm\n", iterations - failures, iterations);
+
+    for (bool is_public : {false, true})
+    {
+        uint8_t base[BYTES], exp[BYTES], mod[BYTES], out[BYTES];
+        make_key_op(base, exp, mod, is_public);
+        double builtin = rate(seconds, [&] { Bignum::PowMod(base, exp, mod, out); });
+        double gmp = rate(seconds, [&] { reference(base, exp, mod, out); });
+        printf("%s: %.1f/s built-in, %.1f/s mpz_powm (%.2fx)\n", is_public ? "2048-bit, e = 65537" : "2048-bit, full exponent",
+            builtin, gmp, builtin / gmp);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+// Measures how fast the CDMA controller moves data for the transfer shapes
+// the firmware uses, and checks the result of each. The bus is FCRAM from
+// bench_memory plus a FIFO register that only the slow path can reach.
+// Usage: dma_bench [seconds per transfer]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include <dma/cdma.h>
+#include <memory/Bus.h>
+#include "bench_memory.h"
+
+// Reads return a counter, writes are dropped, neither has a host pointer
+constexpr uint32_t BENCH_FIFO = 0x10000000;
+static uint32_t fifo_counter;
+
+static uint8_t* bench_ptr(uint32_t addr, uint32_t size)
+{
+    return Bus::GetPhysicalPtr(addr, size);
+}
+
+static uint32_t bench_read32(uint32_t addr)
+{
+    if (addr == BENCH_FIFO)
+        return fifo_counter++;
+    uint32_t value = 0;
+    if (uint8_t* ptr = bench_ptr(addr, 4))
+        memcpy(&value, ptr, 4);
+    return value;
+}
+
+static void bench_write32(uint32_t addr, uint32_t data)
+{
+    if (uint8_t* ptr = bench_ptr(addr, 4))
+        memcpy(ptr, &data, 4);
+}
+
+static uint8_t bench_read8(uint32_t addr)
+{
+    uint8_t* ptr = bench_ptr(addr, 1);
+    return ptr ? *ptr : 0;
+}
+
+static void bench_write8(uint32_t addr, uint8_t data)
+{
+    if (uint8_t* ptr = bench_ptr(addr, 1))
+        *ptr = data;
+}
+
+uint8_t Bus::ARM11::Read8(uint32_t addr) { return bench_read8(addr); }
+uint32_t Bus::ARM11::Read32(uint32_t addr) { return bench_read32(addr); }
+void Bus::ARM11::Write8(uint32_t addr, uint8_t data) { bench_write8(addr, data); }
+void Bus::ARM11::Write32(uint32_t addr, uint32_t data) { bench_write32(addr, data); }
+uint8_t* Bus::ARM11::GetPtr(uint32_t addr, uint32_t size, bool) { return bench_ptr(addr, size); }
+void Bus::ARM11Access::RaiseIrq(int) {}
+
+uint8_t Bus::ARM9::Read8(uint32_t addr) { return bench_read8(addr); }
+uint32_t Bus::ARM9::Read32(uint32_t addr) { return bench_read32(addr); }
+void Bus::ARM9::Write8(uint32_t addr, uint8_t data) { bench_write8(addr, data); }
+void Bus::ARM9::Write32(uint32_t addr, uint32_t data) { bench_write32(addr, data); }
+uint8_t* Bus::ARM9::GetPtr(uint32_t addr, uint32_t size, bool) { return bench_ptr(addr, size); }
+void Bus::ARM9Access::RaiseIrq(int) {}
+
+constexpr uint32_t PROGRAM_ADDR = BENCH_FCRAM;
+constexpr uint32_t SRC_ADDR = BENCH_FCRAM + 0x100000;
+constexpr uint32_t DEST_ADDR = BENCH_FCRAM + 0x400000;
+constexpr uint32_t TRANSFER_SIZE = 0x100000;
+
+// 16 beats of 4 bytes on both sides
+constexpr uint32_t CCR_SRC_INC = 1;
+constexpr uint32_t CCR_DST_INC = 1 << 14;
+constexpr uint32_t CCR_BURST = (2 << 1) | (15 << 4) | (2 << 15) | (15 << 18);
+constexpr uint32_t CCR_SWAP32 = 2 << 28;
+constexpr uint32_t BURST_BYTES = 64;
+
+struct Transfer
+{
+    const char* name;
+    uint32_t ccr;
+    uint32_t src;
+};
+
+// DMAMOVs, then TRANSFER_SIZE / 64 bursts as two nested DMALP loops
+static std::vector<uint8_t> make_program(const Transfer& transfer)
+{
+    std::vector<uint8_t> code;
+    auto mov = [&](uint8_t reg, uint32_t value)
+    {
+        code.insert(code.end(), {0xBC, reg, (uint8_t)value, (uint8_t)(value >> 8),
+            (uint8_t)(value >> 16), (uint8_t)(value >> 24)});
+    };
+
+    mov(0, transfer.src);
+    mov(1, transfer.ccr);
+    mov(2, DEST_ADDR);
+
+    uint32_t bursts = TRANSFER_SIZE / BURST_BYTES;
+    code.insert(code.end(), {0x22, (uint8_t)(bursts / 256 - 1)});
+    size_t outer = code.size();
+    code.insert(code.end(), {0x20, 255});
+    size_t inner = code.size();
+    code.insert(code.end(), {0x04, 0x08});
+    code.insert(code.end(), {0x38, (uint8_t)(code.size() - inner)});
+    code.insert(code.end(), {0x3C, (uint8_t)(code.size() - outer)});
+    code.push_back(0x00);
+    return code;
+}
+
+static bool check(const Transfer& transfer)
+{
+    const uint8_t* src = BenchPtr(SRC_ADDR);
+    const uint8_t* dest = BenchPtr(DEST_ADDR);
+
+    for (uint32_t i = 0; i < TRANSFER_SIZE; i += 4)
+    {
+        uint32_t expected, actual;
+        memcpy(&actual, dest + i, 4);
+        if (transfer.src == BENCH_FIFO)
+        {
+            // Consecutive reads of the counter
+            memcpy(&expected, dest, 4);
+            expected += i / 4;
+        }
+        else
+        {
+            memcpy(&expected, src + i, 4);
+            if (transfer.ccr & CCR_SWAP32)
+                expected = __builtin_bswap32(expected);
+        }
+
+        if (actual != expected)
+        {
+            printf("%s: mismatch at offset 0x%x, 0x%08x instead of 0x%08x\n", transfer.name, i, actual, expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The controller logs every DMAGO, which would drown out the results
+struct Quiet
+{
+    int saved;
+    Quiet()
+    {
+        fflush(stdout);
+        saved = dup(1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        close(null);
+    }
+    ~Quiet()
+    {
+        fflush(stdout);
+        dup2(saved, 1);
+        close(saved);
+    }
+};
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+
+    uint8_t* src = BenchPtr(SRC_ADDR);
+    for (uint32_t i = 0; i < TRANSFER_SIZE; i++)
+        src[i] = (uint8_t)(i * 7 + (i >> 8));
+
+    const Transfer transfers[] =
+    {
+        {"RAM to RAM", CCR_BURST | CCR_SRC_INC | CCR_DST_INC, SRC_ADDR},
+        {"RAM to RAM, byte swapped", CCR_BURST | CCR_SRC_INC | CCR_DST_INC | CCR_SWAP32, SRC_ADDR},
+        {"FIFO to RAM", CCR_BURST | CCR_DST_INC, BENCH_FIFO},
+    };
+
+    bool ok = true;
+    for (const Transfer& transfer : transfers)
+    {
+        std::vector<uint8_t> program = make_program(transfer);
+        memcpy(BenchPtr(PROGRAM_ADDR), program.data(), program.size());
+        memset(BenchPtr(DEST_ADDR), 0, TRANSFER_SIZE);
+
+        CDMA<Bus::ARM11Access> dma;
+        uint64_t runs = 0, ticks = 0;
+        double elapsed;
+        {
+            Quiet quiet;
+            auto start = std::chrono::steady_clock::now();
+            do
+            {
+                dma.Write32(0xD08, 0xA0 << 16);
+                dma.Write32(0xD0C, PROGRAM_ADDR);
+                dma.Write32(0xD04, 0);
+                while (dma.Tick())
+                    ticks++;
+                runs++;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (elapsed < seconds);
+        }
+
+        ok &= check(transfer);
+        printf("%-26s %8.1f MB/s, %.1f ticks per MB\n", transfer.name,
+            runs * (TRANSFER_SIZE / 1048576.0) / elapsed, (double)ticks / runs);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// Measures triangle setup and fill rate of the software rasterizer on
+// synthetic scenes, drawing into a 240x400 RGBA8 framebuffer with a D24S8
+// depth buffer. Usage: raster_bench [threads] [seconds per scene]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <gpu/pica_regs.h>
+#include <gpu/rasterizer.h>
+#include "bench_memory.h"
+
+constexpr uint32_t WIDTH = 240;
+constexpr uint32_t HEIGHT = 400;
+
+static uint32_t float_to_f24(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = bits >> 31;
+    int exponent = ((bits >> 23) & 0xFF) - 127 + 63;
+    if (!value || exponent <= 0)
+        return sign << 23;
+    return (sign << 23) | (exponent << 16) | ((bits >> 7) & 0xFFFF);
+}
+
+struct Scene
+{
+    const char* name;
+    std::vector<RasterVertex> vertices;
+    bool blend;
+};
+
+// Triangles with about the given area in pixels, anywhere on screen. Depth
+// goes front to back, so with depth testing about half the fragments of
+// overlapping triangles fail.
+static Scene make_scene(const char* name, int count, float area, bool blend, std::mt19937& rng)
+{
+    Scene scene = {name, {}, blend};
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float size = sqrtf(area * 2.0f);
+
+    for (int i = 0; i < count; i++)
+    {
+        float cx = unit(rng) * (WIDTH - size) + size / 2;
+        float cy = unit(rng) * (HEIGHT - size) + size / 2;
+        float z = unit(rng);
+        float corners[3][2] = {{cx - size / 2, cy - size / 2}, {cx + size / 2, cy - size / 2}, {cx - size / 2, cy + size / 2}};
+
+        for (int v = 0; v < 3; v++)
+        {
+            RasterVertex vertex = {};
+            vertex.pos[0] = corners[v][0] / WIDTH * 2.0f - 1.0f;
+            vertex.pos[1] = corners[v][1] / HEIGHT * 2.0f - 1.0f;
+            vertex.pos[2] = -z;
+            vertex.pos[3] = 1.0f;
+            for (int c = 0; c < 4; c++)
+                vertex.attr[RASTER_COLOR_R + c] = unit(rng);
+            scene.vertices.push_back(vertex);
+        }
+    }
+    return scene;
+}
+
+static void configure(uint32_t* regs, bool blend)
+{
+    memset(regs, 0, PICA_REG_COUNT * sizeof(uint32_t));
+    regs[PICA_REG_FRAMEBUFFER_DIM] = WIDTH | ((HEIGHT - 1) << 12);
+    regs[PICA_REG_COLORBUFFER_FORMAT] = COLOR_RGBA8 << 16;
+    regs[PICA_REG_COLORBUFFER_LOC] = BENCH_VRAM / 8;
+    regs[PICA_REG_COLORBUFFER_WRITE] = 0xF;
+    regs[PICA_REG_DEPTHBUFFER_FORMAT] = 3;
+    regs[PICA_REG_DEPTHBUFFER_LOC] = (BENCH_VRAM + 0x100000) / 8;
+    regs[PICA_REG_DEPTHBUFFER_WRITE] = 3;
+    regs[PICA_REG_VIEWPORT_WIDTH] = float_to_f24(WIDTH / 2.0f);
+    regs[PICA_REG_VIEWPORT_HEIGHT] = float_to_f24(HEIGHT / 2.0f);
+    regs[PICA_REG_DEPTHMAP_SCALE] = float_to_f24(-1.0f);
+    // Depth test GREATER_EQUAL, color mask RGBA, depth writes
+    regs[PICA_REG_DEPTH_COLOR_MASK] = 1 | (7 << 4) | (0xF << 8) | (1 << 12);
+    regs[PICA_REG_LOGIC_OP] = 3;
+
+    if (blend)
+    {
+        // Source alpha over destination
+        regs[PICA_REG_COLOR_OPERATION] = 1 << 8;
+        regs[PICA_REG_BLEND_FUNC] = (6 << 16) | (7 << 20) | (6 << 24) | (7u << 28);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : -1;
+    double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+    PicaRasterizer::SetWorkerCount(threads);
+
+    std::mt19937 rng(0x3D5);
+    std::vector<Scene> scenes;
+    scenes.push_back(make_scene("small triangles", 20000, 16.0f, false, rng));
+    scenes.push_back(make_scene("medium triangles", 4000, 400.0f, false, rng));
+    scenes.push_back(make_scene("large triangles", 100, 20000.0f, false, rng));
+    scenes.push_back(make_scene("large blended", 100, 20000.0f, true, rng));
+
+    static uint32_t regs[PICA_REG_COUNT];
+    PicaRasterizer rasterizer;
+
+    for (const Scene& scene : scenes)
+    {
+        configure(regs, scene.blend);
+        rasterizer.Configure(regs);
+
+        using Clock = std::chrono::steady_clock;
+        uint64_t fragments_start = rasterizer.FragmentsShaded();
+        uint64_t triangles = 0;
+        int runs = 0;
+        auto start = Clock::now();
+        double elapsed = 0;
+        while (elapsed < seconds)
+        {
+            // Clear depth each run so every run does the same work
+            memset(BenchPtr(BENCH_VRAM + 0x100000), 0, WIDTH * HEIGHT * 4);
+            rasterizer.DrawTriangles(scene.vertices.data(), scene.vertices.size());
+            triangles += scene.vertices.size() / 3;
+            runs++;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        uint64_t fragments = rasterizer.FragmentsShaded() - fragments_start;
+
+        // One more run from cleared buffers, hashed so code paths can be
+        // checked against each other
+        memset(BenchPtr(BENCH_VRAM), 0, 0x200000);
+        rasterizer.DrawTriangles(scene.vertices.data(), scene.vertices.size());
+        uint64_t hash = 0xCBF29CE484222325;
+        const uint8_t* color = BenchPtr(BENCH_VRAM);
+        for (uint32_t i = 0; i < WIDTH * HEIGHT * 4; i++)
+            hash = (hash ^ color[i]) * 0x100000001B3;
+
+        printf("%-18s %6d runs  %8.1f K triangles/s  %8.1f M fragments/s  hash %016lx\n", scene.name, runs,
+            triangles / elapsed / 1e3, fragments / elapsed / 1e6, hash);
+    }
+    return 0;
+}
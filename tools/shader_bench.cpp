@@ -0,0 +1,508 @@
+// Measures vertex shader throughput on the interpreter, the batched engine
+// and the JIT (four lanes, and eight where the host has AVX), on a few
+// hand-written programs of the kind games use and on random ones. Every
+// engine's outputs are checked against the others, the batched engine and
+// the JIT must agree to the bit. Exits with 1 on any mismatch.
+// Usage: shader_bench [seconds per engine] [random programs]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <gpu/pica_regs.h>
+#include <gpu/shader.h>
+#include <gpu/shader_isa.h>
+
+constexpr int VERTICES = 1024;
+constexpr int BATCHES = VERTICES / 4;
+
+// Operand encodings
+constexpr uint32_t V(uint32_t n) { return n; }
+constexpr uint32_t R(uint32_t n) { return 0x10 + n; }
+constexpr uint32_t C(uint32_t n) { return 0x20 + n; }
+constexpr uint32_t O(uint32_t n) { return n; }
+
+constexpr uint32_t XYZW = 0x1B;
+constexpr uint32_t XXXX = 0x00;
+constexpr uint32_t YYYY = 0x55;
+constexpr uint32_t WWWW = 0xFF;
+
+// Relative addressing through a0.x, a0.y or aL
+constexpr uint32_t A0X = 1;
+constexpr uint32_t A0Y = 2;
+constexpr uint32_t AL = 3;
+
+struct Program
+{
+    const char* name;
+    std::vector<uint32_t> code;
+    std::vector<uint32_t> opdescs;
+    uint32_t int_uniforms[4];
+    uint16_t bool_uniforms;
+};
+
+static uint32_t desc(uint32_t mask, uint32_t sel1 = XYZW, uint32_t sel2 = XYZW, uint32_t sel3 = XYZW, uint32_t negate = 0)
+{
+    return mask | (sel1 << 5) | (sel2 << 14) | (sel3 << 23) | ((negate & 1) << 4) | (((negate >> 1) & 1) << 13) |
+        (((negate >> 2) & 1) << 22);
+}
+
+static uint32_t encode(uint32_t opcode, uint32_t dest, uint32_t src1, uint32_t src2, uint32_t desc, uint32_t relative = 0)
+{
+    bool inverted = opcode == SH_DPHI || opcode == SH_DSTI || opcode == SH_SGEI || opcode == SH_SLTI;
+    if (inverted)
+        return (opcode << 26) | (dest << 21) | (relative << 19) | (src1 << 14) | (src2 << 7) | desc;
+    return (opcode << 26) | (dest << 21) | (relative << 19) | (src1 << 12) | (src2 << 7) | desc;
+}
+
+static uint32_t encode_mad(uint32_t opcode, uint32_t dest, uint32_t src1, uint32_t src2, uint32_t src3, uint32_t desc,
+    uint32_t relative = 0)
+{
+    if (opcode == SH_MADI)
+        return (opcode << 26) | (dest << 24) | (relative << 22) | (src1 << 17) | (src2 << 12) | (src3 << 5) | desc;
+    return (opcode << 26) | (dest << 24) | (relative << 22) | (src1 << 17) | (src2 << 10) | (src3 << 5) | desc;
+}
+
+static uint32_t encode_cmp(uint32_t func_x, uint32_t func_y, uint32_t src1, uint32_t src2, uint32_t desc, uint32_t relative = 0)
+{
+    return (SH_CMP << 26) | (func_x << 24) | (func_y << 21) | (relative << 19) | (src1 << 12) | (src2 << 7) | desc;
+}
+
+static uint32_t encode_flow(uint32_t opcode, uint32_t dest, uint32_t count, uint32_t uniform = 0)
+{
+    return (opcode << 26) | (uniform << 22) | (dest << 10) | count;
+}
+
+// Uniforms used by the hand-written programs:
+// c0-c3 projection, c4-c6 normal matrix, c7 light direction, c8 light color,
+// c9 ambient, c10 (0, 1, 0.5, 2), c20-c79 bone matrices, c30-c41 point lights
+static Program make_transform()
+{
+    Program p = {"transform", {}, {}, {}, 0};
+    p.opdescs = {desc(0xF), desc(0x8), desc(0x4), desc(0x2), desc(0x1), desc(0xE, XYZW, WWWW), desc(0x1, WWWW),
+        desc(0xF, XXXX), desc(0x1, XYZW, XXXX)};
+    p.code =
+    {
+        encode(SH_DP4, O(0), C(0), V(0), 1),
+        encode(SH_DP4, O(0), C(1), V(0), 2),
+        encode(SH_DP4, O(0), C(2), V(0), 3),
+        encode(SH_DP4, O(0), C(3), V(0), 4),
+        encode(SH_DP3, R(0), C(4), V(1), 1),
+        encode(SH_DP3, R(0), C(5), V(1), 2),
+        encode(SH_DP3, R(0), C(6), V(1), 3),
+        encode(SH_DP3, R(0), R(0), R(0), 4),
+        encode(SH_RSQ, R(0), R(0), 0, 6),
+        encode(SH_MUL, R(0), R(0), R(0), 5),
+        encode(SH_DP3, R(1), C(7), R(0), 0),
+        encode(SH_MAX, R(1), C(10), R(1), 7),
+        encode(SH_MOV, R(3), C(9), 0, 0),
+        encode_mad(SH_MAD, R(2), R(1), C(8), R(3), 0),
+        encode(SH_MUL, O(1), R(2), V(2), 0),
+        encode(SH_MOV, O(2), V(3), 0, 0),
+        encode_flow(SH_END, 0, 0),
+    };
+    return p;
+}
+
+// Two bones per vertex, v4 holds their indices times three and v5 the weights
+static Program make_skinning()
+{
+    Program p = {"skinning", {}, {}, {}, 0};
+    p.opdescs = {desc(0xF), desc(0x8), desc(0x4), desc(0x2), desc(0x1), desc(0xC), desc(0xE, XYZW, XXXX),
+        desc(0xE, XYZW, YYYY), desc(0x1, YYYY)};
+    p.code =
+    {
+        encode(SH_MOVA, 0, V(4), 0, 5),
+        encode(SH_DP4, R(0), C(20), V(0), 1, A0X),
+        encode(SH_DP4, R(0), C(21), V(0), 2, A0X),
+        encode(SH_DP4, R(0), C(22), V(0), 3, A0X),
+        encode(SH_DP4, R(1), C(20), V(0), 1, A0Y),
+        encode(SH_DP4, R(1), C(21), V(0), 2, A0Y),
+        encode(SH_DP4, R(1), C(22), V(0), 3, A0Y),
+        encode(SH_MUL, R(0), R(0), V(5), 6),
+        encode_mad(SH_MAD, R(0), R(1), V(5), R(0), 7),
+        encode(SH_MOV, R(0), C(10), 0, 8),
+        encode(SH_DP4, O(0), C(0), R(0), 1),
+        encode(SH_DP4, O(0), C(1), R(0), 2),
+        encode(SH_DP4, O(0), C(2), R(0), 3),
+        encode(SH_DP4, O(0), C(3), R(0), 4),
+        encode(SH_MOV, O(1), V(2), 0, 0),
+        encode_flow(SH_END, 0, 0),
+    };
+    return p;
+}
+
+// Lanes take either side of an if depending on which side of x = 0 the
+// vertex is on, so most batches split and get rerun on the interpreter
+static Program make_branches()
+{
+    Program p = {"branches", {}, {}, {}, 0};
+    p.opdescs = {desc(0xF), desc(0x8), desc(0x4), desc(0x2), desc(0x1), desc(0xF, XXXX), desc(0xF, WWWW)};
+    p.code =
+    {
+        encode_cmp(4, 4, C(10), V(0), 5),
+        encode(SH_DP4, O(0), C(0), V(0), 1),
+        encode(SH_DP4, O(0), C(1), V(0), 2),
+        encode(SH_DP4, O(0), C(2), V(0), 3),
+        encode(SH_DP4, O(0), C(3), V(0), 4),
+        // if (cmp.x) {6, 7} else {8, 9}
+        encode_flow(SH_IFC, 8, 2, 2 | (1 << 3)),
+        encode(SH_MUL, R(0), C(8), V(2), 0),
+        encode(SH_MAX, R(0), C(10), R(0), 5),
+        encode(SH_ADD, R(0), C(9), V(2), 0),
+        encode(SH_MUL, R(0), C(10), R(0), 6),
+        encode(SH_MOV, O(1), R(0), 0, 0),
+        encode(SH_MOV, O(2), V(3), 0, 0),
+        encode_flow(SH_END, 0, 0),
+    };
+    return p;
+}
+
+// Four point lights in a loop over aL, with a specular-style power at the end
+static Program make_light_loop()
+{
+    Program p = {"light loop", {}, {}, {3 | (0 << 8) | (3 << 16)}, 0};
+    p.opdescs = {desc(0xF), desc(0x8), desc(0x4), desc(0x2), desc(0x1), desc(0xE, XYZW, XYZW, XYZW, 2),
+        desc(0x1, XYZW, XYZW), desc(0x1, WWWW), desc(0xE, XYZW, WWWW), desc(0xF, XXXX), desc(0xF, XXXX),
+        desc(0xF, WWWW), desc(0x1, XXXX), desc(0xE), desc(0x1, WWWW)};
+    p.code =
+    {
+        encode(SH_DP4, O(0), C(0), V(0), 1),
+        encode(SH_DP4, O(0), C(1), V(0), 2),
+        encode(SH_DP4, O(0), C(2), V(0), 3),
+        encode(SH_DP4, O(0), C(3), V(0), 4),
+        encode(SH_MOV, R(5), C(9), 0, 0),
+        encode_flow(SH_LOOP, 12, 0),
+        encode(SH_ADD, R(0), C(30), V(0), 5, AL),
+        encode(SH_DP3, R(0), R(0), R(0), 6),
+        encode(SH_RSQ, R(0), R(0), 0, 7),
+        encode(SH_MUL, R(0), R(0), R(0), 8),
+        encode(SH_DP3, R(1), V(1), R(0), 0),
+        encode(SH_MAX, R(1), C(10), R(1), 9),
+        encode_mad(SH_MAD, R(5), R(1), C(31), R(5), 0, AL),
+        encode(SH_LG2, R(2), R(5), 0, 10),
+        encode(SH_MUL, R(2), C(10), R(2), 11),
+        encode(SH_EX2, R(2), R(2), 0, 12),
+        encode(SH_MUL, O(1), R(5), V(2), 13),
+        encode(SH_MOV, O(1), R(2), 0, 14),
+        encode(SH_MOV, O(2), V(3), 0, 0),
+        encode_flow(SH_END, 0, 0),
+    };
+    return p;
+}
+
+static uint32_t random_source(std::mt19937& rng, bool wide)
+{
+    switch (rng() % (wide ? 3 : 2))
+    {
+    case 0: return V(rng() % 8);
+    case 1: return R(rng() % 8);
+    default: return C(rng() % SHADER_FLOAT_UNIFORMS);
+    }
+}
+
+static uint32_t random_op(std::mt19937& rng)
+{
+    static const uint32_t opcodes[] =
+    {
+        SH_ADD, SH_DP3, SH_DP4, SH_DPH, SH_DPHI, SH_DST, SH_DSTI, SH_EX2, SH_LG2, SH_LITP, SH_MUL, SH_SGE, SH_SGEI,
+        SH_SLT, SH_SLTI, SH_FLR, SH_MAX, SH_MIN, SH_RCP, SH_RSQ, SH_MOVA, SH_MOV, SH_CMP, SH_MAD, SH_MADI,
+    };
+    uint32_t opcode = opcodes[rng() % (sizeof(opcodes) / sizeof(opcodes[0]))];
+    uint32_t dest = rng() % 4 ? R(rng() % 8) : O(rng() % 4);
+    uint32_t relative = rng() % 4 ? 0 : 1 + rng() % 3;
+    uint32_t desc = rng() % 32;
+    bool inverted = opcode == SH_DPHI || opcode == SH_DSTI || opcode == SH_SGEI || opcode == SH_SLTI;
+
+    if (opcode == SH_MAD)
+        return encode_mad(opcode, dest, random_source(rng, false), random_source(rng, true), random_source(rng, false), desc, relative);
+    if (opcode == SH_MADI)
+        return encode_mad(opcode, dest, random_source(rng, false), random_source(rng, false), random_source(rng, true), desc, relative);
+    if (opcode == SH_CMP)
+        return encode_cmp(rng() % 8, rng() % 8, random_source(rng, true), random_source(rng, false), desc, relative);
+    return encode(opcode, dest, random_source(rng, !inverted), random_source(rng, inverted), desc, relative);
+}
+
+// Straight-line arithmetic with the odd if/else and loop, so blocks get cut
+// at branch targets and frame ends. Ifs on cmp can split batches.
+static Program make_random(std::mt19937& rng)
+{
+    Program p = {"random", {}, {}, {}, (uint16_t)rng()};
+    for (int i = 0; i < 32; i++)
+    {
+        uint32_t selectors = rng();
+        p.opdescs.push_back(desc(1 + rng() % 15, selectors & 0xFF, (selectors >> 8) & 0xFF, (selectors >> 16) & 0xFF, rng() % 8));
+    }
+    for (int i = 0; i < 4; i++)
+        p.int_uniforms[i] = (rng() % 4) | ((rng() % 8) << 8) | ((1 + rng() % 3) << 16);
+
+    while (p.code.size() < 48)
+    {
+        uint32_t pc = p.code.size();
+        switch (rng() % 20)
+        {
+        case 0:
+        {
+            uint32_t then_ops = 1 + rng() % 4, else_ops = rng() % 4;
+            p.code.push_back(encode_flow(SH_IFU, pc + 1 + then_ops, else_ops, rng() % 16));
+            for (uint32_t i = 0; i < then_ops + else_ops; i++)
+                p.code.push_back(random_op(rng));
+            break;
+        }
+        case 1:
+        {
+            uint32_t then_ops = 1 + rng() % 4, else_ops = rng() % 4;
+            p.code.push_back(encode_cmp(rng() % 6, rng() % 6, random_source(rng, true), random_source(rng, false), rng() % 32));
+            p.code.push_back(encode_flow(SH_IFC, pc + 2 + then_ops, else_ops, rng() % 16));
+            for (uint32_t i = 0; i < then_ops + else_ops; i++)
+                p.code.push_back(random_op(rng));
+            break;
+        }
+        case 2:
+        {
+            uint32_t body_ops = 1 + rng() % 4;
+            p.code.push_back(encode_flow(SH_LOOP, pc + body_ops, 0, rng() % 4));
+            for (uint32_t i = 0; i < body_ops; i++)
+                p.code.push_back(random_op(rng));
+            break;
+        }
+        default:
+            p.code.push_back(random_op(rng));
+            break;
+        }
+    }
+    p.code.push_back(encode_flow(SH_END, 0, 0));
+    return p;
+}
+
+static void load_program(PicaShader& shader, const Program& p, uint32_t* regs)
+{
+    shader.SetCodeIndex(0);
+    for (int i = 0; i < SHADER_CODE_SIZE; i++)
+        shader.WriteCode(i < (int)p.code.size() ? p.code[i] : 0);
+    shader.SetOpdescIndex(0);
+    for (int i = 0; i < SHADER_OPDESC_COUNT; i++)
+        shader.WriteOpdesc(i < (int)p.opdescs.size() ? p.opdescs[i] : 0);
+
+    regs[PICA_REG_VSH_BOOLUNIFORM] = p.bool_uniforms;
+    for (int i = 0; i < 4; i++)
+        regs[PICA_REG_VSH_INTUNIFORM_I0 + i] = p.int_uniforms[i];
+    regs[PICA_REG_VSH_ENTRYPOINT] = 0;
+}
+
+static void load_uniforms(PicaShader& shader, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    float uniforms[SHADER_FLOAT_UNIFORMS][4];
+    for (auto& uniform : uniforms)
+    {
+        for (float& value : uniform)
+            value = unit(rng);
+    }
+    const float constants[4] = {0.0f, 1.0f, 0.5f, 2.0f};
+    memcpy(uniforms[10], constants, sizeof(constants));
+    // Something for 0 * inf to hit in the random programs
+    uniforms[95][0] = INFINITY;
+    uniforms[95][1] = 0.0f;
+
+    shader.SetUniformIndex(0x80000000);
+    for (auto& uniform : uniforms)
+    {
+        for (int c = 3; c >= 0; c--)
+        {
+            uint32_t bits;
+            memcpy(&bits, &uniform[c], sizeof(bits));
+            shader.WriteUniform(bits);
+        }
+    }
+}
+
+static void make_inputs(std::vector<ShaderBatch>& batches, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> unit(-2.0f, 2.0f);
+    for (ShaderBatch& batch : batches)
+    {
+        for (int reg = 0; reg < SHADER_INPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                    batch.input[reg][c][lane] = unit(rng);
+            }
+        }
+        for (int lane = 0; lane < 4; lane++)
+        {
+            batch.input[0][3][lane] = 1.0f;
+            batch.input[4][0][lane] = 3.0f * (rng() % 20);
+            batch.input[4][1][lane] = 3.0f * (rng() % 20);
+        }
+    }
+}
+
+static bool same(float a, float b, bool bitwise)
+{
+    if (isnan(a) && isnan(b))
+        return true;
+    if (bitwise)
+        return !memcmp(&a, &b, sizeof(a));
+    return a == b;
+}
+
+// Counts the outputs that differ between two runs
+static int compare(const std::vector<ShaderBatch>& a, const std::vector<ShaderBatch>& b, bool bitwise)
+{
+    int mismatches = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        for (int reg = 0; reg < SHADER_OUTPUTS; reg++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                    mismatches += !same(a[i].output[reg][c][lane], b[i].output[reg][c][lane], bitwise);
+            }
+        }
+    }
+    return mismatches;
+}
+
+static void interpret(PicaShader& shader, std::vector<ShaderBatch>& batches)
+{
+    for (ShaderBatch& batch : batches)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            float input[SHADER_INPUTS][4], output[SHADER_OUTPUTS][4];
+            for (int reg = 0; reg < SHADER_INPUTS; reg++)
+            {
+                for (int c = 0; c < 4; c++)
+                    input[reg][c] = batch.input[reg][c][lane];
+            }
+            shader.Interpret(input, output);
+            for (int reg = 0; reg < SHADER_OUTPUTS; reg++)
+            {
+                for (int c = 0; c < 4; c++)
+                    batch.output[reg][c][lane] = output[reg][c];
+            }
+        }
+    }
+}
+
+enum Engine
+{
+    ENGINE_INTERPRETER,
+    ENGINE_BATCH,
+    ENGINE_JIT,
+    ENGINE_JIT_WIDE,
+};
+
+static void run(PicaShader& shader, Engine engine, std::vector<ShaderBatch>& batches)
+{
+    if (engine == ENGINE_INTERPRETER)
+    {
+        interpret(shader, batches);
+        return;
+    }
+    if (engine == ENGINE_JIT_WIDE)
+    {
+        for (size_t i = 0; i + 1 < batches.size(); i += 2)
+            shader.Run(batches[i], batches[i + 1]);
+        return;
+    }
+    for (ShaderBatch& batch : batches)
+        shader.Run(batch);
+}
+
+static void use_engine(PicaShader& shader, Engine engine, const uint32_t* regs)
+{
+    if (engine != ENGINE_INTERPRETER)
+        shader.SetJit(engine != ENGINE_BATCH);
+    shader.Prepare(regs);
+}
+
+// Vertices per second, in millions
+static double measure(PicaShader& shader, Engine engine, std::vector<ShaderBatch>& batches, double seconds)
+{
+    using Clock = std::chrono::steady_clock;
+    int64_t runs = 0;
+    double elapsed = 0.0;
+    auto start = Clock::now();
+    do
+    {
+        run(shader, engine, batches);
+        runs++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < seconds);
+    return runs * batches.size() * 4 / elapsed / 1e6;
+}
+
+// Runs the program on every engine, returns the number of mismatches
+static int check(PicaShader& shader, const Program& p, const uint32_t* regs, const std::vector<ShaderBatch>& inputs)
+{
+    std::vector<ShaderBatch> results[4] = {inputs, inputs, inputs, inputs};
+    for (int engine = ENGINE_INTERPRETER; engine <= ENGINE_JIT_WIDE; engine++)
+    {
+        use_engine(shader, (Engine)engine, regs);
+        run(shader, (Engine)engine, results[engine]);
+    }
+
+    int batch = compare(results[ENGINE_BATCH], results[ENGINE_JIT], true);
+    int wide = compare(results[ENGINE_BATCH], results[ENGINE_JIT_WIDE], true);
+    int interpreter = compare(results[ENGINE_INTERPRETER], results[ENGINE_JIT], false);
+    if (batch || wide || interpreter)
+    {
+        printf("%s: %d outputs differ from the batched engine (%d eight wide), %d from the interpreter\n",
+            p.name, batch, wide, interpreter);
+    }
+    return batch + wide + interpreter;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    int random_programs = argc > 2 ? atoi(argv[2]) : 500;
+
+    std::mt19937 rng(0x3D5);
+    static PicaShader shader;
+    static uint32_t regs[PICA_REG_COUNT];
+    shader.Reset();
+    load_uniforms(shader, rng);
+
+    std::vector<ShaderBatch> batches(BATCHES);
+    make_inputs(batches, rng);
+
+    int mismatches = 0;
+    const char* engines[] = {"interpreter", "batched", "jit", "jit x8"};
+    for (const Program& p : {make_transform(), make_skinning(), make_light_loop(), make_branches()})
+    {
+        load_program(shader, p, regs);
+        mismatches += check(shader, p, regs, batches);
+
+        printf("%-12s", p.name);
+        for (int engine = ENGINE_INTERPRETER; engine <= ENGINE_JIT_WIDE; engine++)
+        {
+            use_engine(shader, (Engine)engine, regs);
+            printf("  %s %7.2f", engines[engine], measure(shader, (Engine)engine, batches, seconds));
+        }
+        printf(" M vertices/s\n");
+    }
+
+    for (int i = 0; i < random_programs; i++)
+    {
+        Program p = make_random(rng);
+        load_program(shader, p, regs);
+        mismatches += check(shader, p, regs, batches);
+    }
+    printf("%d random programs checked\n", random_programs);
+
+    shader.Dump();
+    if (mismatches)
+    {
+        printf("%d mismatched outputs\n", mismatches);
+        return 1;
+    }
+    return 0;
+}